@@ -1,128 +1,330 @@
 ﻿#include "stdafx.h"
 
+#include <numeric>
 #include "bbx_BlackBox.h"
 #include "bbx_Reader.h"
 #include "bbx_Writer.h"
 #include "bbx_Page.h"
+#include "../helpful/Utf8.h"
 
 using namespace Bbx;
 
+// TimelineBucket implementation
+
+TimelineBucket::TimelineBucket()
+    : begin(0), counts(), bytes(), sessions(0), gaps(0)
+{
+}
+
+size_t TimelineBucket::typeIndex(RecordType type)
+{
+    switch (type)
+    {
+    case RecordType::Increment:
+        return 0;
+    case RecordType::Reference:
+        return 1;
+    case RecordType::IncomingPackage:
+        return 2;
+    case RecordType::OutboxPackage:
+        return 3;
+    }
+    return c_RecordTypesCount;
+}
+
+size_t TimelineBucket::getCount(RecordType type) const
+{
+    size_t index = typeIndex(type);
+    return index < c_RecordTypesCount ? counts[index] : 0;
+}
+
+uint64_t TimelineBucket::getBytes(RecordType type) const
+{
+    size_t index = typeIndex(type);
+    return index < c_RecordTypesCount ? bytes[index] : 0;
+}
+
+size_t TimelineBucket::getTotalCount() const
+{
+    return std::accumulate(std::begin(counts), std::end(counts), size_t(0));
+}
+
+// ReaderPosition implementation
+
+namespace
+{
+    const char c_PositionPrefix[] = "bbxpos";
+    const unsigned c_PositionVersion = 1;
+}
+
+ReaderPosition::ReaderPosition()
+    : fileName(), fileStart(0), page(0), part(0), stamp(0), sequence(0)
+{
+}
+
+bool ReaderPosition::isValid() const
+{
+    return !fileName.empty();
+}
+
+Stamp ReaderPosition::getStamp() const
+{
+    return stamp;
+}
+
+uint64_t ReaderPosition::getSequence() const
+{
+    return sequence;
+}
+
+std::string ReaderPosition::serialize() const
+{
+    /* Имя файла последним: в нём могут быть пробелы */
+    std::ostringstream token;
+    token << c_PositionPrefix << c_PositionVersion << ' ' << int64_t(fileStart.getTime()) << ' ' << fileStart.getNanoseconds()
+        << ' ' << page << ' ' << part << ' ' << int64_t(stamp.getTime()) << ' ' << stamp.getNanoseconds()
+        << ' ' << sequence << ' ' << ToUtf8(fileName);
+    return token.str();
+}
+
+ReaderPosition ReaderPosition::deserialize(const std::string& token)
+{
+    ReaderPosition position;
+    std::istringstream input(token);
+    std::string version;
+    int64_t fileTime = 0, time = 0;
+    uint32_t fileNanoseconds = 0, nanoseconds = 0;
+    std::string name;
+    if (!(input >> version >> fileTime >> fileNanoseconds >> position.page >> position.part >> time >> nanoseconds >> position.sequence)
+        || version != c_PositionPrefix + std::to_string(c_PositionVersion) || input.get() != ' ' || !std::getline(input, name) || name.empty())
+        return ReaderPosition();
+
+    position.fileName = FromUtf8(name);
+    position.fileStart = Stamp(time_t(fileTime), fileNanoseconds);
+    position.stamp = Stamp(time_t(time), nanoseconds);
+    return position;
+}
+
 // Reader implementation
 
-Reader::Reader(const Location& location)
-    : pImpl(new Impl::ReaderImpl(location))
+template<class Locking>
+BasicReader<Locking>::BasicReader(const Location& location)
+    : pImpl(new Impl::BasicReaderImpl<Locking>(location))
+{
+}
+
+template<class Locking>
+BasicReader<Locking>::BasicReader(Impl::BasicReaderImpl<Locking>* _pImpl)
+    : pImpl(_pImpl)
 {
 }
 
-Reader::~Reader()
+template<class Locking>
+std::unique_ptr<BasicReader<Locking>> BasicReader<Locking>::clone() const
 {
+    return std::unique_ptr<BasicReader>(new BasicReader(pImpl->clone()));
 }
 
-ReadResult Reader::lastResult() const
+template<class Locking>
+BasicReader<Locking>::~BasicReader()
+{
+}
+
+template<class Locking>
+ReadResult BasicReader<Locking>::lastResult() const
 {
     return pImpl->lastResult();
 }
 
-ReadResult Reader::readReference(Stamp& stamp, char_vec& caption, char_vec& data)
+template<class Locking>
+ReadResult BasicReader<Locking>::readReference(Stamp& stamp, char_vec& caption, char_vec& data)
 {
     return pImpl->readReference(stamp, caption, data);
 }
 
-ReadResult Reader::readIncrementOriented(Stamp& stamp, char_vec& caption, char_vec& data)
+template<class Locking>
+ReadResult BasicReader<Locking>::readIncrementOriented(Stamp& stamp, char_vec& caption, char_vec& data)
 {
     return pImpl->readIncrementOriented(stamp, caption, data);
 }
 
-ReadResult Reader::readPackage(Stamp& stamp, char_vec& caption, char_vec& data)
+template<class Locking>
+ReadResult BasicReader<Locking>::readPackage(Stamp& stamp, char_vec& caption, char_vec& data)
 {
     return pImpl->readPackage(stamp, caption, data);
 }
 
-ReadResult Reader::readAnyRecord(Stamp& stamp, char_vec& caption, char_vec& data)
+template<class Locking>
+ReadResult BasicReader<Locking>::readAnyRecord(Stamp& stamp, char_vec& caption, char_vec& data)
 {
     return pImpl->readAnyRecord(stamp, caption, data);
 }
 
-ReadResult Reader::rewind(const Stamp& where)
+template<class Locking>
+ReadResult BasicReader<Locking>::rewind(const Stamp& where)
 {
     return pImpl->rewind(where);
 }
 
-ReadResult Reader::next()
+template<class Locking>
+ReadResult BasicReader<Locking>::rewindToSequence(uint64_t sequence)
+{
+    return pImpl->rewindToSequence(sequence);
+}
+
+template<class Locking>
+ReadResult BasicReader<Locking>::next()
 {
     return pImpl->next();
 }
 
-ReadResult Reader::forceNext()
+template<class Locking>
+ReadResult BasicReader<Locking>::forceNext()
 {
     return pImpl->forceNext();
 }
 
-void Reader::setDirection(bool goForward)
+template<class Locking>
+void BasicReader<Locking>::setDirection(bool goForward)
 {
     pImpl->setDirection(goForward);
 }
 
-bool Reader::getDirection() const
+template<class Locking>
+bool BasicReader<Locking>::getDirection() const
 {
     return pImpl->getDirection();
 }
 
-std::pair<Stamp,Stamp> Reader::getBoundStamp()
+template<class Locking>
+std::pair<Stamp,Stamp> BasicReader<Locking>::getBoundStamp()
 {
     return pImpl->getAvailableTimeInterval();
 }
 
-bool Reader::existActualWriter() const
+template<class Locking>
+bool BasicReader<Locking>::existActualWriter() const
 {
     return pImpl->existActualWriter();
 }
 
-Stamp Reader::getCurrentStamp() const
+template<class Locking>
+Stamp BasicReader<Locking>::getCurrentStamp() const
 {
     return pImpl->getCurrentStamp();
 }
 
-Identifier Reader::getCurrentIdentifier() const
+template<class Locking>
+uint64_t BasicReader<Locking>::getCurrentSequence() const
+{
+    return pImpl->getCurrentSequence();
+}
+
+template<class Locking>
+Identifier BasicReader<Locking>::getCurrentIdentifier() const
 {
     return pImpl->getCurrentIdentifier();
 }
 
-RecordType Reader::getCurrentType() const
+template<class Locking>
+RecordType BasicReader<Locking>::getCurrentType() const
 {
     return pImpl->getCurrentType();
 }
 
-bool Reader::resolveToSearchReference(const Stamp& decidesStamp) const
+template<class Locking>
+bool BasicReader<Locking>::resolveToSearchReference(const Stamp& decidesStamp) const
 {
     return pImpl->resolveToSearchReference(decidesStamp);
 }
 
-void Reader::update()
+template<class Locking>
+void BasicReader<Locking>::update()
 {
     pImpl->update();
 }
 
-bool Reader::isOpened() const
+template<class Locking>
+ReadResult BasicReader<Locking>::follow(const boost::posix_time::time_duration& timeout)
+{
+    return pImpl->follow(timeout);
+}
+
+template<class Locking>
+ReadResult BasicReader<Locking>::follow(const std::function<bool (BasicReader&)>& onRecord, const boost::posix_time::time_duration& idle)
+{
+    while (true)
+    {
+        ReadResult res = pImpl->follow(idle);
+        if (!res || !onRecord(*this))
+            return res;
+    }
+}
+
+template<class Locking>
+bool BasicReader<Locking>::isOpened() const
 {
     return pImpl->isOpened();
 }
 
-bool Reader::hasMoreRecords() const
+template<class Locking>
+bool BasicReader<Locking>::hasMoreRecords() const
 {
     return pImpl->hasMoreRecords();
 }
 
-std::string Bbx::Reader::getTimeZone() const
+template<class Locking>
+std::string BasicReader<Locking>::getTimeZone() const
 {
     return pImpl->getTimeZone();
 }
 
-Bbx::Impl::Cursor Bbx::Reader::getCurrentCursor() const
+template<class Locking>
+size_t BasicReader<Locking>::verify(std::vector<std::wstring>* damagedFiles) const
+{
+    return pImpl->verify(damagedFiles);
+}
+
+template<class Locking>
+Bbx::Impl::Cursor BasicReader<Locking>::getCurrentCursor() const
 {
     return pImpl->getCurrentCursor();
 }
 
+template<class Locking>
+std::wstring BasicReader<Locking>::getCurrentFilePath() const
+{
+    return pImpl->getCurrentFilePath();
+}
+
+template<class Locking>
+Bbx::ReadResult BasicReader<Locking>::rewindToCursor(const std::wstring& filePath, const Bbx::Impl::Cursor& cursor)
+{
+    return pImpl->rewindToCursor(filePath, cursor);
+}
+
+template<class Locking>
+std::vector<TimelineBucket> BasicReader<Locking>::summarize(const std::pair<Stamp, Stamp>& range,
+    const boost::posix_time::time_duration& bucket) const
+{
+    return pImpl->summarize(range, bucket);
+}
+
+template<class Locking>
+ReaderPosition BasicReader<Locking>::getPosition() const
+{
+    return pImpl->getPosition();
+}
+
+template<class Locking>
+ReadResult BasicReader<Locking>::rewindToPosition(const ReaderPosition& position)
+{
+    return pImpl->rewindToPosition(position);
+}
+
+template class Bbx::BasicReader<Impl::MutexLocking>;
+template class Bbx::BasicReader<Impl::NoLocking>;
+
 // Writer implementation
 
 std::shared_ptr<Writer> Writer::create(const Bbx::Location& location)
@@ -134,6 +336,15 @@ std::shared_ptr<Writer> Writer::create(const Bbx::Location& location)
         return std::shared_ptr<Writer>();
 }
 
+std::shared_ptr<Writer> Writer::create(const Bbx::Location& location, std::shared_ptr<WriterExecutor> executor)
+{
+    Impl::WriterImpl* impl = Impl::WriterImpl::create(location, executor);
+    if ( impl )
+        return std::shared_ptr<Writer>( new Writer( impl ) );
+    else
+        return std::shared_ptr<Writer>();
+}
+
 Writer::Writer(Impl::WriterImpl* pImpl)
     : pImpl(pImpl)
 {
@@ -198,7 +409,7 @@ void Writer::setPageSize(unsigned page_size)
     pImpl->setPageSize(page_size);
 }
 
-void Writer::setRecomendedFileSize(unsigned file_size)
+void Writer::setRecomendedFileSize(BBX_DISK_SIZE file_size)
 {
     pImpl->setRecomendedFileSize(file_size);
 }
@@ -208,6 +419,21 @@ void Writer::setTimeZone( std::string textTZ )
     pImpl->setTimeZone(textTZ);
 }
 
+void Writer::setPageChecksums( bool enable )
+{
+    pImpl->setPageChecksums(enable);
+}
+
+void Writer::setLocklessReading( bool enable )
+{
+    pImpl->setLocklessReading(enable);
+}
+
+bool Writer::setLiveFeed( size_t capacity )
+{
+    return pImpl->setLiveFeed(capacity);
+}
+
 bool Writer::setDiskLimit(const char * disk_size)
 {
     return pImpl->setDiskLimit(disk_size);
@@ -242,3 +468,8 @@ std::tuple<unsigned, unsigned, unsigned, unsigned> Writer::getWrittenMessagesCou
 {
     return pImpl->getWrittenMessagesCounts();
 }
+
+boost::posix_time::time_duration Writer::getBlockedTime() const
+{
+    return pImpl->getBlockedTime();
+}
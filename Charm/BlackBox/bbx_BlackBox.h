@@ -3,6 +3,7 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <functional>
 #include <cassert>
 #include <sstream>
 
@@ -16,13 +17,18 @@
 namespace Bbx
 {
     namespace Impl {
-        class ReaderImpl;
+        struct MutexLocking;
+        struct NoLocking;
+        template<class Locking> class BasicReaderImpl;
+        typedef BasicReaderImpl<MutexLocking> ReaderImpl;
+        typedef BasicReaderImpl<NoLocking> LocalReaderImpl;
         class WriterImpl;
         struct Cursor;
     }
 
     class ReadResult;
     struct Buffer;
+    class WriterExecutor;
 
     typedef std::vector<char> char_vec;
 
@@ -44,12 +50,71 @@ namespace Bbx
         OutboxPackage = 4
     };
 
-    /** @brief Читатель ЧЯ. Допускается создание любого количества читателей для каждого ЧЯ. */
-    class Reader
+    /** @brief Число типов записей RecordType */
+    const size_t c_RecordTypesCount = 4;
+
+    /** @brief Итоги интервала времени для обзорной шкалы ящика (см. BasicReader::summarize) */
+    struct TimelineBucket
+    {
+        Stamp begin;                            // начало интервала
+        size_t counts[c_RecordTypesCount];      // число записей по типам (индекс - typeIndex)
+        uint64_t bytes[c_RecordTypesCount];     // объём записей по типам
+        size_t sessions;                        // начала сессий ящика
+        size_t gaps;                            // пропуски сквозных номеров перед началом сессии (потерянные записи)
+
+        TimelineBucket();
+
+        /** @brief Индекс типа записи в counts и bytes (c_RecordTypesCount - неизвестный тип) */
+        static size_t typeIndex(RecordType type);
+        size_t getCount(RecordType type) const;
+        uint64_t getBytes(RecordType type) const;
+        /** @brief Число записей всех типов */
+        size_t getTotalCount() const;
+    };
+
+    /** @brief Позиция читателя, сохраняемая между запусками (см. BasicReader::getPosition).
+    Хранит имя файла ящика, момент начала файла, курсор в файле, штамп и сквозной номер записи.
+    Возврат к позиции не требует поиска; если файл удалён по сроку хранения или подменён,
+    запись находится по сквозному номеру, а без номера - по штампу. */
+    class ReaderPosition
+    {
+    public:
+        ReaderPosition();
+
+        /** @brief Позиция получена от читателя или успешно разобрана */
+        bool isValid() const;
+        Stamp getStamp() const;
+        uint64_t getSequence() const;
+
+        /** @brief Текстовое представление с номером версии формата */
+        std::string serialize() const;
+        /** @brief Разбор результата serialize(); неизвестная версия или повреждение дают недействительную позицию */
+        static ReaderPosition deserialize(const std::string& token);
+
+    private:
+        template<class Locking> friend class Impl::BasicReaderImpl;
+
+        std::wstring fileName;  // имя файла без каталога
+        Stamp fileStart;        // момент начала файла из его заголовка
+        uint64_t page;
+        uint64_t part;
+        Stamp stamp;
+        uint64_t sequence;
+    };
+
+    /** @brief Читатель ЧЯ. Допускается создание любого количества читателей для каждого ЧЯ.
+    Locking - политика синхронизации: Reader (Impl::MutexLocking) можно использовать из нескольких потоков,
+    LocalReader (Impl::NoLocking) принадлежит одному потоку и не тратит время на блокировку в каждом методе. */
+    template<class Locking>
+    class BasicReader
     {
     public:
-        explicit Reader(const Location& location);
-        ~Reader();
+        explicit BasicReader(const Location& location);
+        ~BasicReader();
+
+        /** @brief Независимый читатель на той же позиции (для параллельной обработки с этого места).
+        Открытый файл не ищется заново: копия открывает его по тому же пути и получает прочитанную страницу */
+        std::unique_ptr<BasicReader> clone() const;
 
         /** @brief Получение кода результата последней операции, возвращающей код результата */
         ReadResult lastResult() const;
@@ -74,6 +139,9 @@ namespace Bbx
         вне зависимости от направления чтения */
         ReadResult rewind(const Stamp& where);
 
+        /** @brief Точная перемотка до записи с указанным сквозным номером (см. getCurrentSequence) */
+        ReadResult rewindToSequence(uint64_t sequence);
+
         /** @brief Перемещение курсора на следующую запись в соответствие с установленным
         направлением чтения.
         Возвращает код ошибки в случае нестандартной ситуации 
@@ -87,6 +155,17 @@ namespace Bbx
         в случае нестанартной ситуации */
         ReadResult forceNext();
 
+        /** @brief Ожидание следующей записи живого ящика при чтении вперёд.
+        Курсор перемещается как при next(); если новых записей ещё нет, поток спит до дозаписи
+        текущего файла или появления нового файла (без опроса), но не дольше timeout.
+        @return результат перемещения, NoDataAvailable - за timeout записей не появилось */
+        ReadResult follow(const boost::posix_time::time_duration& timeout);
+
+        /** @brief Доставка новых записей по мере их появления: onRecord вызывается по порядку
+        для каждой записи за текущей позицией (запись читается, например, через readAnyRecord).
+        Завершается, когда onRecord вернул false, переход не удался или за idle не появилось записей */
+        ReadResult follow(const std::function<bool (BasicReader&)>& onRecord, const boost::posix_time::time_duration& idle);
+
         /** @brief Установка направления чтения */
         void setDirection(bool goForward);
 
@@ -99,9 +178,14 @@ namespace Bbx
         /** @brief Есть ли писатель для этого ящика */
         bool existActualWriter() const;
 
-        /** @brief Получение временного штампа текущей позиции */
+        /** @brief Получение временного штампа текущей позиции (с наносекундами, как у read*) */
         Stamp getCurrentStamp() const;
 
+        /** @brief Получение сквозного номера записи текущей позиции.
+        Номера присваиваются писателем подряд начиная с 1, ноль означает, что номер неизвестен
+        (файл записан до версии 4.0) */
+        uint64_t getCurrentSequence() const;
+
         /** @brief Получение идентификатора текущей позиции */
         Identifier getCurrentIdentifier() const;
 
@@ -125,19 +209,54 @@ namespace Bbx
         /** @brief Прочитать временнУю зону из заголовка черного ящика */
         std::string getTimeZone() const;
 
+        /** @brief Проверка контрольных сумм всех страниц ящика (крупными блоками, без разбора записей)
+        @param damagedFiles если указан, заполняется файлами с повреждёнными страницами
+        @return число повреждённых страниц */
+        size_t verify(std::vector<std::wstring>* damagedFiles = nullptr) const;
+
+        /** @brief Обзор ящика для шкалы времени без чтения записей: число и объём записей по типам,
+        начала сессий и пропуски по интервалам длиной bucket от range.first до range.second включительно.
+        Закрытые файлы, целиком попадающие в один интервал, учитываются по итогам из зоны расширения,
+        остальные - по заголовкам страниц и кусочков. Файлы обрабатываются параллельно, позиция читателя не меняется.
+        Записи относятся к интервалам по штампу с точностью до секунды; копия опорной записи в начале
+        следующего файла не учитывается */
+        std::vector<TimelineBucket> summarize(const std::pair<Stamp, Stamp>& range, const boost::posix_time::time_duration& bucket) const;
+
         /** @brief Прочитать текущий курсор (для отладки) */
         Bbx::Impl::Cursor getCurrentCursor() const;
+
+        /** @brief Путь к текущему файлу; вместе с курсором задаёт позицию для rewindToCursor */
+        std::wstring getCurrentFilePath() const;
+
+        /** @brief Возврат к позиции, запомненной по getCurrentFilePath и getCurrentCursor */
+        ReadResult rewindToCursor(const std::wstring& filePath, const Bbx::Impl::Cursor& cursor);
+
+        /** @brief Текущая позиция для продолжения чтения, в том числе после перезапуска программы */
+        ReaderPosition getPosition() const;
+
+        /** @brief Возврат к позиции getPosition
+        @return Success - позиция восстановлена без поиска; FoundApproximateValue - файл позиции недоступен,
+        запись найдена по сквозному номеру или ближайшая по штампу */
+        ReadResult rewindToPosition(const ReaderPosition& position);
     private:
-        Reader(const Reader&);
-        Reader& operator =(const Reader&);
+        explicit BasicReader(Impl::BasicReaderImpl<Locking>* pImpl);
+        BasicReader(const BasicReader&);
+        BasicReader& operator =(const BasicReader&);
 
-        std::unique_ptr<Impl::ReaderImpl> pImpl;
+        std::unique_ptr<Impl::BasicReaderImpl<Locking>> pImpl;
     };
 
+    typedef BasicReader<Impl::MutexLocking> Reader;
+    /** @brief Читатель без внутренней синхронизации: все вызовы - из одного потока-владельца.
+    Для параллельной обработки каждому потоку нужен свой читатель (см. clone) */
+    typedef BasicReader<Impl::NoLocking> LocalReader;
+
     class Writer
     {
     public:
         static std::shared_ptr<Writer> create(const Location& location);
+        // The writer is served by the shared thread pool instead of its own thread (see WriterExecutor)
+        static std::shared_ptr<Writer> create(const Location& location, std::shared_ptr<WriterExecutor> executor);
 
         ~Writer();
 
@@ -158,15 +277,24 @@ namespace Bbx
         
         unsigned getPageSize() const;
         void setPageSize(unsigned page_size);
-        void setRecomendedFileSize(unsigned file_size);
+        void setRecomendedFileSize(BBX_DISK_SIZE file_size);
         bool setDiskLimit( const char * disk_size );
 		bool setDiskLimit(BBX_DISK_SIZE disk_size);
 		BBX_DISK_SIZE getDiskLimit() const;
         void setLifeTime(time_t life_time);
         const Location& getLocation() const;
         void setTimeZone( std::string textTZ );
+        // Closes every completely filled page with CRC32C checksum (applies from the next file)
+        void setPageChecksums( bool enable );
+        // Publishes pages with commit counters so that readers never take file locks (applies from the next file)
+        void setLocklessReading( bool enable );
+        // Publishes every written record into a shared memory ring of the given size for LiveFeed readers
+        // on this machine (0 disables); returns false if the ring can't be created
+        bool setLiveFeed( size_t capacity );
         bool needReference( time_t curr_moment ) const;
         std::tuple<unsigned, unsigned, unsigned, unsigned> getWrittenMessagesCounts() const;
+        // Total time push* calls have been blocked waiting for room in the queue of the worker thread
+        boost::posix_time::time_duration getBlockedTime() const;
     private:
         explicit Writer(Impl::WriterImpl *pImpl);
 
@@ -198,6 +326,7 @@ namespace Bbx
             BadPageHeader = 0x86,        /* некорректный заголовок страницы */
             PageRead = 0x87,             /* ошибка чтения страницы */
             PageNotFound = 0x88,         /* страница не найдена */
+            BadPageChecksum = 0x89,      /* контрольная сумма страницы не совпала */
         };
 
         ReadResult() 
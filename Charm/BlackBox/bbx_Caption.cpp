@@ -0,0 +1,96 @@
+﻿#include "stdafx.h"
+
+#include "bbx_Caption.h"
+#include "bbx_File.h"
+
+using namespace Bbx::Impl;
+
+CaptionDictionary::CaptionDictionary()
+    : zone(), usedBytes(0), captions(), identifiers(), lockless(false)
+{
+}
+
+void CaptionDictionary::reset(const FileAddress& dictionaryZone)
+{
+    zone = dictionaryZone;
+    usedBytes = 0;
+    captions.clear();
+    identifiers.clear();
+}
+
+bool CaptionDictionary::encode(const FileId& file, const Bbx::Buffer& caption, unsigned& reference)
+{
+    if (!enabled() || !caption.size || caption.size > c_MaximumDictionaryCaptionSize)
+        return false;
+
+    char_vec key(begin(caption), end(caption));
+    auto found = identifiers.find(key);
+    if (identifiers.end() == found)
+    {
+        if (!append(file, caption))
+            return false;
+        found = identifiers.insert(std::make_pair(key, size32(captions) - 1)).first;
+    }
+    reference = c_ReferenceFlag | found->second;
+    return true;
+}
+
+bool CaptionDictionary::decode(const FileId& file, unsigned reference, Bbx::char_vec& caption)
+{
+    ASSERT(isReference(reference));
+    size_t id = reference & ~c_ReferenceFlag;
+    if (id >= captions.size() && !load(file, id))
+        return false;
+    if (id >= captions.size())
+        return false;
+
+    caption = captions[id];
+    return true;
+}
+
+bool CaptionDictionary::append(const FileId& file, const Bbx::Buffer& caption)
+{
+    /* Место под завершающий нулевой размер должно оставаться всегда */
+    unsigned entrySize = (unsigned)sizeof(unsigned) + caption.size;
+    if (usedBytes + entrySize + sizeof(unsigned) > zone.size)
+        return false;
+
+    char_vec entry(entrySize);
+    memcpy(&entry[0], &caption.size, sizeof(unsigned));
+    memcpy(&entry[sizeof(unsigned)], caption.data_ptr, caption.size);
+
+    OwnSection entrySection(file, zone.offset + usedBytes, entrySize, !lockless);
+    if (!entrySection.write(Bbx::Buffer(entry)))
+        return false;
+
+    usedBytes += entrySize;
+    captions.push_back(char_vec(begin(caption), end(caption)));
+    return true;
+}
+
+bool CaptionDictionary::load(const FileId& file, size_t needed)
+{
+    if (!enabled() || usedBytes >= zone.size)
+        return false;
+
+    /* Дочитываем только ещё неизвестную часть словаря */
+    char_vec tail(zone.size - usedBytes);
+    SharedSection tailSection(file, zone.offset + usedBytes, size32(tail), !lockless);
+    if (!tailSection.read(Bbx::Buffer(tail)))
+        return false;
+
+    size_t pos = 0;
+    while (pos + sizeof(unsigned) <= tail.size() && !(lockless && captions.size() > needed))
+    {
+        unsigned entrySize = 0;
+        memcpy(&entrySize, &tail[pos], sizeof(unsigned));
+        if (!entrySize || entrySize > tail.size() - pos - sizeof(unsigned))
+            break;
+
+        pos += sizeof(unsigned);
+        captions.push_back(char_vec(tail.begin() + pos, tail.begin() + pos + entrySize));
+        pos += entrySize;
+    }
+    usedBytes += (unsigned)pos;
+    return true;
+}
@@ -0,0 +1,80 @@
+﻿#pragma once
+
+#include "bbx_Requirements.h"
+#include "bbx_BlackBox.h"
+#include "bbx_Record.h"
+
+namespace Bbx
+{
+    namespace Impl
+    {
+        /** @brief Размер зоны словаря заголовков записей (caption) по умолчанию */
+        const unsigned c_DefaultCaptionZoneSize = 32 * 1024;
+
+        /** @brief Размер зоны словаря, меньше которого словарь не создаётся */
+        const unsigned c_MinimumCaptionZoneSize = 1024;
+
+        /** @brief Максимальная длина заголовка, помещаемого в словарь */
+        const unsigned c_MaximumDictionaryCaptionSize = 256;
+
+        /**
+        @brief Словарь заголовков записей файла черного ящика.
+        Хранится в конце зоны расширения файла и состоит из последовательности
+        контейнеров [размер][данные], номер контейнера является идентификатором заголовка.
+        Нулевой размер означает конец словаря (зона заполняется нулями при создании файла).
+        В записи вместо заголовка сохраняется размер контейнера с признаком c_ReferenceFlag
+        и идентификатором заголовка в младших битах, данные заголовка при этом не пишутся.
+        */
+        class CaptionDictionary
+        {
+        public:
+            static const unsigned c_ReferenceFlag = 0x80000000u;
+
+            CaptionDictionary();
+
+            /** @brief Привязка словаря к зоне файла, все ранее известные заголовки забываются */
+            void reset(const FileAddress& dictionaryZone);
+            bool enabled() const;
+            /** @brief Работа без блокировок (файлы со счётчиками фиксации страниц).
+            Читатель разбирает словарь лишь до нужного заголовка: он записан раньше ссылающейся
+            на него записи, а за ним может оказаться недописанный контейнер */
+            void setLockless(bool enable);
+
+            /** @brief Получение ссылки на заголовок для записи в файл.
+            Новые заголовки сразу записываются в зону словаря, т.е. до записей с их использованием.
+            @return false если заголовок следует писать в запись целиком */
+            bool encode(const FileId& file, const Buffer& caption, unsigned& reference);
+
+            /** @brief Получение заголовка по ссылке из записи.
+            Если идентификатор еще не известен, словарь дочитывается из файла */
+            bool decode(const FileId& file, unsigned reference, char_vec& caption);
+
+            static bool isReference(unsigned containerSize);
+
+        private:
+            FileAddress zone;
+            unsigned usedBytes;
+            std::vector<char_vec> captions;
+            std::map<char_vec, unsigned> identifiers;
+            bool lockless;
+
+            bool append(const FileId& file, const Buffer& caption);
+            bool load(const FileId& file, size_t needed);
+        };
+
+        inline bool CaptionDictionary::enabled() const
+        {
+            return zone.size != 0;
+        }
+
+        inline void CaptionDictionary::setLockless(bool enable)
+        {
+            lockless = enable;
+        }
+
+        inline bool CaptionDictionary::isReference(unsigned containerSize)
+        {
+            return 0 != (containerSize & c_ReferenceFlag);
+        }
+    }
+}
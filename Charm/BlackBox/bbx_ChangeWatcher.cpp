@@ -0,0 +1,113 @@
+﻿#include "stdafx.h"
+#ifdef LINUX
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+#include <boost/filesystem/path.hpp>
+
+#include "bbx_ChangeWatcher.h"
+#include "../helpful/Utf8.h"
+
+using namespace Bbx::Impl;
+
+#ifndef LINUX
+
+ChangeWatcher::ChangeWatcher()
+    : directory(), fileName(), change(INVALID_HANDLE_VALUE)
+{
+}
+
+ChangeWatcher::~ChangeWatcher()
+{
+    if (INVALID_HANDLE_VALUE != change)
+        FindCloseChangeNotification(change);
+}
+
+void ChangeWatcher::watch(const std::wstring& _directory, const std::wstring& file)
+{
+    fileName = boost::filesystem::path(file).filename().wstring();
+    if (INVALID_HANDLE_VALUE != change && directory == _directory)
+        return;
+    if (INVALID_HANDLE_VALUE != change)
+        FindCloseChangeNotification(change);
+    directory = _directory;
+    change = FindFirstChangeNotification(directory.c_str(), FALSE,
+        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+}
+
+unsigned ChangeWatcher::wait(const boost::posix_time::time_duration& timeout)
+{
+    if (INVALID_HANDLE_VALUE == change)
+        return 0;
+    DWORD milliseconds = DWORD(std::max<int64_t>(0, timeout.total_milliseconds()));
+    if (WAIT_OBJECT_0 != WaitForSingleObject(change, milliseconds))
+        return 0;
+    FindNextChangeNotification(change);
+    // уведомление относится к каталогу целиком
+    return c_CurrentFile | c_OtherFiles;
+}
+
+#else
+
+ChangeWatcher::ChangeWatcher()
+    : directory(), fileName(), fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), directoryWatch(-1)
+{
+    ASSERT(fd != -1);
+}
+
+ChangeWatcher::~ChangeWatcher()
+{
+    if (fd != -1)
+        close(fd);
+}
+
+void ChangeWatcher::watch(const std::wstring& _directory, const std::wstring& file)
+{
+    fileName = boost::filesystem::path(file).filename().wstring();
+    if (fd == -1 || (directoryWatch >= 0 && directory == _directory))
+        return;
+    if (directoryWatch >= 0)
+        inotify_rm_watch(fd, directoryWatch);
+    directory = _directory;
+    // события дозаписи файлов каталога приходят и на сторожок самого каталога
+    directoryWatch = inotify_add_watch(fd, ToUtf8(directory).c_str(), IN_CREATE | IN_MOVED_TO | IN_MODIFY);
+}
+
+unsigned ChangeWatcher::wait(const boost::posix_time::time_duration& timeout)
+{
+    if (fd == -1)
+        return 0;
+
+    struct pollfd fds;
+    fds.fd = fd;
+    fds.events = POLLIN;
+    fds.revents = 0;
+    int milliseconds = int(std::max<int64_t>(0, timeout.total_milliseconds()));
+    if (poll(&fds, 1, milliseconds) <= 0 || !(fds.revents & POLLIN))
+        return 0;
+
+    /* Накопленные события вычитываются целиком */
+    const std::string current = ToUtf8(fileName);
+    unsigned changes = 0;
+    while (true)
+    {
+        union
+        {
+            inotify_event i_event; // только для целей выравнивания
+            char raw[4096];
+        };
+        ssize_t len = read(fd, raw, sizeof(raw));
+        if (len <= 0)
+            break;
+        const inotify_event* event;
+        for (char* ptr = raw; ptr < raw + len; ptr += sizeof(inotify_event) + event->len)
+        {
+            event = reinterpret_cast<const inotify_event*>(ptr);
+            bool same = event->len && current == event->name;
+            changes |= same ? c_CurrentFile : c_OtherFiles;
+        }
+    }
+    return changes;
+}
+
+#endif // !LINUX
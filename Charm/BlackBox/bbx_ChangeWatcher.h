@@ -0,0 +1,41 @@
+﻿#pragma once
+
+#include "bbx_Requirements.h"
+
+namespace Bbx
+{
+    namespace Impl
+    {
+        /**
+        @brief Ожидание изменений живого ящика без опроса.
+        Следит за каталогом ящика: дозаписью текущего файла и появлением или дозаписью других файлов.
+        Изменения, случившиеся между watch() и wait(), не теряются: wait() сразу сообщает о них.
+        */
+        class ChangeWatcher : boost::noncopyable
+        {
+        public:
+            /** @brief Что изменилось за время ожидания */
+            static const unsigned c_CurrentFile = 0x1;
+            static const unsigned c_OtherFiles = 0x2;
+
+            ChangeWatcher();
+            ~ChangeWatcher();
+
+            /** @brief Наблюдение за каталогом directory, текущим считается файл file */
+            void watch(const std::wstring& directory, const std::wstring& file);
+            /** @brief Ожидание изменения не дольше timeout
+            @return набор флагов c_CurrentFile и c_OtherFiles, 0 по истечении времени */
+            unsigned wait(const boost::posix_time::time_duration& timeout);
+
+        private:
+            std::wstring directory;
+            std::wstring fileName; // имя текущего файла без каталога
+#ifndef LINUX
+            HANDLE change;
+#else
+            int fd;            // собственный дескриптор inotify
+            int directoryWatch;
+#endif
+        };
+    }
+}
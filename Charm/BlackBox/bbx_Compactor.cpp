@@ -0,0 +1,185 @@
+﻿#include "stdafx.h"
+
+#include "bbx_Compactor.h"
+
+using namespace Bbx;
+
+namespace
+{
+    /* Пустой вектор передаётся писателю пустым буфером */
+    Buffer asBuffer(const char_vec& vec)
+    {
+        return vec.empty() ? Buffer() : Buffer(vec);
+    }
+
+    bool pushRecord(Writer& output, const MergedRecord& record)
+    {
+        switch (record.type)
+        {
+        case RecordType::Reference:
+            return output.pushReference(asBuffer(record.caption), asBuffer(record.data), record.stamp, record.identifier);
+        case RecordType::Increment:
+            return output.pushIncrement(asBuffer(record.caption), asBuffer(record.before), asBuffer(record.data), record.stamp, record.identifier);
+        case RecordType::IncomingPackage:
+            return output.pushIncomingPackage(asBuffer(record.caption), asBuffer(record.data), record.stamp, record.identifier);
+        case RecordType::OutboxPackage:
+            return output.pushOutboxPackage(asBuffer(record.caption), asBuffer(record.data), record.stamp, record.identifier);
+        default:
+            return true;
+        }
+    }
+}
+
+Compactor::Compactor(const Location& _input, Writer& _output)
+    : input(_input), output(_output), apply(), referenceInterval(0), thinBefore(0),
+    readCount(0), writtenCount(0), createdReferences(0), droppedIncrements(0),
+    pending(), state(), stateKnown(false), lastReference(0)
+{
+}
+
+Compactor::~Compactor()
+{
+}
+
+void Compactor::setApplyIncrement(ApplyIncrement _apply)
+{
+    apply = _apply;
+}
+
+void Compactor::setReferenceInterval(time_t seconds)
+{
+    referenceInterval = seconds;
+}
+
+void Compactor::setThinBefore(const Stamp& until)
+{
+    thinBefore = until;
+}
+
+uint64_t Compactor::getReadCount() const
+{
+    return readCount;
+}
+
+uint64_t Compactor::getWrittenCount() const
+{
+    return writtenCount;
+}
+
+uint64_t Compactor::getCreatedReferences() const
+{
+    return createdReferences;
+}
+
+uint64_t Compactor::getDroppedIncrements() const
+{
+    return droppedIncrements;
+}
+
+bool Compactor::write(const MergedRecord& record)
+{
+    if (!pushRecord(output, record))
+        return false;
+    ++writtenCount;
+    return true;
+}
+
+bool Compactor::writeState(const Stamp& stamp)
+{
+    state.stamp = stamp;
+    if (!write(state))
+        return false;
+    ++createdReferences;
+    lastReference = stamp.getTime();
+    return true;
+}
+
+bool Compactor::flushPending(bool dropIncrements)
+{
+    for (const MergedRecord& held : pending)
+    {
+        if (dropIncrements && RecordType::Increment == held.type)
+            ++droppedIncrements;
+        else if (!write(held))
+            return false;
+    }
+    pending.clear();
+    return true;
+}
+
+/* Придержанные записи до thinBefore без последующей опорной записи. Если ящик продолжается (continued),
+ * отбросить их инкременты можно, только заменив опорной записью с известным состоянием:
+ * иначе продолжение применялось бы к состоянию без них */
+bool Compactor::closePending(bool continued)
+{
+    const bool replace = stateKnown && std::any_of(pending.begin(), pending.end(), [](const MergedRecord& held) {
+        return RecordType::Increment == held.type;
+    });
+    const Stamp last = pending.back().stamp;
+    if (!flushPending(replace || !continued))
+        return false;
+    return !replace || writeState(last);
+}
+
+bool Compactor::run()
+{
+    readCount = writtenCount = createdReferences = droppedIncrements = 0;
+    pending.clear();
+    stateKnown = false;
+    lastReference = 0;
+
+    /* Слияние одного ящика дает чтение с упреждением, пропуск повторов опорных записей и обход разрывов */
+    MergeIterator source(std::vector<Location>(1, input));
+    if (!source.rewindToBegin())
+        return false;
+
+    MergedRecord record;
+    while (source.next(record))
+    {
+        ++readCount;
+        const Stamp stamp = record.stamp;
+        const bool thinned = stamp < thinBefore;
+        if (record.newSession)
+        {
+            /* У прошлого сеанса продолжения нет, его инкременты можно отбросить и при неизвестном состоянии */
+            if (!pending.empty() && !closePending(false))
+                return false;
+            stateKnown = false; // после разрыва состояние продолжается только от новой опорной записи
+        }
+        if (!pending.empty())
+        {
+            /* Опорная запись сама заменяет инкременты перед ней, на границе thinBefore замена создаётся */
+            if (RecordType::Reference == record.type ? !flushPending(true) : !thinned && !closePending(true))
+                return false;
+        }
+
+        if (RecordType::Reference == record.type)
+        {
+            state.caption = record.caption;
+            state.data = record.data;
+            state.identifier = record.identifier;
+            stateKnown = true;
+            lastReference = record.stamp.getTime();
+        }
+        else if (RecordType::Increment == record.type)
+        {
+            if (stateKnown)
+                stateKnown = apply && apply(state.data, record.caption, record.before, record.data);
+        }
+
+        if (thinned && RecordType::Reference != record.type)
+            pending.push_back(std::move(record));
+        else if (!write(record))
+            return false;
+
+        if (stateKnown && referenceInterval && stamp.getTime() - lastReference >= referenceInterval)
+        {
+            /* Состояние после текущей записи сохраняется опорной записью с её штампом */
+            if (!flushPending(true) || !writeState(stamp))
+                return false;
+        }
+    }
+    if (!pending.empty() && !closePending(false))
+        return false;
+    return ReadResult::NoDataAvailable == source.inputResult(0);
+}
@@ -0,0 +1,69 @@
+﻿#pragma once
+
+#include <functional>
+#include "bbx_MergeIterator.h"
+
+namespace Bbx
+{
+    /**
+    @brief Уплотнение черного ящика: перезапись с частыми опорными записями и прореживанием старых инкрементов.
+    Состояние восстанавливается из опорных записей и инкрементов с помощью функции применения инкремента,
+    которую предоставляет пользователь (формат данных состояния черному ящику неизвестен).
+    Через каждые referenceInterval секунд в результат добавляется опорная запись с текущим состоянием.
+    Инкременты раньше момента thinBefore не переносятся: состояние в этой части ящика
+    доступно с шагом опорных записей. Граница прореживания должна приходиться на опорную запись,
+    иначе инкременты после неё применялись бы к состоянию без отброшенных. Поэтому на границе
+    добавляется опорная запись с восстановленным состоянием, а если состояние неизвестно,
+    переносятся инкременты от последней опорной записи перед границей. Посылки переносятся без изменений.
+    */
+    class Compactor
+    {
+    public:
+        /** @brief Применение инкремента к состоянию
+        @return false, если инкремент применить нельзя; тогда новые опорные записи не создаются
+        до следующей опорной записи исходного ящика */
+        typedef std::function<bool(char_vec& state, const char_vec& caption, const char_vec& before, const char_vec& after)> ApplyIncrement;
+
+        Compactor(const Location& input, Writer& output);
+        ~Compactor();
+
+        void setApplyIncrement(ApplyIncrement apply);
+        /** @brief Период добавляемых опорных записей в секундах (0 - не добавлять) */
+        void setReferenceInterval(time_t seconds);
+        /** @brief Инкременты со штампом раньше указанного отбрасываются (кроме нужных для продолжения после границы) */
+        void setThinBefore(const Stamp& until);
+
+        /** @brief Уплотнение всего входного ящика */
+        bool run();
+
+        uint64_t getReadCount() const;
+        uint64_t getWrittenCount() const;
+        uint64_t getCreatedReferences() const;
+        uint64_t getDroppedIncrements() const;
+
+    private:
+        Location input;
+        Writer& output;
+        ApplyIncrement apply;
+        time_t referenceInterval;
+        Stamp thinBefore;
+
+        uint64_t readCount;
+        uint64_t writtenCount;
+        uint64_t createdReferences;
+        uint64_t droppedIncrements;
+
+        std::vector<MergedRecord> pending; // записи до thinBefore после последней опорной
+        MergedRecord state;                // восстановленное состояние в виде опорной записи
+        bool stateKnown;
+        time_t lastReference;
+
+        bool write(const MergedRecord& record);
+        bool writeState(const Stamp& stamp);
+        bool flushPending(bool dropIncrements);
+        bool closePending(bool continued);
+
+        Compactor(const Compactor&);
+        Compactor& operator =(const Compactor&);
+    };
+}
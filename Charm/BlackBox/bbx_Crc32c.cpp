@@ -0,0 +1,152 @@
+﻿#include "stdafx.h"
+
+#include "bbx_Crc32c.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#  define BBX_CRC32C_X86
+#  include <nmmintrin.h>
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#    define BBX_TARGET_SSE42
+#  else
+#    define BBX_TARGET_SSE42 __attribute__((target("sse4.2")))
+#  endif
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#  define BBX_CRC32C_ARM
+#  include <arm_acle.h>
+#endif
+
+namespace
+{
+    const uint32_t c_Polynomial = 0x82F63B78u;
+
+    /* Таблицы для расчета по 8 байт за шаг (slicing-by-8) */
+    struct Crc32cTables
+    {
+        uint32_t table[8][256];
+
+        Crc32cTables()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; ++bit)
+                    crc = (crc & 1) ? (crc >> 1) ^ c_Polynomial : crc >> 1;
+                table[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; ++i)
+                for (int k = 1; k < 8; ++k)
+                    table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+        }
+    };
+
+    uint32_t crc32cSoftware(uint32_t crc, const unsigned char* data, size_t size)
+    {
+        static const Crc32cTables tables;
+        const uint32_t (&t)[8][256] = tables.table;
+
+        while (size && (reinterpret_cast<uintptr_t>(data) & 7))
+        {
+            crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+            --size;
+        }
+        while (size >= 8)
+        {
+            uint32_t low = 0, high = 0;
+            memcpy(&low, data, 4);
+            memcpy(&high, data + 4, 4);
+            low ^= crc;
+            crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+                  t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+            data += 8;
+            size -= 8;
+        }
+        while (size--)
+            crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+        return crc;
+    }
+
+#if defined(BBX_CRC32C_X86)
+    bool detectHardware()
+    {
+#  ifdef _MSC_VER
+        int info[4] = { 0 };
+        __cpuid(info, 1);
+        return 0 != (info[2] & (1 << 20));
+#  else
+        return 0 != __builtin_cpu_supports("sse4.2");
+#  endif
+    }
+
+    BBX_TARGET_SSE42
+    uint32_t crc32cHardwareImpl(uint32_t crc, const unsigned char* data, size_t size)
+    {
+        while (size && (reinterpret_cast<uintptr_t>(data) & 7))
+        {
+            crc = _mm_crc32_u8(crc, *data++);
+            --size;
+        }
+#  if defined(_M_X64) || defined(__x86_64__)
+        uint64_t crc64 = crc;
+        for (; size >= 8; size -= 8, data += 8)
+        {
+            uint64_t value;
+            memcpy(&value, data, sizeof(value));
+            crc64 = _mm_crc32_u64(crc64, value);
+        }
+        crc = uint32_t(crc64);
+#  endif
+        for (; size >= 4; size -= 4, data += 4)
+        {
+            uint32_t value;
+            memcpy(&value, data, sizeof(value));
+            crc = _mm_crc32_u32(crc, value);
+        }
+        while (size--)
+            crc = _mm_crc32_u8(crc, *data++);
+        return crc;
+    }
+#elif defined(BBX_CRC32C_ARM)
+    bool detectHardware()
+    {
+        return true; // наличие инструкций гарантировано параметрами компиляции
+    }
+
+    uint32_t crc32cHardwareImpl(uint32_t crc, const unsigned char* data, size_t size)
+    {
+        for (; size >= 8; size -= 8, data += 8)
+        {
+            uint64_t value;
+            memcpy(&value, data, sizeof(value));
+            crc = __crc32cd(crc, value);
+        }
+        while (size--)
+            crc = __crc32cb(crc, *data++);
+        return crc;
+    }
+#else
+    bool detectHardware()
+    {
+        return false;
+    }
+
+    uint32_t crc32cHardwareImpl(uint32_t crc, const unsigned char* data, size_t size)
+    {
+        return crc32cSoftware(crc, data, size);
+    }
+#endif
+}
+
+bool Bbx::Impl::crc32cHardware()
+{
+    static const bool supported = detectHardware();
+    return supported;
+}
+
+uint32_t Bbx::Impl::crc32c(uint32_t crc, const char* data, size_t size)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    crc = ~crc;
+    crc = crc32cHardware() ? crc32cHardwareImpl(crc, bytes, size) : crc32cSoftware(crc, bytes, size);
+    return ~crc;
+}
@@ -0,0 +1,20 @@
+﻿#pragma once
+
+#include "bbx_Requirements.h"
+
+namespace Bbx
+{
+    namespace Impl
+    {
+        /**
+        @brief Вычисление CRC32C (полином Кастаньоли 0x82F63B78).
+        Используются инструкции SSE4.2 или ARMv8 CRC, если процессор их поддерживает,
+        иначе - табличный расчет по 8 байт за шаг.
+        @param crc Результат для предыдущей части данных (0 для начала расчета)
+        */
+        uint32_t crc32c(uint32_t crc, const char* data, size_t size);
+
+        /** @brief Используется ли аппаратный расчет CRC32C */
+        bool crc32cHardware();
+    }
+}
@@ -2,8 +2,6 @@
 
 #include "bbx_Extension.h"
 
-#include <sstream>
-
 #include "../../AdoptTools/PugiXML/pugixml.hpp"
 
 using namespace Bbx::Impl;
@@ -11,12 +9,14 @@ using namespace Bbx::Impl;
 const char* Extension::c_nodeRoot = "extension";
 const char* Extension::c_nodeLocalize = "localize";
 const char* Extension::c_attrTZ = "tz";
+const char* Extension::c_nodeCaptions = "captions";
+const char* Extension::c_attrSize = "size";
 const char* Version::c_nodeVersion = "version";
 const char* Version::c_attrMajor = "major";
 const char* Version::c_attrMinor = "minor";
 
 Extension::Extension()
-    : version(), timeZone()
+    : version(), timeZone(), captionZoneSize(0), flags(0), indexOffset(0)
 {
 }
 
@@ -34,16 +34,70 @@ void Extension::setTimeZone( std::string textTZ )
     timeZone = textTZ;
 }
 
+void Extension::setCaptionZoneSize(unsigned size)
+{
+    captionZoneSize = size;
+}
+
+void Extension::setFlags(unsigned value)
+{
+    flags = value;
+}
+
+void Extension::setIndexOffset(uint64_t offset)
+{
+    indexOffset = offset;
+}
+
+bool Extension::isBinary(const Bbx::Buffer& extensionBuffer)
+{
+    return extensionBuffer.data_ptr && extensionBuffer.size >= sizeof(c_ExtensionMagic)
+        && 0 == memcmp(extensionBuffer.data_ptr, c_ExtensionMagic, sizeof(c_ExtensionMagic));
+}
+
 bool Extension::load(const Bbx::Buffer& extensionBuffer)
 {
-    pugi::xml_document doc;
     timeZone.clear();
-    if (doc.load_buffer(extensionBuffer.data_ptr, extensionBuffer.size))
+    captionZoneSize = 0;
+    flags = 0;
+    indexOffset = 0;
+    return isBinary(extensionBuffer) ? loadBinary(extensionBuffer) : loadXml(extensionBuffer);
+}
+
+bool Extension::loadBinary(const Bbx::Buffer& extensionBuffer)
+{
+    ExtensionBlock block;
+    if (extensionBuffer.size < sizeof(block))
+        return false;
+    memcpy(&block, extensionBuffer.data_ptr, sizeof(block));
+    if (block.blockSize < sizeof(block))
+        return false;
+
+    version = Version(block.versionMajor, block.versionMinor);
+    flags = block.flags;
+    captionZoneSize = block.captionZoneSize;
+    indexOffset = block.indexOffset;
+    timeZone.assign(block.timeZone, std::find(std::begin(block.timeZone), std::end(block.timeZone), '\0'));
+    return true;
+}
+
+bool Extension::loadXml(const Bbx::Buffer& extensionBuffer)
+{
+    pugi::xml_document doc;
+    // XML завершается нулевым символом, если за ним в зоне расширения лежат двоичные данные
+    const char* xmlEnd = std::find(begin(extensionBuffer), end(extensionBuffer), '\0');
+    if (doc.load_buffer(extensionBuffer.data_ptr, xmlEnd - extensionBuffer.data_ptr))
     {
         pugi::xml_node rootNode = doc.child(c_nodeRoot);
         if (rootNode && version.load(rootNode))
         {
             timeZone = rootNode.child(c_nodeLocalize).attribute(c_attrTZ).as_string();
+            captionZoneSize = rootNode.child(c_nodeCaptions).attribute(c_attrSize).as_uint(0u);
+            // у XML-файлов признаки определяются версией и наличием словаря
+            if (captionZoneSize)
+                flags |= c_FlagCaptions;
+            if (version.getMajor() >= 4u)
+                flags |= c_FlagSequenced;
             return true;
         }
     }
@@ -53,15 +107,19 @@ bool Extension::load(const Bbx::Buffer& extensionBuffer)
 
 std::string Extension::serialize() const
 {
-    pugi::xml_document doc; 
-    pugi::xml_node rootNode = doc.append_child(c_nodeRoot);
-
-    version.serialize(rootNode);
-    rootNode.append_child(c_nodeLocalize).append_attribute(c_attrTZ).set_value( timeZone.c_str() );
-
-    std::stringstream ss;
-    doc.print(ss);
-    return ss.str();
+    ExtensionBlock block;
+    memset(&block, 0, sizeof(block));
+    memcpy(block.magic, c_ExtensionMagic, sizeof(c_ExtensionMagic));
+    block.blockSize = sizeof(block);
+    block.versionMajor = uint16_t(version.getMajor());
+    block.versionMinor = uint16_t(version.getMinor());
+    block.flags = flags;
+    block.captionZoneSize = captionZoneSize;
+    block.indexOffset = indexOffset;
+    // слишком длинная временная зона обрезается, завершающий ноль сохраняется всегда
+    memcpy(block.timeZone, timeZone.data(), std::min(timeZone.size(), sizeof(block.timeZone) - 1));
+
+    return std::string(reinterpret_cast<const char*>(&block), sizeof(block));
 }
 
 const Version Extension::getVersion() const
@@ -74,6 +132,16 @@ std::string Extension::getTimeZone() const
     return timeZone;
 }
 
+unsigned Extension::getCaptionZoneSize() const
+{
+    return captionZoneSize;
+}
+
+uint64_t Extension::getIndexOffset() const
+{
+    return indexOffset;
+}
+
 Version::Version(unsigned _major, unsigned _minor)
     : m_major(_major), m_minor(_minor)
 {
@@ -119,6 +187,16 @@ void Version::serialize(pugi::xml_node& parentNode) const
 
 bool Version::isSupported() const
 {
-    // Игнорируем minor версию. Нужно как следует продумать эту проверку, но пока будет так.
-    return m_major == c_currentVersion.m_major;
+    // Игнорируем minor версию. Читаются все версии от минимальной до текущей включительно.
+    return c_minimalVersion.m_major <= m_major && m_major <= c_currentVersion.m_major;
+}
+
+unsigned Version::getMajor() const
+{
+    return m_major;
+}
+
+unsigned Version::getMinor() const
+{
+    return m_minor;
 }
\ No newline at end of file
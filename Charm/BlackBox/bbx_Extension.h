@@ -7,6 +7,16 @@
     version | changes
         1.0 | Введена система версирования, изменён заголовок страницы (добавлен Identifier),
             |   потеряна обратная совместимость с ЧЯ версией 0
+        2.0 | Добавлен словарь заголовков записей в конце зоны расширения (узел captions),
+            |   заголовок записи может быть заменён ссылкой на словарь; файлы 1.x читаются
+        3.0 | Смещения в файле 64-битные, размер файла может превышать 4Gb,
+            |   маркировка используемого файла (linux) перенесена за пределы данных
+        4.0 | Запись начинается со служебного префикса (наносекунды штампа, сквозной номер),
+            |   зона расширения страницы содержит номер записи первого кусочка страницы
+        5.0 | Зона расширения начинается с двоичного блока ExtensionBlock вместо XML,
+            |   XML разбирается только у файлов прежних версий
+        5.1 | За двоичным блоком - итоги файла (FileSummary) по смещению indexOffset,
+            |   заполняемые писателем при закрытии файла
     */
 
 namespace pugi
@@ -27,6 +37,8 @@ namespace Bbx
             ~Version();
             bool load(const pugi::xml_node& parentNode);
             bool isSupported() const;
+            unsigned getMajor() const;
+            unsigned getMinor() const;
 
             void serialize(pugi::xml_node& parentNode) const;
 
@@ -40,29 +52,117 @@ namespace Bbx
         };
 
         /** @brief Текущая версия чёрного ящика */
-        const Version c_currentVersion = Version(1u, 0u);
+        const Version c_currentVersion = Version(5u, 1u);
+
+        /** @brief Самая ранняя версия чёрного ящика, которую ещё можно прочитать */
+        const Version c_minimalVersion = Version(1u, 0u);
+
+        /** @brief Версия, с которой маркировка используемого файла (linux) лежит за пределами данных */
+        const Version c_markBeyondDataVersion = Version(3u, 0u);
+
+#pragma pack(push, 1)
+        /**
+        @brief Двоичное представление метаинформации в начале зоны расширения (с версии 5.0).
+        Считывается одним чтением без разбора XML; блок фиксированного размера,
+        новые поля добавляются в конец с увеличением blockSize.
+        */
+        struct ExtensionBlock
+        {
+            char magic[4];            // сигнатура c_ExtensionMagic
+            uint32_t blockSize;       // размер блока при записи
+            uint16_t versionMajor;
+            uint16_t versionMinor;
+            uint32_t flags;           // набор Extension::c_Flag*
+            uint32_t codec;           // кодирование данных записей (0 - без кодирования)
+            uint32_t captionZoneSize; // размер словаря заголовков в конце зоны расширения
+            uint64_t indexOffset;     // смещение дополнительного индекса в файле (0 - отсутствует)
+            char timeZone[64];        // временная зона, строка с завершающим нулём
+        };
+
+        /**
+        @brief Итоги файла в зоне расширения по смещению ExtensionBlock::indexOffset (с версии 5.1).
+        Пока файл пишется, зона заполнена нулями; писатель заполняет её при закрытии файла,
+        сигнатура записывается последней. Позволяет строить обзор ящика, не читая страниц (см. BasicReader::summarize).
+        */
+        struct FileSummary
+        {
+            char magic[4];              // сигнатура c_SummaryMagic (нули - итоги ещё не записаны)
+            uint32_t blockSize;
+            uint64_t firstSequence;     // номер первой записи файла (у файла-продолжения - копии опорной)
+            uint64_t lastSequence;      // номер последней записи файла
+            uint32_t firstRecordSize;   // размер первой записи
+            uint32_t counts[c_RecordTypesCount];  // число записей по типам (индекс - TimelineBucket::typeIndex)
+            uint64_t bytes[c_RecordTypesCount];   // объём записей по типам
+        };
+#pragma pack(pop)
+
+        /** @brief Сигнатура двоичного блока зоны расширения */
+        const char c_ExtensionMagic[4] = { 'B', 'B', 'X', 'E' };
+
+        /** @brief Сигнатура итогов файла */
+        const char c_SummaryMagic[4] = { 'B', 'B', 'X', 'S' };
 
         /** @brief Метаинформация о записанном чёрном ящике, включает в себя версию */
         class Extension
         {
         public:
+            /** @brief Файл содержит словарь заголовков записей */
+            static const unsigned c_FlagCaptions = 0x1;
+            /** @brief Записи файла начинаются со служебного префикса (наносекунды, номер) */
+            static const unsigned c_FlagSequenced = 0x2;
+            /** @brief Заполненные страницы файла закрыты контрольной суммой CRC32C */
+            static const unsigned c_FlagPageChecksums = 0x4;
+            /** @brief Страницы публикуются счётчиками фиксации (PageCommit), записи читаются без блокировок */
+            static const unsigned c_FlagCommitCounters = 0x8;
+
             static const char* c_nodeRoot;
             static const char* c_nodeLocalize;
             static const char* c_attrTZ;
+            static const char* c_nodeCaptions;
+            static const char* c_attrSize;
             Extension();
             ~Extension();
+            /** @brief Разбор зоны расширения: двоичного блока или (у прежних версий) XML */
             bool load(const Bbx::Buffer& extensionBuffer);
+            /** @brief Начинается ли зона расширения с двоичного блока */
+            static bool isBinary(const Bbx::Buffer& extensionBuffer);
             void setActualVersion();
             void setTimeZone( std::string textTZ );
+            void setCaptionZoneSize(unsigned size);
+            void setFlags(unsigned value);
+            void setIndexOffset(uint64_t offset);
 
             const Version getVersion() const;
+            unsigned getFlags() const;
+            bool hasFlag(unsigned flag) const;
             std::string getTimeZone() const;
+            /** @brief Размер зоны словаря заголовков в конце зоны расширения (0 - словаря нет) */
+            unsigned getCaptionZoneSize() const;
+            /** @brief Смещение итогов файла FileSummary (0 - файл записан без итогов) */
+            uint64_t getIndexOffset() const;
 
+            /** @brief Двоичный блок для записи в начало зоны расширения */
             std::string serialize() const;
             
         private:
             Version version;
             std::string timeZone;
+            unsigned captionZoneSize;
+            unsigned flags;
+            uint64_t indexOffset;
+
+            bool loadBinary(const Bbx::Buffer& extensionBuffer);
+            bool loadXml(const Bbx::Buffer& extensionBuffer);
         };
+
+        inline unsigned Extension::getFlags() const
+        {
+            return flags;
+        }
+
+        inline bool Extension::hasFlag(unsigned flag) const
+        {
+            return 0 != (flags & flag);
+        }
     }
 }
\ No newline at end of file
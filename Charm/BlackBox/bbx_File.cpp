@@ -89,6 +89,10 @@ bool BaseFile::isOpened() const
     return ( INVALID_HANDLE_VALUE != getHandle() );
 }
 
+void BaseFile::releaseLegacyMark()
+{
+}
+
 bool BaseFile::safeRemove(const std::wstring& path)
 {
     boost::system::error_code ec;
@@ -97,8 +101,14 @@ bool BaseFile::safeRemove(const std::wstring& path)
 
 #else
 
-static const BBX_SIZE MARK_OFFSET = 3 * Bbx::c_GB; // начало маркировки для проверки владения
-static const BBX_SIZE MARK_SIZE   = 1024;          // начало маркировки для проверки владения
+// Маркировка лежит далеко за пределами максимального размера файла (см. c_MaximumFileSize),
+// т.к. в больших файлах прежние 3Gb уже пересекаются с данными.
+// Читатели и писатели до версии 3.0 ставят маркировку по прежнему смещению, поэтому на переходный
+// период файл открывается с обеими маркировками; прежняя снимается, как только известно, что версия
+// файла не ниже 3.0 (такие файлы прежние читатели не принимают, а прежние писатели не создают)
+static const BBX_SIZE MARK_OFFSET        = BBX_SIZE(1) << 62; // начало маркировки для проверки владения
+static const BBX_SIZE LEGACY_MARK_OFFSET = BBX_SIZE(3) << 30; // начало маркировки до версии 3.0
+static const BBX_SIZE MARK_SIZE          = 1024;              // размер маркировки
 
 bool BaseFile::safeOpen_ModeRead( const std::wstring& path )
 {
@@ -108,7 +118,8 @@ bool BaseFile::safeOpen_ModeRead( const std::wstring& path )
 
     if( 0 <= tmp ) {
         handle = tmp;
-        SharedSection::lock( handle, MARK_OFFSET, 1024 ); // отметка используемого файла
+        SharedSection::lock( handle, MARK_OFFSET, MARK_SIZE ); // отметка используемого файла
+        SharedSection::lock( handle, LEGACY_MARK_OFFSET, MARK_SIZE );
         return true;
     }
     return false;
@@ -125,13 +136,19 @@ bool BaseFile::safeOpen_ModeWrite( const std::wstring& path )
         FileId tmp = open( pp.string().c_str(), O_CREAT | O_RDWR, mode );
         if( 0 <= tmp ) {
             handle = tmp;
-            SharedSection::lock( handle, MARK_OFFSET, 1024 ); // отметка используемого файла
+            SharedSection::lock( handle, MARK_OFFSET, MARK_SIZE ); // отметка используемого файла
+            SharedSection::lock( handle, LEGACY_MARK_OFFSET, MARK_SIZE );
             return true;
         }
     }
     return false;
 }
 
+void BaseFile::releaseLegacyMark()
+{
+    SharedSection::unlock( handle, LEGACY_MARK_OFFSET, MARK_SIZE );
+}
+
 void BaseFile::close()
 {
     ::close( handle );
@@ -152,13 +169,13 @@ bool BaseFile::safeRemove(const std::wstring& path)
         FileId tmp = open( pp.string().c_str(), O_RDWR );
         if( 0 <= tmp )
         {
-            if ( OwnSection::trylock( tmp, MARK_OFFSET, 1024 ) ) // проверка отсутствия читателей на файле
+            // проверка отсутствия читателей на файле, в том числе прежних версий
+            const bool unused = OwnSection::trylock( tmp, MARK_OFFSET, MARK_SIZE )
+                && OwnSection::trylock( tmp, LEGACY_MARK_OFFSET, MARK_SIZE );
+            if ( 0 == ::close( tmp ) && unused )
             {
-                if ( 0 == ::close( tmp ) )
-                {
-                    if ( boost::filesystem::remove( path, ec ) )
-                        return true;
-                }
+                if ( boost::filesystem::remove( path, ec ) )
+                    return true;
             }
         }
     }
@@ -171,9 +188,10 @@ bool BaseFile::safeRemove(const std::wstring& path)
 
 FileWriter::FileWriter(const Bbx::Location& bbx_location, unsigned page_size)
     :BaseFile(), location(bbx_location), 
-    page(), lastWroteWasReference(false),
+    page(), captions(), lastWroteWasReference(false),
     maximumFileSizeBytes(c_DefaultMaxFileSize),
-    bytesWritten(0), messagesWritten(), startTime(0)
+    bytesWritten(0), messagesWritten(), typeBytesWritten(), firstSequence(0), lastSequence(0), firstRecordSize(0),
+    startTime(0), timeZone(), pageChecksums(false), commitCounters(false)
 {
     header.setPageSize(page_size);
 }
@@ -181,8 +199,9 @@ FileWriter::FileWriter(const Bbx::Location& bbx_location, unsigned page_size)
 FileWriter::~FileWriter()
 {
     if (isOpened()) {
-        OwnSection headerLock(getHandle(), 0, sizeof(FileHeader));
+        OwnSection headerLock(getHandle(), 0, sizeof(FileHeader), !commitCounters);
         page.update(getHandle());
+        writeSummary();
         headerLock.write(Buffer::create(header));
     }
 }
@@ -190,7 +209,7 @@ FileWriter::~FileWriter()
 void FileWriter::update(bool force)
 {
     if (isOpened() && (force || page.needsUpdate())) {
-        OwnSection headerLocked(getHandle(), 0, sizeof(FileHeader));
+        OwnSection headerLocked(getHandle(), 0, sizeof(FileHeader), !commitCounters);
         page.update(getHandle());
         headerLocked.write(Buffer::create(header));
 #ifndef LINUX
@@ -202,25 +221,56 @@ void FileWriter::update(bool force)
     }
 }
 
+boost::posix_time::ptime FileWriter::updateDeadline() const
+{
+    return isOpened() ? page.updateDeadline() : boost::posix_time::ptime();
+}
+
 std::string FileWriter::generateExtensionZone() const
 {
     Extension extension;
     extension.setActualVersion();
     extension.setTimeZone( timeZone );
+    extension.setCaptionZoneSize( getCaptionZoneSize() );
+    extension.setIndexOffset( getSummaryOffset() );
+    extension.setFlags( Extension::c_FlagSequenced
+        | (getCaptionZoneSize() ? Extension::c_FlagCaptions : 0u)
+        | (pageChecksums ? Extension::c_FlagPageChecksums : 0u)
+        | (commitCounters ? Extension::c_FlagCommitCounters : 0u) );
     return extension.serialize();
 }
 
+unsigned FileWriter::getCaptionZoneSize() const
+{
+    // словарь не должен заметно увеличивать маленькие файлы
+    unsigned zoneSize = unsigned(std::min<BBX_SIZE>(c_DefaultCaptionZoneSize, maximumFileSizeBytes / 32));
+    return (zoneSize >= c_MinimumCaptionZoneSize) ? zoneSize : 0;
+}
+
 bool FileWriter::create(const Bbx::Stamp& stamp)
 {
     for( unsigned attempt = 0; attempt<100; ++attempt ) {
         if (safeOpen_ModeWrite( location.filePath( stamp, attempt ) ) ) {
+            releaseLegacyMark(); // файл текущей версии
             startTime = stamp.getTime();
+            // Зона расширения: двоичный блок, итоги файла и заполненная нулями зона словаря заголовков
+            unsigned captionZoneSize = getCaptionZoneSize();
             std::string extensionString = generateExtensionZone();
+            extensionString.append(sizeof(FileSummary) + captionZoneSize, '\0');
             Bbx::Buffer extensionBuffer = Bbx::Buffer(extensionString);
             header.setExtensionSize(extensionBuffer.size);
 
             page.setAddress(FileAddress(header.getHeaderSize(), header.getPageSize()));
+            captions.reset(FileAddress(header.getHeaderSize() - captionZoneSize, captionZoneSize));
 
+            if (commitCounters)
+            {
+                // читатель без блокировок должен застать зону расширения уже записанной
+                writeExtensionZone(extensionBuffer);
+                OwnSection headerSection(getHandle(), 0, sizeof(FileHeader), false);
+                headerSection.write(Bbx::Buffer::create(header));
+                return true;
+            }
             OwnSection headerLock(getHandle(), 0, sizeof(FileHeader));
             headerLock.write(Bbx::Buffer::create(header));
             writeExtensionZone(extensionBuffer);
@@ -233,16 +283,50 @@ bool FileWriter::create(const Bbx::Stamp& stamp)
 
 bool FileWriter::writeExtensionZone(const Bbx::Buffer& extensionData)
 {
-    OwnSection extensionSection(getHandle(), sizeof(FileHeader), extensionData.size);
+    OwnSection extensionSection(getHandle(), sizeof(FileHeader), extensionData.size, !commitCounters);
     return extensionSection.write(extensionData);
 }
 
+BBX_SIZE FileWriter::getSummaryOffset()
+{
+    return sizeof(FileHeader) + sizeof(ExtensionBlock);
+}
+
+bool FileWriter::writeSummary()
+{
+    FileSummary summary;
+    memset(&summary, 0, sizeof(summary));
+    summary.blockSize = sizeof(summary);
+    summary.firstSequence = firstSequence;
+    summary.lastSequence = lastSequence;
+    summary.firstRecordSize = firstRecordSize;
+    for (const auto& written : messagesWritten)
+    {
+        size_t index = TimelineBucket::typeIndex(written.first);
+        if (index < c_RecordTypesCount)
+            summary.counts[index] = written.second;
+    }
+    for (const auto& written : typeBytesWritten)
+    {
+        size_t index = TimelineBucket::typeIndex(written.first);
+        if (index < c_RecordTypesCount)
+            summary.bytes[index] = written.second;
+    }
+
+    /* Сигнатура пишется последней: читатель без блокировок не примет недописанные итоги */
+    OwnSection summarySection(getHandle(), getSummaryOffset(), sizeof(summary), !commitCounters);
+    if (!summarySection.write(Bbx::Buffer::create(summary)))
+        return false;
+    memcpy(summary.magic, c_SummaryMagic, sizeof(c_SummaryMagic));
+    return summarySection.write(Bbx::Buffer(summary.magic, sizeof(summary.magic)));
+}
+
 bool FileWriter::processMessageIntoPages(RecordOut& record)
 {
     header.setLastRecordTime(record.getStamp().getTime());
 
     if (page.willWriteToFile(record)) {
-        OwnSection headerLock(getHandle(), 0, sizeof(FileHeader));
+        OwnSection headerLock(getHandle(), 0, sizeof(FileHeader), !commitCounters);
         page.processRecord(getHandle(), record);
         return headerLock.write(Bbx::Buffer::create(header));
     } else {
@@ -264,18 +348,33 @@ bool FileWriter::writeRecord(RecordOut& msg)
             return false;
     }
 
+    encodeCaption(msg);
     if (processMessageIntoPages(msg)) {
-        registerDataRecord(msg.getType(), msg.getSize());
+        registerDataRecord(msg.getType(), msg.getSize(), msg.getSequence());
         return true;
     } else {
         return false;
     }
 }
 
-void FileWriter::registerDataRecord(Bbx::RecordType type, unsigned bytes)
+void FileWriter::encodeCaption(RecordOut& record)
+{
+    unsigned reference = 0;
+    if (record.untouched() && captions.encode(getHandle(), record.getCaption(), reference))
+        record.setCaptionReference(reference);
+}
+
+void FileWriter::registerDataRecord(Bbx::RecordType type, unsigned bytes, uint64_t sequence)
 {
+    if (messagesWritten.empty())
+    {
+        firstSequence = sequence;
+        firstRecordSize = bytes;
+    }
+    lastSequence = sequence;
     lastWroteWasReference = (Bbx::RecordType::Reference == type);
     bytesWritten += bytes;
+    typeBytesWritten[type] += bytes;
     ++messagesWritten[type];
 }
 
@@ -293,15 +392,19 @@ bool FileWriter::exceedFileAge(const Bbx::Stamp& stampWrite) const
     }
 }
 
-Bbx::Impl::SectionLocker::SectionLocker( bool Exclusive, const FileId& file, unsigned long offset, unsigned size ) : address( offset, size ), handle( file ), locked( false )
+Bbx::Impl::SectionLocker::SectionLocker( bool Exclusive, const FileId& file, BBX_SIZE offset, unsigned size, bool withLock )
+    : address( offset, size ), handle( file ), locked( !withLock ), ownsLock( withLock )
 {
-    locked = lock( Exclusive, handle, address.offset, address.size );
-    ASSERT( locked && "Locking always works!" );
+    if( ownsLock )
+    {
+        locked = lock( Exclusive, handle, address.offset, address.size );
+        ASSERT( locked && "Locking always works!" );
+    }
 }
 
 Bbx::Impl::SectionLocker::~SectionLocker()
 {
-    if( locked )
+    if( locked && ownsLock )
         unlock( handle, address.offset, address.size );
 }
 
@@ -309,7 +412,7 @@ Bbx::Impl::SectionLocker::~SectionLocker()
 bool Bbx::Impl::SectionLocker::read( Buffer buf ) const
 {
     ASSERT( buf.size <= address.size && "читать можно только в пределах блокированной зоны!" );
-    BBX_SIZE bytesRead = 0;
+    DWORD bytesRead = 0;
     return locked && setPointer()
         && ( 0 != ReadFile( handle, reinterpret_cast<void*>( buf.data_ptr ), buf.size, &bytesRead, NULL ) )
         && ( buf.size == bytesRead );
@@ -318,7 +421,7 @@ bool Bbx::Impl::SectionLocker::read( Buffer buf ) const
 bool Bbx::Impl::SectionLocker::write( const Buffer& data ) const
 {
     ASSERT( data.size <= address.size && "писать можно только в пределах блокированной зоны!" );
-    BBX_SIZE bytesWritten = 0;
+    DWORD bytesWritten = 0;
     return locked && setPointer()
         && ( 0 != WriteFile( handle, data.data_ptr, data.size, &bytesWritten, NULL ) )
         && ( data.size == bytesWritten );
@@ -328,9 +431,10 @@ bool Bbx::Impl::SectionLocker::lock(bool Exclusive, FileId fd, BBX_SIZE offset,
 {
     OVERLAPPED settings;
     memset(&settings, 0, sizeof(OVERLAPPED));
-    settings.Offset = offset;
-    BBX_SIZE flags = (Exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0);
-    bool res = 0 != LockFileEx( fd, flags, 0, size, 0, &settings);
+    settings.Offset = DWORD(offset);
+    settings.OffsetHigh = DWORD(offset >> 32);
+    DWORD flags = (Exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0);
+    bool res = 0 != LockFileEx( fd, flags, 0, DWORD(size), DWORD(size >> 32), &settings);
     ASSERT( res && "Locking always works!" );
     return res;
 }
@@ -339,13 +443,16 @@ void Bbx::Impl::SectionLocker::unlock( FileId fd, BBX_SIZE offset, BBX_SIZE size
 {
     OVERLAPPED settings;
     memset(&settings, 0, sizeof(OVERLAPPED));
-    settings.Offset = offset;
-    UnlockFileEx( fd, 0, size, 0, &settings);
+    settings.Offset = DWORD(offset);
+    settings.OffsetHigh = DWORD(offset >> 32);
+    UnlockFileEx( fd, 0, DWORD(size), DWORD(size >> 32), &settings);
 }
 
 bool Bbx::Impl::SectionLocker::setPointer() const
 {
-    return INVALID_SET_FILE_POINTER != SetFilePointer( handle, address.offset, NULL, FILE_BEGIN );
+    LARGE_INTEGER distance;
+    distance.QuadPart = LONGLONG(address.offset);
+    return 0 != SetFilePointerEx( handle, distance, NULL, FILE_BEGIN );
 }
 
 #else
@@ -354,16 +461,14 @@ bool Bbx::Impl::SectionLocker::read( Buffer buf ) const
 {
     ASSERT( buf.size <= address.size && "читать можно только в пределах блокированной зоны!" );
     return locked
-        && setPointer()
-        && buf.size == ::read( handle, reinterpret_cast<void*>( buf.data_ptr ), buf.size );
+        && ssize_t( buf.size ) == ::pread( handle, reinterpret_cast<void*>( buf.data_ptr ), buf.size, off_t( address.offset ) );
 }
 
 bool Bbx::Impl::SectionLocker::write( const Buffer& data ) const
 {
     ASSERT( data.size <= address.size && "писать можно только в пределах блокированной зоны!" );
     return locked
-        && setPointer()
-        && data.size == ::write( handle, data.data_ptr, data.size );
+        && ssize_t( data.size ) == ::pwrite( handle, data.data_ptr, data.size, off_t( address.offset ) );
 }
 
 bool Bbx::Impl::SectionLocker::lock( bool Exclusive, FileId fd, BBX_SIZE offset, BBX_SIZE size )
@@ -409,10 +514,6 @@ void Bbx::Impl::SectionLocker::unlock( FileId fd, BBX_SIZE offset, BBX_SIZE size
     ASSERT( res && "Unlocking always works!" );
 }
 
-bool Bbx::Impl::SectionLocker::setPointer() const
-{
-    return EINVAL != lseek( handle, address.offset, SEEK_SET );
-}
 
 bool Bbx::Impl::SharedSection::trylock( FileId fd, BBX_SIZE offset, BBX_SIZE size )
 {
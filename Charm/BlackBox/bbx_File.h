@@ -3,6 +3,7 @@
 #include "bbx_BlackBox.h"
 #include "bbx_Page.h"
 #include "bbx_Record.h"
+#include "bbx_Caption.h"
 
 
 namespace Bbx
@@ -55,6 +56,9 @@ namespace Bbx
             void swap( BaseFile& other );
             bool safeOpen_ModeRead (const std::wstring& path);
             bool safeOpen_ModeWrite(const std::wstring& path);
+            /** @brief Снять маркировку используемого файла по смещению до версии 3.0 (linux);
+                вызывается, когда известно, что версия файла не ниже 3.0 */
+            void releaseLegacyMark();
             void close();
             FileId getHandle() const
             {
@@ -75,39 +79,59 @@ namespace Bbx
             ~FileWriter();
 
             void update(bool force);
+            /** @brief Момент, когда update(false) сбросит накопленные данные */
+            boost::posix_time::ptime updateDeadline() const;
             bool writeRecord(RecordOut& msg);
             bool timeToCloseTheFile(const Stamp& stamp) const;
             bool readyToBeClosed() const;
-            void setRecomendedFileSize(unsigned fileSize);
+            void setRecomendedFileSize(BBX_SIZE fileSize);
             void setTimeZone( std::string textTZ );
+            void setPageChecksums(bool enable);
+            /** @brief Публиковать страницы счётчиками фиксации вместо блокировок участков файла */
+            void setCommitCounters(bool enable);
             std::tuple<unsigned, unsigned, unsigned, unsigned> getWrittenMessagesCounts() const;
 
         private:
             Location location;
             PageWriter page;
+            CaptionDictionary captions;
             bool lastWroteWasReference;
-            unsigned maximumFileSizeBytes;
-            unsigned bytesWritten;
+            BBX_SIZE maximumFileSizeBytes;
+            BBX_SIZE bytesWritten;
             std::map<RecordType, unsigned> messagesWritten;
+            std::map<RecordType, BBX_SIZE> typeBytesWritten;
+            uint64_t firstSequence;
+            uint64_t lastSequence;
+            unsigned firstRecordSize;
             time_t startTime;
             std::string timeZone;
+            bool pageChecksums;
+            bool commitCounters;
 
             std::string generateExtensionZone() const;
+            unsigned getCaptionZoneSize() const;
             unsigned getReferenceMessagesCount() const;
             unsigned getMessagesCount(RecordType recordType) const;
             bool create(const Stamp& stamp);
             bool writeExtensionZone(const Bbx::Buffer& extensionData);
-            void registerDataRecord(RecordType type, unsigned bytes);
+            /** @brief Смещение итогов файла: сразу за двоичным блоком зоны расширения */
+            static BBX_SIZE getSummaryOffset();
+            /** @brief Заполнение итогов файла при закрытии */
+            bool writeSummary();
+            void encodeCaption(RecordOut& record);
+            void registerDataRecord(RecordType type, unsigned bytes, uint64_t sequence);
             bool exceedFileAge(const Stamp& stampWrite) const;
             bool exceedFileSize() const;
             bool processMessageIntoPages(RecordOut& record);
         };
 
-        /** @brief Класс блокирует участок файла и перемещает курсор на его начало */
+        /** @brief Класс блокирует участок файла и перемещает курсор на его начало.
+        Без блокировки (withLock = false) только ограничивает чтение и запись участком: так работают
+        с файлами со счётчиками фиксации страниц, где согласованность обеспечивает сам формат */
         class SectionLocker : boost::noncopyable
         {
         public:
-			SectionLocker(bool Exclusive, const FileId& file, BBX_SIZE offset, unsigned size);
+			SectionLocker(bool Exclusive, const FileId& file, BBX_SIZE offset, unsigned size, bool withLock = true);
             ~SectionLocker();
 
             /** @brief Блокирующее чтение из заблокированной зоны файла в буфер
@@ -131,15 +155,18 @@ namespace Bbx
             FileAddress address;
 			FileId handle;
             bool locked;
+            bool ownsLock;
 
+#ifndef LINUX
             bool setPointer() const;
+#endif
         };
 
         class SharedSection : public SectionLocker
         {
         public:
-			SharedSection(const FileId& file, BBX_SIZE offset, unsigned size)
-                : SectionLocker(false, file, offset, size)
+			SharedSection(const FileId& file, BBX_SIZE offset, unsigned size, bool withLock = true)
+                : SectionLocker(false, file, offset, size, withLock)
             {}
 #ifdef LINUX
             static bool trylock(FileId fd, BBX_SIZE offset, BBX_SIZE size );
@@ -151,8 +178,8 @@ namespace Bbx
         class OwnSection : public SectionLocker
         {
         public:
-			OwnSection(const FileId& file, BBX_SIZE offset, unsigned size)
-                : SectionLocker(true, file, offset, size)
+			OwnSection(const FileId& file, BBX_SIZE offset, unsigned size, bool withLock = true)
+                : SectionLocker(true, file, offset, size, withLock)
             {}
 #ifdef LINUX
             static bool trylock(FileId fd, BBX_SIZE offset, BBX_SIZE size );
@@ -233,7 +260,7 @@ namespace Bbx
             return readyToBeClosed() && (maximumFileAgeReached || maximumFileSizeReached);
         }
 
-        inline void FileWriter::setRecomendedFileSize(unsigned fileSize)
+        inline void FileWriter::setRecomendedFileSize(BBX_SIZE fileSize)
         {
             maximumFileSizeBytes = fileSize;
         }
@@ -243,6 +270,19 @@ namespace Bbx
             timeZone = textTZ;
         }
 
+        inline void FileWriter::setPageChecksums(bool enable)
+        {
+            pageChecksums = enable;
+            page.setChecksums(enable);
+        }
+
+        inline void FileWriter::setCommitCounters(bool enable)
+        {
+            commitCounters = enable;
+            page.setCommitCounters(enable);
+            captions.setLockless(enable);
+        }
+
         inline bool FileWriter::exceedFileSize() const
         {
             return (bytesWritten >= maximumFileSizeBytes);
@@ -22,7 +22,6 @@ Bbx::FileChain::FileChain( const std::wstring& directory, const std::wstring& fi
 
 	auto packer = [ this ]( const FilesByMask_Data& fileFindData )
     {
-        ASSERT( fileFindData.fsize < UINT32_MAX && "Ошибка - нарушено ограничение 4Gb");
         m_fileAndSize.emplace_back( fileFindData.fname.to_string(), fileFindData.fsize );
         return true;
     };
@@ -100,6 +99,18 @@ bool Bbx::FileChain::empty() const
     return m_fileAndSize.empty();
 }
 
+// получить полные пути всех файлов цепи не меньше указанного размера
+std::vector<std::wstring> Bbx::FileChain::getFiles( size_t minFileSize ) const
+{
+    std::vector<std::wstring> result;
+    for( const NameAndSize& nas : m_fileAndSize )
+    {
+        if ( nas.size >= minFileSize )
+            result.push_back( addDirectory( nas.name ) );
+    }
+    return result;
+}
+
 std::vector<std::wstring> Bbx::FileChain::filesAroundRange(
     const std::wstring& firstFileName, const std::wstring& lastFileName, size_t minFileSize ) const
 {
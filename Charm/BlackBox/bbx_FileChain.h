@@ -18,6 +18,7 @@ namespace Bbx
         FILE_SIZE getTotalSize() const;
         
         bool empty() const;
+        std::vector<std::wstring> getFiles( size_t minFileSize ) const;
         std::vector<std::wstring> filesAroundRange(
             const std::wstring& firstFileName,
             const std::wstring& lastFileName,
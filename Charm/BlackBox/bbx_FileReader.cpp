@@ -1,12 +1,17 @@
 ﻿#include "stdafx.h"
 
 #include "bbx_FileReader.h"
-#include "bbx_Extension.h"
 
 using namespace Bbx::Impl;
 
+namespace
+{
+    /** @brief Попыток согласованно прочитать заголовок файла, обновляемый писателем без блокировки */
+    const unsigned c_HeaderReadAttempts = 100;
+}
+
 FileReader::FileReader()
-: BaseFile(), path(), cursor(), currentPage()
+: BaseFile(), path(), cursor(), cursorStamp(), currentPage(), captions(), extension(), pageStates()
 {
 }
 
@@ -15,10 +20,35 @@ void FileReader::swap(FileReader& other)
     BaseFile::swap(other);
     std::swap(path, other.path);
     std::swap(cursor, other.cursor);
+    std::swap(cursorStamp, other.cursorStamp);
     std::swap(currentPage, other.currentPage);
+    std::swap(captions, other.captions);
+    std::swap(extension, other.extension);
+    std::swap(pageStates, other.pageStates);
     ASSERT( !path.empty() );
 }
 
+bool FileReader::fork(FileReader& target) const
+{
+    /* Файл открывается заново, а не дублированием дескриптора: у копии должны быть свои
+       блокировки участков и (в Windows) своя позиция в файле */
+    FileReader copy;
+    if (!copy.safeOpen_ModeRead(path))
+        return false;
+    if (!legacyMarked())
+        copy.releaseLegacyMark();
+    copy.header = header;
+    copy.path = path;
+    copy.cursor = cursor;
+    copy.cursorStamp = cursorStamp;
+    copy.currentPage = currentPage;
+    copy.captions = captions;
+    copy.extension = extension;
+    copy.pageStates = pageStates;
+    target.swap(copy);
+    return true;
+}
+
 Bbx::ReadResult FileReader::unsafeOpenFileAndReadHeader(const std::wstring& filePath)
 {
     if (isOpened())
@@ -35,11 +65,16 @@ Bbx::ReadResult FileReader::unsafeOpenFileAndReadHeader(const std::wstring& file
     if (safeOpen_ModeRead(path))
     {
         cursor = Cursor();
+        cursorStamp = Stamp();
         currentPage = PageReader();
+        pageStates.clear();
         if (readHeader())
         {
             if (readAndVerifyVersion())
             {
+                if (!legacyMarked())
+                    releaseLegacyMark();
+                currentPage = PageReader(commitCounters());
                 return currentPage.read(getHandle(), *begin()) ? Bbx::ReadResult::Success : Bbx::ReadResult::PageRead;
             }
             else
@@ -83,6 +118,7 @@ ReadFileInfo FileReader::getFileInfo( const std::wstring& filePath )
         info.startTime = fReader.startsFrom();
         info.endTime   = fReader.endsWith();
         info.fileSize  = fReader.readFileSize();
+        info.firstSequence = fReader.firstSequence();
     }
     return info;
 }
@@ -90,7 +126,7 @@ ReadFileInfo FileReader::getFileInfo( const std::wstring& filePath )
 class PageContainsRef
 {
 public:
-    explicit PageContainsRef(const FileId& handle) : pr(), file(handle) {}
+    PageContainsRef(const FileId& handle, bool commitCounters) : pr(commitCounters), file(handle) {}
     bool operator()(const FileAddress& addr)
     {
         if (!pr.read(file, addr))
@@ -107,7 +143,7 @@ private:
 class PageContainsAnyRecordStart
 {
 public:
-    explicit PageContainsAnyRecordStart(const FileId& handle) : pr(), file(handle) {}
+    PageContainsAnyRecordStart(const FileId& handle, bool commitCounters) : pr(commitCounters), file(handle) {}
     bool operator()(const FileAddress& addr)
     {
         if (!pr.read(file, addr))
@@ -159,6 +195,7 @@ Bbx::ReadResult FileReader::setPart(PageReader& pr, size_t partIndex)
     if (pr[partIndex].header.containsBeginning())
     {
         cursor.part = partIndex;
+        cursorStamp = readPreciseStamp(pr, partIndex);
         return ReadResult::Success;
     }
     else
@@ -210,10 +247,10 @@ Bbx::ReadResult FileReader::setFollowingPage(const Bbx::Stamp& oldStamp, bool no
        надо знать текущий размер файла */
     readHeader();
 
-    PageReader pr;
+    PageReader pr(commitCounters());
     size_t newPageIndex = 0;
     page_iterator theEnd = end();
-    for (page_iterator pageIt = begin() + (int)cursor.page + 1; pageIt != theEnd; ++pageIt)
+    for (page_iterator pageIt = begin() + (page_iterator::difference_type)cursor.page + 1; pageIt != theEnd; ++pageIt)
     {
         if (!pr.read(getHandle(), *pageIt))
         {
@@ -221,7 +258,8 @@ Bbx::ReadResult FileReader::setFollowingPage(const Bbx::Stamp& oldStamp, bool no
             return Bbx::ReadResult::ReadingPageHeader;
         }
 
-        if (pr.getFirstRecord(newPageIndex))
+        /* Повреждённая страница пропускается */
+        if (pageIntact(pageIt, pr) && pr.getFirstRecord(newPageIndex))
         {
             Bbx::ReadResult partSetResult = setPartWithMoreThanTimeCheck(pr, newPageIndex, oldStamp, normalSequence);
             if (partSetResult)
@@ -239,10 +277,10 @@ Bbx::ReadResult FileReader::setPrecedePage(const Bbx::Stamp& oldStamp, bool norm
     if (!isOpened())
         return Bbx::ReadResult::NoFileOpened;
 
-    PageReader pr;
+    PageReader pr(commitCounters());
     size_t newPageIndex = 0;
 
-    for (reverse_page_iterator revPageIt = reverse_page_iterator(begin() + (int)cursor.page); revPageIt != rend(); ++revPageIt)
+    for (reverse_page_iterator revPageIt = reverse_page_iterator(begin() + (page_iterator::difference_type)cursor.page); revPageIt != rend(); ++revPageIt)
     {
         if (!pr.read(getHandle(), *(revPageIt.base() - 1)))
         {
@@ -250,7 +288,8 @@ Bbx::ReadResult FileReader::setPrecedePage(const Bbx::Stamp& oldStamp, bool norm
             return Bbx::ReadResult::ReadingPageHeader;
         }
 
-        if (pr.getLastRecord(newPageIndex))
+        /* Повреждённая страница пропускается */
+        if (pageIntact(revPageIt.base() - 1, pr) && pr.getLastRecord(newPageIndex))
         {
             Bbx::ReadResult partSetResult = setPartWithLessThanTimeCheck(pr, newPageIndex, oldStamp, normalSequence);
             if (partSetResult)
@@ -266,7 +305,7 @@ Bbx::ReadResult FileReader::setPrecedePage(const Bbx::Stamp& oldStamp, bool norm
 class PageStampsLesser
 {
 public:
-	explicit PageStampsLesser(const FileId& handle) : pr(), file(handle) {}
+	PageStampsLesser(const FileId& handle, bool commitCounters) : pr(commitCounters), file(handle) {}
     bool operator()(const FileAddress& addr, const Bbx::Stamp& stamp)
     {
         pr.read(file, addr);
@@ -291,13 +330,13 @@ bool FileReader::isReferenceSearchBetter(const Bbx::Stamp& desiredStamp) const
     ASSERT(isOpened());
 
     /* Обнаружение ближайшей к временному штампу страницы */
-    PageStampsLesser lowerComp(getHandle());
+    PageStampsLesser lowerComp(getHandle(), commitCounters());
     page_iterator foundPageIter = std::lower_bound(begin(), end(), desiredStamp, lowerComp);
     if (end() == foundPageIter)
         --foundPageIter;
 
     FileAddress desired = *foundPageIter;
-    FileAddress current = begin()[(int)cursor.page];
+    FileAddress current = begin()[(page_iterator::difference_type)cursor.page];
     if ( desired < current )
         std::swap( desired, current ); // далее только увеличение от current к desired 
 
@@ -307,7 +346,7 @@ bool FileReader::isReferenceSearchBetter(const Bbx::Stamp& desiredStamp) const
     // (поскольку инкрементные данные содержат двойное состояние - старое+новое).
     // P.S. Суммируем только промежуточные страницы.
     bool suggestReference = false;
-    size_t distanceInPages = (desired.offset - current.offset) / current.size;
+    BBX_SIZE distanceInPages = (desired.offset - current.offset) / current.size;
     if ( distanceInPages <= 1 )
         suggestReference = false; // на соседних страницах - сразу имеем ответ
     else
@@ -318,7 +357,7 @@ bool FileReader::isReferenceSearchBetter(const Bbx::Stamp& desiredStamp) const
         page_iterator inter( current.offset, current.size );
         for( ++inter; *inter < desired && !suggestReference; ++inter )
         {
-            PageReader pr;
+            PageReader pr(commitCounters());
             pr.read( getHandle(), *inter );
             for( size_t i=0; i < pr.getPartsNumber(); ++i )
             {
@@ -351,7 +390,7 @@ bool FileReader::rewindToStamp(const Bbx::Stamp& where)
 {
     ASSERT(isOpened());
     /* Обнаружение ближайшей к временному штампу страницы */
-    PageStampsLesser lowerComp(getHandle());
+    PageStampsLesser lowerComp(getHandle(), commitCounters());
     page_iterator itBegin = begin();
     page_iterator itEnd = end();
     ASSERT(itEnd != itBegin);
@@ -360,7 +399,7 @@ bool FileReader::rewindToStamp(const Bbx::Stamp& where)
         --itBoundPage;
 
     /* Поиск ближайших страниц с опорными записями в обоих направлениях */
-    PageContainsRef comparer(getHandle());
+    PageContainsRef comparer(getHandle(), commitCounters());
     page_iterator itForwardResult = std::find_if(itBoundPage, itEnd, comparer);
     page_iterator itBackwardResult = 
         itBegin == itBoundPage ? itBegin : back_find_if(itBoundPage - 1, itBegin, comparer);
@@ -379,7 +418,7 @@ bool FileReader::rewindToStampAnyRecordType(const Bbx::Stamp& where)
 {
     ASSERT(isOpened());
         /* Обнаружение ближайшей к временному штампу страницы */
-    PageStampsLesser lowerComp(getHandle());
+    PageStampsLesser lowerComp(getHandle(), commitCounters());
     page_iterator itBegin = begin();
     page_iterator itEnd = end();
     ASSERT(itEnd != itBegin);
@@ -388,7 +427,7 @@ bool FileReader::rewindToStampAnyRecordType(const Bbx::Stamp& where)
         --itBoundPage;
 
     /* Поиск ближайших страниц с любыми записями в обоих направлениях */
-    PageContainsAnyRecordStart comparer(getHandle());
+    PageContainsAnyRecordStart comparer(getHandle(), commitCounters());
     //page_iterator itForwardResult = std::find_if(itBoundPage, itEnd, comparer);
     page_iterator itBackwardResult = 
         itBegin == itBoundPage ? itBegin : back_find_if(itBoundPage - 1, itBegin, comparer);
@@ -410,12 +449,19 @@ Bbx::ReadResult FileReader::rewindToCursor(const FileReader::Cursor& targetCurso
     {
         return setPart(currentPage, targetCursor.part);
     }
+    else if (targetCursor.page >= getPagesCount())
+    {
+        // Курсор из другого файла или файл усечён
+        return ReadResult::PageNotFound;
+    }
     else
     {
-        page_iterator itPage = begin() + (int)targetCursor.page;
-        PageReader pr;
+        page_iterator itPage = begin() + (page_iterator::difference_type)targetCursor.page;
+        PageReader pr(commitCounters());
         if (pr.read(getHandle(), *itPage))
         {
+            if (pr.getPartsNumber() <= targetCursor.part)
+                return ReadResult::PageNotFound;
             setPage(pr, itPage);
             ASSERT(this->cursor.page == targetCursor.page);
 
@@ -443,7 +489,7 @@ bool FileReader::rewindToExtreme(bool toStart)
     }
     else
     {
-        PageReader pr;
+        PageReader pr(commitCounters());
         size_t recIndex = 0;
         for (reverse_page_iterator rPageIt = rbegin(), rEnd = rend(); rPageIt != rEnd; ++rPageIt)
         {
@@ -457,6 +503,65 @@ bool FileReader::rewindToExtreme(bool toStart)
     }
 }
 
+class PageSequenceGreater
+{
+public:
+    PageSequenceGreater(const FileId& handle, bool commitCounters) : pr(commitCounters), file(handle) {}
+    bool operator()(uint64_t sequence, const FileAddress& addr)
+    {
+        /* Страницы без номера (недописанные) считаются лежащими после искомой записи */
+        if (!pr.read(file, addr) || !pr.getSequence())
+            return true;
+        return sequence < pr.getSequence();
+    }
+private:
+    PageReader pr;
+    FileId file;
+};
+
+bool FileReader::rewindToSequence(uint64_t sequence)
+{
+    ASSERT(isOpened());
+    if (!sequence || !fileSizeIsEnoughToRead())
+        return false;
+
+    /* Страница, на которой лежит кусочек записи с искомым номером */
+    page_iterator itBegin = begin();
+    page_iterator itPage = std::upper_bound(itBegin, end(), sequence, PageSequenceGreater(getHandle(), commitCounters()));
+    if (itBegin == itPage)
+        return false;
+    --itPage;
+
+    PageReader pr(commitCounters());
+    if (!pr.read(getHandle(), *itPage) || !pr.getSequence())
+        return false;
+    uint64_t partIndex = sequence - pr.getSequence();
+    if (partIndex >= pr.getPartsNumber())
+        return false;
+
+    if (pr[size_t(partIndex)].header.containsBeginning())
+    {
+        setPage(pr, itPage);
+        return setPart(currentPage, size_t(partIndex)) ? true : false;
+    }
+
+    /* Первый кусочек страницы - продолжение записи, её начало последнее на одной из предыдущих страниц */
+    ASSERT(0 == partIndex);
+    size_t recIndex = 0;
+    while (itBegin != itPage)
+    {
+        --itPage;
+        if (!pr.read(getHandle(), *itPage))
+            return false;
+        if (pr.getLastRecord(recIndex))
+        {
+            setPage(pr, itPage);
+            return setPart(currentPage, recIndex) ? true : false;
+        }
+    }
+    return false;
+}
+
 void FileReader::update()
 {
     ASSERT(isOpened());
@@ -467,72 +572,85 @@ void FileReader::update()
 bool FileReader::readHeader()
 {
     ASSERT(isOpened());
-    SharedSection headerLocked(getHandle(), 0, sizeof(FileHeader));
-    return (headerLocked.read(Bbx::Buffer::create(header)));
+    if (!commitCounters())
+    {
+        SharedSection headerLocked(getHandle(), 0, sizeof(FileHeader));
+        return (headerLocked.read(Bbx::Buffer::create(header)));
+    }
+
+    /* Писатель обновляет заголовок без блокировки: он принимается, если два чтения подряд совпали */
+    SharedSection headerSection(getHandle(), 0, sizeof(FileHeader), false);
+    FileHeader first, second;
+    for (unsigned attempt = 0; attempt < c_HeaderReadAttempts; ++attempt)
+    {
+        if (!headerSection.read(Bbx::Buffer::create(first)) || !headerSection.read(Bbx::Buffer::create(second)))
+            return false;
+        if (0 == memcmp(&first, &second, sizeof(FileHeader)))
+        {
+            header = first;
+            return true;
+        }
+    }
+    return false;
 }
 
 bool FileReader::readAndVerifyVersion()
 {
-    std::vector<char> extensionVec(header.getExtensionSize());
+    /* Сначала считывается только двоичный блок, вся зона нужна лишь для разбора XML прежних версий */
+    std::vector<char> extensionVec(std::min<size_t>(header.getExtensionSize(), sizeof(ExtensionBlock)));
     Bbx::Buffer extensionBuffer(extensionVec);
-    if (readExtensionZone(extensionBuffer))
+    if (!readExtensionZone(extensionBuffer))
+        return false;
+    if (!Extension::isBinary(extensionBuffer))
     {
-        Extension extension;
-        if ( extension.load(extensionBuffer) )
-        {
-            return extension.getVersion().isSupported();
-        }
-        else
-        {
+        extensionVec.resize(header.getExtensionSize());
+        extensionBuffer = Bbx::Buffer(extensionVec);
+        if (!readExtensionZone(extensionBuffer))
             return false;
-        }
     }
-    else
-    {
+
+    if ( !extension.load(extensionBuffer) )
         return false;
-    }
+
+    unsigned captionZoneSize = extension.getCaptionZoneSize();
+    if ( captionZoneSize > header.getExtensionSize() )
+        return false;
+    captions.reset(FileAddress(header.getHeaderSize() - captionZoneSize, captionZoneSize));
+    captions.setLockless(commitCounters());
+    return extension.getVersion().isSupported();
 }
 
 bool FileReader::readExtensionZone(Bbx::Buffer& buf) const
 {
     ASSERT(isOpened());
-    unsigned extSize = header.getExtensionSize();
-    if (extSize && buf.size >= extSize && buf.data_ptr)
+    /* Считывается начало зоны расширения размером с буфер */
+    if (buf.size && buf.size <= header.getExtensionSize() && buf.data_ptr)
     {
-        SharedSection extLocked(getHandle(), sizeof(FileHeader), extSize);
+        SharedSection extLocked(getHandle(), sizeof(FileHeader), buf.size);
         return (extLocked.read(buf));
     }
     else
         return false;
 }
 
-size_t FileReader::readFileSize() const
+BBX_SIZE FileReader::readFileSize() const
 {
     ASSERT(isOpened());
 #ifndef LINUX
-	DWORD hiPart;
-	return GetFileSize(getHandle(), &hiPart);
+    LARGE_INTEGER fsize;
+    if (!GetFileSizeEx(getHandle(), &fsize))
+        return 0;
+    return BBX_SIZE(fsize.QuadPart);
 #else
     off_t fsize = lseek( getHandle(), 0, SEEK_END );
     ASSERT( fsize != -1 );
-    return size_t(fsize);
+    return BBX_SIZE(fsize);
 #endif // !LINUX
 }
 
 std::string FileReader::getTimeZone() const
 {
-    if ( isOpened() )
-    {
-        std::vector<char> extensionVec(header.getExtensionSize());
-        Bbx::Buffer extensionBuffer(extensionVec);
-        if (readExtensionZone(extensionBuffer))
-        {
-            Extension extension;
-            if ( extension.load(extensionBuffer) )
-                return extension.getTimeZone();
-        }
-    }
-    return std::string(); // чтение безуспешно
+    return isOpened() ? extension.getTimeZone() : std::string();
 }
 
 bool FileReader::fileSizeIsEnoughToRead() const
@@ -551,7 +669,7 @@ FileReader::page_iterator FileReader::begin() const
 FileReader::page_iterator FileReader::end() const
 {
     ASSERT(isOpened());
-    return begin() + (int)getPagesCount();
+    return begin() + (page_iterator::difference_type)getPagesCount();
 }
 
 FileReader::reverse_page_iterator FileReader::rbegin() const
@@ -567,8 +685,8 @@ FileReader::reverse_page_iterator FileReader::rend() const
 size_t FileReader::getPagesCount() const
 {
     ASSERT(isOpened());
-    size_t pagesDataSize = readFileSize() - header.getHeaderSize();
-    return (pagesDataSize + header.getPageSize() -1 )/ header.getPageSize();
+    BBX_SIZE pagesDataSize = readFileSize() - header.getHeaderSize();
+    return size_t((pagesDataSize + header.getPageSize() -1 )/ header.getPageSize());
 }
 
 Bbx::Stamp FileReader::startsFrom() const
@@ -589,6 +707,55 @@ Bbx::Stamp FileReader::currentCursorStamp() const
     return currentPage[cursor.part].getStamp();
 }
 
+Bbx::Stamp FileReader::currentCursorPreciseStamp() const
+{
+    ASSERT(currentPage.getPartsNumber() > cursor.part);
+    return cursorStamp;
+}
+
+Bbx::Stamp FileReader::readPreciseStamp(const PageReader& pr, size_t partIndex) const
+{
+    const Bbx::Stamp seconds = pr[partIndex].getStamp();
+    if (!extension.hasFlag(Extension::c_FlagSequenced))
+        return seconds;
+
+    /* Префикс лежит в начале записи, но может перейти на следующую страницу */
+    Bbx::Stamp stamp = seconds;
+    char_vec caption, data;
+    RecordIn record(stamp, caption, data);
+    record.skipContents();
+    record.expectPrefix();
+    record.setLockless(commitCounters());
+    if (!record.readPart(getHandle(), pr[partIndex].getPartAddress()))
+        return seconds;
+
+    /* Страница pr может быть ещё не установлена текущей, поэтому следующие ищутся по её адресу */
+    PageReader next(commitCounters());
+    page_iterator pageIt(pr.getAddress().offset, pr.getAddress().size);
+    for (++pageIt; !record.readed() && pageIt < end(); ++pageIt)
+    {
+        if (!next.read(getHandle(), *pageIt) || !next.getPartsNumber() || !record.readPart(getHandle(), next[0].getPartAddress()))
+            return seconds;
+    }
+    return record.readed() ? stamp : seconds;
+}
+
+uint64_t FileReader::currentCursorSequence() const
+{
+    ASSERT(currentPage.getPartsNumber() > cursor.part);
+    uint64_t pageSequence = currentPage.getSequence();
+    return pageSequence ? pageSequence + cursor.part : 0;
+}
+
+uint64_t FileReader::firstSequence() const
+{
+    ASSERT(isOpened());
+    PageReader pr(commitCounters());
+    if (!extension.hasFlag(Extension::c_FlagSequenced) || begin() == end() || !pr.read(getHandle(), *begin()))
+        return 0;
+    return pr.getSequence();
+}
+
 Bbx::Identifier FileReader::currentCursorIdentifier() const
 {
     ASSERT(currentPage.getPartsNumber() > cursor.part);
@@ -617,8 +784,8 @@ bool FileReader::hasMoreRecords(bool directionForward) const
         */
         if ( !comesToTruncated() )
         {
-            PageReader pr;
-            for (page_iterator it = begin() + (int)cursor.page + 1; it != end(); ++it)
+            PageReader pr(commitCounters());
+            for (page_iterator it = begin() + (page_iterator::difference_type)cursor.page + 1; it != end(); ++it)
             {
                 if (pr.read(getHandle(), *it) && pr.containsAnyBeginningParts())
                     return true;
@@ -633,8 +800,8 @@ bool FileReader::hasMoreRecords(bool directionForward) const
             return true;
 
         /* Проверка всех страниц до этой */
-        PageReader pr;
-        for (page_iterator it = begin(), _end = begin() + (int)cursor.page; it != _end; ++it)
+        PageReader pr(commitCounters());
+        for (page_iterator it = begin(), _end = begin() + (page_iterator::difference_type)cursor.page; it != _end; ++it)
         {
             if (pr.read(getHandle(), *it) && pr.containsAnyBeginningParts())
                 return true;
@@ -668,56 +835,208 @@ Bbx::ReadResult FileReader::moveToNextRecord(bool directionForward, bool normalS
     }
 }
 
-bool FileReader::readCurrentRecord( RecordIn& record)
+Bbx::ReadResult FileReader::readCurrentRecord( RecordIn& record)
 {
     if (!isOpened() || !currentPage.update(getHandle()))
-        return false;
+        return ReadResult::NoDataAvailable;
 
     if (cursor.part >= currentPage.getPartsNumber())
-        return false;
+        return ReadResult::NoDataAvailable;
 
+    page_iterator pageIt = begin() + (page_iterator::difference_type)cursor.page;
+    if (!pageIntact(pageIt, currentPage))
+        return ReadResult::BadPageChecksum;
+
+    record.setCaptionDictionary(captions.enabled() ? &captions : nullptr);
+    if (extension.hasFlag(Extension::c_FlagSequenced))
+        record.expectPrefix();
+    record.setLockless(commitCounters());
     const PartHeaderTableRecord& startPart = currentPage[cursor.part];
     ASSERT(startPart.header.containsBeginning());
+    record.setStamp(startPart.getStamp());
     if (!record.readPart(getHandle(), startPart.getPartAddress()))
-        return false;
+        return ReadResult::NoDataAvailable;
 
-    record.setStamp(startPart.getStamp());
     if ( record.readed() )
-        return true;
+        return ReadResult::Success;
 
-    PageReader pr;
+    PageReader pr(commitCounters());
     page_iterator theEnd = end();
-    for (page_iterator it = begin() + (int)cursor.page + 1; it != theEnd; ++it)
+    for (++pageIt; pageIt != theEnd; ++pageIt)
     {
-        if (!pr.read(getHandle(), *it) || !pr.getPartsNumber())
-            return false;
+        if (!pr.read(getHandle(), *pageIt) || !pr.getPartsNumber())
+            return ReadResult::NoDataAvailable;
+        if (!pageIntact(pageIt, pr))
+            return ReadResult::BadPageChecksum;
 
         const PartHeaderTableRecord& contPart = pr[0];
         ASSERT(contPart.header.isContinuationPart());
         if ( !record.readPart( getHandle(), contPart.getPartAddress() ) )
-            return false;
+            return ReadResult::NoDataAvailable;
         if ( record.readed() )
-            return true;
+            return ReadResult::Success;
         ASSERT(!contPart.header.containsEnd());
     }
-    return false;
+    return ReadResult::NoDataAvailable;
 }
 
-bool FileReader::readCurrentRecord(Bbx::Stamp& stamp, Bbx::char_vec& caption, Bbx::char_vec& before, Bbx::char_vec& after)
+Bbx::ReadResult FileReader::readCurrentRecord(Bbx::Stamp& stamp, Bbx::char_vec& caption, Bbx::char_vec& before, Bbx::char_vec& after)
 {
     RecordIn rec(stamp, caption, before, after);
     return readCurrentRecord( rec );
 }
 
-bool FileReader::readCurrentRecord(Bbx::Stamp& stamp, Bbx::char_vec& caption, Bbx::char_vec& data)
+Bbx::ReadResult FileReader::readCurrentRecord(Bbx::Stamp& stamp, Bbx::char_vec& caption, Bbx::char_vec& data)
 {
     RecordIn rec(stamp, caption, data);
     return readCurrentRecord( rec );
 }
 
+bool FileReader::pageIntact(page_iterator pageIt, const PageReader& pr) const
+{
+    /* Сумма сверяется при первом обращении к данным страницы, результат запоминается */
+    if (!pr.hasChecksum())
+        return true;
+
+    size_t index = size_t(pageIt - begin());
+    if (pageStates.size() <= index)
+        pageStates.resize(index + 1, 0);
+    if (!pageStates[index])
+        pageStates[index] = pr.verify(getHandle()) ? 1 : 2;
+    return 1 == pageStates[index];
+}
+
+size_t FileReader::verify()
+{
+    ASSERT(isOpened());
+    const BBX_SIZE pageSize = header.getPageSize();
+    const BBX_SIZE fileSize = readFileSize();
+    if (fileSize <= header.getHeaderSize())
+        return 0;
+
+    /* Проверяются только целые страницы, страницы читаются блоками по несколько мегабайт */
+    const size_t fullPages = size_t((fileSize - header.getHeaderSize()) / pageSize);
+    const size_t pagesPerBlock = std::max<size_t>(1, 8 * c_MB / size_t(pageSize));
+    char_vec block;
+    size_t damaged = 0;
+    pageStates.resize(std::max(pageStates.size(), fullPages), 0);
+    for (size_t first = 0; first < fullPages; first += pagesPerBlock)
+    {
+        size_t count = std::min(pagesPerBlock, fullPages - first);
+        block.resize(size_t(count * pageSize));
+        SharedSection blockSection(getHandle(), begin()[(page_iterator::difference_type)first].offset, size32(block), !commitCounters());
+        if (!blockSection.read(Bbx::Buffer(block)))
+            return damaged + (fullPages - first);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            bool intact = PageReader::checksumMatches(Bbx::Buffer(&block[size_t(i * pageSize)], unsigned(pageSize)));
+            pageStates[first + i] = intact ? 1 : 2;
+            if (!intact)
+                ++damaged;
+        }
+    }
+    return damaged;
+}
+
+bool FileReader::readSummary(FileSummary& summary) const
+{
+    const uint64_t offset = extension.getIndexOffset();
+    if (!offset || offset + sizeof(summary) > header.getHeaderSize())
+        return false;
+    SharedSection summarySection(getHandle(), BBX_SIZE(offset), sizeof(summary), !commitCounters());
+    return summarySection.read(Bbx::Buffer::create(summary))
+        && 0 == memcmp(summary.magic, c_SummaryMagic, sizeof(c_SummaryMagic)) && summary.blockSize >= sizeof(summary);
+}
+
+bool FileReader::summarize(const Bbx::Stamp& from, const Bbx::Stamp& to, time_t bucket, FileTimeline& timeline) const
+{
+    ASSERT(isOpened() && bucket > 0);
+    timeline = FileTimeline();
+    const time_t first = from.getTime();
+    const time_t last = to.getTime();
+    auto inRange = [&](time_t moment) {
+        return first <= moment && moment <= last;
+    };
+    auto bucketOf = [&](time_t moment) {
+        return size_t((moment - first) / bucket);
+    };
+    if (startsFrom().getTime() > last)
+        return false;
+
+    FileSummary summary;
+    if (readSummary(summary))
+    {
+        timeline.firstStamp = startsFrom();
+        timeline.lastStamp = endsWith();
+        timeline.firstSequence = summary.firstSequence;
+        timeline.lastSequence = summary.lastSequence;
+        timeline.firstRecordSize = summary.firstRecordSize;
+        const time_t begin = timeline.firstStamp.getTime();
+        const time_t end = timeline.lastStamp.getTime();
+        if (end < first)
+            return true; // нужен только конец файла, чтобы распознать продолжение в следующем
+        if (inRange(begin) && inRange(end) && bucketOf(begin) == bucketOf(end))
+        {
+            Bbx::TimelineBucket& total = timeline.buckets[bucketOf(begin)];
+            for (size_t i = 0; i < c_RecordTypesCount; ++i)
+            {
+                total.counts[i] += summary.counts[i];
+                total.bytes[i] += summary.bytes[i];
+            }
+            return true;
+        }
+    }
+
+    /* Итогов нет (файл пишется или записан прежней версией) или файл охватывает несколько интервалов */
+    timeline = FileTimeline();
+    PageReader pr(commitCounters());
+    bool started = false;
+    bool inFirstRecord = false;
+    for (page_iterator pageIt = begin(), pageEnd = end(); pageIt != pageEnd; ++pageIt)
+    {
+        if (!pr.read(getHandle(), *pageIt))
+            continue;
+        const uint64_t pageSequence = pr.getSequence();
+        for (size_t i = 0; i < pr.getPartsNumber(); ++i)
+        {
+            const PartHeader& part = pr[i].header;
+            const size_t index = Bbx::TimelineBucket::typeIndex(part.getType());
+            if (!part.tagIsKnown() || index >= c_RecordTypesCount)
+                continue;
+            const Bbx::Stamp stamp = part.getStamp();
+            const uint64_t sequence = pageSequence ? pageSequence + i : 0;
+            if (!started)
+            {
+                if (!part.containsBeginning())
+                    continue;
+                started = inFirstRecord = true;
+                timeline.firstStamp = stamp;
+                timeline.firstSequence = sequence;
+            }
+            if (inFirstRecord)
+            {
+                timeline.firstRecordSize += part.getSize();
+                inFirstRecord = !part.containsEnd();
+            }
+            timeline.lastStamp = stamp;
+            timeline.lastSequence = sequence;
+
+            if (!inRange(stamp.getTime()))
+                continue;
+            Bbx::TimelineBucket& target = timeline.buckets[bucketOf(stamp.getTime())];
+            target.bytes[index] += part.getSize();
+            if (part.containsBeginning())
+                ++target.counts[index];
+        }
+    }
+    return started;
+}
+
 FileReader::page_iterator& FileReader::page_iterator::operator +=(difference_type n)
 {
-    BBX_SIZE __offset = static_cast<BBX_SIZE>(addr.offset) + static_cast<BBX_SIZE>(addr.size * n);
+    // при отрицательном n беззнаковое переполнение даёт правильное смещение назад
+    BBX_SIZE __offset = addr.offset + addr.size * static_cast<BBX_SIZE>(n);
     addr.offset = __offset;
     return *this;
 }
@@ -744,5 +1063,5 @@ FileReader::page_iterator::value_type FileReader::page_iterator::operator[](File
 FileReader::page_iterator::difference_type FileReader::page_iterator::operator -(const FileReader::page_iterator& other) const
 {
     ASSERT(addr.size == other.addr.size);
-    return (std::max(addr.offset, other.addr.offset) - std::min(addr.offset, other.addr.offset)) / addr.size;
+    return difference_type((std::max(addr.offset, other.addr.offset) - std::min(addr.offset, other.addr.offset)) / addr.size);
 }
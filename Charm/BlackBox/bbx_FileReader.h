@@ -2,6 +2,7 @@
 
 #include "bbx_File.h"
 #include "bbx_Page.h"
+#include "bbx_Extension.h"
 
 #pragma pack(push, 1)
 namespace Bbx
@@ -12,7 +13,7 @@ namespace Bbx
         {
         public:
             ReadFileInfo()
-                : fileName(), startTime(0), endTime(0),fileSize(0)  {
+                : fileName(), startTime(0), endTime(0),fileSize(0), firstSequence(0)  {
             }
 
             bool isCorrect() const {
@@ -22,7 +23,24 @@ namespace Bbx
             std::wstring fileName;
             Stamp startTime;
             Stamp endTime;
-            size_t fileSize; // размер файла
+            BBX_SIZE fileSize; // размер файла
+            uint64_t firstSequence; // номер первой записи файла (0 - неизвестен)
+        };
+
+        /** @brief Вклад файла в обзор ящика (см. FileReader::summarize) */
+        struct FileTimeline
+        {
+            FileTimeline()
+                : valid(false), firstStamp(0), lastStamp(0), firstSequence(0), lastSequence(0), firstRecordSize(0), buckets() {
+            }
+
+            bool valid;               // в файле есть записи
+            Stamp firstStamp;         // штамп первой записи (у файла-продолжения - копии опорной)
+            Stamp lastStamp;
+            uint64_t firstSequence;   // 0 - номер неизвестен
+            uint64_t lastSequence;
+            unsigned firstRecordSize;
+            std::map<size_t, Bbx::TimelineBucket> buckets; // по номерам интервалов обзора
         };
 
         /** @brief Курсор для чтения */
@@ -49,11 +67,7 @@ namespace Bbx
             public:
                 using iterator_category = std::random_access_iterator_tag;
                 using value_type = FileAddress; // crap
-#ifndef LINUX
-				using difference_type = int;
-#else
-                using difference_type = unsigned long;
-#endif // LINUX
+                using difference_type = long long;
                 using pointer = FileAddress*;
                 using reference = FileAddress&;
 
@@ -88,6 +102,9 @@ namespace Bbx
 
             Bbx::ReadResult tryOpenFile(const std::wstring& filePath);
             void swap(FileReader& other);
+            /** @brief Копия читателя файла на той же позиции: файл открывается заново по пути,
+            заголовки и прочитанная страница не перечитываются */
+            bool fork(FileReader& target) const;
             void update();
 
             static ReadFileInfo getFileInfo( const std::wstring& onefile );
@@ -98,26 +115,51 @@ namespace Bbx
             template <typename T>
             page_iterator back_find_if(page_iterator itFrom, page_iterator itTo, T comparer);
             bool rewindToExtreme(bool toStart);
+            /** @brief Точная перемотка к записи с указанным сквозным номером (двоичный поиск по страницам) */
+            bool rewindToSequence(uint64_t sequence);
             Stamp startsFrom() const;
             Stamp endsWith() const;
             const std::wstring& getFilePath() const;
             Cursor getCursor() const;
-            size_t readFileSize() const;
+            BBX_SIZE readFileSize() const;
             std::string getTimeZone() const;
             Stamp currentCursorStamp() const;
+            /** @brief Штамп текущей записи с наносекундами из её префикса (секундный для файлов до 4.0).
+            Префикс разбирается один раз при установке курсора на запись */
+            Stamp currentCursorPreciseStamp() const;
+            uint64_t currentCursorSequence() const;
+            uint64_t firstSequence() const;
+            /** @brief Страницы файла опубликованы счётчиками фиксации и читаются без блокировок */
+            bool commitCounters() const;
+            /** @brief Файл версии до 3.0: его используют и прежние читатели, маркирующие файл по смещению 3Gb */
+            bool legacyMarked() const;
             Identifier currentCursorIdentifier() const;
             Bbx::RecordType currentCursorType() const;
             bool hasMoreRecords(bool directionForward) const;
             ReadResult moveToNextRecord(bool directionForward, bool normalSequence);
             bool comesToTruncated() const;
-            bool readCurrentRecord(Stamp& stamp, char_vec& caption, char_vec& before, char_vec& after);
-            bool readCurrentRecord(Stamp& stamp, char_vec& caption, char_vec& data);
+            ReadResult readCurrentRecord(Stamp& stamp, char_vec& caption, char_vec& before, char_vec& after);
+            ReadResult readCurrentRecord(Stamp& stamp, char_vec& caption, char_vec& data);
+            /** @brief Сверка контрольных сумм всех заполненных страниц файла крупными блоками
+            @return число повреждённых страниц */
+            size_t verify();
+            /** @brief Вклад файла в обзор ящика по интервалам длиной bucket секунд от from до to:
+            по итогам из зоны расширения, если файл закрыт и целиком попадает в один интервал,
+            иначе по заголовкам страниц и кусочков. Учитываются все записи файла, включая первую
+            @return false, если в файле нет записей или он начинается позже to */
+            bool summarize(const Stamp& from, const Stamp& to, time_t bucket, FileTimeline& timeline) const;
+            /** @brief Смещение итогов файла в зоне расширения (0 - файл записан без итогов) */
+            uint64_t summaryOffset() const;
             bool isReferenceSearchBetter(const Stamp& desiredStamp) const;
 
         private:
             std::wstring path;
             Cursor cursor;
+            Stamp cursorStamp; // штамп записи под курсором с наносекундами
             PageReader currentPage;
+            CaptionDictionary captions;
+            Extension extension; // метаинформация, считанная при открытии файла
+            mutable std::vector<char> pageStates; // результаты сверки контрольных сумм страниц
 
             Bbx::ReadResult unsafeOpenFileAndReadHeader(const std::wstring& filePath);
 
@@ -125,10 +167,12 @@ namespace Bbx
             page_iterator end() const;
             reverse_page_iterator rbegin() const;
             reverse_page_iterator rend() const;
-            bool readCurrentRecord( RecordIn& record );
+            ReadResult readCurrentRecord( RecordIn& record );
+            bool pageIntact(page_iterator pageIt, const PageReader& pr) const;
             bool readHeader();
             bool readAndVerifyVersion();
             bool readExtensionZone(Buffer& buf) const;
+            bool readSummary(FileSummary& summary) const;
             bool fileSizeIsEnoughToRead() const;
             size_t getPagesCount() const;
             bool readPage(reverse_page_iterator revPageIt);
@@ -136,6 +180,7 @@ namespace Bbx
             void setPage(const PageReader& pr, reverse_page_iterator revPageIt);
             void setPage(const PageReader& pr, page_iterator revPageIt);
             ReadResult setPart(PageReader& pr, size_t partIndex);
+            Stamp readPreciseStamp(const PageReader& pr, size_t partIndex) const;
             ReadResult setPartWithMoreThanTimeCheck(PageReader& pr, size_t partIndex, const Stamp& stamp, bool normalSequence);
             ReadResult setPartWithLessThanTimeCheck(PageReader& pr, size_t partIndex, const Stamp& stamp, bool normalSequence);
 
@@ -144,6 +189,21 @@ namespace Bbx
             ReadResult setPrecedePage(const Stamp& oldStamp, bool normalSequence);
         };
 
+        inline bool FileReader::commitCounters() const
+        {
+            return extension.hasFlag(Extension::c_FlagCommitCounters);
+        }
+
+        inline bool FileReader::legacyMarked() const
+        {
+            return extension.getVersion().getMajor() < c_markBeyondDataVersion.getMajor();
+        }
+
+        inline uint64_t FileReader::summaryOffset() const
+        {
+            return extension.getIndexOffset();
+        }
+
         inline FileReader::page_iterator::page_iterator()
             : addr()
         { }
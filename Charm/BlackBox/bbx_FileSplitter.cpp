@@ -0,0 +1,353 @@
+﻿#include "stdafx.h"
+
+#ifdef LINUX
+#include <unistd.h>
+#endif
+#include "bbx_FileSplitter.h"
+#include "bbx_FileReader.h"
+#include "bbx_Crc32c.h"
+
+using namespace Bbx::Impl;
+
+namespace
+{
+    /** @brief Размер блока при чтении страниц и копировании */
+    const size_t c_BlockSize = 4 * Bbx::c_MB;
+
+    /** @brief Разбор кусочков страницы, считанной в память (смещения кусочков - от начала страницы) */
+    void parseParts(const Bbx::char_vec& page, size_t pageBegin, size_t pageSize, std::vector<PartHeaderTableRecord>& parts)
+    {
+        parts.clear();
+        if (pageSize < sizeof(PageHeader))
+            return;
+        PageHeader pageHeader;
+        memcpy(&pageHeader, &page[pageBegin], sizeof(PageHeader));
+
+        PartHeaderTableRecord part;
+        part.offset = sizeof(PageHeader) + pageHeader.getExtensionSize();
+        while (part.offset + sizeof(PartHeader) < pageSize)
+        {
+            memcpy(&part.header, &page[pageBegin + size_t(part.offset)], sizeof(PartHeader));
+            if (!part.header.tagIsKnown() || part.offset + sizeof(PartHeader) + part.header.getSize() > pageSize)
+                break;
+            parts.push_back(part);
+            part.offset += sizeof(PartHeader) + part.header.getSize();
+        }
+    }
+
+    /** @brief Копирование участка одного файла в другой; на Linux данные не проходят через память процесса */
+    bool copyRange(const FileId& source, BBX_SIZE from, const FileId& target, BBX_SIZE to, BBX_SIZE size)
+    {
+#if defined(LINUX) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+        const int in = source, out = target; // дескрипторы передаются как есть, без копий FileId
+        while (size)
+        {
+            BBX_SIZE chunk = std::min<BBX_SIZE>(size, c_BlockSize);
+            SharedSection::lock(in, from, chunk);
+            OwnSection::lock(out, to, chunk);
+            loff_t inOffset = loff_t(from), outOffset = loff_t(to);
+            ssize_t copied = copy_file_range(in, &inOffset, out, &outOffset, size_t(chunk), 0);
+            OwnSection::unlock(out, to, chunk);
+            SharedSection::unlock(in, from, chunk);
+            if (copied <= 0)
+                break; // файловая система не поддерживает копирование, остаток - через буфер
+            from += BBX_SIZE(copied);
+            to += BBX_SIZE(copied);
+            size -= BBX_SIZE(copied);
+        }
+#endif
+        Bbx::char_vec buffer;
+        while (size)
+        {
+            unsigned chunk = unsigned(std::min<BBX_SIZE>(size, c_BlockSize));
+            buffer.resize(chunk);
+            SharedSection sourceSection(source, from, chunk);
+            OwnSection targetSection(target, to, chunk);
+            if (!sourceSection.read(Bbx::Buffer(buffer)) || !targetSection.write(Bbx::Buffer(buffer)))
+                return false;
+            from += chunk;
+            to += chunk;
+            size -= chunk;
+        }
+        return true;
+    }
+
+    /** @brief Создаваемый файл */
+    class PieceFile : public BaseFile
+    {
+    public:
+        bool create(const Bbx::Location& location, const Bbx::Stamp& stamp, bool legacyMarked, std::wstring& path)
+        {
+            for (unsigned attempt = 0; attempt < 100; ++attempt)
+            {
+                path = location.filePath(stamp, attempt);
+                if (safeOpen_ModeWrite(path))
+                {
+                    if (!legacyMarked)
+                        releaseLegacyMark();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool write(BBX_SIZE offset, const Bbx::Buffer& data) const
+        {
+            OwnSection section(getHandle(), offset, data.size);
+            return section.write(data);
+        }
+
+        bool copy(const FileId& source, BBX_SIZE from, BBX_SIZE to, BBX_SIZE size) const
+        {
+            return copyRange(source, from, getHandle(), to, size);
+        }
+    };
+}
+
+FileSplitter::FileSplitter()
+    : BaseFile(), fileSize(0), pagesCount(0), summaryOffset(0), commitCounters(false), legacyMarked(false)
+{
+}
+
+FileSplitter::~FileSplitter()
+{
+}
+
+bool FileSplitter::open(const std::wstring& path)
+{
+    /* Проверка версии и целостности заголовка - обычным читателем */
+    FileReader checker;
+    if (!checker.tryOpenFile(path))
+        return false;
+    fileSize = checker.readFileSize();
+    summaryOffset = checker.summaryOffset();
+    commitCounters = checker.commitCounters();
+    legacyMarked = checker.legacyMarked();
+
+    if (isOpened())
+        close();
+    if (!safeOpen_ModeRead(path))
+        return false;
+    if (!legacyMarked)
+        releaseLegacyMark();
+    SharedSection headerSection(getHandle(), 0, sizeof(FileHeader));
+    if (!headerSection.read(Bbx::Buffer::create(header)) || !header.getPageSize())
+        return false;
+
+    pagesCount = fileSize > header.getHeaderSize()
+        ? size_t((fileSize - header.getHeaderSize() + header.getPageSize() - 1) / header.getPageSize())
+        : 0;
+    return true;
+}
+
+FileAddress FileSplitter::pageAddress(size_t page) const
+{
+    BBX_SIZE offset = header.getHeaderSize() + BBX_SIZE(page) * header.getPageSize();
+    return FileAddress(offset, std::min<BBX_SIZE>(header.getPageSize(), fileSize - offset));
+}
+
+bool FileSplitter::readPage(size_t page, Bbx::char_vec& buffer) const
+{
+    FileAddress address = pageAddress(page);
+    buffer.resize(size_t(address.size));
+    SharedSection pageSection(getHandle(), address.offset, unsigned(address.size));
+    return pageSection.read(Bbx::Buffer(buffer));
+}
+
+bool FileSplitter::split(const Location& target, BBX_SIZE minPieceBytes, std::vector<std::wstring>& created)
+{
+    ASSERT(isOpened());
+    std::vector<Piece> pieces;
+    if (!scan(minPieceBytes, pieces))
+        return false;
+
+    for (const Piece& piece : pieces)
+    {
+        std::wstring createdPath;
+        if (!writePiece(target, piece, createdPath))
+            return false;
+        created.push_back(createdPath);
+    }
+    return true;
+}
+
+bool FileSplitter::scan(BBX_SIZE minPieceBytes, std::vector<Piece>& pieces) const
+{
+    const size_t pageSize = header.getPageSize();
+    const size_t pagesPerBlock = std::max<size_t>(1, c_BlockSize / pageSize);
+
+    Piece current = Piece();
+    bool started = false;      // найдена первая опорная запись
+    bool hasOwnData = false;   // в куске есть что-то кроме копии опорной записи, завершившей предыдущий
+    bool splitting = false;    // встречено начало опорной записи, на которой кусок закончится
+    PartPosition splitAt = PartPosition();
+    time_t splitTime = 0;
+    BBX_SIZE pieceBytes = 0;
+
+    Bbx::char_vec block;
+    std::vector<PartHeaderTableRecord> parts;
+    for (size_t firstPage = 0; firstPage < pagesCount; firstPage += pagesPerBlock)
+    {
+        /* Страницы читаются блоками, последняя страница файла может быть неполной */
+        size_t count = std::min(pagesPerBlock, pagesCount - firstPage);
+        FileAddress blockBegin = pageAddress(firstPage);
+        FileAddress blockLast = pageAddress(firstPage + count - 1);
+        block.resize(size_t(blockLast.nextOffset() - blockBegin.offset));
+        SharedSection blockSection(getHandle(), blockBegin.offset, size32(block));
+        if (!blockSection.read(Bbx::Buffer(block)))
+            return false;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            const size_t page = firstPage + i;
+            parseParts(block, i * pageSize, size_t(pageAddress(page).size), parts);
+            for (size_t k = 0; k < parts.size(); ++k)
+            {
+                const PartHeader& part = parts[k].header;
+                const time_t stamp = part.getStamp().getTime();
+                const bool referenceBegins = part.isReference() && part.containsBeginning();
+                const PartPosition position = { page, k };
+                if (!started)
+                {
+                    /* Данные до первой опорной записи прочитать всё равно невозможно */
+                    if (!referenceBegins)
+                        continue;
+                    started = hasOwnData = true;
+                    current.first = position;
+                    current.timeBegin = current.timeEnd = stamp;
+                    pieceBytes = 0;
+                }
+                else if (!splitting)
+                    hasOwnData = true;
+
+                current.last = position;
+                current.timeEnd = std::max(current.timeEnd, stamp);
+                pieceBytes += part.getSize();
+
+                if (referenceBegins && !splitting && pieceBytes >= minPieceBytes
+                    && (current.first.page != page || current.first.part != k))
+                {
+                    splitting = true;
+                    splitAt = position;
+                    splitTime = stamp;
+                }
+                /* Кусочки опорной записи идут подряд, первое окончание после её начала - её окончание */
+                if (splitting && part.containsEnd())
+                {
+                    pieces.push_back(current);
+                    current.first = splitAt;
+                    current.timeBegin = current.timeEnd = splitTime;
+                    pieceBytes = 0;
+                    hasOwnData = false;
+                    splitting = false;
+                }
+            }
+        }
+    }
+    if (started && hasOwnData)
+        pieces.push_back(current);
+    return true;
+}
+
+bool FileSplitter::writePiece(const Location& target, const Piece& piece, std::wstring& createdPath) const
+{
+    PieceFile out;
+    if (!out.create(target, Bbx::Stamp(piece.timeBegin), legacyMarked, createdPath))
+        return false;
+
+    FileHeader outHeader = header;
+    outHeader.setFirstRecordTime(Bbx::Stamp(piece.timeBegin));
+    outHeader.setLastRecordTime(Bbx::Stamp(piece.timeEnd));
+    if (!out.write(0, Bbx::Buffer::create(outHeader))
+        || !out.copy(getHandle(), sizeof(FileHeader), sizeof(FileHeader), header.getExtensionSize()))
+        return false;
+    /* Скопированные итоги исходного файла стираются: кусок обозревается по заголовкам страниц */
+    FileSummary emptySummary;
+    memset(&emptySummary, 0, sizeof(emptySummary));
+    if (summaryOffset && !out.write(BBX_SIZE(summaryOffset), Bbx::Buffer::create(emptySummary)))
+        return false;
+
+    const unsigned pageSize = header.getPageSize();
+    BBX_SIZE outOffset = header.getHeaderSize();
+    size_t rawFirst = piece.first.page; // начало ряда страниц, копируемых целиком
+    auto copyRaw = [&](size_t rawEnd) {
+        if (rawFirst == rawEnd)
+            return true;
+        BBX_SIZE from = pageAddress(rawFirst).offset;
+        BBX_SIZE size = pageAddress(rawEnd - 1).nextOffset() - from;
+        bool copied = out.copy(getHandle(), from, outOffset, size);
+        outOffset += size;
+        return copied;
+    };
+
+    /* Страницы между крайними всегда копируются целиком, крайние - если кусок захватывает их полностью */
+    std::vector<size_t> edgePages(1, piece.first.page);
+    if (piece.last.page != piece.first.page)
+        edgePages.push_back(piece.last.page);
+
+    Bbx::char_vec source;
+    std::vector<PartHeaderTableRecord> parts;
+    for (size_t page : edgePages)
+    {
+        if (!readPage(page, source))
+            return false;
+        parseParts(source, 0, source.size(), parts);
+        size_t from = (page == piece.first.page) ? piece.first.part : 0;
+        size_t to = (page == piece.last.page) ? piece.last.part : parts.size() - 1;
+        if (0 == from && to + 1 == parts.size())
+            continue;
+
+        if (!copyRaw(page))
+            return false;
+
+        /* Страница обрезается по границам записей куска. Кусочки остаются на своих местах: читатель
+           считает страницу обрезанной, если последний кусочек не доходит до её конца.
+           Отброшенные в начале кусочки поглощает расширение страницы */
+        PageHeader sourceHeader;
+        memcpy(&sourceHeader, source.data(), sizeof(PageHeader));
+        const size_t partsBegin = size_t(parts[from].offset);
+        const size_t partsEnd = size_t(parts[to].offset) + sizeof(PartHeader) + parts[to].header.getSize();
+        const size_t sourceExtensionEnd = sizeof(PageHeader) + sourceHeader.getExtensionSize();
+        const unsigned extensionSize = unsigned(partsBegin - sizeof(PageHeader));
+        Bbx::char_vec rebuilt(source);
+        std::fill(rebuilt.begin() + sourceExtensionEnd, rebuilt.begin() + partsBegin, '\0');
+        std::fill(rebuilt.begin() + partsEnd, rebuilt.end(), '\0');
+
+        PageHeader rebuiltHeader(extensionSize);
+        for (size_t k = from; k <= to; ++k)
+            rebuiltHeader.addRecordTime(parts[k].header.getStamp().getTime());
+        rebuiltHeader.write(Bbx::Buffer(rebuilt));
+
+        if (commitCounters)
+        {
+            /* Стёртые в конце кусочки не публикуются: граница - конец оставленных, поколение новое и чётное */
+            const size_t commitOffset = sizeof(PageHeader) + sizeof(PageExtension);
+            PageCommit commit;
+            memcpy(&commit, &rebuilt[commitOffset], sizeof(PageCommit));
+            commit.generation = (commit.generation | 1u) + 1;
+            commit.committed = uint32_t(std::min<size_t>(commit.committed, partsEnd));
+            memcpy(&rebuilt[commitOffset], &commit, sizeof(PageCommit));
+        }
+
+        if (sourceHeader.getExtensionSize() >= sizeof(PageExtension))
+        {
+            /* Номер отсчитывается от первого кусочка страницы, сумма считается заново */
+            PageExtension extension;
+            memcpy(&extension, &rebuilt[sizeof(PageHeader)], sizeof(PageExtension));
+            if (extension.sequence)
+                extension.sequence += from;
+            extension.checksum = 0;
+            memcpy(&rebuilt[sizeof(PageHeader)], &extension, sizeof(PageExtension));
+            if (extension.flags & PageExtension::c_FlagChecksum)
+            {
+                extension.checksum = crc32c(0, rebuilt.data(), rebuilt.size());
+                memcpy(&rebuilt[sizeof(PageHeader)], &extension, sizeof(PageExtension));
+            }
+        }
+        if (!out.write(outOffset, Bbx::Buffer(rebuilt)))
+            return false;
+        outOffset += pageSize;
+        rawFirst = page + 1;
+    }
+    return copyRaw(piece.last.page + 1);
+}
@@ -0,0 +1,60 @@
+﻿#pragma once
+
+#include "bbx_File.h"
+
+namespace Bbx
+{
+    namespace Impl
+    {
+        /**
+        @brief Разделение файла черного ящика на файлы меньшего размера без разбора записей.
+        Как и у писателя, каждый новый файл начинается опорной записью, которой заканчивается предыдущий.
+        Целые страницы и зона расширения копируются средствами ОС (copy_file_range, где доступно),
+        заново формируются только заголовки файлов и крайние страницы кусков, разрезанные по границам записей.
+        */
+        class FileSplitter : public BaseFile
+        {
+        public:
+            FileSplitter();
+            ~FileSplitter();
+
+            /** @brief Открытие исходного файла (проверяется поддержка его версии) */
+            bool open(const std::wstring& path);
+
+            /** @brief Разделение открытого файла
+            @param target расположение создаваемых файлов
+            @param minPieceBytes новый файл начинается у опорной записи, если в текущем набралось не меньше данных
+            @param created имена созданных файлов
+            @return false при ошибке чтения или записи */
+            bool split(const Location& target, BBX_SIZE minPieceBytes, std::vector<std::wstring>& created);
+
+        private:
+            /** @brief Положение кусочка записи: номер страницы и номер кусочка на ней */
+            struct PartPosition
+            {
+                size_t page;
+                size_t part;
+            };
+
+            /** @brief Часть исходного файла, из которой получается один новый файл */
+            struct Piece
+            {
+                PartPosition first;
+                PartPosition last;
+                time_t timeBegin;
+                time_t timeEnd;
+            };
+
+            BBX_SIZE fileSize;
+            size_t pagesCount;
+            uint64_t summaryOffset; // итоги исходного файла к кускам не относятся
+            bool commitCounters;    // страницы опубликованы счётчиками фиксации (см. PageCommit)
+            bool legacyMarked;      // версия до 3.0, куски сохраняют версию исходного файла
+
+            bool scan(BBX_SIZE minPieceBytes, std::vector<Piece>& pieces) const;
+            bool writePiece(const Location& target, const Piece& piece, std::wstring& createdPath) const;
+            bool readPage(size_t page, char_vec& buffer) const;
+            FileAddress pageAddress(size_t page) const;
+        };
+    }
+}
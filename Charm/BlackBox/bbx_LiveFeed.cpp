@@ -0,0 +1,158 @@
+﻿#include "stdafx.h"
+
+#include "bbx_LiveFeed.h"
+#include "bbx_LiveRing.h"
+
+using namespace Bbx;
+using Bbx::Impl::LiveRing;
+
+LiveRecord::LiveRecord()
+    : type(RecordType::Reference), stamp(), sequence(0), identifier(), caption(), data(), before()
+{
+}
+
+LiveFeed::LiveFeed(const Location& _location)
+    : location(_location), ring(), position(0), nextSequence(0), catchingUp(false),
+    file(), filePositioned(false), fallbacks(0)
+{
+}
+
+LiveFeed::~LiveFeed()
+{
+}
+
+bool LiveFeed::attach()
+{
+    ring.reset(LiveRing::open(location));
+    position = ring ? ring->head() : 0;
+    nextSequence = 0;
+    catchingUp = false;
+    filePositioned = false;
+    return attached();
+}
+
+bool LiveFeed::attached() const
+{
+    return ring != nullptr;
+}
+
+size_t LiveFeed::getFallbacksCount() const
+{
+    return fallbacks;
+}
+
+ReadResult LiveFeed::read(LiveRecord& record)
+{
+    if (!ring)
+        return ReadResult::NoFileOpened;
+
+    while (!catchingUp)
+    {
+        uint64_t fetched = position;
+        switch (ring->fetch(fetched, record))
+        {
+        case LiveRing::Fetch::Empty:
+            return ReadResult::NoDataAvailable;
+        case LiveRing::Fetch::Overrun:
+            position = ring->head();
+            if (nextSequence)
+                startCatchUp(); // до первой выданной записи догонять нечего
+            break;
+        case LiveRing::Fetch::Record:
+            if (!nextSequence || record.sequence == nextSequence)
+            {
+                position = fetched;
+                nextSequence = record.sequence + 1;
+                return ReadResult::Success;
+            }
+            if (record.sequence > nextSequence)
+                startCatchUp(); // запись не попала в ленту, сама лента остаётся на месте
+            else
+                position = fetched; // уже выдано
+            break;
+        }
+    }
+
+    if (resume(record))
+        return ReadResult::Success;
+    return readFile(record);
+}
+
+void LiveFeed::startCatchUp()
+{
+    catchingUp = true;
+    filePositioned = false;
+    ++fallbacks;
+}
+
+bool LiveFeed::resume(LiveRecord& record)
+{
+    while (true)
+    {
+        uint64_t fetched = position;
+        LiveRing::Fetch fetch = ring->fetch(fetched, record);
+        if (LiveRing::Fetch::Overrun == fetch)
+        {
+            position = ring->head();
+            return false;
+        }
+        if (LiveRing::Fetch::Empty == fetch || record.sequence > nextSequence)
+            return false;
+
+        /* Записи с меньшими номерами уже выданы из файлов */
+        position = fetched;
+        if (record.sequence == nextSequence)
+        {
+            catchingUp = false;
+            ++nextSequence;
+            return true;
+        }
+    }
+}
+
+ReadResult LiveFeed::readFile(LiveRecord& record)
+{
+    if (!file)
+        file.reset(new Reader(location));
+
+    while (true)
+    {
+        ReadResult moved;
+        if (filePositioned)
+        {
+            moved = file->follow(boost::posix_time::time_duration());
+            if (ReadResult::NewSession == moved)
+                moved = file->forceNext();
+        }
+        else
+        {
+            location.refreshFolderCache(); // записи могли уйти в только что созданный файл
+            moved = file->rewindToSequence(nextSequence);
+        }
+        if (!moved)
+            return moved; // запись ещё не сброшена писателем в файл
+        filePositioned = true;
+
+        record.sequence = file->getCurrentSequence();
+        if (record.sequence < nextSequence)
+            continue; // опорная запись, повторённая в начале следующего файла
+        ReadResult read = file->readAnyRecord(record.stamp, record.caption, record.data);
+        if (!read)
+            return read;
+
+        record.type = file->getCurrentType();
+        record.identifier = file->getCurrentIdentifier();
+        record.before.clear();
+        if (RecordType::Increment == record.type)
+        {
+            /* Фрагмент "до" доступен только при чтении в обратном направлении */
+            Stamp stamp_before;
+            char_vec caption_before;
+            file->setDirection(false);
+            file->readIncrementOriented(stamp_before, caption_before, record.before);
+            file->setDirection(true);
+        }
+        nextSequence = record.sequence + 1;
+        return ReadResult::Success;
+    }
+}
@@ -0,0 +1,70 @@
+﻿#pragma once
+
+#include "bbx_BlackBox.h"
+
+namespace Bbx
+{
+    namespace Impl
+    {
+        class LiveRing;
+    }
+
+    /** @brief Запись, полученная из живой ленты писателя */
+    struct LiveRecord
+    {
+        RecordType type;
+        Stamp stamp;
+        uint64_t sequence;     // сквозной номер записи ящика
+        Identifier identifier;
+        char_vec caption;
+        char_vec data;         // данные записи (для инкремента - фрагмент "после")
+        char_vec before;       // только для инкремента - фрагмент "до"
+
+        LiveRecord();
+    };
+
+    /**
+    @brief Получение записей живого ящика через разделяемую память (см. Writer::setLiveFeed).
+    Записи копируются из ленты писателя без чтения файлов и без блокировок.
+    Подключённый читатель получает записи, опубликованные после attach(), по порядку сквозных номеров.
+    Если читатель отстал и его позиция затёрта, или писатель не поместил запись в ленту,
+    пропущенные записи дочитываются из файлов ящика, после чего чтение возвращается к ленте.
+    Записи, ещё не сброшенные писателем в файл, при этом становятся доступны только после сброса.
+    */
+    class LiveFeed
+    {
+    public:
+        explicit LiveFeed(const Location& location);
+        ~LiveFeed();
+
+        /** @brief Подключение к ленте писателя; повторный вызов переподключает к ленте нового писателя
+        @return false, если писатель ящика не запущен или ленту не ведёт */
+        bool attach();
+        bool attached() const;
+
+        /** @brief Получение очередной записи без ожидания
+        @return NoDataAvailable - новых записей пока нет, NoFileOpened - лента не подключена */
+        ReadResult read(LiveRecord& record);
+
+        /** @brief Сколько раз чтение уходило к файлам из-за отставания или пропуска записи */
+        size_t getFallbacksCount() const;
+
+    private:
+        LiveFeed(const LiveFeed&);
+        LiveFeed& operator =(const LiveFeed&);
+
+        Location location;
+        std::unique_ptr<Impl::LiveRing> ring;
+        uint64_t position;             // позиция чтения ленты
+        uint64_t nextSequence;         // номер ожидаемой записи (0 - подойдёт любая)
+        bool catchingUp;               // пропущенное дочитывается из файлов
+        std::unique_ptr<Reader> file;
+        bool filePositioned;           // файловый читатель стоит на уже выданной записи
+        size_t fallbacks;
+
+        void startCatchUp();
+        /** @brief Возврат к ленте, если в ней уже есть ожидаемая запись */
+        bool resume(LiveRecord& record);
+        ReadResult readFile(LiveRecord& record);
+    };
+}
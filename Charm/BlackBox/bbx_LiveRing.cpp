@@ -0,0 +1,334 @@
+﻿#include "stdafx.h"
+#ifdef LINUX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "bbx_LiveRing.h"
+#include "bbx_Record.h"
+#include "../helpful/Utf8.h"
+
+using namespace Bbx::Impl;
+
+/** @brief Заголовок ленты в начале разделяемой памяти */
+struct LiveRing::Header
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t capacity;
+    std::atomic<uint64_t> reserved;  // до этой позиции писатель может затирать данные
+    std::atomic<uint64_t> published; // конец опубликованных записей
+};
+
+/** @brief Элемент кольца, за ним следуют заголовок, фрагмент "до" и данные записи */
+struct LiveRing::Entry
+{
+    uint32_t size;        // весь элемент вместе с выравниванием
+    uint32_t type;        // RecordType или c_PaddingType
+    int64_t time;
+    uint32_t nanoseconds;
+    uint32_t id;
+    uint64_t sequence;
+    uint32_t captionSize;
+    uint32_t beforeSize;
+    uint32_t dataSize;
+    uint32_t reserved;
+};
+
+namespace
+{
+    const char c_Magic[4] = { 'B', 'B', 'X', 'L' };
+    const uint32_t c_Version = 1;
+
+    /** @brief Заполнитель до конца кольца, следующий элемент начинается с нулевого смещения */
+    const uint32_t c_PaddingType = 0xFF;
+
+    /** @brief Заполнитель занимает только поля size и type */
+    const uint64_t c_PaddingSize = 2 * sizeof(uint32_t);
+
+    const uint64_t c_Alignment = 8;
+
+    /** @brief Запись крупнее этой доли кольца не публикуется, чтобы не вытеснять сразу все остальные */
+    const uint64_t c_MaximumEntryShare = 4;
+
+    uint64_t Aligned(uint64_t size)
+    {
+        return (size + c_Alignment - 1) / c_Alignment * c_Alignment;
+    }
+
+    /** @brief Имя разделяемой памяти ленты - хеш FNV-1a пути файла-признака писателя */
+    std::string RingName(const Bbx::Location& location)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for (char c : ToUtf8(location.verificationFilePath()))
+        {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ULL;
+        }
+        char name[32];
+        sprintf(name, "bbx-%016llx", static_cast<unsigned long long>(hash));
+        return name;
+    }
+
+#ifdef LINUX
+    /** @brief Права ленты: пишет только писатель ящика, остальные пользователи лишь читают */
+    const mode_t c_RingMode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+
+    /** @brief Лента изменяема только пользователем owner (иначе чужой процесс мог бы подменять записи) */
+    bool Protected(const struct stat& info, uid_t owner)
+    {
+        return info.st_uid == owner && !(info.st_mode & (S_IWGRP | S_IWOTH));
+    }
+#endif
+}
+
+static_assert(2 == ATOMIC_LLONG_LOCK_FREE,
+    "Лента в разделяемой памяти требует атомарных 64-битных счётчиков без блокировок");
+
+LiveRing::LiveRing()
+    : header(nullptr), data(nullptr), capacity(0), mappedSize(0), owner(false),
+#ifndef LINUX
+    mapping(NULL)
+#else
+    fd(-1), name()
+#endif
+{
+}
+
+#ifndef LINUX
+
+LiveRing::~LiveRing()
+{
+    if (header)
+        UnmapViewOfFile(header);
+    if (mapping)
+        CloseHandle(mapping); // объект удаляется системой с последним дескриптором
+}
+
+bool LiveRing::map(size_t size, bool writable)
+{
+    void* view = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+    if (!view)
+        return false;
+    header = static_cast<Header*>(view);
+    data = static_cast<char*>(view) + sizeof(Header);
+    mappedSize = size;
+    return true;
+}
+
+LiveRing* LiveRing::create(const Bbx::Location& location, size_t _capacity)
+{
+    std::unique_ptr<LiveRing> ring(new LiveRing());
+    ring->capacity = Aligned(_capacity);
+    const uint64_t size = sizeof(Header) + ring->capacity;
+    std::wstring name = L"Local\\" + FromUtf8(RingName(location));
+    ring->mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, DWORD(size >> 32), DWORD(size), name.c_str());
+    if (!ring->mapping)
+        return nullptr;
+    bool existed = ERROR_ALREADY_EXISTS == GetLastError();
+    if (!ring->map(size_t(size), true))
+        return nullptr;
+    if (existed && (memcmp(ring->header->magic, c_Magic, sizeof(c_Magic)) || ring->header->capacity != ring->capacity))
+        return nullptr; // лентой с другими параметрами пользуется другой процесс
+    if (!existed)
+    {
+        new (ring->header) Header{ { 'B', 'B', 'X', 'L' }, c_Version, ring->capacity, { 0 }, { 0 } };
+    }
+    ring->owner = true;
+    return ring.release();
+}
+
+LiveRing* LiveRing::open(const Bbx::Location& location)
+{
+    std::unique_ptr<LiveRing> ring(new LiveRing());
+    std::wstring name = L"Local\\" + FromUtf8(RingName(location));
+    ring->mapping = OpenFileMappingW(FILE_MAP_READ, FALSE, name.c_str());
+    if (!ring->mapping || !ring->map(0, false))
+        return nullptr;
+    if (memcmp(ring->header->magic, c_Magic, sizeof(c_Magic)) || c_Version != ring->header->version)
+        return nullptr;
+    ring->capacity = ring->header->capacity;
+    return ring.release();
+}
+
+#else
+
+LiveRing::~LiveRing()
+{
+    if (header)
+        munmap(header, mappedSize);
+    if (fd >= 0)
+        close(fd);
+    if (owner)
+        shm_unlink(name.c_str());
+}
+
+bool LiveRing::map(size_t size, bool writable)
+{
+    void* view = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == view)
+        return false;
+    header = static_cast<Header*>(view);
+    data = static_cast<char*>(view) + sizeof(Header);
+    mappedSize = size;
+    return true;
+}
+
+LiveRing* LiveRing::create(const Bbx::Location& location, size_t _capacity)
+{
+    std::unique_ptr<LiveRing> ring(new LiveRing());
+    ring->capacity = Aligned(_capacity);
+    ring->name = "/" + RingName(location);
+    const uint64_t size = sizeof(Header) + ring->capacity;
+
+    /* Лента прежнего писателя того же размера продолжается, чтобы подключённые читатели не потеряли её */
+    ring->fd = shm_open(ring->name.c_str(), O_RDWR | O_CREAT, c_RingMode);
+    if (ring->fd < 0)
+        return nullptr;
+    struct stat info;
+    bool existed = 0 == fstat(ring->fd, &info) && Protected(info, geteuid())
+        && uint64_t(info.st_size) == size && ring->map(size_t(size), true)
+        && !memcmp(ring->header->magic, c_Magic, sizeof(c_Magic)) && c_Version == ring->header->version
+        && ring->header->capacity == ring->capacity;
+    if (!existed)
+    {
+        if (ring->header)
+        {
+            munmap(ring->header, ring->mappedSize);
+            ring->header = nullptr;
+        }
+        /* Размер чужой ленты не меняется на месте: читатели, отобразившие её, получили бы SIGBUS */
+        close(ring->fd);
+        shm_unlink(ring->name.c_str());
+        ring->fd = shm_open(ring->name.c_str(), O_RDWR | O_CREAT | O_EXCL, c_RingMode);
+        if (ring->fd < 0 || ftruncate(ring->fd, off_t(size)) || !ring->map(size_t(size), true))
+            return nullptr;
+        new (ring->header) Header{ { 'B', 'B', 'X', 'L' }, c_Version, ring->capacity, { 0 }, { 0 } };
+    }
+    ring->owner = true;
+    return ring.release();
+}
+
+LiveRing* LiveRing::open(const Bbx::Location& location)
+{
+    std::unique_ptr<LiveRing> ring(new LiveRing());
+    ring->fd = shm_open(("/" + RingName(location)).c_str(), O_RDONLY, 0);
+    /* Лента принимается, только если её ведёт владелец файла-признака писателя и больше никто не может в неё писать */
+    struct stat info, writer;
+    if (ring->fd < 0 || fstat(ring->fd, &info) || stat(ToUtf8(location.verificationFilePath()).c_str(), &writer)
+        || !Protected(info, writer.st_uid))
+        return nullptr;
+    if (uint64_t(info.st_size) < sizeof(Header) || !ring->map(size_t(info.st_size), false))
+        return nullptr;
+    if (memcmp(ring->header->magic, c_Magic, sizeof(c_Magic)) || c_Version != ring->header->version
+        || sizeof(Header) + ring->header->capacity > uint64_t(info.st_size))
+        return nullptr;
+    ring->capacity = ring->header->capacity;
+    return ring.release();
+}
+
+#endif // !LINUX
+
+char* LiveRing::entryAt(uint64_t position) const
+{
+    return data + position % capacity;
+}
+
+void LiveRing::publish(const WriterTask& task, uint64_t sequence)
+{
+    /* Задание хранит [заголовок, данные] или у инкремента [заголовок, до, после] */
+    const bool increment = task.sources.size() > 2;
+    const char_vec& caption = task.sources[0].second;
+    const char_vec& data = task.sources.back().second;
+    const char_vec* before = increment ? &task.sources[1].second : nullptr;
+
+    const uint64_t payload = caption.size() + (before ? before->size() : 0) + data.size();
+    const uint64_t size = Aligned(sizeof(Entry) + payload);
+    if (size > capacity / c_MaximumEntryShare)
+        return; // читатели заметят пропуск номера и возьмут запись из файла
+
+    uint64_t position = header->published.load(std::memory_order_relaxed);
+    uint64_t offset = position % capacity;
+    uint64_t padding = offset + size > capacity ? capacity - offset : 0;
+
+    /* Граница затирания объявляется до изменения данных */
+    header->reserved.store(position + padding + size, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (padding)
+    {
+        uint32_t fill[2] = { uint32_t(padding), c_PaddingType };
+        memcpy(entryAt(position), fill, c_PaddingSize);
+        position += padding;
+    }
+
+    Entry entry = { uint32_t(size), uint32_t(task.type), int64_t(task.stamp.getTime()), task.stamp.getNanoseconds(),
+        task.id.asSerializedValue(), sequence, uint32_t(caption.size()), uint32_t(before ? before->size() : 0), uint32_t(data.size()), 0 };
+    char* target = entryAt(position);
+    memcpy(target, &entry, sizeof(entry));
+    target += sizeof(entry);
+    if (!caption.empty())
+        memcpy(target, caption.data(), caption.size());
+    target += caption.size();
+    if (before && !before->empty())
+        memcpy(target, before->data(), before->size());
+    target += entry.beforeSize;
+    if (!data.empty())
+        memcpy(target, data.data(), data.size());
+
+    header->published.store(position + size, std::memory_order_release);
+}
+
+uint64_t LiveRing::head() const
+{
+    return header->published.load(std::memory_order_acquire);
+}
+
+LiveRing::Fetch LiveRing::fetch(uint64_t& position, LiveRecord& record) const
+{
+    while (true)
+    {
+        const uint64_t published = header->published.load(std::memory_order_acquire);
+        if (position == published)
+            return Fetch::Empty;
+        if (position > published || published - position > capacity)
+            return Fetch::Overrun;
+
+        /* Данные копируются до проверки; если писатель успел их затереть, копия отбрасывается */
+        const uint64_t offset = position % capacity;
+        uint32_t fill[2];
+        memcpy(fill, entryAt(position), c_PaddingSize);
+        Entry entry = {};
+        bool sane = fill[0] >= c_PaddingSize && fill[0] % c_Alignment == 0 && offset + fill[0] <= capacity;
+        if (sane && c_PaddingType != fill[1])
+        {
+            memcpy(&entry, entryAt(position), sizeof(entry));
+            sane = fill[0] >= sizeof(Entry)
+                && uint64_t(entry.captionSize) + entry.beforeSize + entry.dataSize <= fill[0] - sizeof(Entry);
+            if (sane)
+            {
+                const char* source = entryAt(position) + sizeof(Entry);
+                record.caption.assign(source, source + entry.captionSize);
+                source += entry.captionSize;
+                record.before.assign(source, source + entry.beforeSize);
+                source += entry.beforeSize;
+                record.data.assign(source, source + entry.dataSize);
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->reserved.load(std::memory_order_relaxed) > position + capacity || !sane)
+            return Fetch::Overrun;
+
+        position += fill[0];
+        if (c_PaddingType == fill[1])
+            continue;
+
+        record.type = RecordType(entry.type);
+        record.stamp = Stamp(time_t(entry.time), entry.nanoseconds);
+        record.identifier.deserialize(entry.id);
+        record.sequence = entry.sequence;
+        return Fetch::Record;
+    }
+}
@@ -0,0 +1,69 @@
+﻿#pragma once
+
+#include <atomic>
+#include "bbx_Requirements.h"
+#include "bbx_LiveFeed.h"
+
+namespace Bbx
+{
+    namespace Impl
+    {
+        struct WriterTask;
+
+        /**
+        @brief Кольцевой буфер записей ящика в разделяемой памяти (лента для читателей этого компьютера).
+        Имя буфера выводится из пути файла-признака писателя, поэтому лента у ящика одна.
+        Писатель - единственный производитель: перед записью элемента объявляет затираемую границу (reserved),
+        после записи публикует новый конец (published). Читатель копирует элемент и проверяет,
+        что граница затирания не дошла до его позиции; иначе позиция считается потерянной (Overrun).
+        Блокировок нет, писатель никогда не ждёт читателей.
+        */
+        class LiveRing : boost::noncopyable
+        {
+        public:
+            enum class Fetch
+            {
+                Record,  // запись скопирована, позиция передвинута
+                Empty,   // новых записей нет
+                Overrun  // позиция затёрта писателем
+            };
+
+            ~LiveRing();
+
+            /** @brief Создание ленты писателем (или повторное использование оставшейся ленты того же размера).
+            Лента доступна другим пользователям только для чтения */
+            static LiveRing* create(const Bbx::Location& location, size_t capacity);
+            /** @brief Подключение читателя к ленте работающего писателя
+            @return nullptr, если писатель ленту не ведёт или в ленту может писать не только он */
+            static LiveRing* open(const Bbx::Location& location);
+
+            /** @brief Публикация записи; слишком крупные записи пропускаются (читатели возьмут их из файла) */
+            void publish(const WriterTask& task, uint64_t sequence);
+
+            /** @brief Позиция, с которой будут выданы следующие опубликованные записи */
+            uint64_t head() const;
+            /** @brief Копирование записи с позиции position */
+            Fetch fetch(uint64_t& position, LiveRecord& record) const;
+
+        private:
+            struct Header;
+            struct Entry;
+
+            LiveRing();
+            bool map(size_t size, bool writable);
+            char* entryAt(uint64_t position) const;
+
+            Header* header;
+            char* data;       // начало кольца за заголовком
+            uint64_t capacity;
+            size_t mappedSize;
+            bool owner;       // лента создана писателем и удаляется вместе с ним
+#ifndef LINUX
+            HANDLE mapping;
+#else
+            int fd;
+            std::string name;
+#endif
+        };
+    }
+}
@@ -56,6 +56,7 @@ namespace { // анонимное пространство - только вну
         ~FreshedFolder();
         void add( const std::wstring& directory, const std::wstring& fileMask );
         PCFileChain getFileChain( const std::wstring& directory, const std::wstring& fileMask );
+        void refresh( const std::wstring& directory );
         void clear();
 
     private:
@@ -71,6 +72,7 @@ namespace { // анонимное пространство - только вну
             Looker               m_looker;
             std::vector<SubData> m_subdata;
         };
+        static void rebuild( NodeData& node );
     private:
         std::mutex                         m_mtx;
         std::map< std::wstring, NodeData > m_data; // папка|маска и ее данные
@@ -330,6 +332,11 @@ void Bbx::Location::clearFolderCache()
     fresh.clear();
 }
 
+void Bbx::Location::refreshFolderCache() const
+{
+    fresh.refresh( directory );
+}
+
 
 FreshedFolder::FreshedFolder()
     : m_data()
@@ -383,19 +390,7 @@ std::shared_ptr<const Bbx::FileChain> FreshedFolder::getFileChain( const std::ws
     if ( m_data.end() != it ) {
         NodeData& node = it->second;
         if ( node.m_looker.occur() )
-        {
-            // пересобрать данные этой папки/маски
-            for( auto& sub : node.m_subdata )
-            {
-                size_t sz = 0;
-                if ( sub.m_curr )
-                    sz = sub.m_curr->getNumberOfFiles()+2;
-                else
-                    sz = 100;
-                sub.m_work = std::make_shared<Bbx::FileChain>( node.m_looker.folder(), sub.m_mask, sz );
-                std::swap( sub.m_curr, sub.m_work );
-            }
-        }
+            rebuild( node );
         for( auto& sd : it->second.m_subdata ) {
             if ( sd.m_mask == fileMask ) {
                 return sd.m_curr;
@@ -405,6 +400,30 @@ std::shared_ptr<const Bbx::FileChain> FreshedFolder::getFileChain( const std::ws
     return nullptr;
 }
 
+// пересобрать данные папки немедленно (размеры файлов запоминаются при сборке)
+void FreshedFolder::refresh( const std::wstring& directory )
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    auto it = m_data.find( directory );
+    if ( m_data.end() != it )
+        rebuild( it->second );
+}
+
+// пересобрать данные всех масок папки
+void FreshedFolder::rebuild( NodeData& node )
+{
+    for( auto& sub : node.m_subdata )
+    {
+        size_t sz = 0;
+        if ( sub.m_curr )
+            sz = sub.m_curr->getNumberOfFiles()+2;
+        else
+            sz = 100;
+        sub.m_work = std::make_shared<Bbx::FileChain>( node.m_looker.folder(), sub.m_mask, sz );
+        std::swap( sub.m_curr, sub.m_work );
+    }
+}
+
 void FreshedFolder::clear()
 {
     std::lock_guard<std::mutex> lock(m_mtx);
@@ -31,6 +31,7 @@ namespace Bbx
         const std::wstring& getFolder() const { return directory; }
 		const std::wstring& getMask() const { return mask_only; }
         static void clearFolderCache();
+        void refreshFolderCache() const; // пересборка набора файлов каталога, не дожидаясь наблюдателя
 
         struct PathComparator // компаратор имен файлов черного ящика
         {
@@ -0,0 +1,177 @@
+﻿#include "stdafx.h"
+
+#include "bbx_MergeIterator.h"
+
+using namespace Bbx;
+
+MergedRecord::MergedRecord()
+    : input(0), type(RecordType::Reference), stamp(), sequence(0), identifier(),
+    caption(), data(), before(), newSession(false), gap(false)
+{
+}
+
+bool MergeIterator::Head::operator >(const Head& other) const
+{
+    if (stamp != other.stamp)
+        return stamp > other.stamp;
+    if (sequence != other.sequence)
+        return sequence > other.sequence;
+    return input > other.input;
+}
+
+MergeIterator::MergeIterator(const std::vector<Location>& locations, size_t _readahead)
+    : inputs(locations.size()), heap(), readahead(std::max<size_t>(1, _readahead))
+{
+    for (size_t i = 0; i < locations.size(); ++i)
+    {
+        inputs[i].reader.reset(new Reader(locations[i]));
+        inputs[i].positioned = false;
+        inputs[i].sessionBreak = false;
+        inputs[i].lastSequence = 0;
+        inputs[i].result = ReadResult::NoDataAvailable;
+    }
+}
+
+MergeIterator::~MergeIterator()
+{
+}
+
+size_t MergeIterator::inputsCount() const
+{
+    return inputs.size();
+}
+
+ReadResult MergeIterator::inputResult(size_t input) const
+{
+    ASSERT(input < inputs.size());
+    return inputs[input].result;
+}
+
+bool MergeIterator::rewindToBegin()
+{
+    for (Input& source : inputs)
+    {
+        source.reader->setDirection(true);
+        source.result = source.reader->rewind(source.reader->getBoundStamp().first);
+        source.positioned = source.result;
+    }
+    restart();
+    return !heap.empty();
+}
+
+bool MergeIterator::rewind(const Stamp& where)
+{
+    for (Input& source : inputs)
+    {
+        Reader& reader = *source.reader;
+        reader.setDirection(true);
+        source.result = reader.rewind(where);
+        if (source.result && reader.getCurrentStamp().getTime() > where.getTime())
+        {
+            /* Перемотка находит ближайшую опорную запись, а нужна предшествующая */
+            reader.setDirection(false);
+            while (reader.next() && reader.getCurrentType() != RecordType::Reference)
+                ;
+            if (reader.getCurrentType() != RecordType::Reference)
+                source.result = reader.rewind(where); // раньше опорных записей нет
+            reader.setDirection(true);
+        }
+        source.positioned = source.result;
+    }
+    restart();
+    return !heap.empty();
+}
+
+bool MergeIterator::next(MergedRecord& record)
+{
+    if (heap.empty())
+        return false;
+
+    size_t input = heap.top().input;
+    heap.pop();
+    Input& source = inputs[input];
+    record = std::move(source.buffer.front());
+    source.buffer.pop_front();
+    if (source.buffer.empty())
+        fill(input);
+    pushHead(input);
+    return true;
+}
+
+void MergeIterator::restart()
+{
+    heap = decltype(heap)();
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        inputs[i].buffer.clear();
+        inputs[i].sessionBreak = false;
+        inputs[i].lastSequence = 0;
+        fill(i);
+        pushHead(i);
+    }
+}
+
+bool MergeIterator::fill(size_t input)
+{
+    Input& source = inputs[input];
+    while (source.positioned && source.buffer.size() < readahead)
+    {
+        source.buffer.emplace_back();
+        if (!readRecord(source, source.buffer.back()))
+            source.buffer.pop_back();
+        else
+            source.buffer.back().input = input;
+
+        ReadResult moved = source.reader->next();
+        if (ReadResult::NewSession == moved)
+        {
+            /* Разрыв ящика: переход к следующей сессии с отметкой её первой записи */
+            moved = source.reader->forceNext();
+            source.sessionBreak = true;
+        }
+        if (!moved)
+        {
+            source.positioned = false;
+            source.result = moved;
+        }
+    }
+    return !source.buffer.empty();
+}
+
+bool MergeIterator::readRecord(Input& source, MergedRecord& record)
+{
+    Reader& reader = *source.reader;
+    record.sequence = reader.getCurrentSequence();
+    if (record.sequence && record.sequence == source.lastSequence)
+        return false; // опорная запись, повторённая в начале следующего файла
+    if (!reader.readAnyRecord(record.stamp, record.caption, record.data))
+        return false; // повреждённая запись пропускается, чтение продолжается со следующей
+    record.gap = source.lastSequence && record.sequence && record.sequence != source.lastSequence + 1;
+    source.lastSequence = record.sequence;
+
+    record.type = reader.getCurrentType();
+    record.identifier = reader.getCurrentIdentifier();
+    record.newSession = source.sessionBreak;
+    source.sessionBreak = false;
+    if (RecordType::Increment == record.type)
+    {
+        /* Фрагмент "до" доступен только при чтении в обратном направлении */
+        Stamp stamp_before;
+        char_vec caption_before;
+        reader.setDirection(false);
+        reader.readIncrementOriented(stamp_before, caption_before, record.before);
+        reader.setDirection(true);
+    }
+    else
+        record.before.clear();
+    return true;
+}
+
+void MergeIterator::pushHead(size_t input)
+{
+    const Input& source = inputs[input];
+    if (source.buffer.empty())
+        return;
+    Head head = { source.buffer.front().stamp, source.buffer.front().sequence, input };
+    heap.push(head);
+}
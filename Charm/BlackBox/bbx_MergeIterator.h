@@ -0,0 +1,90 @@
+﻿#pragma once
+
+#include <deque>
+#include <queue>
+#include "bbx_BlackBox.h"
+
+namespace Bbx
+{
+    /** @brief Запись, выданная слиянием нескольких черных ящиков */
+    struct MergedRecord
+    {
+        size_t input;          // номер ящика в списке слияния
+        RecordType type;
+        Stamp stamp;
+        uint64_t sequence;     // сквозной номер в своём ящике (0 - неизвестен)
+        Identifier identifier;
+        char_vec caption;
+        char_vec data;         // данные записи (для инкремента - фрагмент "после")
+        char_vec before;       // только для инкремента - фрагмент "до"
+        bool newSession;       // перед записью в своём ящике обнаружен разрыв
+        bool gap;              // перед записью в своём ящике пропущены сквозные номера
+
+        MergedRecord();
+    };
+
+    /**
+    @brief Слияние нескольких черных ящиков в один поток записей, упорядоченный по времени.
+    Каждый ящик читается своим читателем с упреждением на несколько записей,
+    очередная запись выбирается пирамидой по штампу, при равенстве - по сквозному номеру и номеру ящика.
+    Записи одного ящика выдаются в исходном порядке; повтор опорной записи в начале следующего файла
+    пропускается, разрывы ящика (NewSession) проходятся с отметкой newSession у первой записи новой сессии.
+    */
+    class MergeIterator
+    {
+    public:
+        static const size_t c_defaultReadahead = 64;
+
+        explicit MergeIterator(const std::vector<Location>& locations, size_t readahead = c_defaultReadahead);
+        ~MergeIterator();
+
+        /** @brief Установка каждого ящика на его первую запись */
+        bool rewindToBegin();
+
+        /** @brief Установка каждого ящика на опорную запись не позже where (если такой нет - на первую опорную)
+        @return false, если ни один ящик не содержит записей */
+        bool rewind(const Stamp& where);
+
+        /** @brief Получение очередной записи
+        @return false, если записи во всех ящиках закончились */
+        bool next(MergedRecord& record);
+
+        size_t inputsCount() const;
+
+        /** @brief Код, которым завершилось чтение ящика (NoDataAvailable при нормальном окончании) */
+        ReadResult inputResult(size_t input) const;
+
+    private:
+        struct Input
+        {
+            std::unique_ptr<Reader> reader;
+            std::deque<MergedRecord> buffer; // прочитанные с упреждением записи
+            bool positioned;                 // читатель стоит на непрочитанной записи
+            bool sessionBreak;               // следующая прочитанная запись начинает новую сессию
+            uint64_t lastSequence;           // номер последней прочитанной записи
+            ReadResult result;
+        };
+
+        /** @brief Голова очереди ящика в пирамиде слияния */
+        struct Head
+        {
+            Stamp stamp;
+            uint64_t sequence;
+            size_t input;
+
+            bool operator >(const Head& other) const;
+        };
+
+        std::vector<Input> inputs;
+        std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heap;
+        size_t readahead;
+
+        MergeIterator(const MergeIterator&);
+        MergeIterator& operator =(const MergeIterator&);
+
+        void restart();
+        bool fill(size_t input);
+        bool readRecord(Input& source, MergedRecord& record);
+        void pushHead(size_t input);
+    };
+}
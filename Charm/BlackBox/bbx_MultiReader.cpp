@@ -0,0 +1,356 @@
+﻿#include "stdafx.h"
+
+#include "bbx_MultiReader.h"
+#include "../helpful/RT_ThreadName.h"
+
+using namespace Bbx;
+
+namespace
+{
+    const size_t c_noInput = size_t(-1);
+
+    /** @brief Переход к следующей записи; разрыв ящика проходится с отметкой */
+    ReadResult Advance(LocalReader& reader, bool& sessionBreak)
+    {
+        ReadResult moved = reader.next();
+        if (ReadResult::NewSession == moved)
+        {
+            moved = reader.forceNext();
+            sessionBreak = true;
+        }
+        return moved;
+    }
+}
+
+bool MultiReader::Head::operator >(const Head& other) const
+{
+    if (stamp != other.stamp)
+        return stamp > other.stamp;
+    if (sequence != other.sequence)
+        return sequence > other.sequence;
+    return input > other.input;
+}
+
+bool MultiReader::Later::operator ()(const Head& left, const Head& right) const
+{
+    return forward ? left > right : right > left;
+}
+
+MultiReader::MultiReader(const std::vector<Location>& locations, size_t _readahead)
+    : inputs(), heap(Later{ true }), readahead(std::max<size_t>(1, _readahead)), forward(true), current(c_noInput)
+{
+    for (const Location& location : locations)
+    {
+        std::unique_ptr<Input> source(new Input);
+        source->reader.reset(new LocalReader(location));
+        source->positioned = false;
+        source->sessionBreak = false;
+        source->lastSequence = 0;
+        source->finished = true;
+        source->stopping = false;
+        source->result = ReadResult::NoDataAvailable;
+        source->emitted = false;
+        source->emittedSequence = 0;
+        inputs.push_back(std::move(source));
+    }
+}
+
+MultiReader::~MultiReader()
+{
+    stopPrefetch();
+}
+
+size_t MultiReader::inputsCount() const
+{
+    return inputs.size();
+}
+
+ReadResult MultiReader::inputResult(size_t input) const
+{
+    ASSERT(input < inputs.size());
+    boost::lock_guard<boost::mutex> lock(inputs[input]->mutex);
+    return inputs[input]->result;
+}
+
+bool MultiReader::getDirection() const
+{
+    return forward;
+}
+
+bool MultiReader::rewindToBegin()
+{
+    stopPrefetch();
+    current = c_noInput;
+    forward = true;
+    for (auto& source : inputs)
+    {
+        LocalReader& reader = *source->reader;
+        reader.setDirection(true);
+        source->result = reader.rewind(reader.getBoundStamp().first);
+        source->positioned = source->result;
+    }
+    return restart();
+}
+
+bool MultiReader::rewindToEnd()
+{
+    stopPrefetch();
+    current = c_noInput;
+    forward = false;
+    for (auto& source : inputs)
+    {
+        LocalReader& reader = *source->reader;
+        /* Граница ящика секундная, последняя запись может быть внутри этой секунды */
+        const Stamp last(reader.getBoundStamp().second.getTime(), 999999999u);
+        source->positioned = positionBackward(reader, last);
+        source->result = source->positioned ? ReadResult::Success : reader.lastResult();
+    }
+    return restart();
+}
+
+bool MultiReader::rewind(const Stamp& where)
+{
+    stopPrefetch();
+    current = c_noInput;
+    for (auto& source : inputs)
+    {
+        LocalReader& reader = *source->reader;
+        if (!forward)
+        {
+            source->positioned = positionBackward(reader, where);
+            source->result = source->positioned ? ReadResult::Success : reader.lastResult();
+            continue;
+        }
+
+        reader.setDirection(true);
+        source->result = reader.rewind(where);
+        if (source->result && reader.getCurrentStamp() > where)
+        {
+            /* Перемотка находит ближайшую опорную запись, а нужна предшествующая */
+            reader.setDirection(false);
+            while (reader.next() && reader.getCurrentType() != RecordType::Reference)
+                ;
+            if (reader.getCurrentType() != RecordType::Reference)
+                source->result = reader.rewind(where); // раньше опорных записей нет
+            reader.setDirection(true);
+        }
+        source->positioned = source->result;
+    }
+    return restart();
+}
+
+void MultiReader::setDirection(bool goForward)
+{
+    if (goForward == forward)
+        return;
+
+    /* Записи, выданные до последней включительно, остаются позади, невыданные упреждённые - впереди.
+    Каждый ящик ставится на границу между ними: ящик последней записи - на неё, остальные - на первую
+    невыданную запись (или на последнюю выданную, если впереди записей не было) */
+    stopPrefetch();
+    forward = goForward;
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        Input& source = *inputs[i];
+        LocalReader& reader = *source.reader;
+        const ReaderPosition* anchor = nullptr;
+        bool behind = true; // запись границы уже выдана в новом направлении
+        if (i == current)
+            anchor = &source.lastEmitted;
+        else if (!source.buffer.empty())
+            anchor = &source.buffer.front().position;
+        else if (source.emitted)
+        {
+            anchor = &source.lastEmitted;
+            behind = false;
+        }
+
+        source.sessionBreak = false;
+        source.positioned = anchor && reader.rewindToPosition(*anchor);
+        reader.setDirection(forward);
+        if (source.positioned && behind)
+        {
+            source.positioned = Advance(reader, source.sessionBreak);
+            if (i != current)
+                source.sessionBreak = false; // разрыв перед невыданной записью в новом направлении не виден
+        }
+        if (!source.positioned)
+            source.result = reader.lastResult();
+    }
+    restart();
+}
+
+bool MultiReader::next(MergedRecord& record)
+{
+    if (heap.empty())
+        return false;
+
+    size_t input = heap.top().input;
+    heap.pop();
+    Input& source = *inputs[input];
+    Prefetched item;
+    {
+        boost::unique_lock<boost::mutex> lock(source.mutex);
+        item = std::move(source.buffer.front());
+        source.buffer.pop_front();
+        source.changed.notify_all();
+        while (source.buffer.empty() && !source.finished)
+            source.changed.wait(lock);
+    }
+    record = std::move(item.record);
+    source.emitted = true;
+    source.lastEmitted = std::move(item.position);
+    source.emittedSequence = record.sequence;
+    current = input;
+    pushHead(input);
+    return true;
+}
+
+void MultiReader::stopPrefetch()
+{
+    for (auto& source : inputs)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(source->mutex);
+            source->stopping = true;
+        }
+        source->changed.notify_all();
+        if (source->prefetcher.joinable())
+            source->prefetcher.join();
+    }
+}
+
+bool MultiReader::restart()
+{
+    /* Номер последней выданной записи нужен, чтобы не повторить её копию в соседнем файле */
+    heap = decltype(heap)(Later{ forward });
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        Input& source = *inputs[i];
+        source.lastSequence = i == current ? source.emittedSequence : 0;
+        source.buffer.clear();
+        source.finished = false;
+        source.stopping = false;
+        source.emitted = false;
+        source.prefetcher = boost::thread(&MultiReader::prefetch, this, i);
+    }
+    current = c_noInput;
+
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        Input& source = *inputs[i];
+        {
+            boost::unique_lock<boost::mutex> lock(source.mutex);
+            while (source.buffer.empty() && !source.finished)
+                source.changed.wait(lock);
+        }
+        pushHead(i);
+    }
+    return !heap.empty();
+}
+
+void MultiReader::prefetch(size_t input)
+{
+    RT_SetThreadName("Bbx::MultiReader");
+    Input& source = *inputs[input];
+    while (true)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(source.mutex);
+            while (!source.stopping && source.buffer.size() >= readahead)
+                source.changed.wait(lock);
+            if (source.stopping)
+                return;
+            if (!source.positioned)
+            {
+                source.finished = true;
+                source.changed.notify_all();
+                return;
+            }
+        }
+
+        Prefetched item;
+        item.position = source.reader->getPosition();
+        bool read = readRecord(source, item.record);
+        item.record.input = input;
+        ReadResult moved = Advance(*source.reader, source.sessionBreak);
+        source.positioned = moved;
+
+        boost::lock_guard<boost::mutex> lock(source.mutex);
+        if (read)
+            source.buffer.push_back(std::move(item));
+        if (!moved)
+            source.result = moved;
+        source.changed.notify_all();
+    }
+}
+
+bool MultiReader::readRecord(Input& source, MergedRecord& record)
+{
+    LocalReader& reader = *source.reader;
+    record.sequence = reader.getCurrentSequence();
+    if (record.sequence && record.sequence == source.lastSequence)
+        return false; // опорная запись, повторённая в соседнем файле
+
+    /* Читатель отдаёт фрагмент инкремента по своему направлению, второй фрагмент - при обратном */
+    record.type = reader.getCurrentType();
+    const bool increment = RecordType::Increment == record.type;
+    if (!reader.readAnyRecord(record.stamp, record.caption, increment && !forward ? record.before : record.data))
+        return false; // повреждённая запись пропускается, чтение продолжается со следующей
+    if (increment)
+    {
+        Stamp stamp_other;
+        char_vec caption_other;
+        reader.setDirection(!forward);
+        reader.readIncrementOriented(stamp_other, caption_other, forward ? record.before : record.data);
+        reader.setDirection(forward);
+    }
+    else
+        record.before.clear();
+
+    const uint64_t expected = forward ? source.lastSequence + 1 : source.lastSequence - 1;
+    record.gap = source.lastSequence && record.sequence && record.sequence != expected;
+    source.lastSequence = record.sequence;
+    record.identifier = reader.getCurrentIdentifier();
+    record.newSession = source.sessionBreak;
+    source.sessionBreak = false;
+    return true;
+}
+
+bool MultiReader::positionBackward(LocalReader& reader, const Stamp& where)
+{
+    bool sessionBreak = false;
+    reader.setDirection(true);
+    if (!reader.rewind(where))
+        return false;
+
+    if (reader.getCurrentStamp() <= where)
+    {
+        /* Перемотка находит ближайшую опорную запись, за ней могут быть записи не позже where */
+        ReadResult moved;
+        while ((moved = Advance(reader, sessionBreak)) && reader.getCurrentStamp() <= where)
+            ;
+        reader.setDirection(false);
+        if (moved)
+            Advance(reader, sessionBreak);
+        return true;
+    }
+
+    reader.setDirection(false);
+    while (reader.getCurrentStamp() > where)
+    {
+        if (!Advance(reader, sessionBreak))
+            return false; // раньше where записей нет
+    }
+    return true;
+}
+
+void MultiReader::pushHead(size_t input)
+{
+    const Input& source = *inputs[input];
+    boost::lock_guard<boost::mutex> lock(source.mutex);
+    if (source.buffer.empty())
+        return;
+    Head head = { source.buffer.front().record.stamp, source.buffer.front().record.sequence, input };
+    heap.push(head);
+}
@@ -0,0 +1,118 @@
+﻿#pragma once
+
+#include <deque>
+#include <queue>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "bbx_MergeIterator.h"
+
+namespace Bbx
+{
+    /**
+    @brief Синхронное воспроизведение нескольких черных ящиков (например, входа Харона и Фонда) одним потоком записей.
+    В отличие от MergeIterator поддерживает чтение в обоих направлениях и смену направления в любой момент:
+    после смены выдаются записи, предшествующие последней выданной в порядке нового направления, как у Reader.
+    Каждый ящик читается с упреждением своим потоком, поэтому ящики подкачиваются параллельно,
+    а выдача записи не ждёт чтения файлов, пока упреждение не исчерпано.
+    Разрывы каждого ящика отмечаются newSession у первой записи после разрыва,
+    пропуски сквозных номеров между соседними записями ящика - отметкой gap.
+    Методы вызываются из одного потока.
+    */
+    class MultiReader
+    {
+    public:
+        static const size_t c_defaultReadahead = 64;
+
+        explicit MultiReader(const std::vector<Location>& locations, size_t readahead = c_defaultReadahead);
+        ~MultiReader();
+
+        /** @brief Чтение вперёд с первой записи каждого ящика */
+        bool rewindToBegin();
+        /** @brief Чтение назад с последней записи каждого ящика */
+        bool rewindToEnd();
+
+        /** @brief Установка каждого ящика на момент where в текущем направлении:
+        вперёд - с опорной записи не позже where (если такой нет - с первой опорной), назад - с последней записи не позже where
+        @return false, если ни в одном ящике нет записей */
+        bool rewind(const Stamp& where);
+
+        /** @brief Смена направления чтения без потери позиции */
+        void setDirection(bool goForward);
+        bool getDirection() const;
+
+        /** @brief Получение очередной записи в текущем направлении
+        @return false, если записи во всех ящиках закончились */
+        bool next(MergedRecord& record);
+
+        size_t inputsCount() const;
+
+        /** @brief Код, которым завершилось чтение ящика (NoDataAvailable при нормальном окончании) */
+        ReadResult inputResult(size_t input) const;
+
+    private:
+        /** @brief Запись, прочитанная с упреждением, и позиция, с которой она прочитана */
+        struct Prefetched
+        {
+            MergedRecord record;
+            ReaderPosition position;
+        };
+
+        struct Input
+        {
+            std::unique_ptr<LocalReader> reader; // пока идёт упреждение, принадлежит его потоку
+            bool positioned;                     // читатель стоит на непрочитанной записи
+            bool sessionBreak;                   // следующая прочитанная запись начинает новую сессию
+            uint64_t lastSequence;               // номер последней прочитанной записи
+
+            mutable boost::mutex mutex;
+            boost::condition_variable changed;   // в буфере появилась запись или место, чтение закончено или остановлено
+            std::deque<Prefetched> buffer;
+            bool finished;                       // упреждение дошло до конца ящика
+            bool stopping;
+            ReadResult result;
+            boost::thread prefetcher;
+
+            bool emitted;                        // из ящика выдана хотя бы одна запись
+            ReaderPosition lastEmitted;          // позиция последней выданной записи
+            uint64_t emittedSequence;
+        };
+
+        /** @brief Голова очереди ящика в пирамиде слияния */
+        struct Head
+        {
+            Stamp stamp;
+            uint64_t sequence;
+            size_t input;
+
+            bool operator >(const Head& other) const;
+        };
+
+        /** @brief Порядок выдачи: при чтении назад - обратный */
+        struct Later
+        {
+            bool forward;
+
+            bool operator ()(const Head& left, const Head& right) const;
+        };
+
+        std::vector<std::unique_ptr<Input>> inputs;
+        std::priority_queue<Head, std::vector<Head>, Later> heap;
+        size_t readahead;
+        bool forward;
+        size_t current; // ящик последней выданной записи
+
+        MultiReader(const MultiReader&);
+        MultiReader& operator =(const MultiReader&);
+
+        void stopPrefetch();
+        /** @brief Запуск упреждения с позиций читателей и построение пирамиды */
+        bool restart();
+        void prefetch(size_t input);
+        /** @brief Переход читателя к следующей записи через разрыв ящика */
+        ReadResult step(Input& source);
+        bool readRecord(Input& source, MergedRecord& record);
+        /** @brief Установка на последнюю запись не позже where */
+        bool positionBackward(LocalReader& reader, const Stamp& where);
+        void pushHead(size_t input);
+    };
+}
@@ -3,6 +3,7 @@
 #include "bbx_Record.h"
 #include "bbx_Page.h"
 #include "bbx_File.h"
+#include "bbx_Crc32c.h"
 
 using namespace Bbx::Impl;
 namespace bt = boost::posix_time;
@@ -10,6 +11,15 @@ namespace bt = boost::posix_time;
 /** @brief Задержка между поступлением данных и их записью в файл */
 bt::time_duration Page::DeviateDelay = bt::milliseconds(500);// текущее значение
 
+namespace
+{
+    /** @brief Смещение счётчика фиксации от начала страницы */
+    const unsigned c_CommitOffset = sizeof(PageHeader) + sizeof(PageExtension);
+
+    /** @brief Попыток прочитать заголовок страницы, не изменявшийся во время чтения */
+    const unsigned c_PublishedReadAttempts = 1000;
+}
+
 PartHeader::PartHeader(bool containsBeginOfTheRecord, const Bbx::Identifier id, time_t time, Bbx::RecordType recordType, unsigned buf_size, bool containsEndOfTheRecord)
     : tag(Tag::Full), type(recordType), stamp(time), id(id.asSerializedValue()), size(buf_size)
 {
@@ -39,7 +49,8 @@ void PageWriter::init()
 
     header.write(reserve(sizeof(PageHeader)));
 
-    // Заполнение зоны расширения нулями (пока нет необходимости заполнять чем-то еще)
+    // Зона расширения заполняется нулями, номер первой записи вписывается при её добавлении
+    ASSERT(header.getExtensionSize() >= sizeof(PageExtension));
     reserve(header.getExtensionSize()).fillWithNulls();
 }
 
@@ -50,6 +61,9 @@ void PageWriter::createNextPage()
     writtenBytes = 0;
     elderRecordMoment = bt::ptime();
     header = PageHeader(header.getExtensionSize());
+    extension = PageExtension();
+    extensionChanged = false;
+    commit = PageCommit();
 
     init();
 }
@@ -78,6 +92,14 @@ void PageWriter::appendRecord(RecordOut& record)
     time_t recordTime = record.getStamp().getTime();
     new (headerBuf.data_ptr) PartHeader(recordStarted, record.getId(), recordTime, record.getType(), dataBuf.size, recordFinished);
 
+    /* Первый кусочек страницы задаёт номер, от которого отсчитываются остальные */
+    if (!extension.sequence && record.getSequence())
+    {
+        extension.sequence = record.getSequence();
+        memcpy(begin(data) + sizeof(PageHeader), &extension, sizeof(PageExtension));
+        extensionChanged = true;
+    }
+
     header.addRecordTime(recordTime);
     if ( elderRecordMoment.is_not_a_date_time() )
         elderRecordMoment = bt::microsec_clock::universal_time();
@@ -161,23 +183,35 @@ void PageWriter::writeCacheToFile(const FileId& file)
     Bbx::Buffer headerData = Bbx::Buffer(begin(data), sizeof(PageHeader));
     new (reinterpret_cast<void *>(headerData.data_ptr)) PageHeader(header);
 
-    OwnSection headerSection(file, address.offset, sizeof(PageHeader));
-    if (writeNewDataToFile(file))
+    if (commitCounters)
     {
-        headerSection.write(headerData);
-        elderRecordMoment = bt::ptime();
+        if (writeNewDataToFile(file) && publishToFile(file))
+            elderRecordMoment = bt::ptime();
+    }
+    else
+    {
+        OwnSection headerSection(file, address.offset, sizeof(PageHeader));
+        if (writeExtensionToFile(file) && writeNewDataToFile(file))
+        {
+            headerSection.write(headerData);
+            elderRecordMoment = bt::ptime();
+        }
     }
 
     if( cacheFullyFilledAndWroteToFile() )
+    {
+        if (checksums)
+            writeChecksumToFile(file);
         createNextPage();
+    }
 }
 
 bool PageWriter::writeNewDataToFile(const FileId& file)
 {
     Bbx::Buffer dataForWriting = getDataBufferForWriting();
-    unsigned long dataOffset = address.offset + sizeof(PageHeader) + writtenBytes;
+    BBX_SIZE dataOffset = address.offset + sizeof(PageHeader) + writtenBytes;
     
-    OwnSection dataLocked(file, dataOffset, dataForWriting.size);
+    OwnSection dataLocked(file, dataOffset, dataForWriting.size, !commitCounters);
 
     if (dataLocked.write(dataForWriting))
     {
@@ -190,6 +224,71 @@ bool PageWriter::writeNewDataToFile(const FileId& file)
     }
 }
 
+bool PageWriter::writeExtensionToFile(const FileId& file)
+{
+    if (!extensionChanged)
+        return true;
+
+    /* Ещё не записанная зона расширения уйдёт в файл вместе с данными */
+    extensionChanged = false;
+    if (writtenBytes < sizeof(PageExtension))
+        return true;
+
+    OwnSection extensionSection(file, address.offset + sizeof(PageHeader), sizeof(PageExtension));
+    return extensionSection.write(Bbx::Buffer(begin(data) + sizeof(PageHeader), sizeof(PageExtension)));
+}
+
+bool PageWriter::writeChecksumToFile(const FileId& file)
+{
+    /* Страница больше не изменяется: сумма считается по кешу, совпадающему с файлом,
+       и записывается последней, чтобы читатель не проверял недописанную страницу */
+    ASSERT(cacheFullyFilledAndWroteToFile());
+    extension.checksum = 0;
+    extension.flags |= PageExtension::c_FlagChecksum;
+    Bbx::Buffer extensionData(begin(data) + sizeof(PageHeader), sizeof(PageExtension));
+    memcpy(extensionData.data_ptr, &extension, sizeof(PageExtension));
+    /* Сумма охватывает и окончательное значение счётчика фиксации */
+    PageCommit changing(commit.generation + 1, commit.committed);
+    if (commitCounters)
+        storeCommit(PageCommit(changing.generation + 1, commit.committed));
+    extension.checksum = crc32c(0, begin(data), data.size);
+    memcpy(extensionData.data_ptr, &extension, sizeof(PageExtension));
+
+    OwnSection extensionSection(file, address.offset + sizeof(PageHeader), sizeof(PageExtension), !commitCounters);
+    if (!commitCounters)
+        return extensionSection.write(extensionData);
+    return writeCommitToFile(file, changing) && extensionSection.write(extensionData) && writeCommitToFile(file, commit);
+}
+
+bool PageWriter::publishToFile(const FileId& file)
+{
+    /* Новые кусочки уже в файле за опубликованной границей. Заголовок и расширение
+       переписываются между нечётным и чётным поколением, чётное поколение сдвигает границу */
+    PageCommit changing(commit.generation + 1, commit.committed);
+    PageCommit published(changing.generation + 1, unsigned(sizeof(PageHeader)) + writtenBytes);
+    OwnSection headSection(file, address.offset, c_CommitOffset, false);
+    if (!writeCommitToFile(file, changing)
+        || !headSection.write(Bbx::Buffer(begin(data), c_CommitOffset))
+        || !writeCommitToFile(file, published))
+        return false;
+    storeCommit(published);
+    extensionChanged = false;
+    return true;
+}
+
+bool PageWriter::writeCommitToFile(const FileId& file, const PageCommit& value) const
+{
+    PageCommit copy = value;
+    OwnSection commitSection(file, address.offset + c_CommitOffset, sizeof(PageCommit), false);
+    return commitSection.write(Bbx::Buffer::create(copy));
+}
+
+void PageWriter::storeCommit(const PageCommit& value)
+{
+    commit = value;
+    memcpy(begin(data) + c_CommitOffset, &commit, sizeof(PageCommit));
+}
+
 bool PageWriter::cacheFullyFilledAndWroteToFile() const
 {
     return (!dataSizeRemainsToFill()) && !dataSizeRemainsToWrite();
@@ -208,7 +307,7 @@ bool PageReader::read(const FileId& file, const FileAddress& pageAddress)
 
 bool PageReader::update(const FileId& file)
 {
-    return valid() && updatePartsHeadersFromPage(file);
+    return valid() && updateCommit(file) && updatePartsHeadersFromPage(file);
 }
 
 bool PageReader::valid() const
@@ -218,14 +317,114 @@ bool PageReader::valid() const
 
 bool PageReader::readHeader(const FileId& file)
 {
-    SharedSection headerSection(file, address.offset, sizeof(PageHeader));
-    headerRead = headerSection.read(Bbx::Buffer::create(header));
+    if (commitCounters)
+        return readPublishedHeader(file);
+
+    /* Заголовок и начало зоны расширения считываются за одно обращение к файлу */
+    char head[sizeof(PageHeader) + sizeof(PageExtension)];
+    SharedSection headerSection(file, address.offset, sizeof(head));
+    headerRead = headerSection.read(Bbx::Buffer(head, sizeof(head)));
+    if (headerRead)
+    {
+        memcpy(&header, head, sizeof(PageHeader));
+        if (header.getExtensionSize() >= sizeof(PageExtension))
+            memcpy(&extension, head + sizeof(PageHeader), sizeof(PageExtension));
+        else
+            extension = PageExtension();
+    }
+    return headerRead;
+}
+
+bool PageReader::readPublishedHeader(const FileId& file)
+{
+    /* Заголовок не менялся во время чтения, если поколение до и после одинаково и чётно;
+       иначе писатель как раз обновляет страницу и чтение повторяется */
+    char head[c_CommitOffset];
+    headerRead = false;
+    for (unsigned attempt = 0; attempt < c_PublishedReadAttempts; ++attempt)
+    {
+        PageCommit before, after;
+        if (!readCommit(file, before))
+            return false;
+        if (before.generation % 2)
+        {
+            boost::this_thread::yield();
+            continue;
+        }
+        SharedSection headerSection(file, address.offset, sizeof(head), false);
+        if (!headerSection.read(Bbx::Buffer(head, sizeof(head))) || !readCommit(file, after))
+            return false;
+        if (before.generation == after.generation)
+        {
+            memcpy(&header, head, sizeof(PageHeader));
+            memcpy(&extension, head + sizeof(PageHeader), sizeof(PageExtension));
+            committedEnd = address.offset + before.committed;
+            headerRead = true;
+            break;
+        }
+    }
     return headerRead;
 }
 
+bool PageReader::readCommit(const FileId& file, PageCommit& value) const
+{
+    SharedSection commitSection(file, address.offset + c_CommitOffset, sizeof(PageCommit), false);
+    return commitSection.read(Bbx::Buffer::create(value));
+}
+
+bool PageReader::updateCommit(const FileId& file)
+{
+    if (!commitCounters)
+        return true;
+    /* Пока кусочков не было, заголовок и расширение страницы ещё не опубликованы */
+    if (committedEnd == address.offset)
+        return readPublishedHeader(file);
+
+    /* Граница только растёт и оба значения счётчика указывают на полностью записанные данные */
+    PageCommit current;
+    if (!readCommit(file, current))
+        return false;
+    committedEnd = std::max<BBX_SIZE>(committedEnd, address.offset + current.committed);
+    return true;
+}
+
+BBX_SIZE PageReader::partsEnd() const
+{
+    return commitCounters ? std::min(committedEnd, address.nextOffset()) : address.nextOffset();
+}
+
+bool PageReader::verify(const FileId& file) const
+{
+    ASSERT(valid());
+    if (!hasChecksum())
+        return true;
+
+    Bbx::char_vec page(size_t(address.size));
+    SharedSection pageSection(file, address.offset, size32(page), !commitCounters);
+    return pageSection.read(Bbx::Buffer(page)) && checksumMatches(Bbx::Buffer(page));
+}
+
+bool PageReader::checksumMatches(const Bbx::Buffer& page)
+{
+    ASSERT(page.size >= sizeof(PageHeader) + sizeof(PageExtension));
+    PageExtension stored;
+    char* extensionPtr = page.data_ptr + sizeof(PageHeader);
+    memcpy(&stored, extensionPtr, sizeof(stored));
+    if (!(stored.flags & PageExtension::c_FlagChecksum))
+        return true;
+
+    /* Сумма считалась при нулевом поле checksum */
+    PageExtension zeroed = stored;
+    zeroed.checksum = 0;
+    memcpy(extensionPtr, &zeroed, sizeof(zeroed));
+    uint32_t actual = crc32c(0, page.data_ptr, page.size);
+    memcpy(extensionPtr, &stored, sizeof(stored));
+    return actual == stored.checksum;
+}
+
 bool PageReader::readOnePartHeader(const FileId& file, PartHeaderTableRecord& partRec)
 {
-    SharedSection headerSection(file, partRec.offset, sizeof(PartHeader));
+    SharedSection headerSection(file, partRec.offset, sizeof(PartHeader), !commitCounters);
     return (headerSection.read(Bbx::Buffer::create(partRec.header)));
 }
 
@@ -250,7 +449,8 @@ bool PageReader::updatePartsHeadersFromPage(const FileId& file)
         ? (address.offset + sizeof(PageHeader) + header.getExtensionSize()) 
         : (partHeaders.back().offset + sizeof(PartHeader) + partHeaders.back().header.getSize());
 
-    bool shouldReadNextPart = (tmpRec.offset + sizeof(PartHeader) < address.nextOffset());
+    const BBX_SIZE limit = partsEnd();
+    bool shouldReadNextPart = (tmpRec.offset + sizeof(PartHeader) < limit);
 
     while (shouldReadNextPart && readOnePartHeader(file, tmpRec))
     {
@@ -262,7 +462,7 @@ bool PageReader::updatePartsHeadersFromPage(const FileId& file)
 
             /* Расчет сдвига следующего куска */
             tmpRec.offset += sizeof(PartHeader) + tmpRec.header.getSize();
-            shouldReadNextPart = (tmpRec.offset + sizeof(PartHeader) < address.nextOffset() );
+            shouldReadNextPart = (tmpRec.offset + sizeof(PartHeader) < limit );
         }
         else
         {
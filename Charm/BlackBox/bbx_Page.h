@@ -38,6 +38,44 @@ namespace Bbx
             time_t timeEnd;
         };
 
+        /**
+        @brief Начало страничной зоны расширения (с версии 4.0).
+        Содержит сквозной номер записи первого кусочка страницы, номера следующих кусочков
+        страницы идут подряд, т.к. каждый кусочек принадлежит следующей записи.
+        Полностью заполненная страница может быть закрыта контрольной суммой CRC32C
+        всей страницы, посчитанной при нулевом поле checksum.
+        */
+        struct PageExtension
+        {
+            static const uint32_t c_FlagChecksum = 0x1; // контрольная сумма заполнена
+
+            uint64_t sequence; // ноль - номер неизвестен (старые файлы или пустая страница)
+            uint32_t checksum;
+            uint32_t flags;
+
+            PageExtension() : sequence(0), checksum(0), flags(0) {}
+        };
+
+        /**
+        @brief Счётчик фиксации страницы, следует сразу за PageExtension
+        (файлы с флагом Extension::c_FlagCommitCounters).
+        Писатель не блокирует участки файла: новые кусочки дописываются за опубликованной границей,
+        а заголовок и расширение страницы меняются на месте между записью нечётного поколения
+        и следующего чётного вместе с новой границей. Читатель принимает заголовок, если поколение
+        до и после его чтения одинаково и чётно, и разбирает кусочки только до границы committed.
+        */
+        struct PageCommit
+        {
+            uint32_t generation;
+            uint32_t committed; // опубликованных байт от начала страницы (0 - кусочков ещё нет)
+
+            PageCommit() : generation(0), committed(0) {}
+            PageCommit(uint32_t _generation, uint32_t _committed) : generation(_generation), committed(_committed) {}
+        };
+
+        /** @brief Размер страничной зоны расширения со счётчиком фиксации */
+        const unsigned c_CommitPageExtensionSize = c_DefaultPageExtensionSize + unsigned(sizeof(PageCommit));
+
         class Page
         {
         public:
@@ -51,6 +89,7 @@ namespace Bbx
 
             FileAddress address;
             PageHeader header;
+            PageExtension extension;
         private:
             /** @brief Задержка между поступлением данных и их записью в файл */
             static boost::posix_time::time_duration DeviateDelay; // текущее значение
@@ -63,17 +102,27 @@ namespace Bbx
             ~PageWriter();
 
             void setAddress(const FileAddress& pageAddress);
+            /** @brief Закрывать заполненные страницы контрольной суммой */
+            void setChecksums(bool enable);
+            /** @brief Публиковать страницы счётчиком фиксации вместо блокировок (до setAddress) */
+            void setCommitCounters(bool enable);
 
             bool willWriteToFile(const RecordOut& record) const;
 			void processRecord(const FileId& file, RecordOut& record);
             void appendRecord(RecordOut& record);
             bool needsUpdate() const;
+            /** @brief Момент, после которого needsUpdate() сработает по задержке (not_a_date_time - данных нет) */
+            boost::posix_time::ptime updateDeadline() const;
             void update(const FileId& file);
 
         private:
             Buffer data;
             unsigned writtenBytes;
             boost::posix_time::ptime elderRecordMoment;
+            bool extensionChanged;
+            bool checksums;
+            bool commitCounters;
+            PageCommit commit; // последнее опубликованное значение (совпадает с кешем и файлом)
 
             void init();
             void createNextPage();
@@ -85,6 +134,11 @@ namespace Bbx
             bool cacheCanTakeNoMoreRecords() const;
             void fillRemainingSpaceWithNulls();
 			bool writeNewDataToFile(const FileId& file);
+			bool writeExtensionToFile(const FileId& file);
+			bool writeChecksumToFile(const FileId& file);
+			bool publishToFile(const FileId& file);
+			bool writeCommitToFile(const FileId& file, const PageCommit& value) const;
+			void storeCommit(const PageCommit& value);
             unsigned dataSizeRemainsToWrite() const;
             unsigned long dataSizeRemainsToFill() const;
             Buffer getDataBufferForWriting();
@@ -94,12 +148,19 @@ namespace Bbx
         class PageReader : public Page
         {
         public:
-            PageReader();
+            explicit PageReader(bool commitCounters = false);
 			bool read(const FileId& file, const FileAddress& pageAddress);
 			bool update(const FileId& file);
             bool valid() const;
             bool truncated() const;
             const PageHeader& getHeader() const;
+            const FileAddress& getAddress() const;
+            uint64_t getSequence() const;
+            bool hasChecksum() const;
+            /** @brief Считывание всей страницы и сверка её контрольной суммы */
+            bool verify(const FileId& file) const;
+            /** @brief Сверка контрольной суммы считанной в память страницы */
+            static bool checksumMatches(const Buffer& page);
             bool containsReferenceBeginningParts() const;
             bool containsAnyBeginningParts() const;
             bool containsBeginningPartsAfter(size_t from) const;
@@ -117,8 +178,14 @@ namespace Bbx
             std::vector<PartHeaderTableRecord> partHeaders;
             bool headerRead;
             bool clipped; // страница неполная т.е. обрезана
+            bool commitCounters;
+            BBX_SIZE committedEnd; // граница опубликованных кусочков (при счётчиках фиксации)
 
 			bool readHeader(const FileId& file);
+			bool readPublishedHeader(const FileId& file);
+			bool readCommit(const FileId& file, PageCommit& value) const;
+			bool updateCommit(const FileId& file);
+			BBX_SIZE partsEnd() const;
 			bool readOnePartHeader(const FileId& file, PartHeaderTableRecord& partRec);
 			bool readAllPartsHeaders(const FileId& file);
 			bool updatePartsHeadersFromPage(const FileId& file);
@@ -162,7 +229,7 @@ namespace Bbx
         { return timeEnd; }
 
         inline Page::Page()
-            : address(), header()
+            : address(), header(), extension()
         { }
 
         inline void Page::setPageAddress(const FileAddress& pageAddress)
@@ -180,10 +247,25 @@ namespace Bbx
             return sizeof(PartHeader) * 2;
         }
 
-        inline PageReader::PageReader()
-            : Page(), partHeaders(), headerRead( false ), clipped(false)
+        inline PageReader::PageReader(bool _commitCounters)
+            : Page(), partHeaders(), headerRead( false ), clipped(false), commitCounters(_commitCounters), committedEnd(0)
         { }
 
+        inline const FileAddress& PageReader::getAddress() const
+        {
+            return address;
+        }
+
+        inline uint64_t PageReader::getSequence() const
+        {
+            return extension.sequence;
+        }
+
+        inline bool PageReader::hasChecksum() const
+        {
+            return 0 != (extension.flags & PageExtension::c_FlagChecksum);
+        }
+
         inline bool PageReader::truncated() const
         {
             return clipped;
@@ -191,7 +273,7 @@ namespace Bbx
 
         inline PageWriter::PageWriter()
             : Page(), data(), writtenBytes(0),
-            elderRecordMoment()
+            elderRecordMoment(), extensionChanged(false), checksums(false), commitCounters(false), commit()
         {
         }
 
@@ -206,11 +288,28 @@ namespace Bbx
             init();
         }
 
+        inline void PageWriter::setChecksums(bool enable)
+        {
+            checksums = enable;
+        }
+
+        inline void PageWriter::setCommitCounters(bool enable)
+        {
+            ASSERT(!data.size);
+            commitCounters = enable;
+            header = PageHeader(enable ? c_CommitPageExtensionSize : c_DefaultPageExtensionSize);
+        }
+
         inline bool PageWriter::needsUpdate() const
         {
             return shouldBeFlushedNow();
         }
 
+        inline boost::posix_time::ptime PageWriter::updateDeadline() const
+        {
+            return elderRecordMoment.is_not_a_date_time() ? elderRecordMoment : elderRecordMoment + getDeviateDelay();
+        }
+
 		inline void PageWriter::update(const FileId& file)
 		{
 			if (dataSizeRemainsToWrite())
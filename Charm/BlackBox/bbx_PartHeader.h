@@ -50,7 +50,7 @@ namespace Bbx
         struct PartHeaderTableRecord
         {
             PartHeader header;
-            BBX_SIZE offset; // suppose offsetHi==0
+            BBX_SIZE offset;
 
             PartHeaderTableRecord();
             Stamp getStamp() const;
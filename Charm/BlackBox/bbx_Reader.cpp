@@ -1,51 +1,79 @@
 ﻿#include "stdafx.h"
 #ifdef LINUX
 #include <fcntl.h>
-#include <boost/filesystem/operations.hpp>
 #endif
+#include <atomic>
+#include <boost/filesystem/operations.hpp>
+#include <boost/thread/thread.hpp>
 #include "bbx_Requirements.h"
 #include "bbx_Reader.h"
 #include "bbx_FileChain.h"
 
 using namespace Bbx::Impl;
 
-ReaderImpl::ReaderImpl(const Bbx::Location& locator)
+template<class Locking>
+BasicReaderImpl<Locking>::BasicReaderImpl(const Bbx::Location& locator)
 :location(locator), forward(true), fileReader(), 
-result(Bbx::ReadResult::NoDataAvailable), mutex()
+result(Bbx::ReadResult::NoDataAvailable), mutex(), watcher()
 {
 }
 
-Bbx::ReadResult& ReaderImpl::saveResult(Bbx::ReadResult res)
+template<class Locking>
+Bbx::ReadResult& BasicReaderImpl<Locking>::saveResult(Bbx::ReadResult res)
 {
     result = res;
     return result;
 }
 
-Bbx::ReadResult ReaderImpl::lastResult() const
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::lastResult() const
 {
-    boost::mutex::scoped_lock lock(mutex);
+    typename Locking::Lock lock(mutex);
     return result;
 }
 
-void ReaderImpl::setDirection(bool goForward)
+template<class Locking>
+void BasicReaderImpl<Locking>::setDirection(bool goForward)
 {
-    boost::mutex::scoped_lock lock(mutex);
+    typename Locking::Lock lock(mutex);
 	forward = goForward;
 }
 
-bool ReaderImpl::getDirection() const
+template<class Locking>
+bool BasicReaderImpl<Locking>::getDirection() const
 {
     return forward;
 }
 
-ReaderImpl::~ReaderImpl(void)
+template<class Locking>
+BasicReaderImpl<Locking>::~BasicReaderImpl(void)
+{
+    typename Locking::Lock lock(mutex);
+}
+
+template<class Locking>
+BasicReaderImpl<Locking>* BasicReaderImpl<Locking>::clone() const
 {
-    boost::mutex::scoped_lock lock(mutex);
+    typename Locking::Lock lock(mutex);
+    std::unique_ptr<BasicReaderImpl> copy(new BasicReaderImpl(location));
+    copy->forward = forward;
+    copy->result = result;
+    copy->eod_front = eod_front;
+    copy->eod_back = eod_back;
+    copy->eod_forward = eod_forward;
+    copy->eod_normalSequence = eod_normalSequence;
+    /* Файл не ищется и не разбирается заново: копия открывает его по тому же пути и получает прочитанную страницу */
+    if (fileReader.isOpened() && !fileReader.fork(copy->fileReader))
+        copy->saveResult(Bbx::ReadResult::ErrorOpeningFile);
+    return copy.release();
 }
 
-Bbx::ReadResult ReaderImpl::rewind(const Bbx::Stamp& stamp)
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::rewind(const Bbx::Stamp& where)
 {
-    boost::mutex::scoped_lock lock(mutex);
+    /* Индекс страниц и файлов секундный, поэтому поиск по времени ведётся с точностью до секунды */
+    const Bbx::Stamp stamp(where.getTime());
+    typename Locking::Lock lock(mutex);
     std::wstring targetFileName = selectFileBy(stamp);
     if ( targetFileName.empty() )
         return saveResult(Bbx::ReadResult::NoDataAvailable);
@@ -74,9 +102,11 @@ Bbx::ReadResult ReaderImpl::rewind(const Bbx::Stamp& stamp)
         return saveResult(Bbx::ReadResult::NoDataAvailable);
 }
 
-Bbx::ReadResult ReaderImpl::rewindToAny(const Bbx::Stamp& stamp)
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::rewindToAny(const Bbx::Stamp& where)
 {
-    boost::mutex::scoped_lock lock(mutex);
+    const Bbx::Stamp stamp(where.getTime());
+    typename Locking::Lock lock(mutex);
     std::wstring targetFileName = selectFileBy(stamp);
     if ( targetFileName.empty() )
         return saveResult(Bbx::ReadResult::NoDataAvailable);
@@ -104,27 +134,164 @@ Bbx::ReadResult ReaderImpl::rewindToAny(const Bbx::Stamp& stamp)
         return saveResult(Bbx::ReadResult::NoDataAvailable);
 }
 
-Bbx::Stamp ReaderImpl::getCurrentStamp() const
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::rewindToSequence(uint64_t sequence)
+{
+    typename Locking::Lock lock(mutex);
+    if (!sequence)
+        return saveResult(Bbx::ReadResult::NoDataAvailable);
+
+    /* Файл, с которого начинается не меньший номер; файлы без номеров (старые) считаются более ранними */
+    const std::vector<std::wstring> files = location.getCPtrChain()->getFiles(sizeof(FileHeader));
+    auto comparer = [](uint64_t seq, const std::wstring& oneFile) {
+        uint64_t first = FileReader::getFileInfo(oneFile).firstSequence;
+        return first && seq < first;
+    };
+    auto fileIt = std::upper_bound(files.begin(), files.end(), sequence, comparer);
+
+    /* Последний файл может быть ещё без страниц, тогда запись ищется в предыдущих */
+    while (files.begin() != fileIt)
+    {
+        --fileIt;
+        FileReader tmpReader;
+        if (tmpReader.tryOpenFile(*fileIt) && tmpReader.rewindToSequence(sequence))
+        {
+            resetEoD();
+            fileReader.swap(tmpReader);
+            return saveResult(Bbx::ReadResult::Success);
+        }
+        if (FileReader::getFileInfo(*fileIt).firstSequence)
+            break;
+    }
+    return saveResult(Bbx::ReadResult::NoDataAvailable);
+}
+
+template<class Locking>
+size_t BasicReaderImpl<Locking>::verify(std::vector<std::wstring>* damagedFiles) const
+{
+    /* Проверка идёт отдельными читателями и не меняет текущую позицию */
+    size_t damagedPages = 0;
+    for (const std::wstring& oneFile : location.getCPtrChain()->getFiles(sizeof(FileHeader)))
+    {
+        FileReader tmpReader;
+        if (!tmpReader.tryOpenFile(oneFile))
+            continue;
+        if (size_t damaged = tmpReader.verify())
+        {
+            damagedPages += damaged;
+            if (damagedFiles)
+                damagedFiles->push_back(oneFile);
+        }
+    }
+    return damagedPages;
+}
+
+template<class Locking>
+std::vector<Bbx::TimelineBucket> BasicReaderImpl<Locking>::summarize(const std::pair<Bbx::Stamp, Bbx::Stamp>& range,
+    const boost::posix_time::time_duration& bucket) const
+{
+    std::vector<Bbx::TimelineBucket> timeline;
+    const time_t from = range.first.getTime();
+    const time_t to = range.second.getTime();
+    const time_t step = std::max<time_t>(1, time_t(bucket.total_seconds()));
+    if (to < from)
+        return timeline;
+    timeline.resize(size_t((to - from) / step) + 1);
+    for (size_t i = 0; i < timeline.size(); ++i)
+        timeline[i].begin = Bbx::Stamp(from + time_t(i) * step);
+
+    /* Файлы обходятся отдельными читателями, как при verify, по нескольку одновременно */
+    const std::vector<std::wstring> files = location.getCPtrChain()->getFiles(sizeof(FileHeader));
+    std::vector<FileTimeline> summaries(files.size());
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        for (size_t index = next++; index < files.size(); index = next++)
+        {
+            FileReader tmpReader;
+            summaries[index].valid = tmpReader.tryOpenFile(files[index])
+                && tmpReader.summarize(range.first, range.second, step, summaries[index]);
+        }
+    };
+    const size_t threads = std::min<size_t>(files.size(), std::max(1u, boost::thread::hardware_concurrency()));
+    boost::thread_group pool;
+    for (size_t i = 1; i < threads; ++i)
+        pool.create_thread(work);
+    work();
+    pool.join_all();
+
+    /* Сессия начинается файлом, который не продолжает предыдущий копией его последней опорной записи */
+    const size_t reference = Bbx::TimelineBucket::typeIndex(Bbx::RecordType::Reference);
+    const FileTimeline* previous = nullptr;
+    for (const FileTimeline& file : summaries)
+    {
+        if (!file.valid)
+            continue;
+        for (const auto& fileBucket : file.buckets)
+        {
+            Bbx::TimelineBucket& target = timeline[fileBucket.first];
+            for (size_t i = 0; i < Bbx::c_RecordTypesCount; ++i)
+            {
+                target.counts[i] += fileBucket.second.counts[i];
+                target.bytes[i] += fileBucket.second.bytes[i];
+            }
+        }
+
+        const time_t begin = file.firstStamp.getTime();
+        if (from <= begin && begin <= to)
+        {
+            Bbx::TimelineBucket& first = timeline[size_t((begin - from) / step)];
+            const bool sequenced = previous && previous->lastSequence && file.firstSequence;
+            const bool continuation = previous
+                && (sequenced ? file.firstSequence == previous->lastSequence : file.firstStamp == previous->lastStamp);
+            if (continuation && first.counts[reference])
+            {
+                --first.counts[reference];
+                first.bytes[reference] -= std::min<uint64_t>(first.bytes[reference], file.firstRecordSize);
+            }
+            else if (!continuation)
+            {
+                ++first.sessions;
+                if (sequenced && file.firstSequence != previous->lastSequence + 1)
+                    ++first.gaps;
+            }
+        }
+        previous = &file;
+    }
+    return timeline;
+}
+
+template<class Locking>
+Bbx::Stamp BasicReaderImpl<Locking>::getCurrentStamp() const
 {
-    boost::mutex::scoped_lock lock(mutex);
-    return fileReader.currentCursorStamp();
+    typename Locking::Lock lock(mutex);
+    return fileReader.currentCursorPreciseStamp();
 }
 
-Bbx::Identifier ReaderImpl::getCurrentIdentifier() const
+template<class Locking>
+uint64_t BasicReaderImpl<Locking>::getCurrentSequence() const
 {
-    boost::mutex::scoped_lock lock(mutex);
+    typename Locking::Lock lock(mutex);
+    return fileReader.isOpened() ? fileReader.currentCursorSequence() : 0;
+}
+
+template<class Locking>
+Bbx::Identifier BasicReaderImpl<Locking>::getCurrentIdentifier() const
+{
+    typename Locking::Lock lock(mutex);
     return fileReader.currentCursorIdentifier();
 }
 
-Bbx::RecordType ReaderImpl::getCurrentType() const
+template<class Locking>
+Bbx::RecordType BasicReaderImpl<Locking>::getCurrentType() const
 {
-    boost::mutex::scoped_lock lock(mutex);
+    typename Locking::Lock lock(mutex);
     return fileReader.currentCursorType();
 }
 
-bool ReaderImpl::resolveToSearchReference(const Bbx::Stamp& desiredStamp) const
+template<class Locking>
+bool BasicReaderImpl<Locking>::resolveToSearchReference(const Bbx::Stamp& desiredStamp) const
 {
-    boost::mutex::scoped_lock lock(mutex);
+    typename Locking::Lock lock(mutex);
 
     /* В случае запуска метода из неинициализированного экземпляра, обязательно надо искать опорную запись */
     if (!fileReader.isOpened())
@@ -137,14 +304,16 @@ bool ReaderImpl::resolveToSearchReference(const Bbx::Stamp& desiredStamp) const
     return fileReader.isReferenceSearchBetter(desiredStamp);
 }
 
-void ReaderImpl::update()
+template<class Locking>
+void BasicReaderImpl<Locking>::update()
 {
-    boost::mutex::scoped_lock lock(mutex);
+    typename Locking::Lock lock(mutex);
     if (fileReader.isOpened())
         fileReader.update();
 }
 
-Bbx::ReadResult ReaderImpl::moveNext(bool normalSequence)
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::moveNext(bool normalSequence)
 {
     if (!fileReader.isOpened())
         return Bbx::ReadResult::NoFileOpened;
@@ -176,7 +345,8 @@ Bbx::ReadResult ReaderImpl::moveNext(bool normalSequence)
     }
 }
 
-bool ReaderImpl::knownEoD( const Bbx::FileChain& fileChain, size_t minFileSize, bool normalSequence ) const
+template<class Locking>
+bool BasicReaderImpl<Locking>::knownEoD( const Bbx::FileChain& fileChain, size_t minFileSize, bool normalSequence ) const
 {
     return forward == eod_forward &&
            normalSequence == eod_normalSequence &&
@@ -185,7 +355,8 @@ bool ReaderImpl::knownEoD( const Bbx::FileChain& fileChain, size_t minFileSize,
            eod_back  == fileChain.getLatestFile(minFileSize);
 }
 
-void ReaderImpl::setEoD( const Bbx::FileChain& fileChain, size_t minFileSize, bool normalSequence )
+template<class Locking>
+void BasicReaderImpl<Locking>::setEoD( const Bbx::FileChain& fileChain, size_t minFileSize, bool normalSequence )
 {
     ASSERT( !fileChain.empty() );
     eod_front = fileChain.getEarliestFile();
@@ -194,7 +365,8 @@ void ReaderImpl::setEoD( const Bbx::FileChain& fileChain, size_t minFileSize, bo
     eod_normalSequence = normalSequence;
 }
 
-Bbx::ReadResult ReaderImpl::nextFileMove( const std::wstring& nextFile, bool normalSequence )
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::nextFileMove( const std::wstring& nextFile, bool normalSequence )
 {
     ASSERT( !nextFile.empty() );
     Stamp oldStamp = fileReader.currentCursorStamp();
@@ -240,21 +412,58 @@ Bbx::ReadResult ReaderImpl::nextFileMove( const std::wstring& nextFile, bool nor
     }
 }
 
-Bbx::ReadResult ReaderImpl::next()
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::next()
 {
-    boost::mutex::scoped_lock lock(mutex);
+    typename Locking::Lock lock(mutex);
     return saveResult(moveNext(true));
 }
 
-Bbx::ReadResult ReaderImpl::forceNext()
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::forceNext()
 {
-    boost::mutex::scoped_lock lock(mutex);
+    typename Locking::Lock lock(mutex);
     return saveResult(moveNext(false));
 }
 
-Bbx::ReadResult ReaderImpl::readReference(Bbx::Stamp& stamp, Bbx::char_vec& caption, Bbx::char_vec& data)
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::follow(const boost::posix_time::time_duration& timeout)
 {
-    boost::mutex::scoped_lock lock(mutex);
+    namespace bt = boost::posix_time;
+    const bt::ptime deadline = bt::microsec_clock::universal_time() + timeout;
+    typename Locking::Lock lock(mutex);
+    if (!fileReader.isOpened())
+        return saveResult(Bbx::ReadResult::NoFileOpened);
+    if (!forward)
+        return saveResult(moveNext(true)); // назад новые записи не появляются
+
+    if (!watcher)
+        watcher.reset(new ChangeWatcher());
+    unsigned changes = 0;
+    while (true)
+    {
+        /* Наблюдение ставится до проверки, поэтому дозапись между проверкой и ожиданием не теряется */
+        watcher->watch(location.getFolder(), fileReader.getFilePath());
+        if (changes & ChangeWatcher::c_OtherFiles)
+            location.refreshFolderCache(); // новый файл мог попасть в набор ещё пустым
+        fileReader.update();
+        Bbx::ReadResult res = moveNext(true);
+        bt::time_duration left = deadline - bt::microsec_clock::universal_time();
+        if (Bbx::ReadResult::NoDataAvailable != res || left.is_negative())
+            return saveResult(res);
+
+        lock.unlock();
+        changes = watcher->wait(left);
+        lock.lock();
+        if (!fileReader.isOpened())
+            return saveResult(Bbx::ReadResult::NoFileOpened);
+    }
+}
+
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::readReference(Bbx::Stamp& stamp, Bbx::char_vec& caption, Bbx::char_vec& data)
+{
+    typename Locking::Lock lock(mutex);
     if (!fileReader.isOpened())
         return saveResult(Bbx::ReadResult::NoFileOpened);
 
@@ -264,9 +473,10 @@ Bbx::ReadResult ReaderImpl::readReference(Bbx::Stamp& stamp, Bbx::char_vec& capt
     return readCurrentRecordImpl(stamp, caption, data);
 }
 
-Bbx::ReadResult ReaderImpl::readIncrementOriented(Bbx::Stamp& stamp, Bbx::char_vec& caption, Bbx::char_vec& data)
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::readIncrementOriented(Bbx::Stamp& stamp, Bbx::char_vec& caption, Bbx::char_vec& data)
 {
-    boost::mutex::scoped_lock lock(mutex);
+    typename Locking::Lock lock(mutex);
     if (!fileReader.isOpened())
         return saveResult(Bbx::ReadResult::NoFileOpened);
 
@@ -276,9 +486,10 @@ Bbx::ReadResult ReaderImpl::readIncrementOriented(Bbx::Stamp& stamp, Bbx::char_v
     return readIncrementOrientedImpl(stamp, caption, data);
 }
 
-Bbx::ReadResult ReaderImpl::readPackage(Bbx::Stamp& stamp, Bbx::char_vec& caption, Bbx::char_vec& data)
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::readPackage(Bbx::Stamp& stamp, Bbx::char_vec& caption, Bbx::char_vec& data)
 {
-    boost::mutex::scoped_lock lock(mutex);
+    typename Locking::Lock lock(mutex);
     if (!fileReader.isOpened())
         return saveResult(Bbx::ReadResult::NoFileOpened);
 
@@ -289,9 +500,10 @@ Bbx::ReadResult ReaderImpl::readPackage(Bbx::Stamp& stamp, Bbx::char_vec& captio
     return readCurrentRecordImpl(stamp, caption, data);
 }
 
-Bbx::ReadResult ReaderImpl::readAnyRecord(Bbx::Stamp& stamp, Bbx::char_vec& caption, Bbx::char_vec& data)
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::readAnyRecord(Bbx::Stamp& stamp, Bbx::char_vec& caption, Bbx::char_vec& data)
 {
-    boost::mutex::scoped_lock lock(mutex);
+    typename Locking::Lock lock(mutex);
     if (!fileReader.isOpened())
         return saveResult(Bbx::ReadResult::NoFileOpened);
 
@@ -301,13 +513,15 @@ Bbx::ReadResult ReaderImpl::readAnyRecord(Bbx::Stamp& stamp, Bbx::char_vec& capt
         return readCurrentRecordImpl(stamp, caption, data);
 }
 
-std::pair<Bbx::Stamp,Bbx::Stamp> ReaderImpl::getAvailableTimeInterval() const
+template<class Locking>
+std::pair<Bbx::Stamp,Bbx::Stamp> BasicReaderImpl<Locking>::getAvailableTimeInterval() const
 {
-    boost::mutex::scoped_lock lock(mutex);
+    typename Locking::Lock lock(mutex);
     return getAvailableTimeInterval(location);
 }
 
-std::pair<Bbx::Stamp,Bbx::Stamp> ReaderImpl::getAvailableTimeInterval(const Bbx::Location& location)
+template<class Locking>
+std::pair<Bbx::Stamp,Bbx::Stamp> BasicReaderImpl<Locking>::getAvailableTimeInterval(const Bbx::Location& location)
 {
     const time_t c_InvalidTimeValue = 0;
 
@@ -332,11 +546,12 @@ std::pair<Bbx::Stamp,Bbx::Stamp> ReaderImpl::getAvailableTimeInterval(const Bbx:
     return std::make_pair( one, two );
 }
 
-bool ReaderImpl::existActualWriter() const
+template<class Locking>
+bool BasicReaderImpl<Locking>::existActualWriter() const
 {
 #ifndef LINUX
 	std::wstring filePath = location.verificationFilePath();
-	BBX_SIZE dw = GetFileAttributes(filePath.c_str());
+	DWORD dw = GetFileAttributes(filePath.c_str());
 	return (dw != INVALID_FILE_ATTRIBUTES);
 #else
     bool res = false;
@@ -355,25 +570,28 @@ bool ReaderImpl::existActualWriter() const
 #endif // !LINUX
 }
 
-FileReader::Cursor ReaderImpl::getCurrentCursor() const
+template<class Locking>
+FileReader::Cursor BasicReaderImpl<Locking>::getCurrentCursor() const
 {
-    boost::mutex::scoped_lock lock(mutex);
+    typename Locking::Lock lock(mutex);
     ASSERT(fileReader.isOpened());
 
     return fileReader.getCursor();
 }
 
-const std::wstring& ReaderImpl::getCurrentFilePath() const
+template<class Locking>
+const std::wstring& BasicReaderImpl<Locking>::getCurrentFilePath() const
 {
-    boost::mutex::scoped_lock lock(mutex);
+    typename Locking::Lock lock(mutex);
     ASSERT(fileReader.isOpened());
 
     return fileReader.getFilePath();
 }
 
-Bbx::ReadResult ReaderImpl::rewindToCursor(const std::wstring& filePath, const FileReader::Cursor& cursor)
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::rewindToCursor(const std::wstring& filePath, const FileReader::Cursor& cursor)
 {
-    boost::mutex::scoped_lock lock(mutex);
+    typename Locking::Lock lock(mutex);
 
     if (fileReader.isOpened() && fileReader.getFilePath() == filePath)
     {
@@ -398,32 +616,91 @@ Bbx::ReadResult ReaderImpl::rewindToCursor(const std::wstring& filePath, const F
     }
 }
 
-const Bbx::Location& ReaderImpl::getLocation() const
+template<class Locking>
+Bbx::ReaderPosition BasicReaderImpl<Locking>::getPosition() const
+{
+    typename Locking::Lock lock(mutex);
+    Bbx::ReaderPosition position;
+    if (!fileReader.isOpened())
+        return position;
+
+    FileReader::Cursor cursor = fileReader.getCursor();
+    position.fileName = boost::filesystem::path(fileReader.getFilePath()).filename().wstring();
+    position.fileStart = fileReader.startsFrom();
+    position.page = cursor.page;
+    position.part = cursor.part;
+    position.stamp = fileReader.currentCursorStamp();
+    position.sequence = fileReader.currentCursorSequence();
+    return position;
+}
+
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::rewindToPosition(const Bbx::ReaderPosition& position)
+{
+    if (!position.isValid())
+        return saveResult(Bbx::ReadResult::NoDataAvailable);
+    {
+        typename Locking::Lock lock(mutex);
+        const std::wstring filePath = (boost::filesystem::path(location.getFolder()) / position.fileName).wstring();
+        FileReader tmpReader;
+        FileReader& target = fileReader.isOpened() && fileReader.getFilePath() == filePath ? fileReader : tmpReader;
+        if (&target == &fileReader)
+            fileReader.update();
+        else
+            tmpReader.tryOpenFile(filePath); // файл мог быть удалён по сроку хранения
+
+        FileReader::Cursor cursor;
+        cursor.page = size_t(position.page);
+        cursor.part = size_t(position.part);
+        /* Файл с тем же именем, но другим началом - уже другой файл */
+        if (target.isOpened() && target.startsFrom() == position.fileStart && target.rewindToCursor(cursor)
+            && target.currentCursorStamp() == position.stamp && target.currentCursorSequence() == position.sequence)
+        {
+            if (&target == &tmpReader)
+            {
+                resetEoD();
+                fileReader.swap(tmpReader);
+            }
+            return saveResult(Bbx::ReadResult::Success);
+        }
+    }
+
+    /* Позиция устарела - поиск записи */
+    Bbx::ReadResult found = position.sequence ? rewindToSequence(position.sequence) : Bbx::ReadResult(Bbx::ReadResult::NoDataAvailable);
+    if (!found)
+        found = rewindToAny(position.stamp);
+    typename Locking::Lock lock(mutex);
+    return saveResult(found ? Bbx::ReadResult::FoundApproximateValue : found);
+}
+
+template<class Locking>
+const Bbx::Location& BasicReaderImpl<Locking>::getLocation() const
 {
     return location;
 }
 
-Bbx::ReadResult ReaderImpl::readIncrementOrientedImpl(Bbx::Stamp& stamp, Bbx::char_vec& caption, Bbx::char_vec& data)
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::readIncrementOrientedImpl(Bbx::Stamp& stamp, Bbx::char_vec& caption, Bbx::char_vec& data)
 {
     /* В зависимости от направления чтения возвращаемые данные брать из правильной части */
     Bbx::char_vec trash;
     Bbx::char_vec& alt_before = forward ? trash : data;
     Bbx::char_vec& alt_after = forward ? data : trash;
 
-    return saveResult(fileReader.readCurrentRecord(stamp, caption, alt_before, alt_after)
-        ? Bbx::ReadResult::Success : Bbx::ReadResult::NoDataAvailable); 
+    return saveResult(fileReader.readCurrentRecord(stamp, caption, alt_before, alt_after));
 }
 
-Bbx::ReadResult ReaderImpl::readCurrentRecordImpl(Bbx::Stamp& stamp, Bbx::char_vec& caption, Bbx::char_vec& data)
+template<class Locking>
+Bbx::ReadResult BasicReaderImpl<Locking>::readCurrentRecordImpl(Bbx::Stamp& stamp, Bbx::char_vec& caption, Bbx::char_vec& data)
 {
-    return saveResult(fileReader.readCurrentRecord(stamp, caption, data)
-        ? Bbx::ReadResult::Success : Bbx::ReadResult::NoDataAvailable);
+    return saveResult(fileReader.readCurrentRecord(stamp, caption, data));
 }
 
 /**
  *	Выбрать ближайшие к временному штампу файлы без чтения их заголовков (по названиям)
  */
-std::vector<std::wstring> ReaderImpl::selectFilesCloserTo(const Bbx::Location& location, const Bbx::Stamp& stamp)
+template<class Locking>
+std::vector<std::wstring> BasicReaderImpl<Locking>::selectFilesCloserTo(const Bbx::Location& location, const Bbx::Stamp& stamp)
 {
     std::wstring firstFN = location.fileName( stamp, 0 );
     // Расширяем временной запрос из-за множественных имён файлов с совпадающими штампами
@@ -436,12 +713,14 @@ std::vector<std::wstring> ReaderImpl::selectFilesCloserTo(const Bbx::Location& l
     return result;
 }
 
-std::wstring ReaderImpl::selectNextFile( const Bbx::FileChain& fileChain, size_t minFileSize ) const
+template<class Locking>
+std::wstring BasicReaderImpl<Locking>::selectNextFile( const Bbx::FileChain& fileChain, size_t minFileSize ) const
 {
     return fileChain.selectNextFile( fileReader.getFilePath(), minFileSize, forward );
 }
 
-std::wstring ReaderImpl::selectFileBy(const Bbx::Stamp& stamp) const
+template<class Locking>
+std::wstring BasicReaderImpl<Locking>::selectFileBy(const Bbx::Stamp& stamp) const
 {
     std::wstring targetFileName;
     const std::vector<std::wstring> foundFiles = selectFilesCloserTo(location, stamp);
@@ -473,7 +752,8 @@ std::wstring ReaderImpl::selectFileBy(const Bbx::Stamp& stamp) const
     return targetFileName;
 }
 
-std::string ReaderImpl::getTimeZone() const
+template<class Locking>
+std::string BasicReaderImpl<Locking>::getTimeZone() const
 {
     std::string resTZ;
     if ( fileReader.isOpened() )
@@ -493,3 +773,6 @@ std::string ReaderImpl::getTimeZone() const
     }
     return resTZ;
 }
+
+template class Bbx::Impl::BasicReaderImpl<MutexLocking>;
+template class Bbx::Impl::BasicReaderImpl<NoLocking>;
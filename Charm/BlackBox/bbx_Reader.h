@@ -1,8 +1,8 @@
 ﻿#pragma once
 
 #include "bbx_FileReader.h"
+#include "bbx_ChangeWatcher.h"
 
-#pragma pack(push, 1)
 namespace Bbx
 {
     namespace Impl
@@ -10,11 +10,37 @@ namespace Bbx
 
         struct ReadFileInfo;
 
-        class ReaderImpl : boost::noncopyable
+        /** @brief Политика синхронизации читателя: каждый метод под мьютексом (читатель общий для потоков) */
+        struct MutexLocking
+        {
+            typedef boost::mutex Mutex;
+            typedef boost::mutex::scoped_lock Lock;
+        };
+
+        /** @brief Политика синхронизации читателя: без блокировок (читатель принадлежит одному потоку) */
+        struct NoLocking
+        {
+            struct Mutex
+            {
+            };
+            struct Lock
+            {
+                explicit Lock(Mutex&) {}
+                void lock() {}
+                void unlock() {}
+            };
+        };
+
+        /** @brief Реализация читателя; Locking - политика синхронизации (MutexLocking или NoLocking) */
+        template<class Locking>
+        class BasicReaderImpl : boost::noncopyable
         {
         public:
-            explicit ReaderImpl(const Location& location);
-            ~ReaderImpl(void);
+            explicit BasicReaderImpl(const Location& location);
+            ~BasicReaderImpl(void);
+
+            /** @brief Копия читателя с той же позицией, направлением и открытым файлом (файл открывается заново по пути) */
+            BasicReaderImpl* clone() const;
 
             /** @brief Получение кода результата последней операции, возвращающей код результата */
             ReadResult lastResult() const;
@@ -43,6 +69,16 @@ namespace Bbx
             Если запись с таким же штампом не найдена, поиск ближайшей меньшей */
             ReadResult rewindToAny(const Stamp& where);
 
+            /** @brief Точная перемотка до записи с указанным сквозным номером
+            Поиск двоичный: сначала по первым номерам файлов, затем по номерам страниц файла */
+            ReadResult rewindToSequence(uint64_t sequence);
+
+            /** @brief Сверка контрольных сумм страниц всех файлов ящика
+            @return общее число повреждённых страниц; имена файлов с повреждениями добавляются в damagedFiles */
+            size_t verify(std::vector<std::wstring>* damagedFiles) const;
+            std::vector<Bbx::TimelineBucket> summarize(const std::pair<Bbx::Stamp, Bbx::Stamp>& range,
+                const boost::posix_time::time_duration& bucket) const;
+
             /** @brief Перемещение курсора на следующую запись в соответствие с установленным
             направлением чтения.
             Возвращает код ошибки в случае нестандартной ситуации 
@@ -56,6 +92,9 @@ namespace Bbx
             в случае нестанартной ситуации */
             ReadResult forceNext();
 
+            /** @brief Перемещение вперёд с ожиданием новых записей не дольше timeout */
+            ReadResult follow(const boost::posix_time::time_duration& timeout);
+
             /** @brief Установка направления чтения */
             void setDirection(bool goForward);
 
@@ -69,9 +108,12 @@ namespace Bbx
             /** @brief Есть ли писатель для этого ящика */
             bool existActualWriter() const;
 
-            /** @brief Получение временного штампа текущей позиции */
+            /** @brief Получение временного штампа текущей позиции (с наносекундами, как у read*) */
             Stamp getCurrentStamp() const;
 
+            /** @brief Получение сквозного номера записи текущей позиции (0 если неизвестен) */
+            uint64_t getCurrentSequence() const;
+
             /** @brief Получение идентификатора текущей позиции */
             Identifier getCurrentIdentifier() const;
 
@@ -95,6 +137,8 @@ namespace Bbx
             const std::wstring& getCurrentFilePath() const;
             FileReader::Cursor getCurrentCursor() const;
             ReadResult rewindToCursor(const std::wstring& filePath, const FileReader::Cursor& cursor);
+            Bbx::ReaderPosition getPosition() const;
+            ReadResult rewindToPosition(const Bbx::ReaderPosition& position);
 
             const Location& getLocation() const;
             std::string getTimeZone() const;
@@ -104,12 +148,13 @@ namespace Bbx
             bool forward;
             FileReader fileReader;
             ReadResult result;
-            mutable boost::mutex mutex;
+            mutable typename Locking::Mutex mutex;
             // сведения о достигнутом конце черного ящика
             std::wstring eod_front; // первый известный файл
             std::wstring eod_back;  // последний известный файл
             bool eod_forward;                       // направление чтения
             bool eod_normalSequence;                // режим чтения
+            std::unique_ptr<ChangeWatcher> watcher; // создаётся при первом follow
 
             ReadResult& saveResult(ReadResult res);
             ReadResult moveNext(bool normalSequence);
@@ -126,21 +171,23 @@ namespace Bbx
             ReadResult readCurrentRecordImpl(Stamp& stamp, char_vec& caption, char_vec& data);
         };
 
-        inline bool ReaderImpl::isOpened() const
+        template<class Locking>
+        inline bool BasicReaderImpl<Locking>::isOpened() const
         {
             return fileReader.isOpened();
         }
 
-        inline bool ReaderImpl::hasMoreRecords() const
+        template<class Locking>
+        inline bool BasicReaderImpl<Locking>::hasMoreRecords() const
         {
             return fileReader.hasMoreRecords(forward);
         }
-        inline void ReaderImpl::resetEoD()
+
+        template<class Locking>
+        inline void BasicReaderImpl<Locking>::resetEoD()
         {
             eod_front.clear();
             eod_back.clear();
         }
-
     }
 }
-#pragma pack(pop)
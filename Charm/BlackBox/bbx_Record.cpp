@@ -4,6 +4,7 @@
 
 #include "bbx_Record.h"
 #include "bbx_File.h"
+#include "bbx_Caption.h"
 
 using namespace Bbx::Impl;
 
@@ -37,15 +38,37 @@ unsigned WriterTask::getWeight() const
     });
 }
 
-RecordOut::RecordOut(const WriterTask& task)
-    : buffers(), size(0u), completedSize(0u), time(task.stamp), id(task.id), type(task.type)
+RecordOut::RecordOut(const WriterTask& task, uint64_t sequence)
+    : buffers(), prefix(), prefixSize(sizeof(RecordPrefix)), caption(), captionIndex(0), captionReference(0u),
+      size(0u), completedSize(0u), time(task.stamp), id(task.id), type(task.type)
 {
+    prefix.nanoseconds = task.stamp.getNanoseconds();
+    prefix.sequence = sequence;
+    addBuffer(Buffer::createConst(prefixSize));
+    addBuffer(Buffer::create(prefix));
+
+    captionIndex = buffers.size();
     for (const WriterTask::Source& source : task.sources)
     {
         addBuffer(Buffer::createConst(source.first));
         if (source.first > 0u)
             addBuffer(source.second);
     }
+    if (!task.sources.empty() && task.sources.front().first > 0u)
+        caption = Buffer(task.sources.front().second);
+}
+
+void RecordOut::setCaptionReference(unsigned reference)
+{
+    ASSERT(untouched() && caption.size && buffers.size() > captionIndex + 1);
+    captionReference = reference;
+
+    /* Размер и данные заголовка заменяются одним размером со ссылкой */
+    auto itCaption = buffers.begin() + captionIndex;
+    size -= itCaption[0].size + itCaption[1].size;
+    itCaption = buffers.erase(itCaption, itCaption + 2);
+    buffers.insert(itCaption, Buffer::create(captionReference));
+    size += sizeof(captionReference);
 }
 
 void RecordOut::write(const Bbx::Buffer& outBuffer)
@@ -89,7 +112,7 @@ bool RecordIn::readPart(const FileId& file, const FileAddress& address)
                     std::min(static_cast<unsigned>(sizeof(container.size)) - container.sizeBytesRead,
                              static_cast<unsigned>(address.size) - readed));
 
-            SharedSection sizeLock(file, address.offset + readed, sizeBuf.size);
+            SharedSection sizeLock(file, address.offset + readed, sizeBuf.size, !lockless);
             if (sizeLock.read(sizeBuf))
             {
                 readed += sizeBuf.size;
@@ -100,10 +123,15 @@ bool RecordIn::readPart(const FileId& file, const FileAddress& address)
                 // Как только размер данных считан, в контейнере резервируется место
                 if (container.sizeBytesRead == sizeof(container.size))
                 {
-                    if (container.size)
+                    if (captions && container.buffer == &caption && CaptionDictionary::isReference(container.size))
+                    {
+                        if (!resolveCaptionReference(file, container))
+                            return false;
+                    }
+                    else if (container.size)
                         container.buffer->reserve(container.size);
                     else
-                        buffers.pop();
+                        buffers.pop_front();
                 }
             }
             else
@@ -122,7 +150,7 @@ bool RecordIn::readPart(const FileId& file, const FileAddress& address)
             container.buffer->resize(container.buffer->size() + requestBytes);
             Bbx::Buffer dataBuf(&container.buffer->back() - requestBytes + 1, requestBytes);
 
-            SharedSection dataLock(file, address.offset + readed, dataBuf.size);                
+            SharedSection dataLock(file, address.offset + readed, dataBuf.size, !lockless);                
             if (dataLock.read(dataBuf))
             {
                 readed += dataBuf.size;
@@ -130,7 +158,7 @@ bool RecordIn::readPart(const FileId& file, const FileAddress& address)
                 // Если размер массива составил нужную величину, мы считаем, 
                 // что считали его полностью и удаляем его из очереди на чтение
                 if (container.buffer->size() == container.size)
-                    buffers.pop();
+                    buffers.pop_front();
             }
             else
             {
@@ -142,12 +170,42 @@ bool RecordIn::readPart(const FileId& file, const FileAddress& address)
         }
     }
 
-    ASSERT(address.size == readed);
+    ASSERT(address.size == readed || (prefixOnly && buffers.empty()));
+    if (buffers.empty())
+        applyPrefix();
+    return true;
+}
+
+void RecordIn::expectPrefix()
+{
+    prefixData.clear();
+    buffers.push_front(ContainerIn(prefixData));
+}
+
+void RecordIn::applyPrefix()
+{
+    /* Префикс уточняет секундный штамп кусочка */
+    if (prefixData.size() == sizeof(RecordPrefix))
+    {
+        RecordPrefix prefix;
+        memcpy(&prefix, prefixData.data(), sizeof(prefix));
+        stamp = Stamp(stamp.getTime(), prefix.nanoseconds);
+        sequence = prefix.sequence;
+    }
+}
+
+bool RecordIn::resolveCaptionReference(const FileId& file, ContainerIn& container)
+{
+    ASSERT(captions);
+    /* Заголовок берётся из словаря, данных заголовка в записи нет */
+    if (!captions->decode(file, container.size, *container.buffer))
+        return false;
+    buffers.pop_front();
     return true;
 }
 
 Bbx::Impl::RecordIn::RecordIn( Stamp& recordStamp, char_vec& caption, char_vec& before, char_vec& after )
-     : stamp(recordStamp), buffers()
+     : stamp(recordStamp), buffers(), caption(caption), captions(nullptr), prefixData(), sequence(0), lockless(false), prefixOnly(false)
 {
     addContainer(caption);
     addContainer(before);
@@ -155,7 +213,7 @@ Bbx::Impl::RecordIn::RecordIn( Stamp& recordStamp, char_vec& caption, char_vec&
 }
 
 Bbx::Impl::RecordIn::RecordIn( Stamp& recordStamp, char_vec& caption, char_vec& data )
-    : stamp(recordStamp), buffers()
+    : stamp(recordStamp), buffers(), caption(caption), captions(nullptr), prefixData(), sequence(0), lockless(false), prefixOnly(false)
 {
     addContainer(caption);
     addContainer(data);
@@ -164,5 +222,5 @@ Bbx::Impl::RecordIn::RecordIn( Stamp& recordStamp, char_vec& caption, char_vec&
 void Bbx::Impl::RecordIn::addContainer(char_vec& container)
 {
     container.clear();
-    buffers.push(container);
+    buffers.push_back(ContainerIn(container));
 }
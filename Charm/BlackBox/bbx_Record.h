@@ -27,13 +27,27 @@ namespace Bbx
             void addCopyOfBuffer(const Bbx::Buffer& data);
         };
 
+        /**
+        @brief Служебный префикс записи (с версии 4.0), хранится первым контейнером тела записи.
+        Дополняет секундный штамп кусочка наносекундами и содержит сквозной номер записи ящика.
+        */
+        struct RecordPrefix
+        {
+            uint32_t nanoseconds;
+            uint64_t sequence; // номера начинаются с 1, ноль - номер неизвестен
+        };
+
         class RecordOut
         {
         public:
-            explicit RecordOut(const WriterTask& task);
+            RecordOut(const WriterTask& task, uint64_t sequence);
 
             void write(const Buffer& outBuffer);
 
+            /** @brief Замена заголовка записи ссылкой на словарь заголовков файла */
+            void setCaptionReference(unsigned reference);
+
+            const Buffer& getCaption() const;
             unsigned getSize() const;
             unsigned getRemainingSize() const;
             bool completed() const;
@@ -41,12 +55,18 @@ namespace Bbx
             Stamp getStamp() const;
             Identifier getId() const;
             RecordType getType() const;
+            uint64_t getSequence() const;
 
         protected:
             typedef std::vector<Buffer> BuffersVec;
             void addBuffer(const Buffer& buf);
 
             BuffersVec buffers;
+            RecordPrefix prefix;
+            unsigned prefixSize;
+            Buffer caption;
+            size_t captionIndex; // позиция размера заголовка среди буферов
+            unsigned captionReference;
             unsigned size;
             unsigned completedSize;
             Stamp time;
@@ -67,15 +87,26 @@ namespace Bbx
             BBX_SIZE nextOffset() const { return offset + size; };
         };
 
+        class CaptionDictionary;
+
         class RecordIn : boost::noncopyable
         {
         public:
             RecordIn( Stamp& recStamp, char_vec& caption, char_vec& before, char_vec& after );
             RecordIn( Stamp& recStamp, char_vec& caption, char_vec& data );
 
+            /** @brief Словарь для раскрытия ссылок на заголовки (отсутствует у файлов без словаря) */
+            void setCaptionDictionary(CaptionDictionary* dictionary);
+            /** @brief Запись начинается со служебного префикса (файлы версии 4.0 и новее) */
+            void expectPrefix();
+            /** @brief Кусочки читаются без блокировок (файлы со счётчиками фиксации страниц) */
+            void setLockless(bool enable);
+            /** @brief Читается только служебный префикс, заголовок и данные пропускаются */
+            void skipContents();
 			bool readPart(const FileId& file, const FileAddress& address);
             bool readed() const;
             void setStamp(const Stamp& time);
+            uint64_t getSequence() const;
 
         private:
             struct ContainerIn
@@ -89,9 +120,17 @@ namespace Bbx
             };
 
             Stamp& stamp;
-            std::queue<ContainerIn> buffers;
+            std::deque<ContainerIn> buffers;
+            char_vec& caption;
+            CaptionDictionary* captions;
+            char_vec prefixData;
+            uint64_t sequence;
+            bool lockless;
+            bool prefixOnly;
 
             void addContainer(char_vec& container);
+            void applyPrefix();
+            bool resolveCaptionReference(const FileId& file, ContainerIn& container);
         };
         
         inline void RecordOut::addBuffer(const Buffer& buf)
@@ -100,6 +139,11 @@ namespace Bbx
             size += buf.size;
         }
 
+        inline const Buffer& RecordOut::getCaption() const
+        {
+            return caption;
+        }
+
         inline unsigned RecordOut::getSize() const
         {
             return size;
@@ -135,6 +179,11 @@ namespace Bbx
             return type;
         }
 
+        inline uint64_t RecordOut::getSequence() const
+        {
+            return prefix.sequence;
+        }
+
         inline FileAddress::FileAddress(BBX_SIZE fileOffset, BBX_SIZE pageSize)
             : offset(fileOffset), size(pageSize) 
         { }
@@ -159,10 +208,31 @@ namespace Bbx
             return buffers.empty();
         }
 
+        inline void RecordIn::setCaptionDictionary(CaptionDictionary* dictionary)
+        {
+            captions = dictionary;
+        }
+
+        inline void RecordIn::setLockless(bool enable)
+        {
+            lockless = enable;
+        }
+
+        inline void RecordIn::skipContents()
+        {
+            buffers.clear();
+            prefixOnly = true;
+        }
+
         inline void RecordIn::setStamp(const Stamp& time)
         {
             stamp = time;
         }
+
+        inline uint64_t RecordIn::getSequence() const
+        {
+            return sequence;
+        }
     }
 }
 
@@ -8,5 +8,5 @@
 #endif
 
 #include <iostream>
-typedef unsigned long BBX_SIZE;
+typedef unsigned long long BBX_SIZE; // смещения и размеры внутри файла (файлы более 4Gb)
 typedef unsigned long long BBX_DISK_SIZE;
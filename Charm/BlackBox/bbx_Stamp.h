@@ -3,11 +3,13 @@
 #pragma pack(push, 1)
 namespace Bbx
 {
+    /** @brief Временной штамп записи: секунды и (необязательно) наносекунды внутри секунды */
     class Stamp
     {
     public:
-        Stamp() : stamp(13) {}; // инициализация произвольной константой
-        Stamp(time_t time) : stamp(time) {};
+        Stamp() : stamp(13), nanoseconds(0) {}; // инициализация произвольной константой
+        Stamp(time_t time) : stamp(time), nanoseconds(0) {};
+        Stamp(time_t time, uint32_t nanosec) : stamp(time), nanoseconds(nanosec) {};
 
         bool operator <(const Stamp& other) const;
         bool operator >(const Stamp& other) const;
@@ -18,10 +20,12 @@ namespace Bbx
         operator time_t() const;
 
         time_t getTime() const;
+        uint32_t getNanoseconds() const;
         Stamp modDifference(const Stamp& other) const;
 
     private:
         time_t stamp;
+        uint32_t nanoseconds;
     };
 
     inline Stamp::operator time_t() const
@@ -31,17 +35,18 @@ namespace Bbx
 
     inline bool Stamp::operator <(const Stamp& other) const
     {
-        return stamp < other.stamp;
+        return stamp < other.stamp ||
+               (stamp == other.stamp && nanoseconds < other.nanoseconds);
     }
 
     inline bool Stamp::operator >(const Stamp& other) const
     {
-        return stamp > other.stamp;
+        return other.operator <(*this);
     }
 
     inline bool Stamp::operator ==(const Stamp& other) const
     {
-        return stamp == other.stamp;
+        return stamp == other.stamp && nanoseconds == other.nanoseconds;
     }
 
     inline bool Stamp::operator !=(const Stamp& other) const
@@ -64,6 +69,11 @@ namespace Bbx
         return stamp;
     }
 
+    inline uint32_t Stamp::getNanoseconds() const
+    {
+        return nanoseconds;
+    }
+
     inline Stamp Stamp::modDifference(const Stamp& other) const
     {
         return stamp > other ? stamp - other : other - stamp;
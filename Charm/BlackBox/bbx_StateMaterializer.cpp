@@ -0,0 +1,315 @@
+﻿#include "stdafx.h"
+
+#include <atomic>
+#include <boost/thread/thread.hpp>
+#include "bbx_StateMaterializer.h"
+#include "../helpful/RT_ThreadName.h"
+
+using namespace Bbx;
+
+namespace
+{
+    /** @brief Расстояние между штампами в наносекундах */
+    double Distance(const Stamp& from, const Stamp& to)
+    {
+        return (double(to.getTime()) - double(from.getTime())) * 1e9 + (double(to.getNanoseconds()) - double(from.getNanoseconds()));
+    }
+
+    bool IsState(RecordType type)
+    {
+        return RecordType::Reference == type || RecordType::Increment == type;
+    }
+}
+
+MaterializedState::MaterializedState()
+    : result(ReadResult::NoDataAvailable), stamp(), sequence(0), state()
+{
+}
+
+StateMaterializer::StateMaterializer(const Location& location, const ApplyIncrement& _apply, size_t _cacheSize)
+    : reader(location), apply(_apply), cache(), cacheSize(std::max<size_t>(1, _cacheSize)), backward(true),
+    current(), cacheHits(0), replayed(0)
+{
+    current.sequence = 0;
+    current.bounded = false;
+}
+
+StateMaterializer::~StateMaterializer()
+{
+}
+
+Stamp StateMaterializer::getStateStamp() const
+{
+    return current.stamp;
+}
+
+uint64_t StateMaterializer::getStateSequence() const
+{
+    return current.sequence;
+}
+
+void StateMaterializer::setBackwardReplay(bool enable)
+{
+    backward = enable;
+}
+
+void StateMaterializer::clear()
+{
+    cache.clear();
+}
+
+size_t StateMaterializer::getCacheHits() const
+{
+    return cacheHits;
+}
+
+size_t StateMaterializer::getReplayedCount() const
+{
+    return replayed;
+}
+
+ReadResult StateMaterializer::materialize(const Stamp& where, char_vec& state)
+{
+    /* Момент между сохранённым состоянием и следующей за ним записью - чтение не нужно */
+    for (auto it = cache.begin(); it != cache.end(); ++it)
+    {
+        if (it->stamp <= where && it->bounded && where < it->next)
+        {
+            cache.splice(cache.begin(), cache, it);
+            ++cacheHits;
+            current = cache.front();
+            state = current.state;
+            return ReadResult::Success;
+        }
+    }
+
+    /* Ближайшие по номеру сохранённые состояния до и после момента */
+    const Checkpoint* before = nullptr;
+    const Checkpoint* after = nullptr;
+    for (const Checkpoint& point : cache)
+    {
+        if (point.stamp <= where)
+        {
+            if (!before || point.sequence > before->sequence)
+                before = &point;
+        }
+        else if (!after || point.sequence < after->sequence)
+            after = &point;
+    }
+
+    /* Отправная точка для движения вперёд: опорная запись или более позднее сохранённое состояние */
+    Checkpoint base;
+    base.bounded = false;
+    bool positioned = false;
+    if (rewindToReference(where))
+    {
+        base.sequence = reader.getCurrentSequence();
+        if (before && base.sequence && before->sequence >= base.sequence)
+            base = *before;
+        else
+        {
+            char_vec caption;
+            if (!readRecord(base.stamp, caption, base.state))
+                return reader.lastResult();
+            ++replayed;
+            positioned = true;
+        }
+    }
+    else if (before)
+        base = *before;
+    else
+        return ReadResult::NoDataAvailable;
+
+    Checkpoint result;
+    bool done = false;
+    if (backward && after && Distance(where, after->stamp) < Distance(base.stamp, where))
+    {
+        result = *after;
+        done = replayBackward(where, result);
+    }
+    if (!done)
+    {
+        result = base;
+        if (!positioned && !reader.rewindToSequence(base.sequence))
+            return reader.lastResult();
+        if (!replayForward(where, result))
+            return reader.lastResult();
+    }
+
+    remember(result);
+    current = std::move(result);
+    state = current.state;
+    return ReadResult::Success;
+}
+
+std::vector<MaterializedState> StateMaterializer::materializeMany(const Location& location, const std::vector<Stamp>& points,
+    const ApplyIncrement& apply, size_t workers)
+{
+    ASSERT(std::is_sorted(points.begin(), points.end()));
+    std::vector<MaterializedState> results(points.size());
+
+    /* Интервалы - подряд идущие моменты с общей предшествующей опорной записью, [first, second) */
+    std::vector<std::pair<size_t, size_t>> partitions;
+    {
+        StateMaterializer probe(location, apply);
+        bool previousFound = false;
+        Stamp previousStamp;
+        uint64_t previousSequence = 0;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            bool found = probe.rewindToReference(points[i]);
+            Stamp stamp = found ? probe.reader.getCurrentStamp() : Stamp();
+            uint64_t sequence = found ? probe.reader.getCurrentSequence() : 0;
+            if (!i || found != previousFound || stamp != previousStamp || sequence != previousSequence)
+                partitions.emplace_back(i, i);
+            ++partitions.back().second;
+            previousFound = found;
+            previousStamp = stamp;
+            previousSequence = sequence;
+        }
+    }
+
+    /* Файлы и их набор у потоков общие (кэш каталога Location и страниц системы), читатели - свои */
+    const size_t threads = std::min(partitions.size(), workers ? workers : std::max(1u, boost::thread::hardware_concurrency()));
+    std::atomic<size_t> next(0);
+    boost::thread_group pool;
+    for (size_t i = 0; i < threads; ++i)
+    {
+        pool.create_thread([&]() {
+            RT_SetThreadName("Bbx::StateMaterializer");
+            /* Моменты интервала идут по возрастанию, поэтому нужно помнить только предыдущее состояние */
+            StateMaterializer materializer(location, apply, 1);
+            for (size_t index = next++; index < partitions.size(); index = next++)
+            {
+                for (size_t point = partitions[index].first; point < partitions[index].second; ++point)
+                {
+                    MaterializedState& out = results[point];
+                    out.result = materializer.materialize(points[point], out.state);
+                    if (out.result)
+                    {
+                        out.stamp = materializer.getStateStamp();
+                        out.sequence = materializer.getStateSequence();
+                    }
+                }
+            }
+        });
+    }
+    pool.join_all();
+    return results;
+}
+
+bool StateMaterializer::rewindToReference(const Stamp& where)
+{
+    reader.setDirection(true);
+    if (!reader.rewind(where))
+        return false;
+    if (reader.getCurrentStamp() <= where)
+        return true;
+
+    /* Перемотка находит ближайшую опорную запись, а нужна предшествующая */
+    reader.setDirection(false);
+    while (reader.next() && reader.getCurrentType() != RecordType::Reference)
+        ;
+    bool found = reader.getCurrentType() == RecordType::Reference && reader.getCurrentStamp() <= where;
+    reader.setDirection(true);
+    return found;
+}
+
+bool StateMaterializer::replayForward(const Stamp& where, Checkpoint& point)
+{
+    /* Курсор стоит на записи, которой заканчивается состояние point */
+    reader.setDirection(true);
+    Stamp stamp;
+    char_vec caption, data;
+    while (true)
+    {
+        ReadResult moved = reader.next();
+        if (ReadResult::NewSession == moved || ReadResult::TimeSequenceViolation == moved)
+            moved = reader.forceNext();
+        if (!moved)
+            return ReadResult::NoDataAvailable == moved; // конец ящика: состояние последнее из имеющихся
+
+        /* Штамп с наносекундами: граница проходит и между записями одной секунды */
+        const Stamp current = reader.getCurrentStamp();
+        if (current > where)
+        {
+            point.bounded = true;
+            point.next = current;
+            return true;
+        }
+        RecordType type = reader.getCurrentType();
+        uint64_t sequence = reader.getCurrentSequence();
+        if (!IsState(type) || (sequence && sequence == point.sequence))
+            continue; // посылки состояние не меняют, повтор опорной записи в начале файла пропускается
+        if (!readRecord(stamp, caption, data))
+            return false;
+
+        if (RecordType::Reference == type)
+            point.state.swap(data);
+        else
+            apply(point.state, caption, data);
+        point.sequence = sequence;
+        point.stamp = stamp;
+        ++replayed;
+    }
+}
+
+bool StateMaterializer::replayBackward(const Stamp& where, Checkpoint& point)
+{
+    if (!point.sequence || !reader.rewindToSequence(point.sequence))
+        return false;
+
+    /* Курсор стоит на записи, которой заканчивается состояние point; записи позже where отменяются фрагментом "до" */
+    reader.setDirection(false);
+    Stamp stamp;
+    char_vec caption, data;
+    bool done = false;
+    while (true)
+    {
+        RecordType type = reader.getCurrentType();
+        const Stamp current = reader.getCurrentStamp();
+        if (current <= where && IsState(type))
+        {
+            point.sequence = reader.getCurrentSequence();
+            point.stamp = current;
+            done = true;
+            break;
+        }
+        if (current > where)
+        {
+            if (RecordType::Reference == type)
+                break; // состояние до опорной записи из неё не восстановить
+            if (RecordType::Increment == type)
+            {
+                if (!readRecord(stamp, caption, data))
+                    break;
+                apply(point.state, caption, data);
+                ++replayed;
+            }
+            point.bounded = true;
+            point.next = current;
+        }
+        if (!reader.next())
+            break; // начало ящика или его разрыв
+    }
+    reader.setDirection(true);
+    return done;
+}
+
+bool StateMaterializer::readRecord(Stamp& stamp, char_vec& caption, char_vec& data)
+{
+    /* Для инкремента в прямом направлении читается фрагмент "после", в обратном - "до" */
+    return bool(reader.readAnyRecord(stamp, caption, data));
+}
+
+void StateMaterializer::remember(const Checkpoint& point)
+{
+    if (!point.sequence)
+        return; // без сквозных номеров состояние не найти повторно
+    cache.remove_if([&point](const Checkpoint& other) {
+        return other.sequence == point.sequence;
+    });
+    cache.push_front(point);
+    if (cache.size() > cacheSize)
+        cache.pop_back();
+}
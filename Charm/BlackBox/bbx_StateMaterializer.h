@@ -0,0 +1,100 @@
+﻿#pragma once
+
+#include <functional>
+#include <list>
+#include "bbx_BlackBox.h"
+
+namespace Bbx
+{
+    /** @brief Состояние на один из моментов пакетного восстановления */
+    struct MaterializedState
+    {
+        ReadResult result;
+        Stamp stamp;           // штамп записи, которой заканчивается состояние
+        uint64_t sequence;     // её сквозной номер
+        char_vec state;
+
+        MaterializedState();
+    };
+
+    /**
+    @brief Восстановление состояния ящика на произвольный момент времени (перемотка при воспроизведении).
+    Состояние - данные опорной записи, к которым по порядку применяются инкременты.
+    Применение инкремента выполняет вызывающий (ApplyIncrement): при движении вперёд передаётся фрагмент "после",
+    при движении назад - фрагмент "до", то есть применение фрагмента должно давать соответствующее ему состояние.
+
+    Путь выбирается по сквозным номерам записей, без оценки объёма промежуточных страниц:
+    вперёд от ближайшей предшествующей точки - опорной записи или сохранённого состояния, с более поздним номером;
+    назад от сохранённого состояния, если оно ближе по времени и до него не встречается опорных записей.
+    Последние восстановленные состояния хранятся в памяти (вытесняются давно не использованные),
+    поэтому перемотка взад-вперёд вокруг одного момента не переигрывает ящик от опорной записи.
+    Для файлов без сквозных номеров (до версии 4.0) состояния не сохраняются.
+    */
+    class StateMaterializer
+    {
+    public:
+        typedef std::function<void (char_vec& state, const char_vec& caption, const char_vec& fragment)> ApplyIncrement;
+
+        static const size_t c_defaultCacheSize = 16;
+
+        StateMaterializer(const Location& location, const ApplyIncrement& apply, size_t cacheSize = c_defaultCacheSize);
+        ~StateMaterializer();
+
+        /** @brief Состояние после последней опорной или инкрементной записи со штампом не позже where
+        @return NoDataAvailable, если раньше where нет опорных записей */
+        ReadResult materialize(const Stamp& where, char_vec& state);
+
+        /** @brief Восстановление состояний на много моментов, упорядоченных по возрастанию.
+        Моменты делятся по интервалам между опорными записями, интервалы восстанавливаются параллельно:
+        каждый поток своим читателем проходит интервал вперёд один раз. apply вызывается из нескольких потоков.
+        @param workers число потоков (0 - по числу ядер)
+        @return состояния в порядке моментов */
+        static std::vector<MaterializedState> materializeMany(const Location& location, const std::vector<Stamp>& points,
+            const ApplyIncrement& apply, size_t workers = 0);
+
+        /** @brief Штамп и номер записи, которой заканчивается последнее восстановленное состояние */
+        Stamp getStateStamp() const;
+        uint64_t getStateSequence() const;
+
+        /** @brief Разрешение восстанавливать состояние назад фрагментами "до" (по умолчанию разрешено) */
+        void setBackwardReplay(bool enable);
+
+        /** @brief Сброс сохранённых состояний (например, после дозаписи ящика задним числом) */
+        void clear();
+
+        /** @brief Сколько раз состояние нашлось в памяти без чтения записей */
+        size_t getCacheHits() const;
+        /** @brief Сколько записей прочитано и применено при восстановлении */
+        size_t getReplayedCount() const;
+
+    private:
+        StateMaterializer(const StateMaterializer&);
+        StateMaterializer& operator =(const StateMaterializer&);
+
+        /** @brief Сохранённое состояние после записи sequence */
+        struct Checkpoint
+        {
+            uint64_t sequence;
+            Stamp stamp;
+            bool bounded;   // известен штамп следующей записи
+            Stamp next;     // состояние действует до этого штампа
+            char_vec state;
+        };
+
+        Reader reader;
+        ApplyIncrement apply;
+        std::list<Checkpoint> cache; // в начале - недавно использованные
+        size_t cacheSize;
+        bool backward;
+        Checkpoint current;
+        size_t cacheHits;
+        size_t replayed;
+
+        /** @brief Установка на опорную запись не позже where */
+        bool rewindToReference(const Stamp& where);
+        bool replayForward(const Stamp& where, Checkpoint& state);
+        bool replayBackward(const Stamp& where, Checkpoint& state);
+        bool readRecord(Stamp& stamp, char_vec& caption, char_vec& data);
+        void remember(const Checkpoint& state);
+    };
+}
@@ -39,27 +39,31 @@ const unsigned c_MaximumPageSize = 1 * Bbx::c_GB;
 const size_t c_DefaultFileSize = 32 * Bbx::c_MB;
 
 /** @brief Максимальный размер файла */
-const unsigned c_MaximumFileSize = 2u * Bbx::c_GB;
+const BBX_SIZE c_MaximumFileSize = 64u * BBX_SIZE(Bbx::c_GB);
 
 /** @brief Максимально возможное значение места на диске */
 const long long c_MaximumDiskSize = 1 * Bbx::c_PB;
 
 
-WriterImpl::WriterImpl(const Bbx::Location& location, FileId verificationFile)
+WriterImpl::WriterImpl(const Bbx::Location& location, FileId verificationFile, std::shared_ptr<WriterExecutor> executor)
     : location(location), verificationFile(verificationFile),
       filewriter(nullptr), pageSize(c_DefaultPageSize), recomendedFileSize(c_DefaultFileSize),
       limitDiskSize(c_MaximumDiskSize),
-      fileLock(), recomendedFilesAge(c_DefaultLifeTime),
+      fileLock(), recomendedFilesAge(c_DefaultLifeTime), timeZone(),
+      lastSequence(0), sequenceLoaded(false), pageChecksums(false), locklessReading(false), live(),
       nextReferenceWriteTime(0),
       referenceFlushInterval(DEFAULT_REF_INTERVAL), 
-      work(), tasks(), queueWeight(0u), fatalError(), errorMessage(""), referenceAdded(), flushRequest(),
+      work(), executor(executor), tasks(), queueWeight(0u), blockedMicroseconds(0u), fatalError(), errorMessage(""), referenceAdded(), flushRequest(),
       flushMutex(), flushCondition(), taskProcessedMutex(), taskProcessedCondition()
 {
     fatalError.store(false);
     referenceAdded.store(false);
     flushRequest.store(false);
 #if !defined(SINGLE_THREAD)
-    work = boost::thread(boost::bind(&WriterImpl::run, this));
+    if (executor)
+        executor->attach(this);
+    else
+        work = boost::thread(boost::bind(&WriterImpl::run, this));
 #endif
 }
 
@@ -70,6 +74,11 @@ WriterImpl::~WriterImpl()
         work.interrupt();
         work.join();
     }
+    else if (executor)
+    {
+        executor->detach(this);
+        finishTasks();
+    }
 
     if (filewriter)
     {
@@ -88,7 +97,7 @@ WriterImpl::~WriterImpl()
 }
 
 #ifndef LINUX
-WriterImpl* WriterImpl::create(const Bbx::Location& location)
+WriterImpl* WriterImpl::create(const Bbx::Location& location, std::shared_ptr<WriterExecutor> executor)
 {
     std::wstring filePath = location.verificationFilePath();
 	FileId verificationFile = CreateFile( filePath.c_str(), 0, 0, NULL, CREATE_ALWAYS,
@@ -96,12 +105,12 @@ WriterImpl* WriterImpl::create(const Bbx::Location& location)
 	if( INVALID_HANDLE_VALUE == verificationFile )
         return nullptr;
     else
-        return new WriterImpl(location, verificationFile);
+        return new WriterImpl(location, verificationFile, executor);
 }
 
 #else
 
-WriterImpl* WriterImpl::create( const Bbx::Location& location )
+WriterImpl* WriterImpl::create( const Bbx::Location& location, std::shared_ptr<WriterExecutor> executor )
 {
     std::wstring filePath = location.verificationFilePath();
     mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
@@ -114,7 +123,7 @@ WriterImpl* WriterImpl::create( const Bbx::Location& location )
     write( verificationFile, sample.c_str(), sample.size() );
     bool mylock = OwnSection::trylock( verificationFile, 0, sample.size() );
     if ( mylock ) {
-        return new WriterImpl( location, verificationFile );
+        return new WriterImpl( location, verificationFile, executor );
     } else {
         close( verificationFile );
         return nullptr;
@@ -174,6 +183,11 @@ void WriterImpl::run()
         ASSERT( false );
     }
 
+    finishTasks();
+}
+
+void WriterImpl::finishTasks()
+{
     // доделка при завершении - обработка очереди
     while( std::shared_ptr<WriterTask> task = tasks.pop() )
     {
@@ -199,6 +213,48 @@ void WriterImpl::run()
     taskProcessedCondition.notify_all();
 }
 
+bool WriterImpl::serve(size_t budget)
+{
+    for (size_t processed = 0; processed < budget; ++processed)
+    {
+        std::shared_ptr<WriterTask> task = tasks.pop();
+        if (!task)
+            break;
+        boost::mutex::scoped_lock lock(fileLock);
+        bool procTask = processTask(*task);
+        queueWeight.fetch_sub(task->getWeight());
+        if (!procTask)
+        {
+            fatalError.store(true);
+            taskProcessedCondition.notify_all();
+            return false;
+        }
+    }
+    taskProcessedCondition.notify_all();
+
+    bool more = !tasks.empty();
+    if (!more && flushRequest)
+    {
+        if (filewriter)
+            filewriter->update(true);
+        flushRequest.store(false);
+        flushCondition.notify_all();
+    }
+    else if (filewriter)
+        filewriter->update(false);
+    return more;
+}
+
+boost::posix_time::ptime WriterImpl::updateDeadline() const
+{
+    return filewriter ? filewriter->updateDeadline() : boost::posix_time::ptime();
+}
+
+bool WriterImpl::serviced() const
+{
+    return work.joinable() || executor;
+}
+
 bool WriterImpl::processTask(const WriterTask& task)
 {
     if (RecordType::Reference == task.type)
@@ -259,12 +315,26 @@ void WriterImpl::deleteOutdatedFiles(const Bbx::Stamp& currentStamp) const
     }
 }
 
+void WriterImpl::loadLastSequence()
+{
+    /* Нумерация записей продолжается с последней записи ящика, оставленной прежним писателем */
+    sequenceLoaded = true;
+    std::wstring latestFile = location.getCPtrChain()->getLatestFile( sizeof(FileHeader) );
+    FileReader latestReader;
+    if ( !latestFile.empty() && latestReader.tryOpenFile( latestFile ) && latestReader.rewindToExtreme( false ) )
+        lastSequence = latestReader.currentCursorSequence();
+}
+
 bool WriterImpl::createFileWriter(const Bbx::Stamp& firstTime)
 {
+    if ( !sequenceLoaded )
+        loadLastSequence();
     deleteOutdatedFiles( firstTime );
     filewriter = new FileWriter(location, pageSize);
     filewriter->setRecomendedFileSize(recomendedFileSize);
     filewriter->setTimeZone(timeZone);
+    filewriter->setPageChecksums(pageChecksums);
+    filewriter->setCommitCounters(locklessReading);
     return true;
 }
 
@@ -286,11 +356,16 @@ bool WriterImpl::pushTask(std::shared_ptr<WriterTask> task)
             nextReferenceWriteTime = calcNextReferenceMoment(task->stamp.getTime());
         }
 
-        if (work.joinable() && (queueWeight.load() >= getMaximumQueueWeight() ) )
+        if (executor)
+            executor->schedule(this);
+
+        if (serviced() && (queueWeight.load() >= getMaximumQueueWeight() ) )
         {
+            const auto waitBegin = boost::posix_time::microsec_clock::universal_time();
             boost::unique_lock<boost::mutex> lock(taskProcessedMutex);
             while (queueWeight.load() >= getMaximumQueueWeight() && !tasks.empty())
                 taskProcessedCondition.wait(lock);
+            blockedMicroseconds.fetch_add( uint64_t((boost::posix_time::microsec_clock::universal_time() - waitBegin).total_microseconds()) );
         }
         return true;
     }
@@ -364,9 +439,11 @@ bool WriterImpl::processReference(const WriterTask& task)
         return false;
     }
 
-    RecordOut referenceRecord(task);
+    RecordOut referenceRecord(task, ++lastSequence);
     if (filewriter->writeRecord(referenceRecord))
     {
+        if (live)
+            live->publish(task, referenceRecord.getSequence());
         if (filewriter->timeToCloseTheFile(task.stamp))
         {
             /* Единственный момент, когда возможно создание следующего файла
@@ -374,7 +451,8 @@ bool WriterImpl::processReference(const WriterTask& task)
                если его пора закрывать (по возрасту или размеру) */
             deleteFileWriter();
             createFileWriter(task.stamp);
-            RecordOut nextReferenceRecord(task);
+            /* Копия опорной записи в новом файле сохраняет её номер */
+            RecordOut nextReferenceRecord(task, referenceRecord.getSequence());
             if (filewriter->writeRecord(nextReferenceRecord))
             {
                 return true;
@@ -409,9 +487,13 @@ bool WriterImpl::processNonReferenceRecord(const WriterTask& task)
         return false;
     }
 
-    RecordOut dataRecord(task);
+    RecordOut dataRecord(task, ++lastSequence);
     if (filewriter->writeRecord(dataRecord))
+    {
+        if (live)
+            live->publish(task, dataRecord.getSequence());
         return true;
+    }
     else
     {
         storeError("Ошибка записи данных в файл");
@@ -426,10 +508,12 @@ void WriterImpl::storeError(std::string errorText)
 
 void WriterImpl::flush()
 {
-    if (work.joinable() && !flushRequest.load())
+    if (serviced() && !flushRequest.load())
     {
         boost::unique_lock<boost::mutex> lock(flushMutex);
         flushRequest.store(true);
+        if (executor)
+            executor->schedule(this);
         while (flushRequest.load())
             flushCondition.timed_wait(lock, bt::milliseconds(100u));
     }
@@ -456,15 +540,15 @@ void WriterImpl::setPageSize(unsigned page_size)
     pageSize = std::max(std::min(page_size, c_MaximumPageSize), c_MinimumPageSize);
 }
 
-void WriterImpl::setRecomendedFileSize(unsigned file_size)
+void WriterImpl::setRecomendedFileSize(BBX_DISK_SIZE file_size)
 {
     /* Использование публичного метода возможно из любой нити */
     boost::mutex::scoped_lock lock(fileLock);
 
     FileHeader temp_header;
-    unsigned h = temp_header.getHeaderSize(); // размер заголовка
-    unsigned f = std::max(file_size, h + pageSize); // 
-    unsigned n = (std::min(f, c_MaximumFileSize) - h) / pageSize; // желаемых страниц
+    BBX_SIZE h = temp_header.getHeaderSize(); // размер заголовка
+    BBX_SIZE f = std::max<BBX_SIZE>(file_size, h + pageSize); // 
+    BBX_SIZE n = (std::min(f, c_MaximumFileSize) - h) / pageSize; // желаемых страниц
     recomendedFileSize = h + n * pageSize;
 }
 
@@ -554,3 +638,27 @@ void WriterImpl::setTimeZone( std::string textTZ )
 {
     timeZone = textTZ;        
 }
+
+void WriterImpl::setPageChecksums(bool enable)
+{
+    /* Использование публичного метода возможно из любой нити, действует с очередного файла */
+    boost::mutex::scoped_lock lock(fileLock);
+    pageChecksums = enable;
+}
+
+void WriterImpl::setLocklessReading(bool enable)
+{
+    /* Как и контрольные суммы, действует с очередного файла */
+    boost::mutex::scoped_lock lock(fileLock);
+    locklessReading = enable;
+}
+
+bool WriterImpl::setLiveFeed(size_t capacity)
+{
+    /* Лента заполняется потоком записи под той же блокировкой */
+    boost::mutex::scoped_lock lock(fileLock);
+    live.reset();
+    if (capacity)
+        live.reset(LiveRing::create(location, capacity));
+    return !capacity || live;
+}
@@ -8,8 +8,9 @@
 #include "bbx_Requirements.h"
 #include "bbx_Record.h"
 #include "bbx_File.h"
+#include "bbx_WriterExecutor.h"
+#include "bbx_LiveRing.h"
 
-#pragma pack(push, 1)
 namespace Bbx
 {
     class Stamp;
@@ -34,8 +35,9 @@ namespace Bbx
         class WriterImpl : boost::noncopyable
         {
         public:
-            static WriterImpl* create(const Bbx::Location& location);
-            WriterImpl(const Bbx::Location& location, FileId verificationFile);
+            /** @brief Без пула писатель записывает данные собственным потоком, с пулом - потоками пула */
+            static WriterImpl* create(const Bbx::Location& location, std::shared_ptr<WriterExecutor> executor = nullptr);
+            WriterImpl(const Bbx::Location& location, FileId verificationFile, std::shared_ptr<WriterExecutor> executor = nullptr);
             ~WriterImpl(void);
 
             bool pushReference(const Buffer& caption, const Buffer& data, const Stamp& stamp, const Identifier id);
@@ -49,35 +51,52 @@ namespace Bbx
                         
             unsigned getPageSize() const;
             void setPageSize(unsigned page_size);
-            void setRecomendedFileSize(unsigned file_size);
+            void setRecomendedFileSize(BBX_DISK_SIZE file_size);
             bool setDiskLimit( const char * disk_size );
 			bool setDiskLimit(BBX_DISK_SIZE disk_size);
 			BBX_DISK_SIZE getDiskLimit() const;
             void setLifeTime(time_t life_time);
             void setTimeZone( std::string textTZ );
+            void setPageChecksums(bool enable);
+            void setLocklessReading(bool enable);
+            bool setLiveFeed(size_t capacity);
             const Location& getLocation() const;
 
             bool needReference( time_t curr_moment ) const;
             
             std::tuple<unsigned, unsigned, unsigned, unsigned> getWrittenMessagesCounts() const;
+            boost::posix_time::time_duration getBlockedTime() const;
+
+            /** @brief Приём обслуживания потоком пула: не более budget записей из очереди и сброс буферов
+            @return true, если в очереди остались записи */
+            bool serve(size_t budget);
+            /** @brief Момент, когда накопленные в странице данные пора сбросить в файл (not_a_date_time - нечего сбрасывать) */
+            boost::posix_time::ptime updateDeadline() const;
         private:
             Location location;
             FileId verificationFile;
             FileWriter *filewriter;
             unsigned pageSize;
-            unsigned recomendedFileSize;
+            BBX_SIZE recomendedFileSize;
             BBX_DISK_SIZE limitDiskSize;
             mutable boost::mutex fileLock;
             time_t recomendedFilesAge;
             std::string timeZone;
+            uint64_t lastSequence;  // сквозной номер последней записанной записи
+            bool sequenceLoaded;    // номер продолжен с последнего файла ящика
+            bool pageChecksums;     // закрывать заполненные страницы контрольной суммой
+            bool locklessReading;   // публиковать страницы счётчиками фиксации вместо блокировок
+            std::unique_ptr<LiveRing> live; // лента записей в разделяемой памяти для читателей этого компьютера
 
             time_t nextReferenceWriteTime; // момент следующего требования опорных данных
             size_t referenceFlushInterval; // интервал записи опорных данных в черный ящик
             static const size_t DEFAULT_REF_INTERVAL = 5 * 60;
 
             boost::thread work;
+            std::shared_ptr<WriterExecutor> executor; // общий пул вместо собственного потока work
             BlockingPtrQueue<WriterTask> tasks;
             std::atomic_size_t queueWeight;
+            std::atomic<uint64_t> blockedMicroseconds; // ожидание места в очереди вызывающим потоком
 
             std::atomic_bool fatalError;
             std::string errorMessage;
@@ -100,9 +119,12 @@ namespace Bbx
             void storeError(std::string errorText);
 
             void run();
+            void finishTasks();
+            bool serviced() const;
             bool pushDataRecord(RecordOut& record);
             void deleteOutdatedFiles(const Stamp& currentStamp) const;
             bool createFileWriter(const Stamp& firstTime);
+            void loadLastSequence();
             void deleteFileWriter();
             bool alive() const;
 
@@ -141,10 +163,14 @@ namespace Bbx
                 return std::make_tuple(0u, 0u, 0u, 0u);
         }
 
+        inline boost::posix_time::time_duration WriterImpl::getBlockedTime() const
+        {
+            return boost::posix_time::microseconds( int64_t(blockedMicroseconds.load()) );
+        }
+
         inline size_t WriterImpl::getMaximumQueueWeight() const
         {
             return static_cast<size_t>(pageSize * c_maximumQueuePagesCapability);
         }
     }
 }
-#pragma pack(pop)
@@ -0,0 +1,233 @@
+﻿#include "stdafx.h"
+
+#include "bbx_WriterExecutor.h"
+#include "bbx_Writer.h"
+#include "../helpful/RT_ThreadName.h"
+
+using namespace Bbx;
+
+namespace
+{
+    /** @brief Шаг колеса таймеров */
+    const int64_t c_TickMilliseconds = 10;
+
+    /** @brief Число ячеек колеса; более далёкие сроки ждут в ячейке лишние обороты */
+    const size_t c_WheelSlots = 256;
+
+    /** @brief Записей за один приём обслуживания писателя, чтобы не задерживать остальных */
+    const size_t c_TasksPerTurn = 64;
+}
+
+WriterExecutor::WriterExecutor(size_t count)
+    : mutex(), wakeup(), timerWakeup(), idle(), ready(std::max<size_t>(1, count)), clients(), wheel(c_WheelSlots),
+    timersCount(0), earliestTick(0), timerWaiting(false), sleeping(0), passedTick(0), started(Clock::now()), nextQueue(0), stopping(false), threads()
+{
+    for (size_t i = 0; i < ready.size(); ++i)
+        threads.create_thread(boost::bind(&WriterExecutor::work, this, i));
+}
+
+WriterExecutor::~WriterExecutor()
+{
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        ASSERT(clients.empty());
+        stopping = true;
+        wakeup.notify_all();
+        timerWakeup.notify_all();
+    }
+    threads.join_all();
+}
+
+size_t WriterExecutor::getThreadsCount() const
+{
+    return ready.size();
+}
+
+void WriterExecutor::attach(Impl::WriterImpl* writer)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    clients[writer] = Client{ false, false, 0 };
+}
+
+void WriterExecutor::detach(Impl::WriterImpl* writer)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    auto it = clients.find(writer);
+    if (it == clients.end())
+        return;
+    while (it->second.running)
+    {
+        idle.wait(lock);
+        it = clients.find(writer);
+    }
+    for (auto& queue : ready)
+        queue.erase(std::remove(queue.begin(), queue.end(), writer), queue.end());
+    clients.erase(it); // устаревшие сроки в колесе пропускаются при срабатывании
+}
+
+void WriterExecutor::schedule(Impl::WriterImpl* writer)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    auto it = clients.find(writer);
+    if (it != clients.end())
+        enqueue(writer, it->second, nextQueue++ % ready.size());
+}
+
+void WriterExecutor::enqueue(Impl::WriterImpl* writer, Client& client, size_t index)
+{
+    if (client.scheduled)
+        return;
+    client.scheduled = true;
+    /* Обслуживаемый писатель ставится в очередь потоком пула по окончании приёма */
+    if (!client.running)
+    {
+        ready[index].push_back(writer);
+        /* Если свободен только ожидающий сроки поток, работу берёт он */
+        if (sleeping || !timerWaiting)
+            wakeup.notify_one();
+        else
+            timerWakeup.notify_one();
+    }
+}
+
+Impl::WriterImpl* WriterExecutor::take(size_t index)
+{
+    if (!ready[index].empty())
+    {
+        Impl::WriterImpl* writer = ready[index].front();
+        ready[index].pop_front();
+        return writer;
+    }
+    /* Своя очередь пуста - работа забирается с конца чужой */
+    for (size_t shift = 1; shift < ready.size(); ++shift)
+    {
+        auto& other = ready[(index + shift) % ready.size()];
+        if (!other.empty())
+        {
+            Impl::WriterImpl* writer = other.back();
+            other.pop_back();
+            return writer;
+        }
+    }
+    return nullptr;
+}
+
+void WriterExecutor::work(size_t index)
+{
+    RT_SetThreadName("Bbx::WriterExecutor");
+    boost::mutex::scoped_lock lock(mutex);
+    while (!stopping)
+    {
+        fireTimers();
+        if (Impl::WriterImpl* writer = take(index))
+        {
+            Client& client = clients[writer];
+            client.scheduled = false;
+            client.running = true;
+            /* Пока поток занят, сроки должен ждать другой свободный поток */
+            if (timersCount && !timerWaiting)
+                wakeup.notify_one();
+            lock.unlock();
+            bool more = writer->serve(c_TasksPerTurn);
+            boost::posix_time::ptime deadline = writer->updateDeadline();
+            lock.lock();
+
+            /* Писатель не удаляется, пока обслуживается (см. detach) */
+            Client& after = clients[writer];
+            after.running = false;
+            bool again = more || after.scheduled;
+            after.scheduled = false;
+            if (again)
+                enqueue(writer, after, index);
+            if (!deadline.is_not_a_date_time())
+                arm(writer, after, deadline);
+            idle.notify_all();
+        }
+        else if (timersCount && !timerWaiting)
+        {
+            /* Ближайшего срока ждёт один поток, а не все свободные на каждом такте */
+            timerWaiting = true;
+            timerWakeup.wait_until(lock, started + boost::chrono::milliseconds(c_TickMilliseconds * int64_t(earliestTick)));
+            timerWaiting = false;
+        }
+        else
+        {
+            ++sleeping;
+            wakeup.wait(lock);
+            --sleeping;
+        }
+    }
+}
+
+void WriterExecutor::arm(Impl::WriterImpl* writer, Client& client, const boost::posix_time::ptime& deadline)
+{
+    int64_t delay = (deadline - boost::posix_time::microsec_clock::universal_time()).total_milliseconds();
+    uint64_t tick = currentTick() + uint64_t(std::max<int64_t>(1, (delay + c_TickMilliseconds - 1) / c_TickMilliseconds));
+    if (client.timerTick && client.timerTick <= tick)
+        return; // более ранний срок уже назначен
+    client.timerTick = tick;
+    wheel[tick % wheel.size()].push_back(Timer{ writer, tick });
+    ++timersCount;
+    if (earliestTick && earliestTick <= tick)
+        return;
+    earliestTick = tick;
+    if (timerWaiting)
+        timerWakeup.notify_one(); // ожидающий поток переводится на более ранний срок
+    else
+        wakeup.notify_one(); // одному из спящих потоков пора ждать срока
+}
+
+void WriterExecutor::fireTimers()
+{
+    uint64_t now = currentTick();
+    if (!timersCount || now <= passedTick)
+    {
+        passedTick = std::max(passedTick, now);
+        return;
+    }
+
+    const size_t armed = timersCount;
+    uint64_t slots = std::min<uint64_t>(now - passedTick, wheel.size());
+    for (uint64_t step = 1; step <= slots; ++step)
+    {
+        auto& slot = wheel[(passedTick + step) % wheel.size()];
+        for (size_t i = 0; i < slot.size();)
+        {
+            Timer timer = slot[i];
+            if (timer.tick > now)
+            {
+                ++i;
+                continue;
+            }
+            slot[i] = slot.back();
+            slot.pop_back();
+            --timersCount;
+            auto it = clients.find(timer.writer);
+            if (it != clients.end() && it->second.timerTick == timer.tick)
+            {
+                it->second.timerTick = 0;
+                enqueue(timer.writer, it->second, nextQueue++ % ready.size());
+            }
+        }
+    }
+    passedTick = now;
+
+    /* Оставшиеся сроки позже now; ближайший ищется только после срабатывания */
+    if (armed != timersCount)
+    {
+        earliestTick = 0;
+        for (const auto& slot : wheel)
+        {
+            for (const Timer& timer : slot)
+            {
+                if (!earliestTick || timer.tick < earliestTick)
+                    earliestTick = timer.tick;
+            }
+        }
+    }
+}
+
+uint64_t WriterExecutor::currentTick() const
+{
+    return uint64_t(boost::chrono::duration_cast<boost::chrono::milliseconds>(Clock::now() - started).count() / c_TickMilliseconds);
+}
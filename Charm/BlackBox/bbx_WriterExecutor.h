@@ -0,0 +1,84 @@
+﻿#pragma once
+
+#include <deque>
+#include <unordered_map>
+#include <boost/chrono.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace Bbx
+{
+    namespace Impl
+    {
+        class WriterImpl;
+    }
+
+    /**
+    @brief Общий пул потоков записи для многих черных ящиков одного процесса.
+    Без пула каждый писатель держит свой поток, который просыпается каждые 30 мс даже без данных.
+    Писатели, созданные с пулом (Writer::create(location, executor)), ставят записи в собственные очереди,
+    а небольшое число потоков пула обслуживает готовые очереди: поток берёт писателя из своей очереди
+    готовых, при её опустошении забирает работу у других потоков. Один писатель в каждый момент
+    обслуживается одним потоком, поэтому порядок записей ящика сохраняется.
+    Сброс страниц по истечении задержки (см. Writer::setCacheDeviateDelay) планируется по сроку
+    в колесе таймеров: до ближайшего срока спит один поток пула, остальные без данных спят без тайм-аута.
+    Пул должен существовать дольше своих писателей (писатели хранят на него указатель).
+    */
+    class WriterExecutor : boost::noncopyable
+    {
+    public:
+        explicit WriterExecutor(size_t threads = 2);
+        ~WriterExecutor();
+
+        size_t getThreadsCount() const;
+
+    private:
+        friend class Impl::WriterImpl;
+        typedef boost::chrono::steady_clock Clock;
+
+        /** @brief Состояние обслуживаемого писателя */
+        struct Client
+        {
+            bool scheduled;     // стоит в очереди готовых или ждёт повторной постановки
+            bool running;       // обслуживается потоком пула
+            uint64_t timerTick; // такт назначенного срока сброса (0 - срока нет)
+        };
+        /** @brief Срок сброса в колесе таймеров */
+        struct Timer
+        {
+            Impl::WriterImpl* writer;
+            uint64_t tick;
+        };
+
+        mutable boost::mutex mutex;
+        boost::condition_variable wakeup;  // появилась работа или нужен поток для ожидания сроков
+        boost::condition_variable timerWakeup; // ожидающему сроки потоку назначен более ранний срок или есть работа
+        boost::condition_variable idle;    // писатель закончил обслуживание
+        std::vector<std::deque<Impl::WriterImpl*>> ready; // очереди готовых писателей по потокам
+        std::unordered_map<Impl::WriterImpl*, Client> clients;
+        std::vector<std::vector<Timer>> wheel;
+        size_t timersCount;
+        uint64_t earliestTick;             // ближайший назначенный такт (0 - сроков нет)
+        bool timerWaiting;                 // один из потоков ждёт ближайшего срока
+        size_t sleeping;                   // потоков, ждущих работы без срока
+        uint64_t passedTick;               // все сроки до этого такта включительно обработаны
+        Clock::time_point started;
+        size_t nextQueue;
+        bool stopping;
+        boost::thread_group threads;
+
+        void attach(Impl::WriterImpl* writer);
+        /** @brief Ожидание окончания обслуживания и удаление писателя из очередей */
+        void detach(Impl::WriterImpl* writer);
+        /** @brief Писатель получил записи или запрос сброса */
+        void schedule(Impl::WriterImpl* writer);
+
+        void work(size_t index);
+        Impl::WriterImpl* take(size_t index);
+        void enqueue(Impl::WriterImpl* writer, Client& client, size_t index);
+        void arm(Impl::WriterImpl* writer, Client& client, const boost::posix_time::ptime& deadline);
+        void fireTimers();
+        uint64_t currentTick() const;
+    };
+}
@@ -4,20 +4,34 @@
 #include "bbx_Location.h"
 #include "bbx_Stamp.h"
 #include "bbx_Reader.h"
+#include "cnv_Pipeline.h"
+#include "cnv_Matcher.h"
+#include "cnv_Batch.h"
+#include "cnv_Checkpoint.h"
+#include "cnv_Export.h"
+#include "cnv_Stats.h"
+#include "bbx_FileSplitter.h"
+#include "bbx_FileChain.h"
+#include "bbx_MergeIterator.h"
+#include "bbx_Compactor.h"
+
+#include <boost/filesystem/operations.hpp>
 
 #include "Utf8.h"
+#include "Time_Iso.h"
 
 const unsigned MINFILESIZE = 1;
 
-enum class operation 
+// Расположение создаётся только для существующей папки
+bool FolderExists(const std::wstring& str)
 {
-    division,
-    filtration
-};
+    size_t folder_end = str.find_last_of(L"\\/");
+    return folder_end != std::wstring::npos && boost::filesystem::is_directory(str.substr(0, folder_end));
+}
 
 Bbx::Location PathToLocation(const std::wstring& str)
 {
-    size_t folder_end = str.find_last_of('\\');
+    size_t folder_end = str.find_last_of(L"\\/");
     size_t pref_end = str.find_last_of('_');
     size_t suff_begin = str.find_last_of('.');
 
@@ -27,204 +41,515 @@ Bbx::Location PathToLocation(const std::wstring& str)
     return { {str, 0, folder_end}, {str, folder_end + 1, pref_end - folder_end}, {str, suff_begin, str.size() - suff_begin} };
 }
 
-std::string HexToBinary(const std::string& hex_str)
+// Контрольные точки из параметров командной строки
+struct Checkpointing
 {
-    std::string binary_str;
-
-    for (size_t i = 2; i < hex_str.length(); i += 2)
-    {
-        std::string byte_str = hex_str.substr(i, 2);
-        try
-        {
-            uint8_t byte = std::stoi(byte_str, nullptr, 16);
-            binary_str.push_back(static_cast<char>(byte));
-        }
-        catch (const std::exception&)
-        {
-            binary_str.clear();
-            break;
-        }
-    }
+    std::string path;     // пусто - без контрольных точек
+    unsigned interval;    // секунд между точками
+    bool resume;          // продолжение с сохранённой точки
+    Cnv::Checkpoint point;
+    Bbx::Location output;
+};
 
-    return binary_str;
+void SetupPipeline(Cnv::Pipeline& pipeline, std::shared_ptr<Bbx::Writer>& writer, size_t workers, const Checkpointing& checkpointing, BBX_DISK_SIZE fileSize, Cnv::Stats* stats)
+{
+    pipeline.setWorkers(workers);
+    pipeline.setStats(stats);
+    if (checkpointing.path.empty())
+        return;
+    Bbx::Location output = checkpointing.output;
+    pipeline.setCheckpoints(checkpointing.path, checkpointing.interval, writer, [output, fileSize]() {
+        auto reopened = Bbx::Writer::create(output);
+        if (reopened && fileSize)
+            reopened->setRecomendedFileSize(fileSize);
+        return reopened;
+    });
+    if (checkpointing.resume)
+        pipeline.resumeFrom(checkpointing.point);
 }
 
-bool PushRecord(Bbx::Reader& reader, std::shared_ptr<Bbx::Writer>& writer, operation oper, std::string& pattern = std::string())
+// Подготовка продолжения: файлы результата, записанные после контрольной точки, удаляются
+bool LoadCheckpoint(Checkpointing& checkpointing, std::ostream& err)
 {
-    Bbx::Stamp stamp;
-    Bbx::char_vec caption;
-    Bbx::char_vec data;
-
-    Bbx::ReadResult result = reader.readAnyRecord(stamp, caption, data);
-
-    // что бы не писать в параметрах каждой функции тернарный оператор
-    Bbx::Buffer caption_buff = caption.empty() ? Bbx::Buffer() : caption;
-    Bbx::Buffer data_buff = data.empty() ? Bbx::Buffer() : data;
-
-    if (result != Bbx::ReadResult::Success)
+    if (!checkpointing.point.load(checkpointing.path))
     {
-        std::cerr << "Error reading data from black box." << std::endl;
+        err << "Failed to read checkpoint " << checkpointing.path << std::endl;
         return false;
     }
 
-    Bbx::RecordType recordType = reader.getCurrentType();
-
-    if (recordType == Bbx::RecordType::Reference)
+    bool after = false;
+    boost::system::error_code ec;
+    for (const std::wstring& file : checkpointing.output.getCPtrChain()->getFiles(0))
     {
-        if (!writer->pushReference(caption_buff, data_buff, stamp, reader.getCurrentIdentifier()))
-            return false;
+        if (after)
+            boost::filesystem::remove(file, ec);
+        after = after || file == checkpointing.point.outputLatest;
     }
-    else
+    if (!after)
     {
-        if (oper == operation::filtration)
-        {
-            std::string find_data = data.data() ? data.data() : "";
-            std::string find_caption = caption.data() ? caption.data() : "";
-
-            if (pattern.empty()) {
-                std::cerr << "Invalid hexadecimal pattern." << std::endl;
-                return false;
-            }
-
-            // если не нашли - выходим
-            if (std::search(find_data.begin(), find_data.end(), pattern.begin(), pattern.end()) == find_data.end() &&
-                std::search(find_caption.begin(), find_caption.end(), pattern.begin(), pattern.end()) == find_caption.end())
-                return true;
-        }
+        err << "Output black box does not contain the checkpoint file " << ToUtf8(checkpointing.point.outputLatest) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Division(Bbx::Reader& reader, std::shared_ptr<Bbx::Writer>& writer, size_t workers, const Checkpointing& checkpointing, Cnv::Stats* stats, std::ostream& err)
+{
+    writer->setRecomendedFileSize(MINFILESIZE);
 
-        if (recordType == Bbx::RecordType::IncomingPackage)
+    Cnv::Pipeline pipeline(reader, *writer);
+    SetupPipeline(pipeline, writer, workers, checkpointing, MINFILESIZE, stats);
+    pipeline.setLog(err);
+    return pipeline.run();
+}
+
+// Деление копированием страниц: записи не разбираются, новый файл начинается у каждой опорной записи
+bool RawDivision(const Bbx::Location& input, const Bbx::Location& output, std::ostream& err)
+{
+    for (const std::wstring& file : input.getCPtrChain()->getFiles(sizeof(Bbx::Impl::FileHeader)))
+    {
+        Bbx::Impl::FileSplitter splitter;
+        std::vector<std::wstring> created;
+        if (!splitter.open(file) || !splitter.split(output, MINFILESIZE, created))
         {
-            if (!writer->pushIncomingPackage(caption_buff, data_buff, stamp, reader.getCurrentIdentifier()))
-                return false;
+            err << "Failed to split file " << ToUtf8(file) << std::endl;
+            return false;
         }
-        else if (recordType == Bbx::RecordType::OutboxPackage)
+    }
+    return true;
+}
+
+bool Filtration(Bbx::Reader& reader, std::shared_ptr<Bbx::Writer>& writer, const std::vector<std::string>& patterns, unsigned targets, size_t workers, const Checkpointing& checkpointing, Cnv::Stats* stats, std::ostream& err)
+{
+    Cnv::Matcher matcher;
+    for (const std::string& pattern : patterns)
+    {
+        if (!matcher.addPattern(pattern))
         {
-            if (!writer->pushOutboxPackage(caption_buff, data_buff, stamp, reader.getCurrentIdentifier()))
-                return false;
+            err << "Invalid pattern: " << pattern << std::endl;
+            return false;
         }
-        else if (recordType == Bbx::RecordType::Increment)
-        {
-            Bbx::char_vec data_before, caption_before;
-            Bbx::Stamp stamp_before;
-
-            reader.setDirection(false);
-            reader.readIncrementOriented(stamp_before, caption_before, data_before);
-            reader.setDirection(true);
+    }
+    matcher.compile();
+
+    Cnv::Pipeline pipeline(reader, *writer);
+    SetupPipeline(pipeline, writer, workers, checkpointing, 0, stats);
+    pipeline.setLog(err);
+    pipeline.setFilter([&matcher, targets](const Cnv::Record& record) {
+        return matcher.matches(record, targets);
+    });
+    return pipeline.run();
+}
 
-            if (!writer->pushIncrement(caption_buff, data_before.empty() ? Bbx::Buffer() : data_before, data_buff, stamp, reader.getCurrentIdentifier()))
-                return false;
-        }
+// Выделение интервала времени: начало - опорная запись не позже from, с ней и инкрементами
+// до from выходной ящик самодостаточен; посылки сохраняются только из интервала [from, to]
+bool Extraction(Bbx::Reader& reader, std::shared_ptr<Bbx::Writer>& writer, time_t from, time_t to, size_t workers, Cnv::Stats* stats, std::ostream& err)
+{
+    if (!reader.rewind(Bbx::Stamp(from)))
+    {
+        err << "No reference record found near " << time_to_iso(from) << std::endl;
+        return false;
+    }
+    if (reader.getCurrentStamp().getTime() > from)
+    {
+        // перемотка находит ближайшую опорную запись, а нужна предшествующая
+        reader.setDirection(false);
+        while (reader.next() && reader.getCurrentType() != Bbx::RecordType::Reference)
+            ;
+        if (reader.getCurrentType() != Bbx::RecordType::Reference)
+            reader.rewind(Bbx::Stamp(from)); // раньше опорных записей нет
+        reader.setDirection(true);
     }
 
-    return true;
+    Cnv::Pipeline pipeline(reader, *writer);
+    pipeline.setWorkers(workers);
+    pipeline.setStats(stats);
+    pipeline.setLog(err);
+    pipeline.setEnd(Bbx::Stamp(to));
+    pipeline.setFilter([from](const Cnv::Record& record) {
+        return record.type == Bbx::RecordType::Increment || record.stamp.getTime() >= from;
+    });
+    return pipeline.run();
 }
 
-bool Division(Bbx::Reader& reader, std::shared_ptr<Bbx::Writer>& writer)
+// Слияние нескольких ящиков в один в порядке времени записей
+bool Merging(const std::vector<Bbx::Location>& inputs, const Bbx::Location& output, std::ostream& out, std::ostream& err)
 {
-    writer->setRecomendedFileSize(MINFILESIZE);
+    auto writer = Bbx::Writer::create(output);
+    if (!writer)
+    {
+        err << "Failed to create Writer." << std::endl;
+        return false;
+    }
 
-    while (true)
+    Bbx::MergeIterator merge(inputs);
+    if (!merge.rewindToBegin())
     {
-        if (!PushRecord(reader, writer, operation::division))
+        err << "Input black boxes contain no records." << std::endl;
+        return false;
+    }
+
+    Bbx::MergedRecord merged;
+    Cnv::Record record;
+    size_t sessions = 0;
+    while (merge.next(merged))
+    {
+        if (merged.newSession)
+            ++sessions;
+        record.type = merged.type;
+        record.stamp = merged.stamp;
+        record.id = merged.identifier;
+        record.caption.swap(merged.caption);
+        record.data.swap(merged.data);
+        record.before.swap(merged.before);
+        if (!Cnv::WriteRecord(*writer, record))
         {
-            std::cerr << "Failed to write record." << std::endl;
+            err << "Failed to write record." << std::endl;
             return false;
         }
+    }
 
-        auto res = reader.next();
+    for (size_t i = 0; i < merge.inputsCount(); ++i)
+    {
+        if (merge.inputResult(i) != Bbx::ReadResult::NoDataAvailable)
+            err << "Reading of black box " << i + 1 << " stopped with code " << merge.inputResult(i).get() << std::endl;
+    }
+    if (sessions)
+        out << "Session breaks passed: " << sessions << std::endl;
+    return true;
+}
 
-        if (res == Bbx::ReadResult::NoDataAvailable)
-            break;
+// Прореживание: инкременты раньше before не переносятся, состояние там остаётся в опорных записях.
+// Формат данных состояния конвертеру неизвестен, поэтому новые опорные записи он не создаёт,
+// и инкременты от последней опорной записи перед before сохраняются
+bool Compaction(const Bbx::Location& input, const Bbx::Location& output, time_t before, std::ostream& out, std::ostream& err)
+{
+    auto writer = Bbx::Writer::create(output);
+    if (!writer)
+    {
+        err << "Failed to create Writer." << std::endl;
+        return false;
+    }
 
-        if (res == Bbx::ReadResult::NewSession)
-            reader.forceNext();
+    Bbx::Compactor compactor(input, *writer);
+    compactor.setThinBefore(Bbx::Stamp(before));
+    if (!compactor.run())
+    {
+        err << "Error reading data from black box." << std::endl;
+        return false;
     }
+    out << "Records read: " << compactor.getReadCount() << ", written: " << compactor.getWrittenCount()
+        << ", increments dropped: " << compactor.getDroppedIncrements() << std::endl;
     return true;
 }
 
-bool Filtration(Bbx::Reader& reader, std::shared_ptr<Bbx::Writer>& writer, std::string& pattern)
+// Экспорт в столбцовые сегменты рядом с путём результата: <папка\префикс><имя файла ящика>.bbxc
+// (суффикс пути результата не используется - сегменты не должны выглядеть как файлы ящика)
+bool Exporting(const Bbx::Location& input, const std::wstring& o_path, size_t workers, std::ostream& out, std::ostream& err)
 {
-    // если обнаружили префикс вначале
-    if (pattern.find_first_of("0x") == 0)
-        pattern = HexToBinary(pattern);
+    Cnv::Exporter exporter(input, o_path.substr(0, o_path.find_last_of('_') + 1));
+    exporter.setWorkers(workers);
+    if (!exporter.run())
+    {
+        err << "Error exporting black box." << std::endl;
+        return false;
+    }
+    out << "Records exported: " << exporter.getRowsCount() << ", segments: " << exporter.getSegmentsCount() << std::endl;
+    return true;
+}
 
-    while (true)
+// Необязательные параметры вида --name=value после обязательных
+std::map<std::string, std::string> ParseOptions(const std::vector<std::string>& tokens, std::vector<std::string>& positional)
+{
+    std::map<std::string, std::string> options;
+    for (const std::string& arg : tokens)
     {
-        if (!PushRecord(reader, writer, operation::filtration, pattern))
+        if (arg.compare(0, 2, "--") == 0)
         {
-            std::cerr << "Failed to write record." << std::endl;
-                return false;
+            size_t eq = arg.find('=');
+            options[arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2)] = eq == std::string::npos ? std::string() : arg.substr(eq + 1);
         }
+        else
+            positional.push_back(arg);
+    }
+    return options;
+}
 
-        auto res = reader.next();
-
-        if (res == Bbx::ReadResult::NoDataAvailable)
-            break;
-
-        if (res == Bbx::ReadResult::NewSession)
-            reader.forceNext();
+// Суммарный размер файлов входного ящика задания
+uint64_t InputBytes(const std::vector<std::string>& tokens)
+{
+    std::vector<std::string> args;
+    ParseOptions(tokens, args);
+    uint64_t bytes = 0;
+    std::wstring path = FromUtf8(args.empty() ? std::string() : args[0]);
+    if (!FolderExists(path))
+        return bytes;
+    boost::system::error_code ec;
+    for (const std::wstring& file : PathToLocation(path).getCPtrChain()->getFiles(sizeof(Bbx::Impl::FileHeader)))
+    {
+        uintmax_t size = boost::filesystem::file_size(file, ec);
+        if (!ec)
+            bytes += size;
     }
-    return true;
+    return bytes;
 }
 
-int main(int argc, char* argv[])
+// Одно преобразование; возвращает код завершения, сообщения выводятся в out и err
+int Convert(const std::vector<std::string>& tokens, size_t workers, std::ostream& out, std::ostream& err)
 {
-    if (argc < 4)
+    std::vector<std::string> args;
+    std::map<std::string, std::string> options = ParseOptions(tokens, args);
+    if (options.count("threads"))
+        workers = std::max(1, atoi(options["threads"].c_str()));
+
+    if (args.size() < 3)
     {
-        std::cerr << "Usage: Converter.exe <input_path\\pref_.suff> <operation> <output_path\\pref_.suff>\n"
-            "<input_path\\pref_.suff> - enter the path to the folder where the black box files are located and specify their prefix and suffix.\n"
-            "<operation> - selecting the operation to be performed on the black box:\n"
-            "division - dividing the black box into smaller files.\n"
-            "filtration - input black box filtering by pattern.\n"
-            "This operation requires an additional parameter - pattern by which the records will be filtered(fifth parameter).\n"
-            "<output_path\\pref_.suff> - enter the path to the folder where the resulting black box will be located, and specify its prefix and suffix.\n";
+        err << "Not enough parameters: " << (args.empty() ? std::string() : args[0]) << std::endl;
         return 1;
     }
 
     // На Windows - From1251()
-    std::wstring i_path(FromUtf8(argv[1])), o_path(FromUtf8(argv[3]));
-    std::string operation(argv[2]);
+    std::wstring i_path(FromUtf8(args[0])), o_path(FromUtf8(args[2]));
+    std::string operation(args[1]);
 
-    Bbx::Reader reader(PathToLocation(i_path));
-    auto writer = Bbx::Writer::create(PathToLocation(o_path));
+    if (!FolderExists(i_path) || !FolderExists(o_path))
+    {
+        err << "Folder not found: " << (FolderExists(i_path) ? args[2] : args[0]) << std::endl;
+        return 1;
+    }
+    Bbx::Location i_location = PathToLocation(i_path), o_location = PathToLocation(o_path);
+    Checkpointing checkpointing = { options["checkpoint"], 60, options.count("resume") != 0, Cnv::Checkpoint(), o_location };
+    if (options.count("checkpoint-interval"))
+        checkpointing.interval = unsigned(std::max(1, atoi(options["checkpoint-interval"].c_str())));
+    if (checkpointing.resume && (checkpointing.path.empty() || !LoadCheckpoint(checkpointing, err)))
+    {
+        err << "Resuming requires a valid --checkpoint=<file>." << std::endl;
+        return 1;
+    }
+
+    // писатель с блокировкой папки результата нужен только операциям конвейера:
+    // слияние и прореживание создают его сами, деление копированием страниц и экспорт пишут файлы без него
+    const bool pipelined = (operation == "division" && !options.count("raw")) || operation == "filtration" || operation == "extract";
+    // этапы замеряет только конвейер; прочие операции выдали бы нулевой отчёт
+    if (!pipelined && (options.count("stats") || options.count("bench")))
+    {
+        err << "--stats and --bench are supported only by division without --raw, filtration and extract." << std::endl;
+        return 1;
+    }
+    Bbx::Reader reader(i_location);
+    std::shared_ptr<Bbx::Writer> writer;
+    if (pipelined)
+        writer = Bbx::Writer::create(o_location);
 
     reader.setDirection(true);
-    Bbx::Stamp beg = reader.getBoundStamp().first;
-    reader.rewind(beg.getTime());
+    if (checkpointing.resume)
+    {
+        // работа продолжается с опорной записи контрольной точки;
+        // штамп точки взят из считанной записи, текущий штамп читателя так же точен до наносекунд
+        const Cnv::Checkpoint& point = checkpointing.point;
+        if (!reader.rewindToCursor(point.inputFile, point.cursor) || reader.getCurrentType() != Bbx::RecordType::Reference
+            || reader.getCurrentStamp() != point.stamp)
+        {
+            err << "Checkpoint does not match the input black box." << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        Bbx::Stamp beg = reader.getBoundStamp().first;
+        reader.rewind(beg.getTime());
+    }
 
-    if (!writer || !reader.isOpened())
+    if ((pipelined && !writer) || !reader.isOpened())
     {
-        std::cerr << "Failed to create Writer or Reader(wrong paths)." << std::endl;
+        err << "Failed to create Writer or Reader(wrong paths)." << std::endl;
         return 1;
     }
 
+    // замеры этапов включаются только по запросу: часы на каждой записи заметно замедляют конвейер
+    std::unique_ptr<Cnv::Stats> stats;
+    if (options.count("stats") || options.count("bench"))
+    {
+        stats.reset(new Cnv::Stats());
+        stats->operation = operation;
+        stats->inputBytes = InputBytes(tokens);
+    }
+    const Cnv::Stats::Clock::time_point started = Cnv::Stats::Clock::now();
+
     if (operation == "division")
     {
-        if (!Division(reader, writer))
+        if (options.count("raw") ? !RawDivision(i_location, o_location, err) : !Division(reader, writer, workers, checkpointing, stats.get(), err))
             return 1;
     }
     else if (operation == "filtration")
     {
-        if (argc < 5)
+        if (args.size() < 4)
+        {
+            err << "This operation requires a search pattern.\n"
+                "Usage: Converter.exe <input_path\\pref_.suff> <operation> <output_path\\pref_.suff> <pattern> [<pattern>...] [--in=...]\n"
+                "<pattern> - pattern by which the records will be filtered, a record is kept if any pattern is found.\n"
+                "Use the 0x prefix to filter on binary data, which is specified in hexadecimal, for example <0x4B>.\n"
+                "--in=caption,data,before,after - where to search: caption, data (both parts of increment),\n"
+                "before or after part of increment (after also means data of packages and references).\n";
+            return 1;
+        }
+
+        unsigned targets = Cnv::TargetCaption | Cnv::TargetAfter;
+        if (options.count("in") && !Cnv::Matcher::parseTargets(options["in"], targets))
+        {
+            err << "Invalid search targets: " << options["in"] << std::endl;
+            return 1;
+        }
+
+        if (!Filtration(reader, writer, std::vector<std::string>(args.begin() + 3, args.end()), targets, workers, checkpointing, stats.get(), err))
+            return 1;
+    }
+    else if (operation == "extract")
+    {
+        time_t from = options.count("from") ? time_from_iso(options["from"]) : 0;
+        time_t to = options.count("to") ? time_from_iso(options["to"]) : 0;
+        if (!from || !to || to < from)
+        {
+            err << "This operation requires a time range.\n"
+                "Usage: Converter.exe <input_path\\pref_.suff> extract <output_path\\pref_.suff> --from=YYYYMMDDTHHMMSSZ --to=YYYYMMDDTHHMMSSZ\n";
+            return 1;
+        }
+
+        if (!Extraction(reader, writer, from, to, workers, stats.get(), err))
+            return 1;
+    }
+    else if (operation == "merge")
+    {
+        if (args.size() < 4)
         {
-            std::cerr << "This operation requires a search pattern.\n"
-                "Usage: Converter.exe <input_path\\pref_.suff> <operation> <output_path\\pref_.suff> <pattern>\n"
-                "<pattern> - pattern by which the records will be filtered(fifth parameter).\n"
-                "Use the 0x prefix to filter on binary data, which is specified in hexadecimal, for example <0x4B>.\n";
+            err << "This operation requires black boxes to merge with.\n"
+                "Usage: Converter.exe <input_path\\pref_.suff> merge <output_path\\pref_.suff> <input_path\\pref_.suff> [<input_path\\pref_.suff>...]\n";
             return 1;
         }
 
-        std::string pattern = argv[4];
+        std::vector<Bbx::Location> inputs(1, i_location);
+        for (size_t i = 3; i < args.size(); ++i)
+            inputs.push_back(PathToLocation(FromUtf8(args[i])));
+        if (!Merging(inputs, o_location, out, err))
+            return 1;
+    }
+    else if (operation == "compact")
+    {
+        time_t before = options.count("before") ? time_from_iso(options["before"]) : 0;
+        if (!before)
+        {
+            err << "This operation requires a moment before which increments are dropped.\n"
+                "Usage: Converter.exe <input_path\\pref_.suff> compact <output_path\\pref_.suff> --before=YYYYMMDDTHHMMSSZ\n";
+            return 1;
+        }
 
-        if (!Filtration(reader, writer, pattern))
+        if (!Compaction(i_location, o_location, before, out, err))
+            return 1;
+    }
+    else if (operation == "export")
+    {
+        if (!Exporting(i_location, o_path, workers, out, err))
             return 1;
     }
     else
     {
-        std::cerr << "Unknown operation. Enter <division> to divide or <filtration> to filter." << std::endl;
+        err << "Unknown operation. Enter <division> to divide, <filtration> to filter, <merge> to combine, <compact> to thin out, <extract> to cut out a time range or <export> to write columnar segments." << std::endl;
         return 1;
     }
 
-    std::cout << "Operation completed successfully!" << std::endl;
+    if (stats)
+    {
+        if (writer)
+            writer->flush(); // время записи включает сброс очереди писателя на диск
+        stats->elapsed = Cnv::Stats::since(started);
+        if (options.count("bench") || options["stats"].empty())
+            out << stats->toJson();
+        if (!options["stats"].empty() && !stats->save(options["stats"]))
+            err << "Failed to save statistics " << options["stats"] << std::endl;
+    }
+
+    // работа завершена, продолжать больше нечего
+    if (!checkpointing.path.empty())
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove(checkpointing.path, ec);
+    }
     return 0;
 }
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> tokens(argv + 1, argv + argc), args;
+    std::map<std::string, std::string> options = ParseOptions(tokens, args);
+
+    std::vector<Cnv::BatchRunner::Job> jobs;
+    bool batch = options.count("batch") != 0;
+    if (batch)
+    {
+        if (!Cnv::BatchRunner::loadManifest(options["batch"], jobs))
+        {
+            std::cerr << "Failed to read manifest " << options["batch"] << std::endl;
+            return 1;
+        }
+    }
+    else if (!args.empty() && Cnv::BatchRunner::isGlob(args[0]))
+    {
+        batch = true;
+        Cnv::BatchRunner::Job pattern;
+        std::copy_if(tokens.begin(), tokens.end(), std::back_inserter(pattern), [](const std::string& token) {
+            return token.compare(0, 7, "--jobs=") != 0;
+        });
+        if (!Cnv::BatchRunner::expandGlob(pattern, jobs))
+        {
+            std::cerr << "Failed to expand " << args[0] << ", the output path must contain * too." << std::endl;
+            return 1;
+        }
+    }
+
+    if (!batch && args.size() < 3)
+    {
+        std::cerr << "Usage: Converter.exe <input_path\\pref_.suff> <operation> <output_path\\pref_.suff> [--threads=N]\n"
+            "<input_path\\pref_.suff> - enter the path to the folder where the black box files are located and specify their prefix and suffix.\n"
+            "<operation> - selecting the operation to be performed on the black box:\n"
+            "division - dividing the black box into smaller files.\n"
+            "--raw - copy pages without decoding records, a new file starts at every reference record.\n"
+            "filtration - input black box filtering by pattern.\n"
+            "This operation requires additional parameters - patterns by which the records will be filtered(fifth and following parameters).\n"
+            "<output_path\\pref_.suff> - enter the path to the folder where the resulting black box will be located, and specify its prefix and suffix.\n"
+            "--threads=N - number of filtering threads (by default depends on the number of processor cores).\n"
+            "--in=caption,data,before,after - parts of the record searched by filtration (by default caption,after).\n"
+            "merge - combine the input black box and the black boxes given as additional parameters into one, ordered by time.\n"
+            "compact --before=YYYYMMDDTHHMMSSZ - drop increments older than the given moment, keeping references and packages\n"
+            "(increments after the last reference record before the moment are kept).\n"
+            "extract --from=YYYYMMDDTHHMMSSZ --to=YYYYMMDDTHHMMSSZ - time range of the black box starting with the preceding reference record.\n"
+            "export - write every file of the black box as a columnar segment <output_path\\pref_><file name>.bbxc for analysis tools,\n"
+            "the segments are listed in <output_path\\pref_>index.tsv.\n"
+            "--checkpoint=<file> [--checkpoint-interval=S] - division and filtration save their position every S seconds (60 by default).\n"
+            "--resume - continue division or filtration from the checkpoint file after an interruption.\n"
+            "--bench - print a JSON report: records/s and MB/s of the read, filter and write stages, time spent in Reader::next\n"
+            "and Reader::readAnyRecord, time the writer blocked on a full queue and reading speed of every input file.\n"
+            "--stats[=<file>] - collect the same JSON report and save it to a file (printed without a file name).\n"
+            "--bench and --stats are accepted by division without --raw, filtration and extract only.\n"
+            "Batch mode (boxes are converted concurrently, a throughput summary is printed):\n"
+            "Converter.exe --batch=<manifest> [--jobs=N] - one set of converter parameters per line of the manifest.\n"
+            "Converter.exe <input_folder\\*\\pref_.suff> <operation> <output_folder\\*\\pref_.suff> ... [--jobs=N] - every subfolder.\n"
+            "--jobs=N - number of boxes converted at once (by default depends on the number of processor cores).\n"
+            "Paths may use either \\ or / as the folder separator.\n";
+        return 1;
+    }
+
+    int code = 0;
+    if (batch)
+    {
+        Cnv::BatchRunner runner(Convert, InputBytes);
+        if (options.count("jobs"))
+            runner.setJobsLimit(std::max(1, atoi(options["jobs"].c_str())));
+        code = runner.run(jobs) ? 1 : 0;
+    }
+    else
+        code = Convert(tokens, Cnv::Pipeline::defaultWorkers(), std::cout, std::cerr);
+
+    if (!code)
+        std::cout << "Operation completed successfully!" << std::endl;
+    return code;
+}
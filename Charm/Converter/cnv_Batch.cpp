@@ -0,0 +1,190 @@
+#include "stdafx.h"
+
+#include <atomic>
+#include <iomanip>
+#include <sstream>
+#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include "cnv_Batch.h"
+#include "RT_ThreadName.h"
+#include "Utf8.h"
+
+using namespace Cnv;
+
+namespace
+{
+    const size_t c_diskJobs = 4; // больше одновременных заданий упирается в диск, а не в процессор
+
+    // Номера позиционных аргументов задания (опции --name пропускаются)
+    std::vector<size_t> Positional(const BatchRunner::Job& job)
+    {
+        std::vector<size_t> positions;
+        for (size_t i = 0; i < job.size(); ++i)
+        {
+            if (job[i].compare(0, 2, "--") != 0)
+                positions.push_back(i);
+        }
+        return positions;
+    }
+
+    const std::string& JobName(const BatchRunner::Job& job)
+    {
+        std::vector<size_t> positions = Positional(job);
+        return job[positions.empty() ? 0 : positions.front()];
+    }
+
+    std::string Folder(const std::string& path)
+    {
+        size_t end = path.find_last_of("\\/");
+        return end == std::string::npos ? std::string() : path.substr(0, end);
+    }
+}
+
+BatchRunner::BatchRunner(Convert _convert, Measure _measure)
+    : convert(_convert), measure(_measure), jobsLimit(0)
+{
+}
+
+void BatchRunner::setJobsLimit(size_t jobs)
+{
+    jobsLimit = jobs;
+}
+
+bool BatchRunner::isGlob(const std::string& path)
+{
+    return path.find('*') != std::string::npos;
+}
+
+bool BatchRunner::loadManifest(const std::string& path, std::vector<Job>& jobs)
+{
+    std::ifstream manifest(path);
+    if (!manifest)
+        return false;
+
+    std::string line;
+    while (std::getline(manifest, line))
+    {
+        std::istringstream stream(line);
+        Job job;
+        std::string token;
+        while (stream >> std::quoted(token))
+            job.push_back(token);
+        if (!job.empty() && job.front()[0] != '#')
+            jobs.push_back(job);
+    }
+    return true;
+}
+
+bool BatchRunner::expandGlob(const Job& pattern, std::vector<Job>& jobs)
+{
+    std::vector<size_t> positions = Positional(pattern);
+    if (positions.size() < 3)
+        return false;
+    const std::string& input = pattern[positions[0]];
+    const std::string& output = pattern[positions[2]];
+    size_t star = input.find('*');
+    size_t outputStar = output.find('*');
+    if (star == std::string::npos || outputStar == std::string::npos || star > Folder(input).size())
+        return false;
+
+    // подпапки перебираются в порядке имён, чтобы сводка не зависела от файловой системы
+    std::string parent = input.substr(0, star);
+    boost::system::error_code ec;
+    std::vector<std::wstring> names;
+    for (boost::filesystem::directory_iterator it(FromUtf8(parent.empty() ? std::string(".") : parent), ec), end; !ec && it != end; it.increment(ec))
+    {
+        if (boost::filesystem::is_directory(it->status()))
+            names.push_back(it->path().filename().wstring());
+    }
+    if (ec)
+        return false;
+    std::sort(names.begin(), names.end());
+
+    for (const std::wstring& name : names)
+    {
+        std::string folder = ToUtf8(name);
+        Job job(pattern);
+        job[positions[0]] = parent + folder + input.substr(star + 1);
+        job[positions[2]] = output.substr(0, outputStar) + folder + output.substr(outputStar + 1);
+        boost::filesystem::create_directories(FromUtf8(Folder(job[positions[2]])), ec);
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+size_t BatchRunner::run(const std::vector<Job>& jobs)
+{
+    const size_t cores = std::max(1u, boost::thread::hardware_concurrency());
+    const size_t threads = std::min(jobs.size(), jobsLimit ? jobsLimit : std::min(cores, c_diskJobs));
+    const size_t workers = std::max<size_t>(1, cores / std::max<size_t>(1, threads));
+
+    std::vector<Outcome> outcomes(jobs.size(), Outcome{ 1, 0.0, 0, std::string() });
+    std::atomic<size_t> nextJob(0);
+    boost::mutex console; // сообщения заданий выводятся целиком, не перемежаясь
+    const auto started = boost::posix_time::microsec_clock::universal_time();
+    boost::thread_group pool;
+    for (size_t i = 0; i < threads; ++i)
+    {
+        pool.create_thread([&]() {
+            RT_SetThreadName("Cnv::BatchRunner");
+            for (size_t job = nextJob++; job < jobs.size(); job = nextJob++)
+            {
+                Outcome& outcome = outcomes[job];
+                std::ostringstream out, err;
+                const auto begin = boost::posix_time::microsec_clock::universal_time();
+                // исключение не должно покидать поток пула: задание считается неудавшимся, остальные продолжаются
+                try
+                {
+                    outcome.bytes = measure(jobs[job]);
+                    outcome.code = convert(jobs[job], workers, out, err);
+                }
+                catch (const std::exception& e)
+                {
+                    outcome.code = 1;
+                    outcome.error = e.what();
+                }
+                catch (...)
+                {
+                    outcome.code = 1;
+                    outcome.error = "unknown exception";
+                }
+                outcome.seconds = (boost::posix_time::microsec_clock::universal_time() - begin).total_microseconds() / 1e6;
+                if (!outcome.error.empty())
+                    err << "Conversion aborted: " << outcome.error << std::endl;
+
+                boost::mutex::scoped_lock lock(console);
+                if (!out.str().empty())
+                    std::cout << "[" << JobName(jobs[job]) << "]\n" << out.str() << std::flush;
+                if (!err.str().empty())
+                    std::cerr << "[" << JobName(jobs[job]) << "]\n" << err.str() << std::flush;
+            }
+        });
+    }
+    pool.join_all();
+
+    printSummary(jobs, outcomes, (boost::posix_time::microsec_clock::universal_time() - started).total_microseconds() / 1e6);
+    return size_t(std::count_if(outcomes.begin(), outcomes.end(), [](const Outcome& outcome) { return outcome.code != 0; }));
+}
+
+void BatchRunner::printSummary(const std::vector<Job>& jobs, const std::vector<Outcome>& outcomes, double seconds) const
+{
+    const double c_MB = 1024.0 * 1024.0;
+    uint64_t totalBytes = 0;
+    std::ostringstream summary;
+    summary << std::fixed << std::setprecision(1);
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        const Outcome& outcome = outcomes[i];
+        summary << (outcome.code ? "FAILED " : "ok     ") << JobName(jobs[i])
+            << ": " << outcome.bytes / c_MB << " MB in " << outcome.seconds << " s, "
+            << (outcome.seconds > 0 ? outcome.bytes / c_MB / outcome.seconds : 0.0) << " MB/s";
+        if (!outcome.error.empty())
+            summary << " (" << outcome.error << ")";
+        summary << "\n";
+        totalBytes += outcome.bytes;
+    }
+    summary << "Total: " << jobs.size() << " boxes, " << totalBytes / c_MB << " MB in " << seconds << " s, "
+        << (seconds > 0 ? totalBytes / c_MB / seconds : 0.0) << " MB/s\n";
+    std::cout << summary.str();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Cnv
+{
+    // Пакетный режим: несколько преобразований конвертера выполняются одновременно
+    // ограниченным пулом потоков, по окончании выводится сводка со скоростью по каждому ящику.
+    // Задание - аргументы одного запуска конвертера (пути, операция, параметры и --опции).
+    // Сообщения задания копятся отдельно и выводятся под его именем, когда оно завершится.
+    class BatchRunner
+    {
+    public:
+        typedef std::vector<std::string> Job;
+        // Выполнение одного задания; workers - число рабочих потоков, отведённое заданию,
+        // out и err - вывод и сообщения об ошибках задания
+        typedef std::function<int(const Job& job, size_t workers, std::ostream& out, std::ostream& err)> Convert;
+        // Объём входных данных задания в байтах
+        typedef std::function<uint64_t(const Job& job)> Measure;
+
+        BatchRunner(Convert convert, Measure measure);
+
+        // Ограничение числа одновременных заданий (0 - по числу ядер и допустимой нагрузке на диск)
+        void setJobsLimit(size_t jobs);
+
+        // Выполнить все задания; возвращает число неудавшихся
+        size_t run(const std::vector<Job>& jobs);
+
+        // Задания из файла: по одному запуску в строке, пустые строки и строки с # пропускаются.
+        // Пути с пробелами заключаются в кавычки
+        static bool loadManifest(const std::string& path, std::vector<Job>& jobs);
+        // Задания по маске папки: * в пути входного ящика заменяется именами подпапок,
+        // то же имя подставляется вместо * в пути результата (недостающие папки создаются)
+        static bool expandGlob(const Job& pattern, std::vector<Job>& jobs);
+        static bool isGlob(const std::string& path);
+
+    private:
+        struct Outcome
+        {
+            int code;
+            double seconds;
+            uint64_t bytes;
+            std::string error; // исключение, прервавшее задание
+        };
+
+        Convert convert;
+        Measure measure;
+        size_t jobsLimit;
+
+        void printSummary(const std::vector<Job>& jobs, const std::vector<Outcome>& outcomes, double seconds) const;
+    };
+}
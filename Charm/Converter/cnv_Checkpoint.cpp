@@ -0,0 +1,76 @@
+#include "stdafx.h"
+
+#include <iomanip>
+#include <sstream>
+#include <boost/filesystem/operations.hpp>
+#include "cnv_Checkpoint.h"
+#include "Utf8.h"
+
+using namespace Cnv;
+
+namespace
+{
+    const unsigned c_version = 1;
+}
+
+Checkpoint::Checkpoint()
+    : inputFile(), cursor(), stamp(), writtenCount(0), outputLatest()
+{
+}
+
+bool Checkpoint::save(const std::string& path) const
+{
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        file << "version=" << c_version << "\n"
+            << "input=" << ToUtf8(inputFile) << "\n"
+            << "page=" << cursor.page << "\n"
+            << "part=" << cursor.part << "\n"
+            << "stamp=" << stamp.getTime() << "." << std::setw(9) << std::setfill('0') << stamp.getNanoseconds() << std::setfill(' ') << "\n"
+            << "written=" << writtenCount << "\n"
+            << "output=" << ToUtf8(outputLatest) << "\n";
+        file.flush();
+        if (!file)
+            return false;
+    }
+    boost::system::error_code ec;
+    boost::filesystem::rename(temporary, path, ec);
+    return !ec;
+}
+
+bool Checkpoint::load(const std::string& path)
+{
+    std::ifstream file(path);
+    std::string line;
+    unsigned version = 0;
+    while (std::getline(file, line))
+    {
+        size_t eq = line.find('=');
+        if (eq == std::string::npos)
+            continue;
+        std::string name = line.substr(0, eq), value = line.substr(eq + 1);
+        std::istringstream stream(value);
+        if (name == "version")
+            stream >> version;
+        else if (name == "input")
+            inputFile = FromUtf8(value);
+        else if (name == "page")
+            stream >> cursor.page;
+        else if (name == "part")
+            stream >> cursor.part;
+        else if (name == "stamp")
+        {
+            time_t seconds = 0;
+            uint32_t nanoseconds = 0;
+            char dot = 0;
+            stream >> seconds >> dot >> nanoseconds;
+            stamp = Bbx::Stamp(seconds, nanoseconds);
+        }
+        else if (name == "written")
+            stream >> writtenCount;
+        else if (name == "output")
+            outputLatest = FromUtf8(value);
+    }
+    return c_version == version && !inputFile.empty() && !outputLatest.empty();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+
+#include "bbx_BlackBox.h"
+#include "bbx_FileReader.h"
+
+namespace Cnv
+{
+    // Контрольная точка преобразования. Точка ставится у опорной записи входного ящика:
+    // файл результата закрывается этой записью (как при смене файла писателем), следующий файл
+    // начинается с неё же. Продолжение работы начинается с этой опорной записи, а файлы результата
+    // позже outputLatest удаляются - так результат не содержит ни пропусков, ни повторов.
+    struct Checkpoint
+    {
+        std::wstring inputFile;    // файл входного ящика с опорной записью
+        Bbx::Impl::Cursor cursor;  // положение опорной записи в этом файле
+        Bbx::Stamp stamp;          // штамп опорной записи (для сверки при продолжении)
+        uint64_t writtenCount;     // записей результата до опорной записи
+        std::wstring outputLatest; // последний файл результата, закрытый в этой точке
+
+        Checkpoint();
+
+        // Запись через временный файл: прерывание не оставляет испорченной точки
+        bool save(const std::string& path) const;
+        bool load(const std::string& path);
+    };
+}
@@ -0,0 +1,260 @@
+#include "stdafx.h"
+
+#include <atomic>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/thread/thread.hpp>
+#include "cnv_Export.h"
+#include "bbx_FileChain.h"
+#include "bbx_FileReader.h"
+#include "RT_ThreadName.h"
+
+using namespace Cnv;
+
+namespace
+{
+    const uint32_t c_version = 1;
+
+    int64_t Nanoseconds(const Bbx::Stamp& stamp)
+    {
+        return int64_t(stamp.getTime()) * 1000000000 + stamp.getNanoseconds();
+    }
+
+    void Append(std::vector<char>& blob, std::vector<uint64_t>& offsets, const Bbx::char_vec& data)
+    {
+        blob.insert(blob.end(), data.begin(), data.end());
+        offsets.push_back(blob.size());
+    }
+
+    // Столбец, ещё не размещённый в файле
+    struct ColumnData
+    {
+        const char* name;
+        const void* data;
+        uint64_t size;
+    };
+
+    template<typename T>
+    ColumnData Describe(const char* name, const std::vector<T>& column)
+    {
+        return ColumnData{ name, column.data(), column.size() * sizeof(T) };
+    }
+
+    uint64_t Aligned(uint64_t offset)
+    {
+        return (offset + ColumnarSegment::c_columnAlignment - 1) / ColumnarSegment::c_columnAlignment * ColumnarSegment::c_columnAlignment;
+    }
+
+    // Порядковый номер последней записи файла (0 - файл без номеров или пуст)
+    uint64_t LastSequence(const std::wstring& path)
+    {
+        Bbx::Impl::FileReader reader;
+        if (!reader.tryOpenFile(path) || !reader.rewindToExtreme(false))
+            return 0;
+        return reader.currentCursorSequence();
+    }
+}
+
+const wchar_t* const ColumnarSegment::c_suffix = L".bbxc";
+
+ColumnarSegment::ColumnarSegment()
+    : payloadOffsets(1, 0), beforeOffsets(1, 0), captionOffsets(1, 0)
+{
+}
+
+void ColumnarSegment::add(Bbx::RecordType type, const Bbx::Stamp& stamp, uint64_t sequence, const Bbx::Identifier& identifier,
+    const Bbx::char_vec& caption, const Bbx::char_vec& _before, const Bbx::char_vec& data)
+{
+    if (stamps.size() % c_indexStep == 0)
+    {
+        timeIndex.push_back(Nanoseconds(stamp));
+        timeIndex.push_back(int64_t(stamps.size()));
+    }
+    stamps.push_back(Nanoseconds(stamp));
+    types.push_back(uint8_t(type));
+    identifiers.push_back(identifier.asSerializedValue());
+    sequences.push_back(sequence);
+
+    // заголовков немного, поэтому каждый хранится один раз в словаре сегмента
+    auto inserted = captions.emplace(std::string(caption.begin(), caption.end()), uint32_t(captions.size()));
+    if (inserted.second)
+        Append(captionText, captionOffsets, caption);
+    captionIds.push_back(inserted.first->second);
+
+    Append(payload, payloadOffsets, data);
+    Append(before, beforeOffsets, _before);
+}
+
+bool ColumnarSegment::save(const std::wstring& path) const
+{
+    const ColumnData columns[] = {
+        Describe("stamp", stamps),
+        Describe("type", types),
+        Describe("id", identifiers),
+        Describe("sequence", sequences),
+        Describe("caption", captionIds),
+        Describe("payload_offset", payloadOffsets),
+        Describe("payload", payload),
+        Describe("before_offset", beforeOffsets),
+        Describe("before", before),
+        Describe("caption_offset", captionOffsets),
+        Describe("caption_text", captionText),
+        Describe("time_index", timeIndex),
+    };
+    const size_t count = sizeof(columns) / sizeof(columns[0]);
+
+    Header header = { { 'B', 'B', 'X', 'C' }, c_version, stamps.size(), uint32_t(count), 0 };
+    std::vector<Column> table(count);
+    uint64_t offset = Aligned(sizeof(Header) + count * sizeof(Column));
+    for (size_t i = 0; i < count; ++i)
+    {
+        memset(table[i].name, 0, sizeof(table[i].name));
+        strncpy(table[i].name, columns[i].name, sizeof(table[i].name) - 1);
+        table[i].offset = offset;
+        table[i].size = columns[i].size;
+        offset = Aligned(offset + columns[i].size);
+    }
+
+    boost::filesystem::ofstream file(boost::filesystem::path(path), std::ios::binary | std::ios::trunc);
+    if (!file)
+        return false;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(Column));
+    uint64_t written = sizeof(Header) + count * sizeof(Column);
+    const char padding[c_columnAlignment] = {};
+    for (size_t i = 0; i < count; ++i)
+    {
+        file.write(padding, std::streamsize(table[i].offset - written));
+        file.write(static_cast<const char*>(columns[i].data), std::streamsize(columns[i].size));
+        written = table[i].offset + columns[i].size;
+    }
+    file.write(padding, std::streamsize(Aligned(written) - written));
+    return bool(file.flush());
+}
+
+uint64_t ColumnarSegment::getRowsCount() const
+{
+    return stamps.size();
+}
+
+int64_t ColumnarSegment::firstStamp() const
+{
+    return stamps.empty() ? 0 : stamps.front();
+}
+
+int64_t ColumnarSegment::lastStamp() const
+{
+    return stamps.empty() ? 0 : stamps.back();
+}
+
+Exporter::Exporter(const Bbx::Location& _input, const std::wstring& _base)
+    : input(_input), base(_base), workers(0), segments()
+{
+}
+
+void Exporter::setWorkers(size_t _workers)
+{
+    workers = _workers;
+}
+
+uint64_t Exporter::getRowsCount() const
+{
+    uint64_t rows = 0;
+    for (const Segment& segment : segments)
+        rows += segment.rows;
+    return rows;
+}
+
+size_t Exporter::getSegmentsCount() const
+{
+    return segments.size();
+}
+
+bool Exporter::run()
+{
+    segments.clear();
+    for (const std::wstring& file : input.getCPtrChain()->getFiles(sizeof(Bbx::Impl::FileHeader)))
+    {
+        std::wstring name = boost::filesystem::path(file).stem().wstring();
+        segments.push_back(Segment{ file, base + name + ColumnarSegment::c_suffix, 0, 0, 0, false });
+    }
+
+    // файлы ящика независимы, поэтому кодируются параллельно; память - по одному сегменту на поток
+    const size_t threads = std::min(segments.size(), workers ? workers : std::max(1u, boost::thread::hardware_concurrency()));
+    std::atomic<size_t> next(0);
+    boost::thread_group pool;
+    for (size_t i = 0; i < threads; ++i)
+    {
+        pool.create_thread([&]() {
+            RT_SetThreadName("Cnv::Exporter");
+            for (size_t index = next++; index < segments.size(); index = next++)
+                segments[index].done = encode(index);
+        });
+    }
+    pool.join_all();
+
+    for (const Segment& segment : segments)
+    {
+        if (!segment.done)
+            return false;
+    }
+    return saveIndex();
+}
+
+bool Exporter::encode(size_t index)
+{
+    Segment& segment = segments[index];
+    Bbx::Impl::FileReader reader;
+    if (!reader.tryOpenFile(segment.input))
+        return false;
+
+    ColumnarSegment columns;
+    if (reader.rewindToExtreme(true))
+    {
+        // файл начинается повтором последней опорной записи предыдущего файла
+        uint64_t repeated = index ? LastSequence(segments[index - 1].input) : 0;
+        bool skip = repeated && reader.currentCursorType() == Bbx::RecordType::Reference && reader.currentCursorSequence() == repeated;
+
+        Bbx::ReadResult moved = Bbx::ReadResult::Success;
+        Bbx::Stamp stamp;
+        Bbx::char_vec caption, before, data;
+        while (moved)
+        {
+            if (!skip)
+            {
+                Bbx::RecordType type = reader.currentCursorType();
+                before.clear();
+                Bbx::ReadResult read = type == Bbx::RecordType::Increment ? reader.readCurrentRecord(stamp, caption, before, data)
+                    : reader.readCurrentRecord(stamp, caption, data);
+                if (!read)
+                    return false;
+                columns.add(type, stamp, reader.currentCursorSequence(), reader.currentCursorIdentifier(), caption, before, data);
+            }
+            skip = false;
+
+            moved = reader.moveToNextRecord(true, true);
+            if (Bbx::ReadResult::TimeSequenceViolation == moved)
+                moved = reader.moveToNextRecord(true, false); // штампы сохраняются как есть, порядок - как в файле
+        }
+        if (Bbx::ReadResult::NoDataAvailable != moved)
+            return false;
+    }
+
+    segment.rows = columns.getRowsCount();
+    segment.first = columns.firstStamp();
+    segment.last = columns.lastStamp();
+    return columns.save(segment.output);
+}
+
+bool Exporter::saveIndex() const
+{
+    boost::filesystem::ofstream index(boost::filesystem::path(base + L"index.tsv"), std::ios::trunc);
+    if (!index)
+        return false;
+    index << "segment\trows\tfirst_stamp_ns\tlast_stamp_ns\n";
+    for (const Segment& segment : segments)
+    {
+        index << boost::filesystem::path(segment.output).filename().string() << '\t' << segment.rows << '\t'
+            << segment.first << '\t' << segment.last << '\n';
+    }
+    return bool(index.flush());
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "bbx_BlackBox.h"
+
+namespace Cnv
+{
+    // Столбцовый сегмент: записи одного файла черного ящика, разложенные по столбцам.
+    // Файл сегмента читается отображением в память без разбора страниц и частей:
+    // заголовок, таблица столбцов и сами столбцы, каждый выровнен на c_columnAlignment.
+    // Столбцы (число элементов):
+    //   stamp           int64  - штамп в наносекундах от начала эпохи (rows)
+    //   type            uint8  - Bbx::RecordType (rows)
+    //   id              uint32 - идентификатор в сохраняемом виде: старшие 4 бита - источник (rows)
+    //   sequence        uint64 - порядковый номер записи, 0 если ящик без номеров (rows)
+    //   caption         uint32 - номер заголовка в словаре сегмента (rows)
+    //   payload_offset  uint64 - начало данных записи в payload, последний элемент - размер payload (rows + 1)
+    //   payload         байты  - данные записей (для инкремента - состояние после)
+    //   before_offset   uint64 - то же для состояния до инкремента, у прочих записей пусто (rows + 1)
+    //   before          байты
+    //   caption_offset  uint64 - начала заголовков словаря в caption_text (captions + 1)
+    //   caption_text    байты
+    //   time_index      пары int64 штамп, uint64 номер строки - каждая c_indexStep-я строка
+    // Все числа в порядке байт little-endian.
+    class ColumnarSegment
+    {
+    public:
+        static const size_t c_columnAlignment = 64;
+        static const size_t c_indexStep = 1024;
+        // Суффикс файлов сегментов: не совпадает с суффиксом ящика, чтобы сегменты не принимались за его файлы
+        static const wchar_t* const c_suffix;
+
+        #pragma pack(push, 1)
+        struct Header
+        {
+            char magic[4];      // "BBXC"
+            uint32_t version;
+            uint64_t rows;
+            uint32_t columns;   // число элементов таблицы столбцов после заголовка
+            uint32_t reserved;
+        };
+        struct Column
+        {
+            char name[16];
+            uint64_t offset;    // от начала файла
+            uint64_t size;      // в байтах
+        };
+        #pragma pack(pop)
+
+        ColumnarSegment();
+
+        void add(Bbx::RecordType type, const Bbx::Stamp& stamp, uint64_t sequence, const Bbx::Identifier& identifier,
+            const Bbx::char_vec& caption, const Bbx::char_vec& before, const Bbx::char_vec& data);
+        bool save(const std::wstring& path) const;
+
+        uint64_t getRowsCount() const;
+        int64_t firstStamp() const;
+        int64_t lastStamp() const;
+
+    private:
+        std::vector<int64_t> stamps;
+        std::vector<uint8_t> types;
+        std::vector<uint32_t> identifiers;
+        std::vector<uint64_t> sequences;
+        std::vector<uint32_t> captionIds;
+        std::vector<uint64_t> payloadOffsets;
+        std::vector<char> payload;
+        std::vector<uint64_t> beforeOffsets;
+        std::vector<char> before;
+        std::unordered_map<std::string, uint32_t> captions;
+        std::vector<uint64_t> captionOffsets;
+        std::vector<char> captionText;
+        std::vector<int64_t> timeIndex; // штамп и номер строки подряд
+    };
+
+    // Экспорт черного ящика в набор столбцовых сегментов для внешнего анализа.
+    // Каждый файл ящика кодируется в свой сегмент <base><имя файла>.bbxc отдельным потоком;
+    // повтор опорной записи в начале следующего файла в сегмент не попадает.
+    // Оглавление <base>index.tsv перечисляет сегменты по порядку с числом строк и границами штампов.
+    class Exporter
+    {
+    public:
+        Exporter(const Bbx::Location& input, const std::wstring& base);
+
+        // Число потоков кодирования (0 - по числу ядер)
+        void setWorkers(size_t workers);
+        bool run();
+
+        uint64_t getRowsCount() const;
+        size_t getSegmentsCount() const;
+
+    private:
+        struct Segment
+        {
+            std::wstring input;
+            std::wstring output;
+            uint64_t rows;
+            int64_t first;
+            int64_t last;
+            bool done;
+        };
+
+        Bbx::Location input;
+        std::wstring base;
+        size_t workers;
+        std::vector<Segment> segments;
+
+        bool encode(size_t index);
+        bool saveIndex() const;
+    };
+}
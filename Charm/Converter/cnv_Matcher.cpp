@@ -0,0 +1,278 @@
+#include "stdafx.h"
+
+#include <deque>
+#include <sstream>
+#include "cnv_Matcher.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#  define CNV_TEDDY_X86
+#  include <tmmintrin.h>
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#    define CNV_TARGET_SSSE3
+#  else
+#    define CNV_TARGET_SSSE3 __attribute__((target("ssse3")))
+#  endif
+#endif
+
+using namespace Cnv;
+
+namespace
+{
+#ifdef CNV_TEDDY_X86
+    bool detectSsse3()
+    {
+#  ifdef _MSC_VER
+        int info[4] = { 0 };
+        __cpuid(info, 1);
+        return 0 != (info[2] & (1 << 9));
+#  else
+        return 0 != __builtin_cpu_supports("ssse3");
+#  endif
+    }
+
+    unsigned lowestBit(unsigned mask)
+    {
+#  ifdef _MSC_VER
+        unsigned long index = 0;
+        _BitScanForward(&index, mask);
+        return index;
+#  else
+        return unsigned(__builtin_ctz(mask));
+#  endif
+    }
+
+    // Поиск блока по 16 байт, в котором байт попадает в корзину первого байта какого-либо образца.
+    // Возвращает false и начало непросмотренного хвоста, если кандидатов в целых блоках нет.
+    CNV_TARGET_SSSE3 bool teddyScan(const unsigned char* data, size_t from, size_t size,
+        const unsigned char* lowMask, const unsigned char* highMask, size_t& position)
+    {
+        const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lowMask));
+        const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(highMask));
+        const __m128i nibble = _mm_set1_epi8(0x0F);
+        const __m128i zero = _mm_setzero_si128();
+        for (; from + 16 <= size; from += 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + from));
+            __m128i lowBuckets = _mm_shuffle_epi8(low, _mm_and_si128(block, nibble));
+            __m128i highBuckets = _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi16(block, 4), nibble));
+            unsigned candidates = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lowBuckets, highBuckets), zero))) ^ 0xFFFFu;
+            if (candidates)
+            {
+                position = from + lowestBit(candidates);
+                return true;
+            }
+        }
+        position = from;
+        return false;
+    }
+#endif
+
+    int hexDigit(char symbol)
+    {
+        if (symbol >= '0' && symbol <= '9')
+            return symbol - '0';
+        if (symbol >= 'a' && symbol <= 'f')
+            return symbol - 'a' + 10;
+        if (symbol >= 'A' && symbol <= 'F')
+            return symbol - 'A' + 10;
+        return -1;
+    }
+}
+
+Matcher::Matcher()
+    : patterns(), transitions(), accepting(), vectorPrefilter(false)
+{
+    std::fill(std::begin(firstBytes), std::end(firstBytes), false);
+    std::fill(std::begin(lowMask), std::end(lowMask), 0);
+    std::fill(std::begin(highMask), std::end(highMask), 0);
+}
+
+bool Matcher::parsePattern(const std::string& pattern, std::string& binary)
+{
+    binary.clear();
+    if (pattern.compare(0, 2, "0x") != 0)
+    {
+        binary = pattern;
+        return !binary.empty();
+    }
+
+    if (pattern.size() == 2 || pattern.size() % 2 != 0)
+        return false;
+    for (size_t i = 2; i < pattern.size(); i += 2)
+    {
+        int high = hexDigit(pattern[i]);
+        int low = hexDigit(pattern[i + 1]);
+        if (high < 0 || low < 0)
+            return false;
+        binary.push_back(static_cast<char>(high << 4 | low));
+    }
+    return true;
+}
+
+bool Matcher::parseTargets(const std::string& text, unsigned& targets)
+{
+    targets = 0;
+    std::istringstream stream(text);
+    std::string name;
+    while (std::getline(stream, name, ','))
+    {
+        if (name == "caption")
+            targets |= TargetCaption;
+        else if (name == "data")
+            targets |= TargetData;
+        else if (name == "before")
+            targets |= TargetBefore;
+        else if (name == "after")
+            targets |= TargetAfter;
+        else
+            return false;
+    }
+    return targets != 0;
+}
+
+bool Matcher::addPattern(const std::string& pattern)
+{
+    std::string binary;
+    if (!parsePattern(pattern, binary))
+        return false;
+    patterns.push_back(binary);
+    return true;
+}
+
+void Matcher::compile()
+{
+    // бор образцов; переход в корень (0) до построения означает отсутствие ребра
+    transitions.assign(256, 0);
+    accepting.assign(1, 0);
+    for (const std::string& pattern : patterns)
+    {
+        uint32_t state = 0;
+        for (unsigned char symbol : pattern)
+        {
+            uint32_t& next = transitions[state * 256 + symbol];
+            if (!next)
+            {
+                next = uint32_t(accepting.size());
+                accepting.push_back(0);
+                transitions.resize(transitions.size() + 256, 0);
+            }
+            state = transitions[state * 256 + symbol];
+        }
+        accepting[state] = 1;
+    }
+
+    // суффиксные ссылки обходом в ширину превращают бор в полный автомат
+    std::vector<uint32_t> failure(accepting.size(), 0);
+    std::deque<uint32_t> queue;
+    for (unsigned symbol = 0; symbol < 256; ++symbol)
+    {
+        if (uint32_t child = transitions[symbol])
+            queue.push_back(child);
+    }
+    while (!queue.empty())
+    {
+        uint32_t state = queue.front();
+        queue.pop_front();
+        for (unsigned symbol = 0; symbol < 256; ++symbol)
+        {
+            uint32_t& next = transitions[state * 256 + symbol];
+            uint32_t fallback = transitions[failure[state] * 256 + symbol];
+            if (next)
+            {
+                failure[next] = fallback;
+                accepting[next] |= accepting[fallback];
+                queue.push_back(next);
+            }
+            else
+                next = fallback;
+        }
+    }
+
+    // префильтр: корзины по первым байтам образцов
+    std::fill(std::begin(firstBytes), std::end(firstBytes), false);
+    std::fill(std::begin(lowMask), std::end(lowMask), 0);
+    std::fill(std::begin(highMask), std::end(highMask), 0);
+    unsigned bucket = 0;
+    for (const std::string& pattern : patterns)
+    {
+        unsigned char first = static_cast<unsigned char>(pattern[0]);
+        if (firstBytes[first])
+            continue;
+        firstBytes[first] = true;
+        unsigned char bit = static_cast<unsigned char>(1u << (bucket++ % 8));
+        lowMask[first & 0x0F] |= bit;
+        highMask[first >> 4] |= bit;
+    }
+#ifdef CNV_TEDDY_X86
+    static const bool ssse3 = detectSsse3();
+    vectorPrefilter = ssse3 && !patterns.empty();
+#endif
+}
+
+bool Matcher::empty() const
+{
+    return patterns.empty();
+}
+
+size_t Matcher::patternsCount() const
+{
+    return patterns.size();
+}
+
+size_t Matcher::nextCandidate(const unsigned char* data, size_t from, size_t size) const
+{
+#ifdef CNV_TEDDY_X86
+    if (vectorPrefilter)
+    {
+        size_t position = from;
+        while (teddyScan(data, from, size, lowMask, highMask, position))
+        {
+            // корзины объединяют разные байты, кандидат уточняется по точной таблице
+            if (firstBytes[data[position]])
+                return position;
+            from = position + 1;
+        }
+        from = position;
+    }
+#endif
+    for (; from < size; ++from)
+    {
+        if (firstBytes[data[from]])
+            return from;
+    }
+    return size;
+}
+
+bool Matcher::find(const char* data, size_t size) const
+{
+    if (patterns.empty() || !size)
+        return false;
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    size_t position = 0;
+    while ((position = nextCandidate(bytes, position, size)) < size)
+    {
+        // автомат работает, пока не вернётся в корень; дальше снова ищет префильтр
+        uint32_t state = 0;
+        do
+        {
+            state = transitions[state * 256 + bytes[position++]];
+            if (accepting[state])
+                return true;
+        } while (state && position < size);
+    }
+    return false;
+}
+
+bool Matcher::find(const Bbx::char_vec& data) const
+{
+    return !data.empty() && find(data.data(), data.size());
+}
+
+bool Matcher::matches(const Record& record, unsigned targets) const
+{
+    return ((targets & TargetCaption) && find(record.caption))
+        || ((targets & TargetAfter) && find(record.data))
+        || ((targets & TargetBefore) && find(record.before));
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "cnv_Record.h"
+
+namespace Cnv
+{
+    // Части записи, в которых ищутся образцы
+    enum Target : unsigned
+    {
+        TargetCaption = 1 << 0,
+        TargetBefore = 1 << 1, // фрагмент "до" инкремента
+        TargetAfter = 1 << 2,  // данные посылок и опорных записей, фрагмент "после" инкремента
+        TargetData = TargetBefore | TargetAfter
+    };
+
+    // Поиск любого из множества двоичных образцов по всей длине данных.
+    // Кандидаты находятся векторным префильтром по первым байтам образцов (в духе Teddy:
+    // полубайтовые маски и PSHUFB по 16 байт), затем проверяются автоматом Ахо-Корасик.
+    // После compile() объект только читается и может использоваться из нескольких потоков.
+    class Matcher
+    {
+    public:
+        Matcher();
+
+        // Образец с префиксом 0x задаётся шестнадцатеричными цифрами, иначе - текстом как есть
+        bool addPattern(const std::string& pattern);
+        void compile();
+
+        bool empty() const;
+        size_t patternsCount() const;
+
+        bool find(const char* data, size_t size) const;
+        bool find(const Bbx::char_vec& data) const;
+        bool matches(const Record& record, unsigned targets) const;
+
+        static bool parsePattern(const std::string& pattern, std::string& binary);
+        static bool parseTargets(const std::string& text, unsigned& targets);
+
+    private:
+        std::vector<std::string> patterns;
+        std::vector<uint32_t> transitions; // переходы автомата: [состояние * 256 + байт]
+        std::vector<char> accepting;       // состояние завершает какой-либо образец
+        bool firstBytes[256];              // байты, с которых начинается хотя бы один образец
+        unsigned char lowMask[16];         // маски корзин по младшему полубайту первого байта
+        unsigned char highMask[16];        // маски корзин по старшему полубайту первого байта
+        bool vectorPrefilter;
+
+        size_t nextCandidate(const unsigned char* data, size_t from, size_t size) const;
+    };
+}
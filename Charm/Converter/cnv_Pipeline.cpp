@@ -0,0 +1,345 @@
+#include "stdafx.h"
+
+#include "cnv_Pipeline.h"
+#include "bbx_FileChain.h"
+#include "RT_ThreadName.h"
+
+using namespace Cnv;
+
+namespace
+{
+    const size_t c_defaultBatchSize = 256;
+    const size_t c_batchesPerWorker = 4; // запас пачек в обработке на один рабочий поток
+
+    uint64_t RecordBytes(const Record& record)
+    {
+        return record.caption.size() + record.data.size() + record.before.size();
+    }
+}
+
+Pipeline::Pipeline(Bbx::Reader& _reader, Bbx::Writer& _writer)
+    : reader(_reader), writer(&_writer), filter(), workers(defaultWorkers()), batchSize(c_defaultBatchSize), bounded(false), until(),
+    checkpointPath(), checkpointInterval(0), writerOwner(nullptr), reopen(), lastCheckpoint(), resumedWritten(0), stats(nullptr), log(&std::cerr),
+    queued(), done(), produced(0), committed(0), readFinished(false), failed(false),
+    readCount(0), writtenCount(0)
+{
+}
+
+Pipeline::~Pipeline()
+{
+}
+
+void Pipeline::setFilter(Filter _filter)
+{
+    filter = _filter;
+}
+
+void Pipeline::setWorkers(size_t count)
+{
+    workers = std::max<size_t>(1, count);
+}
+
+void Pipeline::setBatchSize(size_t records)
+{
+    batchSize = std::max<size_t>(1, records);
+}
+
+void Pipeline::setEnd(const Bbx::Stamp& _until)
+{
+    bounded = true;
+    until = _until;
+}
+
+void Pipeline::setCheckpoints(const std::string& path, unsigned interval, std::shared_ptr<Bbx::Writer>& owner, WriterFactory _reopen)
+{
+    ASSERT(owner.get() == writer);
+    checkpointPath = path;
+    checkpointInterval = interval;
+    writerOwner = &owner;
+    reopen = _reopen;
+}
+
+void Pipeline::resumeFrom(const Checkpoint& checkpoint)
+{
+    resumedWritten = checkpoint.writtenCount;
+}
+
+void Pipeline::setStats(Stats* _stats)
+{
+    stats = _stats;
+}
+
+void Pipeline::setLog(std::ostream& _log)
+{
+    log = &_log;
+}
+
+uint64_t Pipeline::getReadCount() const
+{
+    return readCount;
+}
+
+uint64_t Pipeline::getWrittenCount() const
+{
+    return writtenCount;
+}
+
+size_t Pipeline::defaultWorkers()
+{
+    // по одному ядру остаётся потоку чтения и писателю ящика
+    unsigned cores = boost::thread::hardware_concurrency();
+    return cores > 2 ? cores - 2 : 1;
+}
+
+bool Pipeline::run()
+{
+    queued.clear();
+    done.clear();
+    produced = committed = 0;
+    readFinished = failed = false;
+    readCount = 0;
+    writtenCount = resumedWritten;
+    lastCheckpoint = boost::posix_time::microsec_clock::universal_time();
+
+    boost::thread_group threads;
+    threads.create_thread([this]() { readStage(); });
+    for (size_t i = 0; i < workers; ++i)
+        threads.create_thread([this]() { workStage(); });
+
+    bool success = writeStage();
+    if (!success)
+        fail();
+    threads.join_all();
+    if (stats && writer)
+        stats->writerBlockedSeconds += writer->getBlockedTime().total_microseconds() / 1e6;
+    return success && !failed;
+}
+
+void Pipeline::fail()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    failed = true;
+    roomFreed.notify_all();
+    batchQueued.notify_all();
+    batchDone.notify_all();
+}
+
+// Этапы чтения и записи сообщают об ошибках из разных потоков
+void Pipeline::report(const std::string& message)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    *log << message << std::endl;
+}
+
+void Pipeline::readStage()
+{
+    RT_SetThreadName("Cnv::Pipeline[reader]");
+    const uint64_t maxInFlight = workers * c_batchesPerWorker;
+    bool moreData = true;
+    for (uint64_t number = 0; moreData; ++number)
+    {
+        BatchPtr batch = std::make_shared<Batch>(number);
+        batch->records.reserve(batchSize);
+        while (moreData && batch->records.size() < batchSize)
+        {
+            // граница секундная, запись за ней не читается
+            if (bounded && reader.getCurrentStamp().getTime() > until.getTime())
+            {
+                moreData = false;
+                break;
+            }
+            const Stats::Clock::time_point readBegin = stats ? Stats::Clock::now() : Stats::Clock::time_point();
+            batch->records.emplace_back();
+            if (!readRecord(batch->records.back()))
+            {
+                report("Error reading data from black box.");
+                fail();
+                return;
+            }
+
+            if (stats)
+            {
+                const double readSeconds = Stats::since(readBegin);
+                const uint64_t bytes = RecordBytes(batch->records.back());
+                stats->readRecordSeconds += readSeconds;
+                stats->read.bytes += bytes;
+                stats->addFileRecord(reader.getCurrentFilePath(), bytes, readSeconds);
+            }
+            const Stats::Clock::time_point nextBegin = stats ? Stats::Clock::now() : Stats::Clock::time_point();
+            auto res = reader.next();
+            if (stats)
+                stats->nextSeconds += Stats::since(nextBegin);
+            if (res == Bbx::ReadResult::NoDataAvailable)
+                moreData = false;
+            else if (res == Bbx::ReadResult::NewSession)
+                reader.forceNext();
+        }
+
+        if (batch->records.empty())
+            break;
+
+        boost::mutex::scoped_lock lock(mutex);
+        while (!failed && produced - committed >= maxInFlight)
+            roomFreed.wait(lock);
+        if (failed)
+            return;
+        readCount += batch->records.size();
+        if (stats)
+        {
+            stats->read.records = readCount;
+            stats->read.seconds = stats->readRecordSeconds + stats->nextSeconds;
+        }
+        queued.push_back(batch);
+        ++produced;
+        batchQueued.notify_one();
+    }
+
+    boost::mutex::scoped_lock lock(mutex);
+    readFinished = true;
+    batchQueued.notify_all();
+    batchDone.notify_all();
+}
+
+void Pipeline::workStage()
+{
+    RT_SetThreadName("Cnv::Pipeline[worker]");
+    while (true)
+    {
+        BatchPtr batch;
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            while (!failed && !readFinished && queued.empty())
+                batchQueued.wait(lock);
+            if (failed || queued.empty())
+                return;
+            batch = queued.front();
+            queued.pop_front();
+        }
+
+        const Stats::Clock::time_point filterBegin = stats ? Stats::Clock::now() : Stats::Clock::time_point();
+        uint64_t bytes = 0;
+        if (filter)
+        {
+            for (Record& record : batch->records)
+            {
+                record.keep = record.type == Bbx::RecordType::Reference || filter(record);
+                bytes += stats ? RecordBytes(record) : 0;
+            }
+        }
+
+        boost::mutex::scoped_lock lock(mutex);
+        if (stats && filter)
+        {
+            stats->filter.records += batch->records.size();
+            stats->filter.bytes += bytes;
+            stats->filter.seconds += Stats::since(filterBegin);
+        }
+        done.emplace(batch->number, batch);
+        batchDone.notify_all();
+    }
+}
+
+bool Pipeline::writeStage()
+{
+    while (true)
+    {
+        BatchPtr batch;
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            while (!failed && done.find(committed) == done.end() && !(readFinished && committed == produced))
+                batchDone.wait(lock);
+            if (failed)
+                return false;
+            auto doneIt = done.find(committed);
+            if (doneIt == done.end())
+                return true; // все пачки записаны
+            batch = doneIt->second;
+            done.erase(doneIt);
+        }
+
+        for (const Record& record : batch->records)
+        {
+            if (!record.keep)
+                continue;
+            if (record.type == Bbx::RecordType::Reference && checkpointDue() && !checkpoint(record))
+            {
+                report("Failed to save checkpoint " + checkpointPath);
+                return false;
+            }
+            const Stats::Clock::time_point writeBegin = stats ? Stats::Clock::now() : Stats::Clock::time_point();
+            if (!WriteRecord(*writer, record))
+            {
+                report("Failed to write record.");
+                return false;
+            }
+            ++writtenCount;
+            if (stats)
+            {
+                ++stats->write.records;
+                stats->write.bytes += RecordBytes(record);
+                stats->write.seconds += Stats::since(writeBegin);
+            }
+        }
+
+        boost::mutex::scoped_lock lock(mutex);
+        ++committed;
+        roomFreed.notify_one();
+    }
+}
+
+bool Pipeline::readRecord(Record& record)
+{
+    if (reader.readAnyRecord(record.stamp, record.caption, record.data) != Bbx::ReadResult::Success)
+        return false;
+
+    record.type = reader.getCurrentType();
+    record.id = reader.getCurrentIdentifier();
+    if (record.type == Bbx::RecordType::Reference && writerOwner)
+    {
+        record.file = reader.getCurrentFilePath();
+        record.cursor = reader.getCurrentCursor();
+    }
+    if (record.type == Bbx::RecordType::Increment)
+    {
+        // фрагмент "до" доступен только при чтении в обратном направлении
+        Bbx::Stamp stamp_before;
+        Bbx::char_vec caption_before;
+        reader.setDirection(false);
+        reader.readIncrementOriented(stamp_before, caption_before, record.before);
+        reader.setDirection(true);
+    }
+    return true;
+}
+
+bool Pipeline::checkpointDue() const
+{
+    return writerOwner && writtenCount > resumedWritten
+        && boost::posix_time::microsec_clock::universal_time() - lastCheckpoint >= boost::posix_time::seconds(checkpointInterval);
+}
+
+bool Pipeline::checkpoint(const Record& reference)
+{
+    // опорная запись закрывает файл результата, новый писатель начнёт с неё же
+    if (!WriteRecord(*writer, reference))
+        return false;
+    const Bbx::Location output = writer->getLocation();
+    writer->flush();
+    if (stats)
+        stats->writerBlockedSeconds += writer->getBlockedTime().total_microseconds() / 1e6;
+    writer = nullptr;
+    writerOwner->reset(); // файл результата закрывается
+
+    Checkpoint point;
+    point.inputFile = reference.file;
+    point.cursor = reference.cursor;
+    point.stamp = reference.stamp;
+    point.writtenCount = writtenCount;
+    point.outputLatest = output.getCPtrChain()->getLatestFile(0);
+    if (!point.save(checkpointPath))
+        return false;
+
+    *writerOwner = reopen();
+    writer = writerOwner->get();
+    lastCheckpoint = boost::posix_time::microsec_clock::universal_time();
+    return writer != nullptr;
+}
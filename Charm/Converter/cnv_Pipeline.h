@@ -0,0 +1,97 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "cnv_Record.h"
+#include "cnv_Checkpoint.h"
+#include "cnv_Stats.h"
+
+namespace Cnv
+{
+    // Конвейер преобразования черного ящика:
+    // - поток чтения нарезает входной ящик на пронумерованные пачки записей;
+    // - пул рабочих потоков применяет к пачкам фильтр;
+    // - вызывающий поток записывает пачки строго в порядке номеров.
+    // Число пачек в обработке ограничено, поэтому память не растёт при медленном писателе.
+    // С контрольными точками поток записи периодически закрывает результат у опорной записи
+    // (см. Checkpoint) и продолжает в новом писателе.
+    class Pipeline
+    {
+    public:
+        // Фильтр вызывается для всех записей, кроме опорных (они сохраняются всегда)
+        typedef std::function<bool(const Record&)> Filter;
+        // Создание писателя результата после контрольной точки
+        typedef std::function<std::shared_ptr<Bbx::Writer>()> WriterFactory;
+
+        Pipeline(Bbx::Reader& reader, Bbx::Writer& writer);
+        ~Pipeline();
+
+        void setFilter(Filter filter);
+        void setWorkers(size_t count);
+        void setBatchSize(size_t records);
+        // Чтение прекращается на первой записи со штампом позже указанного
+        void setEnd(const Bbx::Stamp& until);
+        // Контрольные точки не чаще раза в interval секунд; писатель в owner заменяется созданным reopen
+        void setCheckpoints(const std::string& path, unsigned interval, std::shared_ptr<Bbx::Writer>& owner, WriterFactory reopen);
+        // Продолжение после контрольной точки: счётчик записанных продолжается с её значения
+        void resumeFrom(const Checkpoint& checkpoint);
+        // Сбор статистики этапов в stats (nullptr - без замеров)
+        void setStats(Stats* stats);
+        // Сообщения об ошибках этапов (по умолчанию std::cerr)
+        void setLog(std::ostream& log);
+
+        // Выполнить преобразование от текущей позиции читателя до конца ящика (или до границы setEnd)
+        bool run();
+
+        // Итоги последнего выполнения
+        uint64_t getReadCount() const;
+        uint64_t getWrittenCount() const;
+
+        static size_t defaultWorkers();
+
+    private:
+        Bbx::Reader& reader;
+        Bbx::Writer* writer;
+        Filter filter;
+        size_t workers;
+        size_t batchSize;
+        bool bounded;
+        Bbx::Stamp until;
+
+        std::string checkpointPath;
+        unsigned checkpointInterval;
+        std::shared_ptr<Bbx::Writer>* writerOwner;
+        WriterFactory reopen;
+        boost::posix_time::ptime lastCheckpoint;
+        uint64_t resumedWritten;
+        Stats* stats;
+        std::ostream* log;
+
+        boost::mutex mutex;
+        boost::condition_variable roomFreed;   // писатель освободил место для новой пачки
+        boost::condition_variable batchQueued; // читатель выдал пачку рабочим
+        boost::condition_variable batchDone;   // рабочий закончил пачку
+        std::deque<BatchPtr> queued;           // пачки, ожидающие фильтрации
+        std::map<uint64_t, BatchPtr> done;     // отфильтрованные пачки, ожидающие записи
+        uint64_t produced;                     // число выданных пачек
+        uint64_t committed;                    // число записанных пачек
+        bool readFinished;
+        bool failed;
+        uint64_t readCount;
+        uint64_t writtenCount;
+
+        void readStage();
+        void workStage();
+        bool writeStage();
+        void fail();
+        void report(const std::string& message);
+
+        bool readRecord(Record& record);
+        bool checkpointDue() const;
+        bool checkpoint(const Record& reference);
+    };
+}
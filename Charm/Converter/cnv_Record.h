@@ -0,0 +1,65 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "bbx_BlackBox.h"
+#include "bbx_FileReader.h"
+
+namespace Cnv
+{
+    // Запись черного ящика, полностью считанная в память для обработки вне потока чтения
+    struct Record
+    {
+        Bbx::RecordType type;
+        Bbx::Stamp stamp;
+        Bbx::Identifier id;
+        Bbx::char_vec caption;
+        Bbx::char_vec data;   // данные записи (для инкремента - фрагмент "после")
+        Bbx::char_vec before; // только для инкремента - фрагмент "до"
+        bool keep;            // решение фильтра: записывать ли запись в результат
+        std::wstring file;    // только для опорной записи - её положение во входном ящике
+        Bbx::Impl::Cursor cursor;
+
+        Record()
+            : type(Bbx::RecordType::Reference), stamp(), id(), caption(), data(), before(), keep(true), file(), cursor()
+        {}
+    };
+
+    // Пачка записей - единица работы конвейера; номер пачки задаёт порядок записи результата
+    struct Batch
+    {
+        uint64_t number;
+        std::vector<Record> records;
+
+        explicit Batch(uint64_t _number)
+            : number(_number), records()
+        {}
+    };
+
+    typedef std::shared_ptr<Batch> BatchPtr;
+
+    // Буфер для методов писателя: пустой вектор передаётся пустым буфером
+    inline Bbx::Buffer AsBuffer(const Bbx::char_vec& vec)
+    {
+        return vec.empty() ? Bbx::Buffer() : Bbx::Buffer(vec);
+    }
+
+    // Запись в выходной ящик методом, соответствующим типу записи
+    inline bool WriteRecord(Bbx::Writer& writer, const Record& record)
+    {
+        switch (record.type)
+        {
+        case Bbx::RecordType::Reference:
+            return writer.pushReference(AsBuffer(record.caption), AsBuffer(record.data), record.stamp, record.id);
+        case Bbx::RecordType::Increment:
+            return writer.pushIncrement(AsBuffer(record.caption), AsBuffer(record.before), AsBuffer(record.data), record.stamp, record.id);
+        case Bbx::RecordType::IncomingPackage:
+            return writer.pushIncomingPackage(AsBuffer(record.caption), AsBuffer(record.data), record.stamp, record.id);
+        case Bbx::RecordType::OutboxPackage:
+            return writer.pushOutboxPackage(AsBuffer(record.caption), AsBuffer(record.data), record.stamp, record.id);
+        default:
+            return true;
+        }
+    }
+}
@@ -0,0 +1,99 @@
+#include "stdafx.h"
+
+#include <iomanip>
+#include <sstream>
+#include "cnv_Stats.h"
+#include "Utf8.h"
+
+using namespace Cnv;
+
+namespace
+{
+    const double c_MB = 1024.0 * 1024.0;
+
+    std::string Quoted(const std::string& text)
+    {
+        std::ostringstream quoted;
+        quoted << '"';
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                quoted << '\\' << c;
+            else if (static_cast<unsigned char>(c) < 0x20)
+                quoted << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+            else
+                quoted << c;
+        }
+        quoted << '"';
+        return quoted.str();
+    }
+
+    double Rate(double amount, double seconds)
+    {
+        return seconds > 0 ? amount / seconds : 0.0;
+    }
+
+    void WriteStage(std::ostream& json, const char* name, const StageStats& stage)
+    {
+        json << "    " << Quoted(name) << ": { \"records\": " << stage.records << ", \"bytes\": " << stage.bytes
+            << ", \"seconds\": " << stage.seconds << ", \"records_per_s\": " << Rate(double(stage.records), stage.seconds)
+            << ", \"mb_per_s\": " << Rate(stage.bytes / c_MB, stage.seconds) << " }";
+    }
+}
+
+Stats::Stats()
+    : operation(), elapsed(0), inputBytes(0), read(), filter(), write(),
+    readRecordSeconds(0), nextSeconds(0), writerBlockedSeconds(0), files()
+{
+}
+
+void Stats::addFileRecord(const std::wstring& file, uint64_t bytes, double seconds)
+{
+    if (files.empty() || files.back().file != file)
+        files.push_back(FileStats{ file, 0, 0, 0.0 });
+    FileStats& current = files.back();
+    ++current.records;
+    current.bytes += bytes;
+    current.seconds += seconds;
+}
+
+std::string Stats::toJson() const
+{
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(6);
+    json << "{\n"
+        << "  \"operation\": " << Quoted(operation) << ",\n"
+        << "  \"elapsed_seconds\": " << elapsed << ",\n"
+        << "  \"input_bytes\": " << inputBytes << ",\n"
+        << "  \"input_mb_per_s\": " << Rate(inputBytes / c_MB, elapsed) << ",\n"
+        << "  \"stages\": {\n";
+    WriteStage(json, "read", read);
+    json << ",\n";
+    WriteStage(json, "filter", filter);
+    json << ",\n";
+    WriteStage(json, "write", write);
+    json << "\n  },\n"
+        << "  \"reader\": { \"read_any_record_seconds\": " << readRecordSeconds << ", \"next_seconds\": " << nextSeconds << " },\n"
+        << "  \"writer\": { \"blocked_seconds\": " << writerBlockedSeconds << " },\n"
+        << "  \"files\": [";
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        const FileStats& file = files[i];
+        json << (i ? ",\n" : "\n") << "    { \"file\": " << Quoted(ToUtf8(file.file)) << ", \"records\": " << file.records
+            << ", \"bytes\": " << file.bytes << ", \"seconds\": " << file.seconds
+            << ", \"mb_per_s\": " << Rate(file.bytes / c_MB, file.seconds) << " }";
+    }
+    json << (files.empty() ? "]\n" : "\n  ]\n") << "}\n";
+    return json.str();
+}
+
+bool Stats::save(const std::string& path) const
+{
+    std::ofstream file(path, std::ios::trunc);
+    return file << toJson() && file.flush();
+}
+
+double Stats::since(const Clock::time_point& begin)
+{
+    return boost::chrono::duration<double>(Clock::now() - begin).count();
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <boost/chrono.hpp>
+
+namespace Cnv
+{
+    // Счётчики этапа конвейера; seconds - суммарное время работы этапа (у рабочих - по всем потокам)
+    struct StageStats
+    {
+        uint64_t records;
+        uint64_t bytes;
+        double seconds;
+    };
+
+    // Чтение одного файла входного ящика
+    struct FileStats
+    {
+        std::wstring file;
+        uint64_t records;
+        uint64_t bytes;
+        double seconds;
+    };
+
+    // Статистика преобразования для --stats и --bench: скорость этапов чтения, фильтрации и записи,
+    // время ожидания писателя ящика и разбивка чтения по файлам. Выводится в JSON для сравнения запусков
+    struct Stats
+    {
+        typedef boost::chrono::steady_clock Clock;
+
+        Stats();
+
+        std::string operation;
+        double elapsed;             // от начала до конца преобразования
+        uint64_t inputBytes;        // размер файлов входного ящика
+        StageStats read;
+        StageStats filter;
+        StageStats write;
+        double readRecordSeconds;   // Reader::readAnyRecord (с фрагментом "до" у инкрементов)
+        double nextSeconds;         // Reader::next
+        double writerBlockedSeconds; // ожидание места в очереди писателя (Writer::getBlockedTime)
+        std::vector<FileStats> files;
+
+        // Учёт записи, прочитанной из файла file (файлы идут подряд)
+        void addFileRecord(const std::wstring& file, uint64_t bytes, double seconds);
+
+        std::string toJson() const;
+        bool save(const std::string& path) const;
+
+        static double since(const Clock::time_point& begin);
+    };
+}
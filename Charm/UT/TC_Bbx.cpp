@@ -1,9 +1,22 @@
 ﻿#include "stdafx.h"
 
+#ifdef LINUX
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif // LINUX
 #include <numeric>
 #include <boost/filesystem.hpp>
 #include "TC_Bbx.h"
 #include "../BlackBox/bbx_FileChain.h"
+#include "../BlackBox/bbx_FileReader.h"
+#include "../BlackBox/bbx_Crc32c.h"
+#include "../BlackBox/bbx_FileSplitter.h"
+#include "../BlackBox/bbx_MergeIterator.h"
+#include "../BlackBox/bbx_MultiReader.h"
+#include "../BlackBox/bbx_Compactor.h"
+#include "../BlackBox/bbx_WriterExecutor.h"
+#include "../BlackBox/bbx_LiveFeed.h"
+#include "../BlackBox/bbx_StateMaterializer.h"
 #include "../helpful/RT_ThreadName.h"
 #include "../helpful/Log.h"
 #include "../helpful/Time_Iso.h"
@@ -1346,3 +1359,1302 @@ void TC_Bbx::StoreTimeZone()
         CPPUNIT_ASSERT( t3.empty() );
     }
 }
+
+// словарь заголовков записей
+void TC_Bbx::CaptionDictionary()
+{
+    const size_t count = 1000;
+    const std::string longCaption( 300, 'L' ); // слишком длинный для словаря
+    auto captionOf = [&longCaption]( size_t i ) {
+        if ( 0 == i % 100 )
+            return longCaption;
+        if ( 0 == i % 7 )
+            return std::string();
+        return std::string( 200, char( 'a' + i % 3 ) );
+    };
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[0] );
+        for( size_t i = 0; i < count; ++i )
+        {
+            std::string data = "data" + std::to_string( i );
+            if ( 0 == i % 50 )
+                CPPUNIT_ASSERT( bOut->pushReference( captionOf( i ), data, fix_moment + i, defaultId ) );
+            else
+                CPPUNIT_ASSERT( bOut->pushIncrement( captionOf( i ), data, data, fix_moment + i, defaultId ) );
+        }
+    }
+    // повторяющиеся заголовки не пишутся в каждую запись
+    CPPUNIT_ASSERT( BbxLocation[0].getCPtrChain()->getTotalSize() < count * 200 );
+
+    Reader bIn( BbxLocation[0] );
+    CPPUNIT_ASSERT( bIn.rewind( fix_moment ) );
+    Stamp stamp;
+    char_vec caption, data;
+    for( size_t i = 0; i < count; ++i )
+    {
+        CPPUNIT_ASSERT( bIn.readAnyRecord( stamp, caption, data ) );
+        CPPUNIT_ASSERT_EQUAL( captionOf( i ), std::string( caption.begin(), caption.end() ) );
+        CPPUNIT_ASSERT_EQUAL( "data" + std::to_string( i ), std::string( data.begin(), data.end() ) );
+        CPPUNIT_ASSERT( i + 1 == count || bIn.next() );
+    }
+    bIn.setDirection( false );
+    for( size_t i = count; i > 0; --i )
+    {
+        CPPUNIT_ASSERT( bIn.readAnyRecord( stamp, caption, data ) );
+        CPPUNIT_ASSERT_EQUAL( captionOf( i - 1 ), std::string( caption.begin(), caption.end() ) );
+        CPPUNIT_ASSERT( 1 == i || bIn.next() );
+    }
+}
+
+// 64-битные смещения страниц
+void TC_Bbx::LargeFileOffsets()
+{
+    typedef Bbx::Impl::FileReader::page_iterator page_iterator;
+    const BBX_SIZE pageSize = 256 * 1024;
+    const BBX_SIZE start = 5ull * 1024 * 1024 * 1024 + 100; // за пределами 4Gb
+
+    page_iterator first( start, pageSize );
+    page_iterator last = first + 40000; // ~10Gb
+    CPPUNIT_ASSERT_EQUAL( start + 40000 * pageSize, last->offset );
+    CPPUNIT_ASSERT_EQUAL( page_iterator::difference_type( 40000 ), last - first );
+    CPPUNIT_ASSERT_EQUAL( start + 39999 * pageSize, ( last - 1 )->offset );
+    CPPUNIT_ASSERT_EQUAL( start + 5 * pageSize, first[ 5 ].offset );
+    CPPUNIT_ASSERT( first < last );
+
+    page_iterator back = last;
+    back -= 39990;
+    CPPUNIT_ASSERT_EQUAL( start + 10 * pageSize, back->offset );
+    CPPUNIT_ASSERT_EQUAL( BBX_SIZE( 10 ), BBX_SIZE( std::distance( first, back ) ) );
+
+    // запись на двух страницах за пределами 4Gb; файл разреженный, на диске занимает только эти страницы
+    const bfs::path path = bfs::temp_directory_path() / "bbx_LargeFileOffsets.tmp";
+    bfs::remove( path );
+#ifdef LINUX
+    FileId file( ::open( path.string().c_str(), O_CREAT | O_RDWR, S_IRUSR | S_IWUSR ) );
+#else
+    FileId file( CreateFileW( path.wstring().c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL ) );
+    DWORD returned = 0;
+    DeviceIoControl( file, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, NULL );
+#endif // LINUX
+    CPPUNIT_ASSERT( !file.empty() );
+
+    const unsigned smallPage = 4096;
+    Bbx::char_vec caption( 10, 'C' ), data( smallPage + 500 );
+    for ( size_t i = 0; i < data.size(); ++i )
+        data[ i ] = char( i % 251 );
+    {
+        Impl::PageWriter pageWriter;
+        pageWriter.setAddress( Impl::FileAddress( start, smallPage ) );
+        Impl::WriterTask task( defaultId, Stamp( fix_moment ), RecordType::Reference, Buffer( caption ), Buffer( data ) );
+        Impl::RecordOut record( task, 77 );
+        pageWriter.processRecord( file, record );
+        pageWriter.update( file );
+    }
+
+    Stamp stamp;
+    Bbx::char_vec readCaption, readData;
+    Impl::RecordIn record( stamp, readCaption, readData );
+    record.expectPrefix();
+    size_t pages = 0;
+    for ( page_iterator pageIt( start, smallPage ); !record.readed() && pages < 3; ++pageIt, ++pages )
+    {
+        Impl::PageReader page;
+        CPPUNIT_ASSERT( page.read( file, *pageIt ) && page.getPartsNumber() );
+        CPPUNIT_ASSERT( page[ 0 ].getPartAddress().offset > start );
+        CPPUNIT_ASSERT( record.readPart( file, page[ 0 ].getPartAddress() ) );
+    }
+    const BBX_SIZE fileSize = bfs::file_size( path );
+#ifdef LINUX
+    ::close( file );
+#else
+    CloseHandle( file );
+#endif // LINUX
+    bfs::remove( path );
+
+    CPPUNIT_ASSERT( record.readed() );
+    CPPUNIT_ASSERT_EQUAL( size_t( 2 ), pages );
+    CPPUNIT_ASSERT( start + smallPage < fileSize && fileSize <= start + 2 * smallPage ); // вторая страница дописана не целиком
+    CPPUNIT_ASSERT_EQUAL( uint64_t( 77 ), record.getSequence() );
+    CPPUNIT_ASSERT( caption == readCaption );
+    CPPUNIT_ASSERT( data == readData );
+}
+
+// точная перемотка по сквозному номеру записи
+void TC_Bbx::SequenceSeek()
+{
+    const size_t count = 600;
+    const size_t perSecond = 250; // много записей в одной секунде
+    auto stampOf = [this, perSecond]( size_t i ) {
+        return Stamp( fix_moment + i / perSecond, uint32_t( i % perSecond * 1000 + 7 ) );
+    };
+    auto dataOf = []( size_t i ) {
+        return "data" + std::to_string( i ) + std::string( i % 13 * 40, 'x' ); // часть записей длиннее страницы
+    };
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[0] );
+        bOut->setPageSize( 256 );
+        bOut->setRecomendedFileSize( 4 * 1024 );
+        for( size_t i = 0; i < count; ++i )
+        {
+            if ( 0 == i % 40 )
+                CPPUNIT_ASSERT( bOut->pushReference( std::string(), dataOf( i ), stampOf( i ), defaultId ) );
+            else
+                CPPUNIT_ASSERT( bOut->pushIncrement( std::string(), dataOf( i ), dataOf( i ), stampOf( i ), defaultId ) );
+        }
+    }
+    CPPUNIT_ASSERT( BbxLocation[0].getCPtrChain()->getNumberOfFiles() > 1 );
+
+    Reader bIn( BbxLocation[0] );
+    Stamp stamp;
+    char_vec caption, data;
+    for( uint64_t seq : { 1ull, 2ull, 40ull, 41ull, 99ull, 321ull, 480ull, 599ull, 600ull } )
+    {
+        CPPUNIT_ASSERT( bIn.rewindToSequence( seq ) );
+        CPPUNIT_ASSERT_EQUAL( seq, bIn.getCurrentSequence() );
+        CPPUNIT_ASSERT( stampOf( size_t( seq - 1 ) ) == bIn.getCurrentStamp() );
+        CPPUNIT_ASSERT( bIn.readAnyRecord( stamp, caption, data ) );
+        CPPUNIT_ASSERT_EQUAL( dataOf( size_t( seq - 1 ) ), std::string( data.begin(), data.end() ) );
+        CPPUNIT_ASSERT( stampOf( size_t( seq - 1 ) ) == stamp );
+    }
+    CPPUNIT_ASSERT( !bIn.rewindToSequence( count + 1 ) );
+
+    // последовательное чтение сохраняет нумерацию (копия опорной записи в новом файле имеет тот же номер)
+    CPPUNIT_ASSERT( bIn.rewindToSequence( 100 ) );
+    for( uint64_t seq = 100; seq < 200; )
+    {
+        CPPUNIT_ASSERT( bIn.next() );
+        uint64_t current = bIn.getCurrentSequence();
+        CPPUNIT_ASSERT( current == seq + 1 || ( current == seq && RecordType::Reference == bIn.getCurrentType() ) );
+        CPPUNIT_ASSERT( stampOf( size_t( current - 1 ) ) == bIn.getCurrentStamp() ); // штамп текущей позиции точный, как у read*
+        seq = current;
+    }
+
+    // новый писатель продолжает нумерацию
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[0] );
+        CPPUNIT_ASSERT( bOut->pushReference( std::string(), dataOf( count ), stampOf( count ), defaultId ) );
+    }
+    CPPUNIT_ASSERT( bIn.rewindToSequence( count + 1 ) );
+    CPPUNIT_ASSERT( bIn.readAnyRecord( stamp, caption, data ) );
+    CPPUNIT_ASSERT_EQUAL( dataOf( count ), std::string( data.begin(), data.end() ) );
+}
+
+// двоичный блок зоны расширения и разбор XML прежних версий
+void TC_Bbx::ExtensionFormats()
+{
+    using Bbx::Impl::Extension;
+    Extension out;
+    out.setActualVersion();
+    out.setTimeZone( "UTC+3" );
+    out.setCaptionZoneSize( 4096 );
+    out.setFlags( Extension::c_FlagCaptions | Extension::c_FlagSequenced );
+    std::string binary = out.serialize();
+    CPPUNIT_ASSERT_EQUAL( sizeof( Bbx::Impl::ExtensionBlock ), binary.size() );
+    binary.append( 4096, '\0' );
+
+    Extension in;
+    CPPUNIT_ASSERT( Extension::isBinary( Buffer( binary ) ) );
+    CPPUNIT_ASSERT( in.load( Buffer( binary ) ) );
+    CPPUNIT_ASSERT( in.getVersion().isSupported() );
+    CPPUNIT_ASSERT_EQUAL( std::string( "UTC+3" ), in.getTimeZone() );
+    CPPUNIT_ASSERT_EQUAL( 4096u, in.getCaptionZoneSize() );
+    CPPUNIT_ASSERT( in.hasFlag( Extension::c_FlagSequenced ) );
+
+    // слишком длинная временная зона обрезается
+    out.setTimeZone( std::string( 100, 'z' ) );
+    CPPUNIT_ASSERT( in.load( Buffer( out.serialize() ) ) );
+    CPPUNIT_ASSERT_EQUAL( std::string( 63, 'z' ), in.getTimeZone() );
+
+    // файл версии 2.0
+    std::string xml = "<extension><version major=\"2\" minor=\"0\"/><localize tz=\"msk\"/><captions size=\"2048\"/></extension>";
+    xml.append( 1 + 2048, '\0' );
+    CPPUNIT_ASSERT( !Extension::isBinary( Buffer( xml ) ) );
+    CPPUNIT_ASSERT( in.load( Buffer( xml ) ) );
+    CPPUNIT_ASSERT( in.getVersion().isSupported() );
+    CPPUNIT_ASSERT_EQUAL( std::string( "msk" ), in.getTimeZone() );
+    CPPUNIT_ASSERT_EQUAL( 2048u, in.getCaptionZoneSize() );
+    CPPUNIT_ASSERT( in.hasFlag( Extension::c_FlagCaptions ) );
+    CPPUNIT_ASSERT( !in.hasFlag( Extension::c_FlagSequenced ) );
+}
+
+// контрольные суммы страниц: полная проверка и пропуск повреждённой страницы при чтении
+void TC_Bbx::PageChecksums()
+{
+    const char digits[] = "123456789";
+    CPPUNIT_ASSERT_EQUAL( 0xE3069283u, Bbx::Impl::crc32c( 0, digits, 9 ) );
+    CPPUNIT_ASSERT_EQUAL( 0xE3069283u, Bbx::Impl::crc32c( Bbx::Impl::crc32c( 0, digits, 4 ), digits + 4, 5 ) );
+
+    const size_t count = 300;
+    auto dataOf = []( size_t i ) {
+        return "data" + std::to_string( i ) + std::string( i % 7 * 30, 'x' );
+    };
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[0] );
+        bOut->setPageSize( 256 );
+        bOut->setPageChecksums( true );
+        for( size_t i = 0; i < count; ++i )
+            CPPUNIT_ASSERT( bOut->pushReference( std::string(), dataOf( i ), Stamp( fix_moment + i ), defaultId ) );
+    }
+    Reader bIn( BbxLocation[0] );
+    CPPUNIT_ASSERT_EQUAL( size_t( 0 ), bIn.verify() );
+
+    // порча одного байта в середине файла
+    const std::wstring damagedFile = BbxLocation[0].getCPtrChain()->getEarliestFile();
+    {
+        boost::filesystem::fstream fs( damagedFile, std::ios::in | std::ios::out | std::ios::binary );
+        fs.seekg( 0, std::ios::end );
+        std::streamoff pos = std::streamoff( fs.tellg() ) / 2;
+        fs.seekg( pos );
+        char byte = char( fs.get() ^ 0x5A );
+        fs.seekp( pos );
+        fs.put( byte );
+    }
+    std::vector<std::wstring> damagedFiles;
+    CPPUNIT_ASSERT_EQUAL( size_t( 1 ), bIn.verify( &damagedFiles ) );
+    CPPUNIT_ASSERT( std::vector<std::wstring>( 1, damagedFile ) == damagedFiles );
+
+    // при чтении повреждённые данные не выдаются, страница пропускается
+    size_t good = 0, bad = 0;
+    Stamp stamp;
+    char_vec caption, data;
+    CPPUNIT_ASSERT( bIn.rewind( Stamp( fix_moment ) ) );
+    do
+    {
+        ReadResult res = bIn.readAnyRecord( stamp, caption, data );
+        if ( ReadResult::BadPageChecksum == res )
+            ++bad;
+        else
+        {
+            CPPUNIT_ASSERT( res );
+            CPPUNIT_ASSERT_EQUAL( dataOf( size_t( stamp.getTime() - fix_moment ) ), std::string( data.begin(), data.end() ) );
+            ++good;
+        }
+    } while( bIn.next() );
+    CPPUNIT_ASSERT( 0 < bad );
+    CPPUNIT_ASSERT( good < count && good + 10 > count ); // потеряны только записи повреждённой страницы
+}
+
+void TC_Bbx::FileSplitting()
+{
+    splitAndCheck( false );
+}
+
+void TC_Bbx::LocklessFileSplitting()
+{
+    splitAndCheck( true );
+}
+
+void TC_Bbx::splitAndCheck( bool lockless )
+{
+    const size_t count = 200;
+    auto dataOf = []( size_t i ) {
+        return "data" + std::to_string( i ) + std::string( i % 9 * 70, 'x' );
+    };
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[0] );
+        bOut->setPageSize( 256 );
+        bOut->setPageChecksums( true );
+        bOut->setLocklessReading( lockless );
+        for( size_t i = 0; i < count; ++i )
+        {
+            if ( i % 20 == 0 )
+                CPPUNIT_ASSERT( bOut->pushReference( std::string(), dataOf( i ), Stamp( fix_moment + i ), defaultId ) );
+            else
+                CPPUNIT_ASSERT( bOut->pushIncomingPackage( std::string(), dataOf( i ), Stamp( fix_moment + i ), defaultId ) );
+        }
+    }
+
+    std::vector<std::wstring> created;
+    {
+        Bbx::Impl::FileSplitter splitter;
+        CPPUNIT_ASSERT( splitter.open( BbxLocation[0].getCPtrChain()->getEarliestFile() ) );
+        CPPUNIT_ASSERT( splitter.split( BbxLocation[1], 1, created ) );
+    }
+    CPPUNIT_ASSERT_EQUAL( count / 20, created.size() );
+
+    // граница публикации страницы - конец её кусочков (у заполненной писателем - конец страницы)
+    for( const std::wstring& path : created )
+    {
+        if ( !lockless )
+            break;
+        char_vec file( size_t( bfs::file_size( path ) ) );
+        bfs::ifstream( path, std::ios::binary ).read( file.data(), std::streamsize( file.size() ) );
+        Impl::FileHeader header;
+        memcpy( &header, file.data(), sizeof( header ) );
+        for( size_t offset = header.getHeaderSize(); offset < file.size(); offset += header.getPageSize() )
+        {
+            const size_t pageSize = std::min<size_t>( header.getPageSize(), file.size() - offset );
+            Impl::PageHeader page( 0 );
+            Impl::PageCommit commit;
+            memcpy( &page, &file[ offset ], sizeof( page ) );
+            memcpy( &commit, &file[ offset + sizeof( Impl::PageHeader ) + sizeof( Impl::PageExtension ) ], sizeof( commit ) );
+            size_t partsEnd = sizeof( Impl::PageHeader ) + page.getExtensionSize();
+            Impl::PartHeaderTableRecord part;
+            while( partsEnd + sizeof( Impl::PartHeader ) < pageSize )
+            {
+                memcpy( &part.header, &file[ offset + partsEnd ], sizeof( Impl::PartHeader ) );
+                if ( !part.header.tagIsKnown() )
+                    break;
+                partsEnd += sizeof( Impl::PartHeader ) + part.header.getSize();
+            }
+            CPPUNIT_ASSERT_EQUAL( uint32_t( 0 ), commit.generation % 2 );
+            CPPUNIT_ASSERT( commit.committed == partsEnd
+                || ( commit.committed == pageSize && pageSize - partsEnd <= 2 * sizeof( Impl::PartHeader ) ) );
+        }
+    }
+
+    // каждый новый файл начинается повтором опорной записи, которой закончился предыдущий
+    Reader bIn( BbxLocation[1] );
+    CPPUNIT_ASSERT_EQUAL( size_t( 0 ), bIn.verify() );
+    std::vector<size_t> seen( count, 0 );
+    Stamp stamp;
+    char_vec caption, data;
+    CPPUNIT_ASSERT( bIn.rewind( Stamp( fix_moment ) ) );
+    do
+    {
+        CPPUNIT_ASSERT( bIn.readAnyRecord( stamp, caption, data ) );
+        size_t i = size_t( stamp.getTime() - fix_moment );
+        CPPUNIT_ASSERT( i < count );
+        CPPUNIT_ASSERT_EQUAL( dataOf( i ), std::string( data.begin(), data.end() ) );
+        ++seen[ i ];
+    } while( bIn.next() );
+    for( size_t i = 0; i < count; ++i )
+        CPPUNIT_ASSERT( 1 == seen[ i ] || ( i % 20 == 0 && 2 == seen[ i ] ) );
+}
+
+void TC_Bbx::MergeBoxes()
+{
+    const size_t count = 120;
+    const Bbx::Identifier::Source sources[] = { Bbx::Identifier::HaronInput, Bbx::Identifier::FundInput };
+    for( size_t box = 0; box < 2; ++box )
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[box] );
+        Bbx::Identifier id( sources[box] );
+        // второй ящик начинается позже, его записи перемежаются с записями первого
+        for( size_t i = 0; i < count; ++i )
+        {
+            Stamp stamp( fix_moment + box * 10 + i * 2, uint32_t( box ) );
+            std::string data = std::to_string( box ) + ":" + std::to_string( i );
+            if ( i % 30 == 0 )
+                CPPUNIT_ASSERT( bOut->pushReference( std::string(), data, stamp, id ) );
+            else if ( i % 2 )
+                CPPUNIT_ASSERT( bOut->pushIncrement( std::string(), "was " + data, data, stamp, id ) );
+            else
+                CPPUNIT_ASSERT( bOut->pushIncomingPackage( std::string(), data, stamp, id ) );
+        }
+    }
+
+    std::vector<Bbx::Location> locations( BbxLocation, BbxLocation + 2 );
+    Bbx::MergeIterator merge( locations, 7 );
+    CPPUNIT_ASSERT_EQUAL( size_t( 2 ), merge.inputsCount() );
+    CPPUNIT_ASSERT( merge.rewindToBegin() );
+
+    size_t expected[ 2 ] = { 0, 0 };
+    Stamp last( 0 );
+    Bbx::MergedRecord record;
+    while( merge.next( record ) )
+    {
+        CPPUNIT_ASSERT( record.input < 2 );
+        CPPUNIT_ASSERT( last <= record.stamp );
+        last = record.stamp;
+        size_t& i = expected[ record.input ];
+        std::string data = std::to_string( record.input ) + ":" + std::to_string( i );
+        CPPUNIT_ASSERT_EQUAL( data, std::string( record.data.begin(), record.data.end() ) );
+        CPPUNIT_ASSERT( sources[ record.input ] == record.identifier.getSource() );
+        if ( RecordType::Increment == record.type )
+            CPPUNIT_ASSERT_EQUAL( "was " + data, std::string( record.before.begin(), record.before.end() ) );
+        CPPUNIT_ASSERT( !record.newSession );
+        ++i;
+    }
+    CPPUNIT_ASSERT_EQUAL( count, expected[ 0 ] );
+    CPPUNIT_ASSERT_EQUAL( count, expected[ 1 ] );
+    CPPUNIT_ASSERT( ReadResult::NoDataAvailable == merge.inputResult( 0 ) );
+
+    // с середины: каждый ящик начинается с опорной записи не позже указанного момента
+    CPPUNIT_ASSERT( merge.rewind( Stamp( fix_moment + 130 ) ) );
+    CPPUNIT_ASSERT( merge.next( record ) );
+    CPPUNIT_ASSERT( RecordType::Reference == record.type );
+    CPPUNIT_ASSERT_EQUAL( std::string( "0:60" ), std::string( record.data.begin(), record.data.end() ) );
+    while( merge.next( record ) && 0 == record.input )
+        ;
+    CPPUNIT_ASSERT( RecordType::Reference == record.type );
+    CPPUNIT_ASSERT_EQUAL( std::string( "1:60" ), std::string( record.data.begin(), record.data.end() ) );
+}
+
+void TC_Bbx::CompactBox()
+{
+    // состояние - значение последнего инкремента
+    const size_t count = 200;
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[0] );
+        for( size_t i = 0; i < count; ++i )
+        {
+            std::string value = "v" + std::to_string( i );
+            if ( i % 50 == 0 )
+                CPPUNIT_ASSERT( bOut->pushReference( std::string(), value, Stamp( fix_moment + i ), defaultId ) );
+            else if ( i % 10 == 5 )
+                CPPUNIT_ASSERT( bOut->pushIncomingPackage( std::string(), "p" + value, Stamp( fix_moment + i ), defaultId ) );
+            else
+                CPPUNIT_ASSERT( bOut->pushIncrement( std::string(), std::string(), value, Stamp( fix_moment + i ), defaultId ) );
+        }
+    }
+
+    Bbx::Compactor::ApplyIncrement apply = []( char_vec& state, const char_vec&, const char_vec&, const char_vec& after ) {
+        state = after;
+        return true;
+    };
+    size_t created = 0;
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[1] );
+        Bbx::Compactor compactor( BbxLocation[0], *bOut );
+        compactor.setApplyIncrement( apply );
+        compactor.setReferenceInterval( 8 );
+        compactor.setThinBefore( Stamp( fix_moment + 100 ) );
+        CPPUNIT_ASSERT( compactor.run() );
+        CPPUNIT_ASSERT_EQUAL( uint64_t( count ), compactor.getReadCount() );
+        CPPUNIT_ASSERT( 0 < compactor.getDroppedIncrements() );
+        created = size_t( compactor.getCreatedReferences() );
+        CPPUNIT_ASSERT( created > count / 8 / 2 );
+    }
+
+    // опорные записи несут состояние на свой момент, старых инкрементов нет
+    Reader bIn( BbxLocation[1] );
+    CPPUNIT_ASSERT( bIn.rewind( Stamp( fix_moment ) ) );
+    Stamp stamp;
+    char_vec caption, data;
+    size_t references = 0, packages = 0;
+    do
+    {
+        CPPUNIT_ASSERT( bIn.readAnyRecord( stamp, caption, data ) );
+        size_t i = size_t( stamp.getTime() - fix_moment );
+        std::string expected = "v" + std::to_string( i );
+        switch( bIn.getCurrentType() )
+        {
+        case RecordType::Reference:
+            CPPUNIT_ASSERT_EQUAL( i % 10 == 5 ? "v" + std::to_string( i - 1 ) : expected, std::string( data.begin(), data.end() ) );
+            ++references;
+            break;
+        case RecordType::Increment:
+            CPPUNIT_ASSERT( i >= 100 );
+            break;
+        default:
+            ++packages;
+            break;
+        }
+    } while( bIn.next() );
+    CPPUNIT_ASSERT_EQUAL( count / 50 + created, references );
+    CPPUNIT_ASSERT_EQUAL( count / 10, packages );
+}
+
+void TC_Bbx::CompactBetweenReferences()
+{
+    // состояние - сумма номеров инкрементов, каждый инкремент зависит от всех предыдущих
+    const size_t count = 200;
+    std::vector<long long> expected( count );
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[0] );
+        long long sum = 0;
+        for( size_t i = 0; i < count; ++i )
+        {
+            if ( i % 50 == 0 )
+                CPPUNIT_ASSERT( bOut->pushReference( std::string(), std::to_string( sum ), Stamp( fix_moment + i ), defaultId ) );
+            else if ( i % 10 == 5 )
+                CPPUNIT_ASSERT( bOut->pushIncomingPackage( std::string(), std::string( "p" ), Stamp( fix_moment + i ), defaultId ) );
+            else
+            {
+                sum += i;
+                CPPUNIT_ASSERT( bOut->pushIncrement( std::string(), std::string(), std::to_string( i ), Stamp( fix_moment + i ), defaultId ) );
+            }
+            expected[ i ] = sum;
+        }
+    }
+    auto number = []( const char_vec& v ) {
+        return std::stoll( std::string( v.begin(), v.end() ) );
+    };
+
+    // воспроизведение результата от опорных записей даёт исходное состояние в каждой записи состояния
+    // (посылки в прореженной части видят состояние с шагом опорных записей)
+    auto replay = [&]( const Bbx::Location& location, size_t& increments ) {
+        Reader bIn( location );
+        CPPUNIT_ASSERT( bIn.rewind( Stamp( fix_moment ) ) );
+        Stamp stamp;
+        char_vec caption, data;
+        long long state = 0;
+        increments = 0;
+        do
+        {
+            CPPUNIT_ASSERT( bIn.readAnyRecord( stamp, caption, data ) );
+            if ( RecordType::Reference == bIn.getCurrentType() )
+                state = number( data );
+            else if ( RecordType::Increment == bIn.getCurrentType() )
+            {
+                state += number( data );
+                ++increments;
+            }
+            else
+                continue;
+            CPPUNIT_ASSERT_EQUAL( expected[ size_t( stamp.getTime() - fix_moment ) ], state );
+        } while( bIn.next() );
+    };
+
+    // без применения инкрементов граница отодвигается к опорной записи 100
+    size_t increments = 0;
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[1] );
+        Bbx::Compactor compactor( BbxLocation[0], *bOut );
+        compactor.setThinBefore( Stamp( fix_moment + 120 ) );
+        CPPUNIT_ASSERT( compactor.run() );
+        CPPUNIT_ASSERT_EQUAL( uint64_t( 100 - 2 - 10 ), compactor.getDroppedIncrements() );
+        CPPUNIT_ASSERT_EQUAL( uint64_t( 0 ), compactor.getCreatedReferences() );
+    }
+    replay( BbxLocation[1], increments );
+    CPPUNIT_ASSERT_EQUAL( size_t( 100 - 2 - 10 ), increments );
+
+    // с применением инкрементов на границе появляется опорная запись с накопленной суммой
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[2] );
+        Bbx::Compactor compactor( BbxLocation[0], *bOut );
+        compactor.setApplyIncrement( [&number]( char_vec& state, const char_vec&, const char_vec&, const char_vec& after ) {
+            std::string sum = std::to_string( number( state ) + number( after ) );
+            state.assign( sum.begin(), sum.end() );
+            return true;
+        } );
+        compactor.setThinBefore( Stamp( fix_moment + 120 ) );
+        CPPUNIT_ASSERT( compactor.run() );
+        CPPUNIT_ASSERT_EQUAL( uint64_t( 120 - 3 - 12 ), compactor.getDroppedIncrements() );
+        CPPUNIT_ASSERT_EQUAL( uint64_t( 1 ), compactor.getCreatedReferences() );
+    }
+    replay( BbxLocation[2], increments );
+    CPPUNIT_ASSERT_EQUAL( size_t( 80 - 1 - 8 ), increments );
+}
+
+void TC_Bbx::SharedWriterExecutor()
+{
+    const size_t count = 300;
+    auto executor = std::make_shared<Bbx::WriterExecutor>( 2 );
+    CPPUNIT_ASSERT_EQUAL( size_t( 2 ), executor->getThreadsCount() );
+
+    // ящиков больше, чем потоков пула; записи каждого ящика пишутся по порядку
+    std::shared_ptr<Bbx::Writer> writers[ BBX_COUNT ];
+    for( size_t box = 0; box < BBX_COUNT; ++box )
+    {
+        writers[ box ] = Bbx::Writer::create( BbxLocation[ box ], executor );
+        CPPUNIT_ASSERT( writers[ box ] );
+    }
+    for( size_t i = 0; i < count; ++i )
+    {
+        for( size_t box = 0; box < BBX_COUNT; ++box )
+        {
+            std::string data = std::to_string( box ) + ":" + std::to_string( i );
+            Stamp stamp( fix_moment + i );
+            if ( i % 100 == 0 )
+                CPPUNIT_ASSERT( writers[ box ]->pushReference( std::string(), data, stamp, defaultId ) );
+            else
+                CPPUNIT_ASSERT( writers[ box ]->pushIncomingPackage( std::string(), data, stamp, defaultId ) );
+        }
+    }
+
+    auto checkBox = [this, count]( size_t box ) {
+        Reader reader( BbxLocation[ box ] );
+        CPPUNIT_ASSERT( reader.rewind( Stamp( fix_moment ) ) );
+        size_t i = 0;
+        do {
+            Stamp stamp;
+            char_vec caption, data;
+            CPPUNIT_ASSERT( reader.readAnyRecord( stamp, caption, data ) );
+            if ( i && RecordType::Reference == reader.getCurrentType() && i % 100 != 0 )
+                continue; // копия опорной записи в начале следующего файла
+            CPPUNIT_ASSERT_EQUAL( std::to_string( box ) + ":" + std::to_string( i ), std::string( data.begin(), data.end() ) );
+            ++i;
+        } while( reader.next() );
+        CPPUNIT_ASSERT_EQUAL( count, i );
+    };
+
+    // без flush данные попадают на диск по сроку из колеса таймеров
+    boost::this_thread::sleep( quick_delay + bt::milliseconds( 300 ) );
+    for( size_t box = 0; box < BBX_COUNT; ++box )
+        checkBox( box );
+
+    for( auto& writer : writers )
+        writer.reset();
+    for( size_t box = 0; box < BBX_COUNT; ++box )
+        checkBox( box );
+}
+
+void TC_Bbx::LocklessReading()
+{
+    const size_t count = 400;
+    auto dataOf = []( size_t i ) {
+        return "data" + std::to_string( i ) + std::string( i % 7 * 30, 'x' );
+    };
+    auto bOut = Bbx::Writer::create( BbxLocation[0] );
+    bOut->setPageSize( 256 );
+    bOut->setPageChecksums( true );
+    bOut->setLocklessReading( true );
+
+    // читатель проходит ящик, пока писатель дописывает страницы без блокировок
+    std::atomic<bool> writing( true );
+    size_t passes = 0, broken = 0, seen = 0;
+    boost::thread reading( [&]() {
+        bt::ptime deadline;
+        while ( seen < count && ( writing || deadline.is_not_a_date_time() || bt::microsec_clock::universal_time() < deadline ) )
+        {
+            if ( !writing && deadline.is_not_a_date_time() )
+                deadline = bt::microsec_clock::universal_time() + bt::seconds( 5 );
+            Reader bIn( BbxLocation[0] );
+            size_t i = 0;
+            if ( bIn.rewind( Stamp( fix_moment ) ) )
+            {
+                do {
+                    Stamp stamp;
+                    char_vec caption, data;
+                    if ( !bIn.readAnyRecord( stamp, caption, data ) )
+                        break;
+                    if ( dataOf( i ) != std::string( data.begin(), data.end() ) || "cap" + std::to_string( i % 3 ) != std::string( caption.begin(), caption.end() ) )
+                        ++broken;
+                    ++i;
+                } while( bIn.next() );
+            }
+            seen = std::max( seen, i );
+            ++passes;
+        }
+    } );
+    for( size_t i = 0; i < count; ++i )
+    {
+        CPPUNIT_ASSERT( bOut->pushReference( "cap" + std::to_string( i % 3 ), dataOf( i ), Stamp( fix_moment + i ), defaultId ) );
+        if ( i % 50 == 0 )
+            boost::this_thread::sleep( quick_delay );
+    }
+    bOut->flush();
+    writing = false;
+    reading.join();
+    CPPUNIT_ASSERT_EQUAL( size_t( 0 ), broken );
+    CPPUNIT_ASSERT_EQUAL( count, seen );
+    CPPUNIT_ASSERT( passes > 1 );
+
+    bOut.reset();
+    Bbx::Impl::FileReader file;
+    CPPUNIT_ASSERT( file.tryOpenFile( BbxLocation[0].getCPtrChain()->getEarliestFile() ) );
+    CPPUNIT_ASSERT( file.commitCounters() );
+    CPPUNIT_ASSERT_EQUAL( size_t( 0 ), Reader( BbxLocation[0] ).verify() );
+}
+
+void TC_Bbx::FollowLiveBox()
+{
+    const size_t count = 300;
+    auto dataOf = []( size_t i ) {
+        return "data" + std::to_string( i ) + std::string( i % 5 * 20, 'x' );
+    };
+    auto bOut = Bbx::Writer::create( BbxLocation[0] );
+    bOut->setPageSize( 256 );
+    bOut->setRecomendedFileSize( 4 * 1024 ); // чтение переходит и на новые файлы
+    CPPUNIT_ASSERT( bOut->pushReference( std::string(), dataOf( 0 ), Stamp( fix_moment ), defaultId ) );
+    bOut->flush();
+
+    Reader bIn( BbxLocation[0] );
+    CPPUNIT_ASSERT( bIn.rewind( Stamp( fix_moment ) ) );
+    CPPUNIT_ASSERT_EQUAL( ReadResult( ReadResult::NoDataAvailable ), bIn.follow( bt::milliseconds( 20 ) ) );
+
+    boost::thread writing( [&]() {
+        for( size_t i = 1; i < count; ++i )
+        {
+            Stamp stamp( fix_moment + i );
+            if ( i % 10 == 0 )
+                bOut->pushReference( std::string(), dataOf( i ), stamp, defaultId );
+            else
+                bOut->pushIncomingPackage( std::string(), dataOf( i ), stamp, defaultId );
+            if ( i % 10 == 9 )
+            {
+                bOut->flush();
+                boost::this_thread::sleep( bt::milliseconds( 5 ) );
+            }
+        }
+        bOut->flush();
+    } );
+
+    // записи доставляются по порядку по мере записи, без опроса
+    size_t i = 1, broken = 0;
+    ReadResult res = bIn.follow( [&]( Reader& reader ) {
+        Stamp stamp;
+        char_vec caption, data;
+        if ( !reader.readAnyRecord( stamp, caption, data ) )
+            ++broken;
+        else if ( RecordType::Reference == reader.getCurrentType() && i % 10 != 0 )
+            return true; // копия опорной записи в начале следующего файла
+        else if ( dataOf( i++ ) != std::string( data.begin(), data.end() ) )
+            ++broken;
+        return i < count;
+    }, bt::seconds( 5 ) );
+    writing.join();
+    CPPUNIT_ASSERT( res );
+    CPPUNIT_ASSERT_EQUAL( size_t( 0 ), broken );
+    CPPUNIT_ASSERT_EQUAL( count, i );
+    CPPUNIT_ASSERT( BbxLocation[0].getCPtrChain()->getNumberOfFiles() > 1 );
+
+    // писатель молчит - ожидание заканчивается по времени
+    bt::ptime start = bt::microsec_clock::universal_time();
+    CPPUNIT_ASSERT_EQUAL( ReadResult( ReadResult::NoDataAvailable ), bIn.follow( bt::milliseconds( 100 ) ) );
+    CPPUNIT_ASSERT( bt::microsec_clock::universal_time() - start >= bt::milliseconds( 90 ) );
+}
+
+void TC_Bbx::LiveFeedFallsBackToFiles()
+{
+    auto dataOf = []( size_t i ) {
+        return "data" + std::to_string( i ) + std::string( i % 7 * 10, 'x' );
+    };
+    auto asString = []( const char_vec& v ) {
+        return std::string( v.begin(), v.end() );
+    };
+    LiveFeed feed( BbxLocation[0] );
+    LiveRecord record;
+    CPPUNIT_ASSERT( !feed.attach() );
+    CPPUNIT_ASSERT_EQUAL( ReadResult( ReadResult::NoFileOpened ), feed.read( record ) );
+
+    auto bOut = Bbx::Writer::create( BbxLocation[0] );
+    bOut->setPageSize( 1024 );
+    CPPUNIT_ASSERT( bOut->setLiveFeed( 4096 ) );
+    CPPUNIT_ASSERT( feed.attach() );
+    CPPUNIT_ASSERT_EQUAL( ReadResult( ReadResult::NoDataAvailable ), feed.read( record ) );
+
+    // записи приходят из ленты вместе с номерами и фрагментом "до"
+    CPPUNIT_ASSERT( bOut->pushReference( std::string( "cap" ), dataOf( 1 ), Stamp( fix_moment, 5 ), defaultId ) );
+    CPPUNIT_ASSERT( bOut->pushIncrement( std::string( "cap" ), std::string( "before" ), dataOf( 2 ), Stamp( fix_moment + 1 ), defaultId ) );
+    bOut->flush();
+    CPPUNIT_ASSERT( feed.read( record ) );
+    CPPUNIT_ASSERT( RecordType::Reference == record.type );
+    CPPUNIT_ASSERT_EQUAL( uint64_t( 1 ), record.sequence );
+    CPPUNIT_ASSERT( Stamp( fix_moment, 5 ) == record.stamp );
+    CPPUNIT_ASSERT_EQUAL( std::string( "cap" ), asString( record.caption ) );
+    CPPUNIT_ASSERT_EQUAL( dataOf( 1 ), asString( record.data ) );
+    CPPUNIT_ASSERT( feed.read( record ) );
+    CPPUNIT_ASSERT( RecordType::Increment == record.type );
+    CPPUNIT_ASSERT_EQUAL( std::string( "before" ), asString( record.before ) );
+    CPPUNIT_ASSERT_EQUAL( dataOf( 2 ), asString( record.data ) );
+    CPPUNIT_ASSERT_EQUAL( ReadResult( ReadResult::NoDataAvailable ), feed.read( record ) );
+    CPPUNIT_ASSERT_EQUAL( size_t( 0 ), feed.getFallbacksCount() );
+
+    // отставший читатель дочитывает затёртое из файлов и возвращается к ленте
+    const size_t count = 200;
+    for( size_t i = 3; i <= count; ++i )
+        CPPUNIT_ASSERT( bOut->pushIncomingPackage( std::string(), dataOf( i ), Stamp( fix_moment + i ), defaultId ) );
+    bOut->flush();
+    size_t next = 3, broken = 0;
+    while( feed.read( record ) )
+    {
+        if ( record.sequence != next || dataOf( next++ ) != asString( record.data ) )
+            ++broken;
+    }
+    CPPUNIT_ASSERT_EQUAL( size_t( 0 ), broken );
+    CPPUNIT_ASSERT_EQUAL( count + 1, next );
+    CPPUNIT_ASSERT_EQUAL( size_t( 1 ), feed.getFallbacksCount() );
+
+    // запись, не поместившаяся в ленту, также берётся из файла
+    const std::string large( 2000, 'L' );
+    for( size_t i = count + 1; i <= count + 3; ++i )
+    {
+        std::string data = i == count + 2 ? large : dataOf( i );
+        CPPUNIT_ASSERT( bOut->pushIncomingPackage( std::string(), data, Stamp( fix_moment + i ), defaultId ) );
+    }
+    bOut->flush();
+    CPPUNIT_ASSERT( feed.read( record ) );
+    CPPUNIT_ASSERT_EQUAL( uint64_t( count + 1 ), record.sequence );
+    CPPUNIT_ASSERT_EQUAL( size_t( 1 ), feed.getFallbacksCount() );
+    CPPUNIT_ASSERT( feed.read( record ) );
+    CPPUNIT_ASSERT_EQUAL( uint64_t( count + 2 ), record.sequence );
+    CPPUNIT_ASSERT_EQUAL( large, asString( record.data ) );
+    CPPUNIT_ASSERT_EQUAL( size_t( 2 ), feed.getFallbacksCount() );
+    CPPUNIT_ASSERT( feed.read( record ) );
+    CPPUNIT_ASSERT_EQUAL( uint64_t( count + 3 ), record.sequence );
+
+    // догнавший читатель снова получает записи из ленты
+    CPPUNIT_ASSERT( bOut->pushIncomingPackage( std::string(), dataOf( 4 ), Stamp( fix_moment + count + 4 ), defaultId ) );
+    bOut->flush();
+    CPPUNIT_ASSERT( feed.read( record ) );
+    CPPUNIT_ASSERT_EQUAL( uint64_t( count + 4 ), record.sequence );
+    CPPUNIT_ASSERT_EQUAL( dataOf( 4 ), asString( record.data ) );
+    CPPUNIT_ASSERT_EQUAL( size_t( 2 ), feed.getFallbacksCount() );
+    CPPUNIT_ASSERT_EQUAL( ReadResult( ReadResult::NoDataAvailable ), feed.read( record ) );
+}
+
+std::vector<std::string> TC_Bbx::writeStateBox( size_t count, unsigned perSecond )
+{
+    // состояние - 16 символов, инкремент меняет один символ: фрагменты "до" и "после" - пара (позиция, символ)
+    // perSecond записей в секунду с равным шагом наносекунд
+    std::vector<std::string> states( count );
+    std::string state( 16, '-' );
+    auto bOut = Bbx::Writer::create( BbxLocation[0] );
+    bOut->setPageSize( 512 );
+    for( size_t i = 0; i < count; ++i )
+    {
+        Stamp stamp( fix_moment + i / perSecond, unsigned( i % perSecond ) * ( 1000000000u / perSecond ) );
+        if ( i % 50 == 0 )
+            CPPUNIT_ASSERT( bOut->pushReference( std::string( "S" ), state, stamp, defaultId ) );
+        else
+        {
+            char index = char( i % state.size() );
+            std::string before = { index, state[index] };
+            state[index] = char( 'a' + i % 26 );
+            std::string after = { index, state[index] };
+            CPPUNIT_ASSERT( bOut->pushIncrement( std::string( "S" ), before, after, stamp, defaultId ) );
+            if ( i % 7 == 0 )
+                CPPUNIT_ASSERT( bOut->pushIncomingPackage( std::string(), std::string( "package" ), stamp, defaultId ) );
+        }
+        states[i] = state;
+    }
+    return states;
+}
+
+void TC_Bbx::applyStateFragment( Bbx::char_vec& state, const Bbx::char_vec& /*caption*/, const Bbx::char_vec& fragment )
+{
+    CPPUNIT_ASSERT_EQUAL( size_t( 2 ), fragment.size() );
+    state[size_t( fragment[0] )] = fragment[1];
+}
+
+void TC_Bbx::MaterializeState()
+{
+    const size_t count = 300;
+    std::vector<std::string> states = writeStateBox( count );
+
+    StateMaterializer materializer( BbxLocation[0], &TC_Bbx::applyStateFragment );
+    auto stateAt = [&]( size_t i ) {
+        char_vec result;
+        CPPUNIT_ASSERT( materializer.materialize( Stamp( fix_moment + i ), result ) );
+        CPPUNIT_ASSERT_EQUAL( uint64_t( fix_moment + i ), uint64_t( materializer.getStateStamp().getTime() ) );
+        return std::string( result.begin(), result.end() );
+    };
+
+    // от опорной записи 100 вперёд
+    CPPUNIT_ASSERT_EQUAL( states[120], stateAt( 120 ) );
+    CPPUNIT_ASSERT_EQUAL( size_t( 21 ), materializer.getReplayedCount() );
+
+    // повтор - из памяти
+    CPPUNIT_ASSERT_EQUAL( states[120], stateAt( 120 ) );
+    CPPUNIT_ASSERT_EQUAL( size_t( 1 ), materializer.getCacheHits() );
+    CPPUNIT_ASSERT_EQUAL( size_t( 21 ), materializer.getReplayedCount() );
+
+    // вперёд от сохранённого состояния, а не от опорной записи
+    CPPUNIT_ASSERT_EQUAL( states[125], stateAt( 125 ) );
+    CPPUNIT_ASSERT_EQUAL( size_t( 26 ), materializer.getReplayedCount() );
+
+    // назад от более близкого сохранённого состояния фрагментами "до"
+    CPPUNIT_ASSERT_EQUAL( states[124], stateAt( 124 ) );
+    CPPUNIT_ASSERT_EQUAL( size_t( 27 ), materializer.getReplayedCount() );
+
+    // опорная запись ближе сохранённых состояний
+    CPPUNIT_ASSERT_EQUAL( states[160], stateAt( 160 ) );
+    CPPUNIT_ASSERT_EQUAL( size_t( 38 ), materializer.getReplayedCount() );
+
+    // без движения назад - только вперёд
+    materializer.setBackwardReplay( false );
+    CPPUNIT_ASSERT_EQUAL( states[159], stateAt( 159 ) );
+    CPPUNIT_ASSERT_EQUAL( size_t( 48 ), materializer.getReplayedCount() );
+
+    for( size_t i = 0; i < count; i += 13 )
+        CPPUNIT_ASSERT_EQUAL( states[i], stateAt( i ) );
+
+    // после последней записи - последнее состояние
+    char_vec result;
+    CPPUNIT_ASSERT( materializer.materialize( Stamp( fix_moment + count + 100 ), result ) );
+    CPPUNIT_ASSERT_EQUAL( states[count - 1], std::string( result.begin(), result.end() ) );
+    CPPUNIT_ASSERT_EQUAL( ReadResult( ReadResult::NoDataAvailable ), materializer.materialize( Stamp( fix_moment - 10 ), result ) );
+}
+
+void TC_Bbx::MaterializeManyPoints()
+{
+    const size_t count = 300;
+    std::vector<std::string> states = writeStateBox( count );
+
+    std::vector<Stamp> points;
+    for( time_t t = fix_moment - 5; t < time_t( fix_moment + count + 5 ); t += 3 )
+        points.push_back( Stamp( t ) );
+    points.push_back( points.back() ); // повтор момента
+
+    std::vector<MaterializedState> results = StateMaterializer::materializeMany( BbxLocation[0], points, &TC_Bbx::applyStateFragment, 4 );
+    CPPUNIT_ASSERT_EQUAL( points.size(), results.size() );
+    for( size_t i = 0; i < points.size(); ++i )
+    {
+        if ( points[i].getTime() < fix_moment )
+        {
+            CPPUNIT_ASSERT_EQUAL( ReadResult( ReadResult::NoDataAvailable ), results[i].result );
+            continue;
+        }
+        size_t expected = std::min<size_t>( count - 1, size_t( points[i].getTime() - fix_moment ) );
+        CPPUNIT_ASSERT( results[i].result );
+        CPPUNIT_ASSERT_EQUAL( states[expected], std::string( results[i].state.begin(), results[i].state.end() ) );
+        CPPUNIT_ASSERT_EQUAL( time_t( fix_moment + expected ), results[i].stamp.getTime() );
+    }
+}
+
+void TC_Bbx::MaterializeWithinSecond()
+{
+    const size_t count = 300;
+    const unsigned perSecond = 4;
+    const unsigned step = 1000000000u / perSecond;
+    std::vector<std::string> states = writeStateBox( count, perSecond );
+    auto stampOf = [&]( size_t i, unsigned shift ) {
+        return Stamp( fix_moment + i / perSecond, unsigned( i % perSecond ) * step + shift );
+    };
+
+    StateMaterializer materializer( BbxLocation[0], &TC_Bbx::applyStateFragment );
+    auto stateAt = [&]( const Stamp& where ) {
+        char_vec result;
+        CPPUNIT_ASSERT( materializer.materialize( where, result ) );
+        return std::string( result.begin(), result.end() );
+    };
+
+    // записи позже момента в той же секунде не применяются
+    CPPUNIT_ASSERT_EQUAL( states[121], stateAt( stampOf( 121, step / 2 ) ) );
+    CPPUNIT_ASSERT( stampOf( 121, 0 ) == materializer.getStateStamp() );
+    const size_t replayed = materializer.getReplayedCount();
+
+    // момент до следующей записи той же секунды - из памяти
+    CPPUNIT_ASSERT_EQUAL( states[121], stateAt( stampOf( 121, step - 1 ) ) );
+    CPPUNIT_ASSERT_EQUAL( states[121], stateAt( stampOf( 121, 0 ) ) );
+    CPPUNIT_ASSERT_EQUAL( size_t( 2 ), materializer.getCacheHits() );
+    CPPUNIT_ASSERT_EQUAL( replayed, materializer.getReplayedCount() );
+
+    // следующая запись той же секунды уже входит в состояние
+    CPPUNIT_ASSERT_EQUAL( states[122], stateAt( stampOf( 122, 0 ) ) );
+    CPPUNIT_ASSERT( stampOf( 122, 0 ) == materializer.getStateStamp() );
+
+    // назад внутри секунды фрагментами "до"
+    CPPUNIT_ASSERT_EQUAL( states[120], stateAt( stampOf( 120, 1 ) ) );
+    CPPUNIT_ASSERT( stampOf( 120, 0 ) == materializer.getStateStamp() );
+
+    for( size_t i = 0; i < count; i += 7 )
+        CPPUNIT_ASSERT_EQUAL( states[i], stateAt( stampOf( i, step / 3 ) ) );
+}
+
+void TC_Bbx::LocalReaderClone()
+{
+    const size_t count = 200;
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[0] );
+        bOut->setPageSize( 256 );
+        bOut->setRecomendedFileSize( 4 * 1024 );
+        for( size_t i = 0; i < count; ++i )
+        {
+            std::string data = "data" + std::to_string( i );
+            if ( i % 20 == 0 )
+                CPPUNIT_ASSERT( bOut->pushReference( std::string(), data, Stamp( fix_moment + i ), defaultId ) );
+            else
+                CPPUNIT_ASSERT( bOut->pushIncomingPackage( std::string(), data, Stamp( fix_moment + i ), defaultId ) );
+        }
+    }
+
+    // чтение одного потока без блокировок: номера идут подряд, копии опорных записей повторяют номер
+    LocalReader local( BbxLocation[0] );
+    CPPUNIT_ASSERT( local.rewind( Stamp( fix_moment ) ) );
+    for( size_t i = 1; i < 50; ++i )
+        CPPUNIT_ASSERT( local.next() );
+    uint64_t position = local.getCurrentSequence();
+
+    // копия продолжает с той же позиции независимо от исходного читателя
+    std::unique_ptr<LocalReader> fork = local.clone();
+    CPPUNIT_ASSERT( fork->isOpened() );
+    CPPUNIT_ASSERT_EQUAL( position, fork->getCurrentSequence() );
+    CPPUNIT_ASSERT( local.getCurrentFilePath() == fork->getCurrentFilePath() );
+
+    auto readToEnd = []( LocalReader& reader, uint64_t& last ) {
+        size_t gaps = 0;
+        last = reader.getCurrentSequence();
+        while( reader.next() )
+        {
+            uint64_t sequence = reader.getCurrentSequence();
+            Stamp stamp;
+            char_vec caption, data;
+            if ( !reader.readAnyRecord( stamp, caption, data ) || ( sequence != last + 1 && sequence != last ) )
+                ++gaps;
+            last = sequence;
+        }
+        return gaps;
+    };
+    uint64_t forkLast = 0, localLast = 0;
+    size_t forkGaps = 0;
+    boost::thread forking( [&]() {
+        forkGaps = readToEnd( *fork, forkLast );
+    } );
+    size_t localGaps = readToEnd( local, localLast );
+    forking.join();
+    CPPUNIT_ASSERT_EQUAL( size_t( 0 ), forkGaps );
+    CPPUNIT_ASSERT_EQUAL( size_t( 0 ), localGaps );
+    CPPUNIT_ASSERT_EQUAL( uint64_t( count ), forkLast );
+    CPPUNIT_ASSERT_EQUAL( uint64_t( count ), localLast );
+
+    // копия сохраняет направление
+    local.setDirection( false );
+    std::unique_ptr<LocalReader> backward = local.clone();
+    CPPUNIT_ASSERT( !backward->getDirection() );
+    CPPUNIT_ASSERT( backward->next() );
+    CPPUNIT_ASSERT_EQUAL( uint64_t( count - 1 ), backward->getCurrentSequence() );
+    CPPUNIT_ASSERT_EQUAL( uint64_t( count ), local.getCurrentSequence() );
+}
+
+void TC_Bbx::ReaderPositionToken()
+{
+    const size_t count = 200;
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[0] );
+        bOut->setPageSize( 256 );
+        bOut->setRecomendedFileSize( 4 * 1024 );
+        for( size_t i = 0; i < count; ++i )
+        {
+            std::string data = "data" + std::to_string( i );
+            if ( i % 20 == 0 )
+                CPPUNIT_ASSERT( bOut->pushReference( std::string(), data, Stamp( fix_moment + i ), defaultId ) );
+            else
+                CPPUNIT_ASSERT( bOut->pushIncomingPackage( std::string(), data, Stamp( fix_moment + i ), defaultId ) );
+        }
+    }
+
+    // позиция без открытого файла недействительна
+    Reader reader( BbxLocation[0] );
+    CPPUNIT_ASSERT( !reader.getPosition().isValid() );
+    CPPUNIT_ASSERT( !reader.rewindToPosition( Bbx::ReaderPosition() ) );
+
+    CPPUNIT_ASSERT( reader.rewind( Stamp( fix_moment + 120 ) ) );
+    for( size_t i = 0; i < 7; ++i )
+        CPPUNIT_ASSERT( reader.next() );
+    const uint64_t sequence = reader.getCurrentSequence();
+    const Stamp stamp = reader.getCurrentStamp();
+    const std::string token = reader.getPosition().serialize();
+
+    // восстановление в другом читателе без поиска
+    Bbx::ReaderPosition restored = Bbx::ReaderPosition::deserialize( token );
+    CPPUNIT_ASSERT( restored.isValid() );
+    CPPUNIT_ASSERT_EQUAL( sequence, restored.getSequence() );
+    CPPUNIT_ASSERT( stamp == restored.getStamp() );
+    LocalReader local( BbxLocation[0] );
+    CPPUNIT_ASSERT_EQUAL( Bbx::ReadResult::Success, local.rewindToPosition( restored ).get() );
+    CPPUNIT_ASSERT_EQUAL( sequence, local.getCurrentSequence() );
+    CPPUNIT_ASSERT( local.getCurrentFilePath() == reader.getCurrentFilePath() );
+    CPPUNIT_ASSERT( local.next() );
+    CPPUNIT_ASSERT_EQUAL( sequence + 1, local.getCurrentSequence() );
+
+    // тот же читатель возвращается к позиции в уже открытом файле
+    CPPUNIT_ASSERT( reader.next() && reader.next() );
+    CPPUNIT_ASSERT_EQUAL( Bbx::ReadResult::Success, reader.rewindToPosition( restored ).get() );
+    CPPUNIT_ASSERT_EQUAL( sequence, reader.getCurrentSequence() );
+
+    // неизвестная версия и повреждённая запись не разбираются
+    CPPUNIT_ASSERT( !Bbx::ReaderPosition::deserialize( "bbxpos999" + token.substr( token.find( ' ' ) ) ).isValid() );
+    CPPUNIT_ASSERT( !Bbx::ReaderPosition::deserialize( token.substr( 0, token.size() / 2 ) + "x" ).isValid() );
+    CPPUNIT_ASSERT( !Bbx::ReaderPosition::deserialize( std::string() ).isValid() );
+
+    // файл удалён по сроку хранения: запись ищется по номеру
+    const std::string fileName = ToUtf8( boost::filesystem::path( reader.getCurrentFilePath() ).filename().wstring() );
+    std::string lost = token;
+    lost.replace( lost.rfind( fileName ), fileName.size(), "gone.bbx" );
+    Bbx::ReaderPosition stale = Bbx::ReaderPosition::deserialize( lost );
+    CPPUNIT_ASSERT( stale.isValid() );
+    Reader other( BbxLocation[0] );
+    CPPUNIT_ASSERT_EQUAL( Bbx::ReadResult::FoundApproximateValue, other.rewindToPosition( stale ).get() );
+    CPPUNIT_ASSERT_EQUAL( sequence, other.getCurrentSequence() );
+    CPPUNIT_ASSERT( stamp == other.getCurrentStamp() );
+}
+
+void TC_Bbx::MultiReaderPlayback()
+{
+    const size_t count = 120;
+    const Bbx::Identifier::Source sources[] = { Bbx::Identifier::HaronInput, Bbx::Identifier::FundInput };
+    auto push = [&]( Bbx::Writer& bOut, size_t box, size_t i, time_t moment ) {
+        Bbx::Identifier id( sources[box] );
+        Stamp stamp( moment, uint32_t( box ) );
+        std::string data = std::to_string( box ) + ":" + std::to_string( i );
+        if ( i % 30 == 0 )
+            CPPUNIT_ASSERT( bOut.pushReference( std::string(), data, stamp, id ) );
+        else if ( i % 2 )
+            CPPUNIT_ASSERT( bOut.pushIncrement( std::string(), "was " + data, data, stamp, id ) );
+        else
+            CPPUNIT_ASSERT( bOut.pushIncomingPackage( std::string(), data, stamp, id ) );
+    };
+    // первый ящик записан двумя сессиями с перерывом, второй - одной
+    for( size_t session = 0; session < 2; ++session )
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[0] );
+        bOut->setPageSize( 256 );
+        bOut->setRecomendedFileSize( 2 * 1024 );
+        for( size_t i = session * count / 2; i < ( session + 1 ) * count / 2; ++i )
+            push( *bOut, 0, i, fix_moment + session * 200 + i * 2 );
+    }
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[1] );
+        bOut->setPageSize( 256 );
+        bOut->setRecomendedFileSize( 2 * 1024 );
+        for( size_t i = 0; i < count; ++i )
+            push( *bOut, 1, i, fix_moment + 1 + i * 3 );
+    }
+
+    auto text = []( const char_vec& v ) {
+        return std::string( v.begin(), v.end() );
+    };
+    auto same = [&]( const Bbx::MergedRecord& left, const Bbx::MergedRecord& right ) {
+        return left.input == right.input && left.stamp == right.stamp && left.type == right.type
+            && left.data == right.data && left.before == right.before;
+    };
+
+    std::vector<Bbx::Location> locations( BbxLocation, BbxLocation + 2 );
+    Bbx::MultiReader multi( locations, 5 );
+    CPPUNIT_ASSERT_EQUAL( size_t( 2 ), multi.inputsCount() );
+
+    // вперёд: общий порядок по времени, порядок и фрагменты каждого ящика сохраняются
+    CPPUNIT_ASSERT( multi.rewindToBegin() );
+    std::vector<Bbx::MergedRecord> forward;
+    Bbx::MergedRecord record;
+    size_t expected[ 2 ] = { 0, 0 };
+    while( multi.next( record ) )
+    {
+        CPPUNIT_ASSERT( forward.empty() || forward.back().stamp < record.stamp );
+        size_t& i = expected[ record.input ];
+        std::string data = std::to_string( record.input ) + ":" + std::to_string( i );
+        CPPUNIT_ASSERT_EQUAL( data, text( record.data ) );
+        CPPUNIT_ASSERT( sources[ record.input ] == record.identifier.getSource() );
+        if ( RecordType::Increment == record.type )
+            CPPUNIT_ASSERT_EQUAL( "was " + data, text( record.before ) );
+        CPPUNIT_ASSERT_EQUAL( 0 == record.input && count / 2 == i, record.newSession );
+        CPPUNIT_ASSERT( !record.gap );
+        ++i;
+        forward.push_back( record );
+    }
+    CPPUNIT_ASSERT_EQUAL( count, expected[ 0 ] );
+    CPPUNIT_ASSERT_EQUAL( count, expected[ 1 ] );
+    CPPUNIT_ASSERT( ReadResult::NoDataAvailable == multi.inputResult( 1 ) );
+
+    // назад с конца: те же записи в обратном порядке, разрыв отмечен у последней записи первой сессии
+    CPPUNIT_ASSERT( multi.rewindToEnd() );
+    CPPUNIT_ASSERT( !multi.getDirection() );
+    size_t index = forward.size();
+    while( multi.next( record ) )
+    {
+        CPPUNIT_ASSERT( index > 0 );
+        --index;
+        CPPUNIT_ASSERT( same( forward[ index ], record ) );
+        CPPUNIT_ASSERT_EQUAL( 0 == record.input && "0:" + std::to_string( count / 2 - 1 ) == text( record.data ), record.newSession );
+        CPPUNIT_ASSERT( !record.gap );
+    }
+    CPPUNIT_ASSERT_EQUAL( size_t( 0 ), index );
+
+    // смена направления посреди воспроизведения продолжает от последней выданной записи
+    CPPUNIT_ASSERT( multi.rewindToBegin() );
+    for( size_t i = 0; i < 70; ++i )
+        CPPUNIT_ASSERT( multi.next( record ) && same( forward[ i ], record ) );
+    multi.setDirection( false );
+    for( size_t i = 68; i >= 39; --i )
+        CPPUNIT_ASSERT( multi.next( record ) && same( forward[ i ], record ) );
+    multi.setDirection( true );
+    for( size_t i = 40; i < forward.size(); ++i )
+        CPPUNIT_ASSERT( multi.next( record ) && same( forward[ i ], record ) );
+    CPPUNIT_ASSERT( !multi.next( record ) );
+
+    // перемотка при чтении назад: с последней записи не позже момента
+    const Stamp where( fix_moment + 101 );
+    multi.setDirection( false );
+    CPPUNIT_ASSERT( multi.rewind( where ) );
+    index = forward.size();
+    while( forward[ index - 1 ].stamp > where )
+        --index;
+    for( size_t i = index; i > index - 10; --i )
+        CPPUNIT_ASSERT( multi.next( record ) && same( forward[ i - 1 ], record ) );
+}
+
+void TC_Bbx::TimelineSummary()
+{
+    // тип записи по номеру: опорные каждые 10, иначе вперемешку инкременты и посылки
+    auto typeOf = []( size_t i ) {
+        if ( i % 10 == 0 )
+            return RecordType::Reference;
+        if ( i % 3 == 0 )
+            return RecordType::OutboxPackage;
+        return ( i % 2 ) ? RecordType::Increment : RecordType::IncomingPackage;
+    };
+    auto push = [&]( Bbx::Writer& bOut, size_t i, time_t moment ) {
+        std::string data = "data" + std::to_string( i );
+        switch( typeOf( i ) )
+        {
+        case RecordType::Reference:
+            return bOut.pushReference( std::string(), data, Stamp( moment ), defaultId );
+        case RecordType::Increment:
+            return bOut.pushIncrement( std::string(), "was " + data, data, Stamp( moment ), defaultId );
+        case RecordType::IncomingPackage:
+            return bOut.pushIncomingPackage( std::string(), data, Stamp( moment ), defaultId );
+        default:
+            return bOut.pushOutboxPackage( std::string(), data, Stamp( moment ), defaultId );
+        }
+    };
+    // две сессии: записи раз в секунду с начала и с fix_moment + 400
+    const size_t count = 150;
+    for( size_t session = 0; session < 2; ++session )
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[0] );
+        bOut->setPageSize( 256 );
+        bOut->setRecomendedFileSize( 1024 );
+        for( size_t i = session * 100; i < ( session ? count : 100 ); ++i )
+            CPPUNIT_ASSERT( push( *bOut, i, fix_moment + i + session * 300 ) );
+    }
+    BbxLocation[0].refreshFolderCache();
+    CPPUNIT_ASSERT( BbxLocation[0].getCPtrChain()->getNumberOfFiles() > 3 );
+    size_t expected[ Bbx::c_RecordTypesCount ] = {};
+    for( size_t i = 0; i < count; ++i )
+        ++expected[ Bbx::TimelineBucket::typeIndex( typeOf( i ) ) ];
+
+    // закрытые файлы несут итоги в зоне расширения
+    Bbx::Impl::FileReader closed;
+    CPPUNIT_ASSERT( closed.tryOpenFile( BbxLocation[0].getCPtrChain()->getEarliestFile() ) );
+    CPPUNIT_ASSERT( closed.summaryOffset() != 0 );
+
+    // один интервал на весь ящик: файлы учитываются по итогам, копии опорных записей не повторяются
+    Reader reader( BbxLocation[0] );
+    const std::pair<Stamp, Stamp> range( Stamp( fix_moment ), Stamp( fix_moment + 499 ) );
+    std::vector<Bbx::TimelineBucket> whole = reader.summarize( range, boost::posix_time::hours( 1 ) );
+    CPPUNIT_ASSERT_EQUAL( size_t( 1 ), whole.size() );
+    for( size_t type = 0; type < Bbx::c_RecordTypesCount; ++type )
+        CPPUNIT_ASSERT_EQUAL( expected[ type ], whole[ 0 ].counts[ type ] );
+    CPPUNIT_ASSERT_EQUAL( count, whole[ 0 ].getTotalCount() );
+    CPPUNIT_ASSERT_EQUAL( size_t( 2 ), whole[ 0 ].sessions );
+    CPPUNIT_ASSERT_EQUAL( size_t( 0 ), whole[ 0 ].gaps );
+
+    // посекундные интервалы считаются по заголовкам кусочков и дают те же объёмы
+    std::vector<Bbx::TimelineBucket> seconds = reader.summarize( range, boost::posix_time::seconds( 1 ) );
+    CPPUNIT_ASSERT_EQUAL( size_t( 500 ), seconds.size() );
+    uint64_t bytes[ Bbx::c_RecordTypesCount ] = {};
+    for( size_t k = 0; k < seconds.size(); ++k )
+    {
+        const Bbx::TimelineBucket& bucket = seconds[ k ];
+        CPPUNIT_ASSERT( Stamp( fix_moment + k ) == bucket.begin );
+        const bool written = k < 100 || ( k >= 400 && k < 450 );
+        CPPUNIT_ASSERT_EQUAL( size_t( written ? 1 : 0 ), bucket.getTotalCount() );
+        if ( written )
+            CPPUNIT_ASSERT_EQUAL( size_t( 1 ), bucket.getCount( typeOf( k < 100 ? k : k - 300 ) ) );
+        CPPUNIT_ASSERT_EQUAL( size_t( 0 == k || 400 == k ? 1 : 0 ), bucket.sessions );
+        for( size_t type = 0; type < Bbx::c_RecordTypesCount; ++type )
+            bytes[ type ] += bucket.bytes[ type ];
+    }
+    for( size_t type = 0; type < Bbx::c_RecordTypesCount; ++type )
+        CPPUNIT_ASSERT_EQUAL( whole[ 0 ].bytes[ type ], bytes[ type ] );
+
+    // записываемый файл итогов ещё не имеет и учитывается по заголовкам
+    {
+        auto bOut = Bbx::Writer::create( BbxLocation[0] );
+        for( size_t i = 0; i < 5; ++i )
+            CPPUNIT_ASSERT( push( *bOut, i, fix_moment + 480 + i ) );
+        bOut->flush();
+        BbxLocation[0].refreshFolderCache();
+        std::vector<Bbx::TimelineBucket> live = reader.summarize( range, boost::posix_time::hours( 1 ) );
+        CPPUNIT_ASSERT_EQUAL( count + 5, live[ 0 ].getTotalCount() );
+        CPPUNIT_ASSERT_EQUAL( size_t( 3 ), live[ 0 ].sessions );
+    }
+
+    // удалённый файл посреди сессии - пропуск номеров и начало новой сессии
+    std::vector<std::wstring> files = BbxLocation[0].getCPtrChain()->getFiles( sizeof( Bbx::Impl::FileHeader ) );
+    CPPUNIT_ASSERT( bfs::remove( files[ 1 ] ) );
+    BbxLocation[0].refreshFolderCache();
+    std::vector<Bbx::TimelineBucket> damaged = reader.summarize( range, boost::posix_time::hours( 1 ) );
+    CPPUNIT_ASSERT_EQUAL( size_t( 1 ), damaged[ 0 ].gaps );
+    CPPUNIT_ASSERT_EQUAL( size_t( 4 ), damaged[ 0 ].sessions );
+    CPPUNIT_ASSERT( damaged[ 0 ].getTotalCount() < count + 5 );
+
+    // пустой и перевёрнутый диапазоны
+    CPPUNIT_ASSERT( reader.summarize( std::make_pair( Stamp( fix_moment + 200 ), Stamp( fix_moment + 299 ) ), boost::posix_time::minutes( 1 ) )[ 0 ].getTotalCount() == 0 );
+    CPPUNIT_ASSERT( reader.summarize( std::make_pair( range.second, range.first ), boost::posix_time::minutes( 1 ) ).empty() );
+}
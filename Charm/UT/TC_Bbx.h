@@ -37,6 +37,27 @@ class TC_Bbx : public CPPUNIT_NS::TestFixture
   CPPUNIT_TEST(PushStressTest);
   CPPUNIT_TEST(Compatible_NameLess);
   CPPUNIT_TEST(StoreTimeZone);
+  CPPUNIT_TEST(CaptionDictionary);       /*      */
+  CPPUNIT_TEST(LargeFileOffsets);        /*     4Gb */
+  CPPUNIT_TEST(SequenceSeek);            /*      */
+  CPPUNIT_TEST(ExtensionFormats);        /*   XML   */
+  CPPUNIT_TEST(PageChecksums);           /*    */
+  CPPUNIT_TEST(FileSplitting);           /*      */
+  CPPUNIT_TEST(LocklessFileSplitting);   /*       */
+  CPPUNIT_TEST(MergeBoxes);              /*      */
+  CPPUNIT_TEST(CompactBox);              /*     */
+  CPPUNIT_TEST(CompactBetweenReferences); /*      */
+  CPPUNIT_TEST(SharedWriterExecutor);    /*        */
+  CPPUNIT_TEST(LocklessReading);         /*        */
+  CPPUNIT_TEST(FollowLiveBox);           /*      */
+  CPPUNIT_TEST(LiveFeedFallsBackToFiles); /*       */
+  CPPUNIT_TEST(MaterializeState);        /*      */
+  CPPUNIT_TEST(MaterializeManyPoints);   /*      */
+  CPPUNIT_TEST(MaterializeWithinSecond); /*      */
+  CPPUNIT_TEST(LocalReaderClone);        /*           */
+  CPPUNIT_TEST(ReaderPositionToken);     /*      */
+  CPPUNIT_TEST(MultiReaderPlayback);     /*        */
+  CPPUNIT_TEST(TimelineSummary);         /*        */
   CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -73,6 +94,27 @@ protected:
     void PushStressTest();
     void Compatible_NameLess(); //       
     void StoreTimeZone();   //      
+    void CaptionDictionary(); //   
+    void LargeFileOffsets();  // 64-  
+    void SequenceSeek();      //      
+    void ExtensionFormats();  //    
+    void PageChecksums();     //     
+    void FileSplitting();     //    
+    void LocklessFileSplitting(); //       
+    void MergeBoxes();        //    
+    void CompactBox();        //      
+    void CompactBetweenReferences(); //        
+    void SharedWriterExecutor(); //      
+    void LocklessReading();   //  ,   
+    void FollowLiveBox();     //    
+    void LiveFeedFallsBackToFiles(); //        
+    void MaterializeState();  //      
+    void MaterializeManyPoints(); //      
+    void MaterializeWithinSecond(); //      
+    void LocalReaderClone();  //    clone()
+    void ReaderPositionToken();  //     
+    void MultiReaderPlayback();  // MultiReader: ,  , 
+    void TimelineSummary();      // Reader::summarize      
 private:
     static time_t fixTm();
 
@@ -87,6 +129,9 @@ private:
     void search_addSupport( int shift, Bbx::Writer &out_bbx, std::vector<int> &supp );
     void addSupport( time_t moment, Bbx::Writer &out_bbx );
     std::vector<int> search_make_checkpoint( const std::vector<int>& supp );
+    void splitAndCheck( bool lockless );
+    std::vector<std::string> writeStateBox( size_t count, unsigned perSecond = 1 );
+    static void applyStateFragment( Bbx::char_vec& state, const Bbx::char_vec& caption, const Bbx::char_vec& fragment );
 
 
 private:
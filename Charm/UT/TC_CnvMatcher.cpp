@@ -0,0 +1,161 @@
+﻿#include "stdafx.h"
+
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include "TC_CnvMatcher.h"
+#include "../Converter/cnv_Matcher.h"
+
+using namespace Cnv;
+
+CPPUNIT_TEST_SUITE_REGISTRATION( TC_CnvMatcher );
+
+namespace
+{
+    Bbx::char_vec bytesOf( const std::string& text )
+    {
+        return Bbx::char_vec( text.begin(), text.end() );
+    }
+}
+
+void TC_CnvMatcher::ParsePatterns()
+{
+    std::string binary;
+    CPPUNIT_ASSERT( Matcher::parsePattern( "0x00ff41", binary ) );
+    CPPUNIT_ASSERT( std::string( "\x00\xff\x41", 3 ) == binary );
+    CPPUNIT_ASSERT( Matcher::parsePattern( "0xABcd", binary ) );
+    CPPUNIT_ASSERT( std::string( "\xab\xcd", 2 ) == binary );
+    CPPUNIT_ASSERT( Matcher::parsePattern( "route 12", binary ) );
+    CPPUNIT_ASSERT_EQUAL( std::string( "route 12" ), binary );
+    CPPUNIT_ASSERT( Matcher::parsePattern( "0X41", binary ) ); // префикс различает регистр, это текст
+    CPPUNIT_ASSERT_EQUAL( std::string( "0X41" ), binary );
+
+    // пустые образцы и ошибки в шестнадцатеричной записи
+    CPPUNIT_ASSERT( !Matcher::parsePattern( "", binary ) );
+    CPPUNIT_ASSERT( !Matcher::parsePattern( "0x", binary ) );
+    CPPUNIT_ASSERT( !Matcher::parsePattern( "0x4", binary ) );
+    CPPUNIT_ASSERT( !Matcher::parsePattern( "0x414", binary ) );
+    CPPUNIT_ASSERT( !Matcher::parsePattern( "0x4g", binary ) );
+    CPPUNIT_ASSERT( !Matcher::parsePattern( "0x 41", binary ) );
+
+    Matcher matcher;
+    CPPUNIT_ASSERT( matcher.empty() );
+    CPPUNIT_ASSERT( matcher.addPattern( "0x4142" ) );
+    CPPUNIT_ASSERT( !matcher.addPattern( "0xZZ" ) );
+    CPPUNIT_ASSERT( matcher.addPattern( "text" ) );
+    CPPUNIT_ASSERT_EQUAL( size_t( 2 ), matcher.patternsCount() );
+    matcher.compile();
+    CPPUNIT_ASSERT( matcher.find( bytesOf( "xxABxx" ) ) );
+    CPPUNIT_ASSERT( matcher.find( bytesOf( "some text" ) ) );
+    CPPUNIT_ASSERT( !matcher.find( bytesOf( "0x4142 tex" ) ) );
+    CPPUNIT_ASSERT( !matcher.find( Bbx::char_vec() ) );
+
+    Matcher nothing;
+    nothing.compile();
+    CPPUNIT_ASSERT( !nothing.find( bytesOf( "anything" ) ) );
+}
+
+void TC_CnvMatcher::Targets()
+{
+    unsigned targets = 0;
+    CPPUNIT_ASSERT( Matcher::parseTargets( "caption", targets ) );
+    CPPUNIT_ASSERT_EQUAL( unsigned( TargetCaption ), targets );
+    CPPUNIT_ASSERT( Matcher::parseTargets( "data", targets ) );
+    CPPUNIT_ASSERT_EQUAL( unsigned( TargetBefore | TargetAfter ), targets );
+    CPPUNIT_ASSERT( Matcher::parseTargets( "before", targets ) );
+    CPPUNIT_ASSERT_EQUAL( unsigned( TargetBefore ), targets );
+    CPPUNIT_ASSERT( Matcher::parseTargets( "after,caption", targets ) );
+    CPPUNIT_ASSERT_EQUAL( unsigned( TargetAfter | TargetCaption ), targets );
+    CPPUNIT_ASSERT( !Matcher::parseTargets( "", targets ) );
+    CPPUNIT_ASSERT( !Matcher::parseTargets( "caption,payload", targets ) );
+    CPPUNIT_ASSERT( !Matcher::parseTargets( "Caption", targets ) );
+
+    Matcher matcher;
+    CPPUNIT_ASSERT( matcher.addPattern( "key" ) );
+    matcher.compile();
+
+    Record inCaption, inBefore, inAfter;
+    inCaption.caption = bytesOf( "caption with key" );
+    inCaption.data = bytesOf( "plain" );
+    inBefore.type = inAfter.type = Bbx::RecordType::Increment;
+    inBefore.before = bytesOf( "old key" );
+    inBefore.data = bytesOf( "new" );
+    inAfter.before = bytesOf( "old" );
+    inAfter.data = bytesOf( "new key" );
+
+    CPPUNIT_ASSERT( matcher.matches( inCaption, TargetCaption ) );
+    CPPUNIT_ASSERT( !matcher.matches( inCaption, TargetData ) );
+    CPPUNIT_ASSERT( matcher.matches( inBefore, TargetBefore ) );
+    CPPUNIT_ASSERT( !matcher.matches( inBefore, TargetAfter ) );
+    CPPUNIT_ASSERT( matcher.matches( inBefore, TargetData ) );
+    CPPUNIT_ASSERT( !matcher.matches( inBefore, TargetCaption ) );
+    CPPUNIT_ASSERT( matcher.matches( inAfter, TargetAfter ) );
+    CPPUNIT_ASSERT( !matcher.matches( inAfter, TargetBefore ) );
+    CPPUNIT_ASSERT( matcher.matches( inAfter, TargetData ) );
+    CPPUNIT_ASSERT( matcher.matches( inAfter, TargetCaption | TargetAfter ) );
+}
+
+void TC_CnvMatcher::NulBytes()
+{
+    Matcher matcher;
+    CPPUNIT_ASSERT( matcher.addPattern( "0x0041000042" ) );
+    CPPUNIT_ASSERT( matcher.addPattern( "tail" ) );
+    matcher.compile();
+
+    // поиск идёт по всей длине данных, нулевой байт не завершает их
+    std::string data( 40, '\0' );
+    data.replace( 35, 5, std::string( "\x00\x41\x00\x00\x42", 5 ) );
+    CPPUNIT_ASSERT( matcher.find( data.data(), data.size() ) );
+    CPPUNIT_ASSERT( !matcher.find( data.data(), data.size() - 1 ) );
+
+    std::string text( 20, '\0' );
+    text += "tail";
+    CPPUNIT_ASSERT( matcher.find( text.data(), text.size() ) );
+    text[ 22 ] = '\0';
+    CPPUNIT_ASSERT( !matcher.find( text.data(), text.size() ) );
+}
+
+void TC_CnvMatcher::CompareWithNaiveSearch()
+{
+    std::mt19937 random( 20170412 );
+    auto randomBytes = [&random]( size_t size, unsigned alphabet ) {
+        std::string bytes( size, '\0' );
+        for( char& byte : bytes )
+            byte = static_cast<char>( random() % alphabet );
+        return bytes;
+    };
+
+    // малый алфавит даёт частые совпадения и общие начала образцов,
+    // больше восьми разных первых байтов делят корзины префильтра
+    for( unsigned alphabet : { 4u, 16u, 256u } )
+    {
+        for( size_t round = 0; round < 40; ++round )
+        {
+            std::vector<std::string> patterns;
+            const size_t count = 1 + random() % 20;
+            for( size_t i = 0; i < count; ++i )
+                patterns.push_back( randomBytes( 1 + random() % 6, alphabet ) );
+
+            Matcher matcher;
+            for( const std::string& pattern : patterns )
+            {
+                std::ostringstream hex;
+                hex << "0x" << std::hex << std::setfill( '0' );
+                for( unsigned char byte : pattern )
+                    hex << std::setw( 2 ) << unsigned( byte );
+                CPPUNIT_ASSERT( matcher.addPattern( hex.str() ) );
+            }
+            matcher.compile();
+
+            for( size_t sample = 0; sample < 50; ++sample )
+            {
+                // размеры захватывают целые блоки по 16 байт и хвосты
+                std::string data = randomBytes( random() % 100, alphabet );
+                bool expected = std::any_of( patterns.begin(), patterns.end(), [&data]( const std::string& pattern ) {
+                    return std::search( data.begin(), data.end(), pattern.begin(), pattern.end() ) != data.end();
+                } );
+                CPPUNIT_ASSERT_EQUAL( expected, matcher.find( data.data(), data.size() ) );
+            }
+        }
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef TC_CNVMATCHER_H
+#define TC_CNVMATCHER_H
+#include <cppunit/extensions/HelperMacros.h>
+/* 
+ *        (Cnv::Matcher)
+ */
+class TC_CnvMatcher : public CPPUNIT_NS::TestFixture
+{
+  CPPUNIT_TEST_SUITE( TC_CnvMatcher );
+  CPPUNIT_TEST(ParsePatterns);           /*      */
+  CPPUNIT_TEST(Targets);                 /*  ,   --in */
+  CPPUNIT_TEST(NulBytes);                /*       */
+  CPPUNIT_TEST(CompareWithNaiveSearch);  /*     std::search */
+  CPPUNIT_TEST_SUITE_END();
+
+protected:
+    void ParsePatterns();
+    void Targets();
+    void NulBytes();
+    void CompareWithNaiveSearch();
+};
+
+#endif // TC_CNVMATCHER_H